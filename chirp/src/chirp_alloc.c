@@ -11,54 +11,82 @@ See the file COPYING for details.
 #include "debug.h"
 #include "hash_table.h"
 #include "int_sizes.h"
-#include "itable.h"
 #include "macros.h"
 #include "path.h"
 #include "stringtools.h"
 #include "xxmalloc.h"
 
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
-/* On why HDFS can't do quotas (allocations) [1]:
+#ifndef MAP_ANONYMOUS
+#	define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/* Allocation accounting:
  *
- * In the current implementation, quotas (allocations) do not work
- * with HDFS b/c the chirp_alloc module stores the allocation
- * information in the Unix filesystem and relies upon file locking
- * and signals to ensure mutual exclusion. Modifying the code to
- * store it in cfs instead of Unix would be easy, but hdfs still
- * doesn't support file locking. (Nor does any other distributed
- * file system.)
+ * Every allocation (a directory created by mkalloc, plus the root) has an
+ * entry in a single table holding its size and the space in use. The Chirp
+ * server maps the table shared (chirp_alloc_share) before forking, so all
+ * the processes serving clients see and update the same entries. Usage is
+ * adjusted with an atomic compare-and-swap, so a quota check on a write is
+ * a few memory operations rather than the open/lock/read/write of a state
+ * file it used to be.
  *
- * An alternative approach would be to store the allocation data in
- * a database alongside the filesystem. This has some pros and cons
- * to be worked out.
+ * The directory of an allocation is still marked by a `.__alloc' file,
+ * written once by mkalloc with the allocation size. It is no longer locked
+ * or rewritten, so allocations also work on backends without file locking.
+ * Usage is not persisted: the tree is the record of it, and is scanned once
+ * when the server starts, by the first process to initialize the table (the
+ * server's bootstrap). Later processes attach without rescanning.
  *
- * Addendum: flock is now part of CFS, but HDFS has a stub for it.
+ * The slot of an allocation is freed when its directory is removed
+ * (chirp_alloc_rmdir), and moved when its directory is renamed
+ * (chirp_alloc_rename).
  *
- * [1] https://github.com/batrick/cctools/commit/377377f54e7660c8571d3088487b00c8ad2d2d7d#commitcomment-4265178
+ * The table is a mapping of an unlinked file in the transient directory.
+ * Address space for ALLOC_MAX entries is reserved when it is created, so
+ * the file can grow by ALLOC_GROW entries at a time without any process
+ * having to remap it. Should it ever be full, a new allocation is treated
+ * as part of the allocation enclosing it.
  */
 
+#define ALLOC_GROW 1024 /* allocations */
+#define ALLOC_MAX (1024*1024) /* allocations */
 
-static int alloc_enabled = 0;
-static struct hash_table *alloc_table = 0;
-static time_t last_flush_time = 0;
-static int recovery_in_progress = 0;
-static struct hash_table *root_table = 0;
-
-struct alloc_state {
-	int fd;
+struct alloc_entry {
+	char path[CHIRP_PATH_MAX]; /* empty if the slot is free */
 	INT64_T size;
-	INT64_T inuse;
-	INT64_T avail;
-	INT64_T dirty;
+	INT64_T inuse; /* updated with atomic compare-and-swap */
 };
 
+struct alloc_table {
+	int ready; /* recovery complete */
+	int lock; /* spinlock serializing changes to the slots (never held across I/O) */
+	int count; /* slots ever used */
+	int capacity; /* slots backed by the file */
+	struct alloc_entry entry[];
+};
+
+extern char chirp_transient_path[PATH_MAX];
+
+static int alloc_enabled = 0;
+static struct alloc_table *table = 0;
+static int table_fd = -1;
+static time_t last_flush_time = 0;
+static struct hash_table *root_table = 0; /* directory -> entry index + 1 */
+
 /*
 Note that the space consumed by a file is not the same
 as the filesize.  This function computes the space consumed
@@ -76,84 +104,165 @@ static INT64_T space_consumed(INT64_T filesize)
 	return blocks * block_size;
 }
 
-static void alloc_state_update(struct alloc_state *a, INT64_T change)
+static size_t alloc_table_size(int capacity)
 {
-	if(change != 0) {
-		a->inuse += change;
-		if(a->inuse < 0)
-			a->inuse = 0;
-		a->avail = a->size - a->inuse;
-		a->dirty = 1;
-	}
+	return sizeof(struct alloc_table) + capacity * sizeof(struct alloc_entry);
 }
 
-static struct alloc_state *alloc_state_load(const char *path)
+static struct alloc_table *alloc_table_map(int flags)
 {
-	struct alloc_state *s = xxmalloc(sizeof(*s));
-	char statename[CHIRP_PATH_MAX];
-	char buffer[4096]; /* any .__alloc file is smaller than this */
+	char path[PATH_MAX];
+	void *p;
+
+	string_nformat(path, sizeof(path), "%s/.__alloc.XXXXXX", chirp_transient_path);
+	table_fd = mkstemp(path);
+	if(table_fd == -1)
+		return 0;
+	unlink(path);
 
-	debug(D_ALLOC, "locking %s", path);
+	/* a new file reads as zeroes, so the table starts out empty */
+	if(ftruncate(table_fd, alloc_table_size(ALLOC_GROW)) == -1)
+		goto failure;
+	p = mmap(NULL, alloc_table_size(ALLOC_MAX), PROT_READ|PROT_WRITE, flags, table_fd, 0);
+	if(p == MAP_FAILED)
+		goto failure;
 
-	string_nformat(statename, sizeof(statename), "%s/.__alloc", path);
+	((struct alloc_table *) p)->capacity = ALLOC_GROW;
+	return p;
 
-	s->fd = cfs->open(statename, O_RDWR, S_IRUSR|S_IWUSR);
-	if(s->fd == -1) {
-		free(s);
+failure:
+	close(table_fd);
+	table_fd = -1;
+	return 0;
+}
+
+/* Back more slots with the file. Called with the table locked. */
+static int alloc_table_grow(void)
+{
+	int capacity = MIN(table->capacity + ALLOC_GROW, ALLOC_MAX);
+	if(capacity == table->capacity)
+		return 0;
+	if(ftruncate(table_fd, alloc_table_size(capacity)) == -1) {
+		debug(D_ALLOC, "couldn't grow allocation table: %s", strerror(errno));
 		return 0;
 	}
+	__sync_synchronize();
+	table->capacity = capacity;
+	return 1;
+}
 
-	if(cfs->lockf(s->fd, F_TLOCK, 0)) {
-		debug(D_ALLOC, "lock of %s blocked; flushing outstanding locks", path);
-		chirp_alloc_flush();
-		debug(D_ALLOC, "locking %s (retry)", path);
+static void alloc_table_lock(void)
+{
+	while(__sync_lock_test_and_set(&table->lock, 1))
+		sched_yield();
+}
 
-		if(cfs->lockf(s->fd, F_LOCK, 0)) {
-			debug(D_ALLOC, "lock of %s failed: %s", path, strerror(errno));
-			cfs->close(s->fd);
-			free(s);
-			return 0;
+static void alloc_table_unlock(void)
+{
+	__sync_lock_release(&table->lock);
+}
+
+/*
+Add (or reset) the allocation for path, in a free slot if there is one.
+The path of an entry is filled in last, and a new slot is published by
+incrementing the count after it, so readers never need the lock.
+*/
+
+static struct alloc_entry *alloc_entry_publish(const char *path, INT64_T size, INT64_T inuse)
+{
+	struct alloc_entry *e = 0;
+	struct alloc_entry *free = 0;
+	int i;
+
+	alloc_table_lock();
+	for(i = 0; i < table->count; i++) {
+		if(strcmp(table->entry[i].path, path) == 0) {
+			e = &table->entry[i];
+			e->size = size;
+			e->inuse = inuse;
+			break;
+		} else if(!free && table->entry[i].path[0] == 0) {
+			free = &table->entry[i];
 		}
 	}
+	if(!e && (free || table->count < table->capacity || alloc_table_grow())) {
+		e = free ? free : &table->entry[table->count];
+		e->size = size;
+		e->inuse = inuse;
+		__sync_synchronize();
+		string_nformat(e->path+1, sizeof(e->path)-1, "%s", path+1);
+		__sync_synchronize();
+		e->path[0] = path[0];
+		__sync_synchronize();
+		if(!free)
+			table->count++;
+	}
+	alloc_table_unlock();
 
-	memset(buffer, 0, sizeof(buffer));
-	INT64_T result = cfs->pread(s->fd, buffer, sizeof(buffer), 0);
-	assert(0 < result && result < (INT64_T)sizeof(buffer));
-	result = sscanf(buffer, "%" SCNd64 " %" SCNd64, &s->size, &s->inuse);
-	assert(result == 2);
-
-	s->dirty = 0;
+	if(!e) {
+		debug(D_ALLOC, "allocation table is full (%d entries)", table->capacity);
+		errno = ENOSPC;
+	}
+	return e;
+}
 
-	if(recovery_in_progress) {
-		s->inuse = 0;
-		s->dirty = 1;
+static struct alloc_entry *alloc_entry_find(const char *path)
+{
+	int i, count = table->count;
+	__sync_synchronize();
+	for(i = 0; i < count; i++) {
+		if(strcmp(table->entry[i].path, path) == 0)
+			return &table->entry[i];
 	}
+	return 0;
+}
 
-	s->avail = s->size - s->inuse;
+static void alloc_entry_free(struct alloc_entry *e)
+{
+	alloc_table_lock();
+	e->path[0] = 0;
+	__sync_synchronize();
+	alloc_table_unlock();
+}
 
-	return s;
+/* Does the entry (still) hold an allocation containing path? */
+static int alloc_entry_contains(struct alloc_entry *e, const char *path)
+{
+	size_t n = strlen(e->path);
+	if(n == 0)
+		return 0;
+	if(strcmp(e->path, "/") == 0)
+		return 1;
+	return strncmp(e->path, path, n) == 0 && (path[n] == 0 || path[n] == '/');
 }
 
-static void alloc_state_save(const char *path, struct alloc_state *s)
+/*
+Charge change bytes to the allocation. A positive change
+fails with ENOSPC if it does not fit; a negative change never fails.
+*/
+
+static int alloc_entry_update(struct alloc_entry *e, INT64_T change)
 {
-	if(s->dirty) {
-		debug(D_ALLOC, "storing %s", path);
-	} else {
-		debug(D_ALLOC, "freeing %s", path);
-	}
+	INT64_T old, new;
 
-	if(s->dirty) {
-		char buffer[4096];
-		cfs->ftruncate(s->fd, 0);
-		string_nformat(buffer, sizeof(buffer), "%" PRId64 "\n%" PRId64 "\n", s->size, s->inuse);
-		int64_t result = cfs->pwrite(s->fd, buffer, strlen(buffer), 0);
-		assert(result == (int64_t) strlen(buffer));
-	}
-	cfs->close(s->fd);
-	free(s);
+	if(change == 0)
+		return 0;
+
+	do {
+		old = e->inuse;
+		if(change > 0 && e->size - old < change) {
+			errno = ENOSPC;
+			return -1;
+		}
+		new = old + change;
+		if(new < 0)
+			new = 0;
+	} while(!__sync_bool_compare_and_swap(&e->inuse, old, new));
+
+	return 0;
 }
 
-static int alloc_state_create(const char *path, INT64_T size)
+static int alloc_marker_create(const char *path, INT64_T size)
 {
 	char statepath[CHIRP_PATH_MAX];
 	int fd;
@@ -172,7 +281,37 @@ static int alloc_state_create(const char *path, INT64_T size)
 	}
 }
 
-static char *alloc_state_root(const char *path)
+static int alloc_marker_read(const char *path, INT64_T *size)
+{
+	char statepath[CHIRP_PATH_MAX];
+	char buffer[4096]; /* any .__alloc file is smaller than this */
+	INT64_T result;
+	int fd;
+
+	string_nformat(statepath, sizeof(statepath), "%s/.__alloc", path);
+	fd = cfs->open(statepath, O_RDONLY, 0);
+	if(fd == -1)
+		return 0;
+
+	memset(buffer, 0, sizeof(buffer));
+	result = cfs->pread(fd, buffer, sizeof(buffer)-1, 0);
+	cfs->close(fd);
+	if(result <= 0 || sscanf(buffer, "%" SCNd64, size) != 1) {
+		debug(D_ALLOC, "corrupt allocation state in %s", statepath);
+		errno = EIO;
+		return 0;
+	}
+	return 1;
+}
+
+/*
+Find the innermost allocation containing path. A directory is an
+allocation only while its marker exists; directories with a marker
+but no entry (e.g. created by an older server) are adopted. If there
+is no room for it, the directory is charged to its parent allocation.
+*/
+
+static struct alloc_entry *alloc_entry_root(const char *path)
 {
 	char dirname[CHIRP_PATH_MAX];
 
@@ -180,12 +319,19 @@ static char *alloc_state_root(const char *path)
 
 	while(1) {
 		char statename[CHIRP_PATH_MAX];
+		const char *name = dirname[0] ? dirname : "/";
 		string_nformat(statename, sizeof(statename), "%s/.__alloc", dirname);
 		if(cfs_file_size(statename) >= 0) {
-			if (dirname[0])
-				return xxstrdup(dirname);
-			else
-				return xxstrdup("/");
+			struct alloc_entry *e = alloc_entry_find(name);
+			if(!e) {
+				INT64_T size;
+				if(!alloc_marker_read(name, &size))
+					return 0;
+				debug(D_ALLOC, "adopting allocation %s (%sB)", name, string_metric(size, -1, 0));
+				e = alloc_entry_publish(name, size, 0);
+			}
+			if(e)
+				return e;
 		}
 		char *s = strrchr(dirname, '/');
 		if(!s)
@@ -196,66 +342,42 @@ static char *alloc_state_root(const char *path)
 	return 0;
 }
 
-static char *alloc_state_root_cached(const char *path)
+static struct alloc_entry *alloc_entry_cache_exact(const char *path)
 {
-	char *result;
-
-	result = hash_table_lookup(root_table, path);
-	if(result)
-		return result;
-
-	result = alloc_state_root(path);
-	if(!result)
-		return 0;
-
-	hash_table_insert(root_table, path, result);
-
-	return result;
-}
-
-static struct alloc_state *alloc_state_cache_exact(const char *path)
-{
-	struct alloc_state *a;
-	char *d;
-	char dirname[CHIRP_PATH_MAX];
+	struct alloc_entry *e;
+	intptr_t index;
+
+	/* another process may have freed and reused the slot since it was cached */
+	index = (intptr_t) hash_table_lookup(root_table, path);
+	if(index && alloc_entry_contains(&table->entry[index-1], path))
+		return &table->entry[index-1];
+	if(index)
+		hash_table_remove(root_table, path);
 
-	d = alloc_state_root_cached(path);
-	if(!d)
+	e = alloc_entry_root(path);
+	if(!e)
 		return 0;
 
-	/*
-	   Save a copy of dirname, because the following
-	   alloc_table_load_cached may result in a flush of the alloc table root.
-	 */
-	strcpy(dirname, d);
-	a = hash_table_lookup(alloc_table, dirname);
-	if(a)
-		return a;
-
-	a = alloc_state_load(dirname);
-	if(!a)
-		return a;
+	hash_table_insert(root_table, path, (void *) (intptr_t) (e - table->entry + 1));
 
-	hash_table_insert(alloc_table, dirname, a);
-
-	return a;
+	return e;
 }
 
-static struct alloc_state *alloc_state_cache(const char *path)
+static struct alloc_entry *alloc_entry_cache(const char *path)
 {
 	char dirname[CHIRP_PATH_MAX];
 	path_dirname(path, dirname);
-	return alloc_state_cache_exact(dirname);
+	return alloc_entry_cache_exact(dirname);
 }
 
 static void recover(const char *path)
 {
 	char newpath[CHIRP_PATH_MAX];
-	struct alloc_state *a, *b;
+	struct alloc_entry *a, *b;
 	struct chirp_dir *dir;
 	struct chirp_dirent *d;
 
-	a = alloc_state_cache_exact(path);
+	a = alloc_entry_cache_exact(path);
 	if(!a)
 		fatal("couldn't open alloc state in %s: %s", path, strerror(errno));
 
@@ -271,15 +393,15 @@ static void recover(const char *path)
 		if(!strncmp(d->name, ".__", 3))
 			continue;
 
-		string_nformat(newpath, sizeof(newpath), "%s/%s", path, d->name);
+		string_nformat(newpath, sizeof(newpath), "%s/%s", strcmp(path, "/") == 0 ? "" : path, d->name);
 
 		if(S_ISDIR(d->info.cst_mode)) {
 			recover(newpath);
-			b = alloc_state_cache_exact(newpath);
+			b = alloc_entry_cache_exact(newpath);
 			if(a != b)
-				alloc_state_update(a, b->size);
+				a->inuse += b->size;
 		} else if(S_ISREG(d->info.cst_mode)) {
-			alloc_state_update(a, space_consumed(d->info.cst_size));
+			a->inuse += space_consumed(d->info.cst_size);
 		} else {
 			debug(D_ALLOC, "warning: unknown file type: %s\n", newpath);
 		}
@@ -290,35 +412,43 @@ static void recover(const char *path)
 	debug(D_ALLOC, "%s (%sB)", path, string_metric(a->inuse, -1, 0));
 }
 
+int chirp_alloc_share(void)
+{
+	assert(table == NULL);
+	table = alloc_table_map(MAP_SHARED);
+	return table ? 0 : -1;
+}
+
 int chirp_alloc_init(INT64_T size)
 {
-	struct alloc_state *a;
+	struct alloc_entry *a;
 	time_t start, stop;
 	INT64_T inuse, avail;
 
 	alloc_enabled = 0;
-	if(size == 0) {
+	if(size == 0)
 		return 0;
-	} else if (cfs->lockf(-1, F_TEST, 0) == -1 && errno == ENOSYS) {
+
+	if(!table && !(table = alloc_table_map(MAP_PRIVATE))) {
+		debug(D_ALLOC, "couldn't create allocation table: %s\n", strerror(errno));
 		return -1;
 	}
 
-	alloc_enabled = 1;
-	recovery_in_progress = 1;
-
-	assert(alloc_table == NULL);
-	alloc_table = hash_table_create(0, 0);
 	assert(root_table == NULL);
 	root_table = hash_table_create(0, 0);
+	alloc_enabled = 1;
+
+	if(table->ready)
+		return 0;
 
 	debug(D_ALLOC, "### begin allocation recovery scan ###");
 
-	if(!alloc_state_create("/", size)) {
+	if(!alloc_marker_create("/", size)) {
 		debug(D_ALLOC, "couldn't create allocation in `/': %s\n", strerror(errno));
 		return -1;
 	}
 
-	a = alloc_state_cache_exact("/");
+	a = alloc_entry_publish("/", size, 0);
 	if(!a) {
 		debug(D_ALLOC, "couldn't find allocation in `/': %s\n", strerror(errno));
 		return -1;
@@ -326,11 +456,15 @@ int chirp_alloc_init(INT64_T size)
 
 	start = time(0);
 	recover("/");
+	stop = time(0);
+
+	hash_table_clear(root_table);
+
 	size = a->size;
 	inuse = a->inuse;
-	avail = a->avail;
-	chirp_alloc_flush();
-	stop = time(0);
+	avail = a->size - a->inuse;
+
+	last_flush_time = time(0);
 
 	debug(D_ALLOC, "### allocation recovery took %d seconds ###", (int) (stop-start) );
 
@@ -338,33 +472,18 @@ int chirp_alloc_init(INT64_T size)
 	debug(D_ALLOC, "%sB in use", string_metric(inuse, -1, 0));
 	debug(D_ALLOC, "%sB available", string_metric(avail, -1, 0));
 
-	recovery_in_progress = 0;
+	table->ready = 1;
 	return 0;
 }
 
 void chirp_alloc_flush()
 {
-	char *path, *root;
-	struct alloc_state *s;
-
 	if(!alloc_enabled)
 		return;
 
 	debug(D_ALLOC, "flushing allocation states...");
 
-
-	hash_table_firstkey(alloc_table);
-	while(hash_table_nextkey(alloc_table, &path, (void **) &s)) {
-		alloc_state_save(path, s);
-		hash_table_remove(alloc_table, path);
-	}
-
-
-	hash_table_firstkey(root_table);
-	while(hash_table_nextkey(root_table, &path, (void **) &root)) {
-		free(root);
-		hash_table_remove(root_table, path);
-	}
+	hash_table_clear(root_table);
 
 	last_flush_time = time(0);
 }
@@ -373,7 +492,7 @@ int chirp_alloc_flush_needed()
 {
 	if(!alloc_enabled)
 		return 0;
-	return hash_table_size(alloc_table);
+	return hash_table_size(root_table);
 }
 
 time_t chirp_alloc_last_flush_time()
@@ -383,7 +502,7 @@ time_t chirp_alloc_last_flush_time()
 
 INT64_T chirp_alloc_realloc (const char *path, INT64_T change, INT64_T *current)
 {
-	struct alloc_state *a;
+	struct alloc_entry *a;
 	int result;
 	INT64_T dummy;
 
@@ -396,7 +515,7 @@ INT64_T chirp_alloc_realloc (const char *path, INT64_T change, INT64_T *current)
 	}
 
 	debug(D_ALLOC, "path `%s' change = %" PRId64, path, change);
-	a = alloc_state_cache(path);
+	a = alloc_entry_cache(path);
 	if(a) {
 		/* FIXME this won't work with symlinks, problem existed before probably */
 		*current = cfs_file_size(path);
@@ -409,13 +528,7 @@ INT64_T chirp_alloc_realloc (const char *path, INT64_T change, INT64_T *current)
 			} else {
 				INT64_T alloc_change = space_consumed(change) - space_consumed(*current);
 				debug(D_ALLOC, "path `%s' actual change = %" PRId64 " from current = %" PRId64, path, alloc_change, *current);
-				if(a->avail >= alloc_change) {
-					alloc_state_update(a, alloc_change);
-					result = 0;
-				} else {
-					errno = ENOSPC;
-					result = -1;
-				}
+				result = alloc_entry_update(a, alloc_change);
 			}
 		} else {
 			result = -1;
@@ -435,20 +548,21 @@ INT64_T chirp_alloc_frealloc (int fd, INT64_T change, INT64_T *current)
 
 INT64_T chirp_alloc_statfs(const char *path, struct chirp_statfs * info)
 {
-	struct alloc_state *a;
+	struct alloc_entry *a;
 	int result;
 
 	if(!alloc_enabled)
 		return cfs->statfs(path, info);
 
-	a = alloc_state_cache(path);
+	a = alloc_entry_cache(path);
 	if(a) {
 		result = cfs->statfs(path, info);
 		if(result == 0) {
+			INT64_T avail = a->size - a->inuse;
 			info->f_blocks = a->size / info->f_bsize;
-			info->f_bavail = a->avail / info->f_bsize;
-			info->f_bfree = a->avail / info->f_bsize;
-			if(a->avail < 0) {
+			info->f_bavail = avail / info->f_bsize;
+			info->f_bfree = avail / info->f_bsize;
+			if(avail < 0) {
 				info->f_bavail = 0;
 				info->f_bfree = 0;
 			}
@@ -469,33 +583,27 @@ INT64_T chirp_alloc_fstatfs(int fd, struct chirp_statfs *buf)
 
 INT64_T chirp_alloc_lsalloc(const char *path, char *alloc_path, INT64_T * total, INT64_T * inuse)
 {
-	int result = -1;
+	struct alloc_entry *a;
 
 	if(!alloc_enabled) {
 		errno = ENOSYS;
 		return -1;
 	}
 
-	char *name = alloc_state_root_cached(path);
-	if(name) {
-		struct alloc_state *a = alloc_state_cache_exact(name);
-		if(a) {
-			strcpy(alloc_path, name);
-			*total = a->size;
-			*inuse = a->inuse;
-			result = 0;
-		} else {
-			result = -1;
-		}
+	a = alloc_entry_cache_exact(path);
+	if(a) {
+		strcpy(alloc_path, a->path);
+		*total = a->size;
+		*inuse = a->inuse;
+		return 0;
 	} else {
-		result = -1;
+		return -1;
 	}
-	return result;
 }
 
 INT64_T chirp_alloc_mkalloc(const char *path, INT64_T size, INT64_T mode)
 {
-	struct alloc_state *a;
+	struct alloc_entry *a;
 	int result = -1;
 
 	if(!alloc_enabled) {
@@ -503,19 +611,22 @@ INT64_T chirp_alloc_mkalloc(const char *path, INT64_T size, INT64_T mode)
 		return -1;
 	}
 
-	a = alloc_state_cache(path);
+	a = alloc_entry_cache(path);
 	if(a) {
-		if(a->avail > size) {
+		/* the parent allocation must have strictly more than size available */
+		if(alloc_entry_update(a, size+1) == 0) {
+			alloc_entry_update(a, -1);
 			result = cfs->mkdir(path, mode);
 			if(result == 0) {
-				if(alloc_state_create(path, size)) {
-					alloc_state_update(a, size);
+				if(alloc_marker_create(path, size) && alloc_entry_publish(path, size, 0)) {
 					debug(D_ALLOC, "mkalloc %s %"PRId64, path, size);
 					chirp_alloc_flush();
 				} else {
 					result = -1;
 				}
 			}
+			if(result == -1)
+				alloc_entry_update(a, -size);
 		} else {
 			errno = ENOSPC;
 			return -1;
@@ -527,4 +638,71 @@ INT64_T chirp_alloc_mkalloc(const char *path, INT64_T size, INT64_T mode)
 	return result;
 }
 
+INT64_T chirp_alloc_rmdir(const char *path)
+{
+	struct alloc_entry *a, *parent;
+	INT64_T result;
+
+	if(!alloc_enabled)
+		return cfs->rmdir(path);
+
+	a = alloc_entry_find(path);
+	result = cfs->rmdir(path);
+	if(result == 0 && a && strcmp(path, "/") != 0) {
+		/* give the space reserved by mkalloc back to the enclosing allocation */
+		hash_table_clear(root_table);
+		parent = alloc_entry_cache(path);
+		if(parent)
+			alloc_entry_update(parent, -a->size);
+		debug(D_ALLOC, "rmalloc %s", path);
+		alloc_entry_free(a);
+	}
+
+	return result;
+}
+
+/*
+Rename path to newpath. Allocations in a renamed directory move with it,
+keeping their usage, so they are not adopted afresh at the new path.
+*/
+
+INT64_T chirp_alloc_rename(const char *path, const char *newpath)
+{
+	INT64_T result;
+	size_t n = strlen(path);
+	int i, count;
+
+	result = cfs->rename(path, newpath);
+	if(result == -1 || !alloc_enabled || strcmp(path, "/") == 0)
+		return result;
+
+	count = table->count;
+	__sync_synchronize();
+	for(i = 0; i < count; i++) {
+		struct alloc_entry *e = &table->entry[i];
+		char oldname[CHIRP_PATH_MAX];
+		char newname[CHIRP_PATH_MAX];
+		INT64_T size, inuse;
+
+		string_nformat(oldname, sizeof(oldname), "%s", e->path);
+		if(strncmp(oldname, path, n) != 0 || (oldname[n] != 0 && oldname[n] != '/'))
+			continue;
+		string_nformat(newname, sizeof(newname), "%s%s", newpath, oldname+n);
+
+		/* take the usage out of the old entry, so no change to it is lost */
+		size = e->size;
+		do {
+			inuse = e->inuse;
+		} while(!__sync_bool_compare_and_swap(&e->inuse, inuse, 0));
+		alloc_entry_free(e);
+
+		debug(D_ALLOC, "moving allocation %s to %s", oldname, newname);
+		alloc_entry_publish(newname, size, inuse);
+	}
+
+	hash_table_clear(root_table);
+
+	return result;
+}
+
 /* vim: set noexpandtab tabstop=4: */
@@ -12,6 +12,7 @@ See the file COPYING for details.
 
 #include <sys/types.h>
 
+int    chirp_alloc_share(void);
 int    chirp_alloc_init(INT64_T size);
 void   chirp_alloc_flush(void);
 int    chirp_alloc_flush_needed(void);
@@ -19,6 +20,8 @@ time_t chirp_alloc_last_flush_time(void);
 
 INT64_T chirp_alloc_lsalloc(const char *path, char *alloc_path, INT64_T * total, INT64_T * inuse);
 INT64_T chirp_alloc_mkalloc(const char *path, INT64_T size, INT64_T mode);
+INT64_T chirp_alloc_rmdir(const char *path);
+INT64_T chirp_alloc_rename(const char *path, const char *newpath);
 
 INT64_T chirp_alloc_realloc(const char *path, INT64_T change, INT64_T *inuse);
 INT64_T chirp_alloc_frealloc (int fd, INT64_T change, INT64_T *current);
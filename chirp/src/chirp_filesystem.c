@@ -35,6 +35,8 @@ See the file COPYING for details.
 #include <string.h>
 
 #define CHIRP_FILESYSTEM_BUFFER  65536
+/* Large files are hashed in big chunks to amortize the per-call backend cost. */
+#define CHIRP_FILESYSTEM_HASH_CHUNK  (1<<20)
 
 struct chirp_filesystem *cfs = NULL;
 char chirp_url[CHIRP_PATH_MAX] = "local://./";
@@ -492,10 +494,10 @@ INT64_T cfs_basic_hash(const char *path, const char *algorithm, unsigned char di
 	if(fd >= 0) {
 		INT64_T total = 0;
 		INT64_T length = info.cst_size;
+		char *buffer = xxmalloc(CHIRP_FILESYSTEM_HASH_CHUNK);
 
 		while(length > 0) {
-			char buffer[65536];
-			INT64_T chunk = MIN((int) sizeof(buffer), length);
+			INT64_T chunk = MIN(CHIRP_FILESYSTEM_HASH_CHUNK, length);
 
 			INT64_T ractual = cfs->pread(fd, buffer, chunk, total);
 			if(ractual <= 0)
@@ -509,6 +511,7 @@ INT64_T cfs_basic_hash(const char *path, const char *algorithm, unsigned char di
 			length -= ractual;
 			total += ractual;
 		}
+		free(buffer);
 		cfs->close(fd);
 
 		if(type == MD5) {
@@ -52,8 +52,11 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
 #include <limits.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
 #ifndef O_CLOEXEC
@@ -505,6 +508,54 @@ out:
 	return rc;
 }
 
+/* Write bytes [offset, offset+length) of the local file to the same range of
+ * the remote file. Several of these may target the same remote file at once,
+ * each writing a disjoint stripe, so the remote file is never truncated.
+ */
+static int put_range (const char *hostport, const char *path, const char *remote, int64_t offset, int64_t length)
+{
+	static const size_t CHUNK = 1<<20;
+
+	int rc;
+	int fd = -1;
+	struct chirp_file *file = NULL;
+	char *buffer = NULL;
+	time_t stoptime = time(NULL) + 120 + length/1024; /* anything less than 1KB/s is unacceptable */
+
+	debug(D_CHIRP, "put_range('%s', '%s', '%s', %" PRId64 ", %" PRId64 ")", hostport, path, remote, offset, length);
+
+	CATCHUNIX(fd = open(path, O_RDONLY));
+	buffer = malloc(CHUNK);
+	if (buffer == NULL)
+		CATCH(ENOMEM);
+	file = chirp_reli_open(hostport, remote, O_WRONLY|O_CREAT, S_IRUSR|S_IWUSR, stoptime);
+	CATCHUNIX(file ? 0 : -1);
+
+	while (length > 0) {
+		ssize_t n;
+		CATCHUNIX(n = pread(fd, buffer, (size_t)length < CHUNK ? (size_t)length : CHUNK, offset));
+		if (n == 0)
+			CATCH(EIO); /* local replica is shorter than the stripe */
+		CATCHUNIX(chirp_reli_pwrite(file, buffer, n, offset, stoptime));
+		offset += n;
+		length -= n;
+	}
+
+	rc = chirp_reli_close(file, stoptime);
+	file = NULL;
+	CATCHUNIX(rc);
+
+	rc = 0;
+	goto out;
+out:
+	if (file)
+		chirp_reli_close(file, stoptime);
+	if (fd >= 0)
+		close(fd);
+	free(buffer);
+	return rc;
+}
+
 static void do_put (char *const argv[], char *const envp[])
 {
 	int rc;
@@ -514,6 +565,12 @@ static void do_put (char *const argv[], char *const envp[])
 
 	debug(D_CHIRP, "do_put('%s', '%s', '%s')", argv[1], argv[2], argv[3]);
 
+	if (argv[4] && argv[5]) {
+		/* striped transfer: @put <host> <file> <remote> <offset> <length> */
+		CATCH(put_range(argv[1], argv[2], argv[3], strtoll(argv[4], NULL, 10), strtoll(argv[5], NULL, 10)));
+		goto out;
+	}
+
 	stream = fopen(argv[2], "r");
 	CATCHUNIX(stream == NULL ? -1 : 0);
 	CATCHUNIX(fstat(fileno(stream), &info));
@@ -0,0 +1,190 @@
+/*
+Copyright (C) 2016- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "chirp_filesystem.h"
+#include "chirp_hash_cache.h"
+#include "chirp_sqlite.h"
+
+#include "catch.h"
+#include "debug.h"
+
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/* A file modified within this many seconds of being hashed may still change
+ * without its (second granularity) mtime or ctime changing, so we do not
+ * remember its digest.
+ */
+#define HASH_CACHE_RACY_WINDOW 2
+
+extern char chirp_transient_path[PATH_MAX];
+
+int chirp_hash_cache_enabled = 1;
+
+static int db_init (sqlite3 *db)
+{
+	static const char Initialize[] =
+		"PRAGMA journal_mode = WAL;"
+		"CREATE TABLE IF NOT EXISTS HashCache ("
+		"	path TEXT NOT NULL,"
+		"	algorithm TEXT NOT NULL,"
+		"	ino INTEGER NOT NULL,"
+		"	size INTEGER NOT NULL,"
+		"	mtime INTEGER NOT NULL,"
+		"	ctime INTEGER NOT NULL,"
+		"	digest BLOB NOT NULL,"
+		"	PRIMARY KEY (path, algorithm));";
+
+	int rc;
+
+	sqlcatchexec(db, Initialize);
+
+	rc = 0;
+	goto out;
+out:
+	return rc;
+}
+
+static int db_get (sqlite3 **dbp)
+{
+	int rc;
+	static sqlite3 *db;
+	char uri[PATH_MAX];
+
+	if (db == NULL) {
+		if (snprintf(uri, PATH_MAX, "file://%s/.__hash.db?mode=rwc", chirp_transient_path) >= PATH_MAX)
+			CATCH(ENAMETOOLONG);
+		CATCH(sqlite3_open_v2(uri, &db, SQLITE_OPEN_URI|SQLITE_OPEN_READWRITE|SQLITE_OPEN_CREATE, NULL) ? EIO : 0);
+		sqlite3_busy_timeout(db, CHIRP_SQLITE_TIMEOUT);
+		CATCH(db_init(db));
+	}
+
+	rc = 0;
+	goto out;
+out:
+	if (rc) {
+		sqlite3_close(db);
+		db = NULL;
+	}
+	*dbp = db;
+	return rc;
+}
+
+static int lookup (sqlite3 *db, const char *path, const char *algorithm, const struct chirp_stat *info, unsigned char digest[CHIRP_DIGEST_MAX], INT64_T *length)
+{
+	static const char SQL[] =
+		"SELECT digest"
+		"	FROM HashCache"
+		"	WHERE path = ? AND algorithm = ? AND ino = ? AND size = ? AND mtime = ? AND ctime = ?;";
+
+	int rc;
+	sqlite3_stmt *stmt = NULL;
+	const char *current = SQL;
+
+	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(sqlite3_bind_text(stmt, 1, path, -1, SQLITE_STATIC));
+	sqlcatch(sqlite3_bind_text(stmt, 2, algorithm, -1, SQLITE_STATIC));
+	sqlcatch(sqlite3_bind_int64(stmt, 3, info->cst_ino));
+	sqlcatch(sqlite3_bind_int64(stmt, 4, info->cst_size));
+	sqlcatch(sqlite3_bind_int64(stmt, 5, info->cst_mtime));
+	sqlcatch(sqlite3_bind_int64(stmt, 6, info->cst_ctime));
+	rc = sqlite3_step(stmt);
+	if (rc == SQLITE_ROW) {
+		int n = sqlite3_column_bytes(stmt, 0);
+		if (n <= 0 || n > CHIRP_DIGEST_MAX)
+			CATCH(EINVAL);
+		memcpy(digest, sqlite3_column_blob(stmt, 0), n);
+		*length = n;
+	} else if (rc == SQLITE_DONE) {
+		THROW_QUIET(ENOENT);
+	} else {
+		sqlcatch(rc);
+	}
+	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+
+	rc = 0;
+	goto out;
+out:
+	sqlite3_finalize(stmt);
+	return rc;
+}
+
+static int store (sqlite3 *db, const char *path, const char *algorithm, const struct chirp_stat *info, const unsigned char *digest, INT64_T length)
+{
+	static const char SQL[] =
+		"INSERT OR REPLACE INTO HashCache (path, algorithm, ino, size, mtime, ctime, digest)"
+		"	VALUES (?, ?, ?, ?, ?, ?, ?);";
+
+	int rc;
+	sqlite3_stmt *stmt = NULL;
+	const char *current = SQL;
+
+	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(sqlite3_bind_text(stmt, 1, path, -1, SQLITE_STATIC));
+	sqlcatch(sqlite3_bind_text(stmt, 2, algorithm, -1, SQLITE_STATIC));
+	sqlcatch(sqlite3_bind_int64(stmt, 3, info->cst_ino));
+	sqlcatch(sqlite3_bind_int64(stmt, 4, info->cst_size));
+	sqlcatch(sqlite3_bind_int64(stmt, 5, info->cst_mtime));
+	sqlcatch(sqlite3_bind_int64(stmt, 6, info->cst_ctime));
+	sqlcatch(sqlite3_bind_blob(stmt, 7, digest, (int)length, SQLITE_STATIC));
+	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
+	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+
+	rc = 0;
+	goto out;
+out:
+	sqlite3_finalize(stmt);
+	return rc;
+}
+
+static int unchanged (const struct chirp_stat *a, const struct chirp_stat *b)
+{
+	return a->cst_ino == b->cst_ino && a->cst_size == b->cst_size && a->cst_mtime == b->cst_mtime && a->cst_ctime == b->cst_ctime;
+}
+
+static int racy (const struct chirp_stat *info)
+{
+	time_t now = time(NULL);
+	return (now - info->cst_mtime) < HASH_CACHE_RACY_WINDOW || (now - info->cst_ctime) < HASH_CACHE_RACY_WINDOW;
+}
+
+INT64_T chirp_hash_cache_hash(const char *path, const char *algorithm, unsigned char digest[CHIRP_DIGEST_MAX])
+{
+	sqlite3 *db = NULL;
+	struct chirp_stat before, after;
+	INT64_T result;
+
+	if (!chirp_hash_cache_enabled)
+		return cfs->hash(path, algorithm, digest);
+
+	if (cfs->stat(path, &before) == -1)
+		return -1;
+	if (S_ISDIR(before.cst_mode))
+		return cfs->hash(path, algorithm, digest);
+
+	if (db_get(&db) == 0 && lookup(db, path, algorithm, &before, digest, &result) == 0) {
+		debug(D_CHIRP, "hash cache hit: %s `%s'", algorithm, path);
+		return result;
+	}
+
+	result = cfs->hash(path, algorithm, digest);
+	if (result < 0)
+		return result;
+
+	if (db && cfs->stat(path, &after) == 0 && unchanged(&before, &after) && !racy(&after)) {
+		if (store(db, path, algorithm, &after, digest, result) == 0)
+			debug(D_CHIRP, "hash cache store: %s `%s'", algorithm, path);
+	}
+
+	return result;
+}
+
+/* vim: set noexpandtab tabstop=4: */
@@ -0,0 +1,31 @@
+/*
+Copyright (C) 2016- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef CHIRP_HASH_CACHE_H
+#define CHIRP_HASH_CACHE_H
+
+#include "chirp_types.h"
+
+/* The hash cache remembers the digests computed by the md5 and hash verbs in
+ * a small database kept in the transient directory. Each entry is keyed by the
+ * Chirp path and algorithm and is only considered valid while the file's
+ * inode, size, mtime and ctime still match those observed when the digest was
+ * computed. Stale entries are recomputed lazily on the next request.
+ */
+
+extern int chirp_hash_cache_enabled;
+
+/** Compute (or recall) the digest of a file.
+@param path The Chirp path of the file.
+@param algorithm The name of the hash algorithm (e.g. "md5" or "sha1").
+@param digest Buffer to receive the binary digest.
+@return The length of the digest on success, -1 on failure with errno set.
+*/
+INT64_T chirp_hash_cache_hash(const char *path, const char *algorithm, unsigned char digest[CHIRP_DIGEST_MAX]);
+
+#endif
+
+/* vim: set noexpandtab tabstop=4: */
@@ -227,6 +227,7 @@ static int db_get (sqlite3 **dbp, int timeout)
 	goto out;
 out:
 	if (rc) {
+		chirp_sqlite3_uncache(db);
 		sqlite3_close(db);
 		db = NULL;
 	}
@@ -10,6 +10,7 @@
 #include "chirp_filesystem.h"
 #include "chirp_fs_confuga.h"
 #include "chirp_group.h"
+#include "chirp_hash_cache.h"
 #include "chirp_job.h"
 #include "chirp_protocol.h"
 #include "chirp_reli.h"
@@ -491,7 +492,7 @@ static INT64_T rmall(const char *path)
 				cfs->closedir(dir);
 
 				if(result == 0) {
-					result = cfs->rmdir(path);
+					result = chirp_alloc_rmdir(path);
 				}
 			} else {
 				result = -1;
@@ -1163,7 +1164,7 @@ static void chirp_handler(struct link *l, const char *addr, const char *subject)
 			INT64_T oldcurrent;
 			if ((result = chirp_alloc_realloc(path, 0, &oldcurrent)) == 0) {
 				if ((result = chirp_alloc_realloc(newpath, cfs_file_size(path), &newcurrent)) == 0) {
-					result = cfs->rename(path, newpath);
+					result = chirp_alloc_rename(path, newpath);
 					if (result == -1) {
 						chirp_alloc_realloc(path, oldcurrent, NULL);
 						chirp_alloc_realloc(newpath, newcurrent, NULL);
@@ -1354,7 +1355,7 @@ static void chirp_handler(struct link *l, const char *addr, const char *subject)
 			path_fix(path);
 			if(chirp_acl_check_link(path, subject, CHIRP_ACL_DELETE) || chirp_acl_check_dir(path, subject, CHIRP_ACL_DELETE)) {
 				/* rmdir only works if the directory is user-visibly empty, and we don't track allocations for empty directories */
-				result = cfs->rmdir(path);
+				result = chirp_alloc_rmdir(path);
 			} else {
 				goto failure;
 			}
@@ -1493,7 +1494,7 @@ static void chirp_handler(struct link *l, const char *addr, const char *subject)
 			path_fix(path);
 			if(!chirp_acl_check(path, subject, CHIRP_ACL_READ))
 				goto failure;
-			result = cfs->hash(path, "md5", digest);
+			result = chirp_hash_cache_hash(path, "md5", digest);
 			if (result >= 0) {
 				buffer_putlstring(B, (char *)digest, result);
 			} else {
@@ -1504,7 +1505,7 @@ static void chirp_handler(struct link *l, const char *addr, const char *subject)
 			path_fix(path);
 			if(!chirp_acl_check(path, subject, CHIRP_ACL_READ))
 				goto failure;
-			result = cfs->hash(path, chararg1, digest);
+			result = chirp_hash_cache_hash(path, chararg1, digest);
 			if (result >= 0) {
 				buffer_putlstring(B, (char *)digest, result);
 			} else {
@@ -1869,6 +1870,7 @@ static void show_help(const char *cmd)
 	fprintf(stdout, " %-30s Execution time limit for jobs. (default: %ds)\n", "   --job-time-limit", chirp_job_time_limit);
 	fprintf(stdout, " %-30s Set the maximum number of clients to accept at once. (default unlimited)\n", "-M,--max-clients=<count>");
 	fprintf(stdout, " %-30s Use this name when reporting to the catalog.\n", "-n,--catalog-name=<name>");
+	fprintf(stdout, " %-30s Do not remember file digests between md5/hash requests.\n", "   --no-hash-cache");
 	fprintf(stdout, " %-30s Rotate debug file once it reaches this size.\n", "-O,--debug-rotate-max=<bytes>");
 	fprintf(stdout, " %-30s Superuser for all directories. (default: none)\n", "-P,--superuser=<user>");
 	fprintf(stdout, " %-30s Listen on this port. (default: %d; arbitrary: 0)\n", "-p,--port=<port>", chirp_port);
@@ -1898,6 +1900,7 @@ int main(int argc, char *argv[])
 		LONGOPT_JOB_TIME_LIMIT                   = INT_MAX-2,
 		LONGOPT_INHERIT_DEFAULT_ACL              = INT_MAX-3,
 		LONGOPT_PROJECT_NAME                     = INT_MAX-4,
+		LONGOPT_NO_HASH_CACHE                    = INT_MAX-5,
 	};
 
 	static const struct option long_options[] = {
@@ -1922,6 +1925,7 @@ int main(int argc, char *argv[])
 		{"job-time-limit", required_argument, 0, LONGOPT_JOB_TIME_LIMIT},
 		{"max-clients", required_argument, 0, 'M'},
 		{"no-core-dump", no_argument, 0, 'C'},
+		{"no-hash-cache", no_argument, 0, LONGOPT_NO_HASH_CACHE},
 		{"owner", required_argument, 0, 'w'},
 		{"parent-check", required_argument, 0, 'e'},
 		{"parent-death", no_argument, 0, 'E'},
@@ -2104,6 +2108,9 @@ int main(int argc, char *argv[])
 		case LONGOPT_PROJECT_NAME:
 			strncpy(chirp_project_name, optarg, sizeof(chirp_project_name)-1);
 			break;
+		case LONGOPT_NO_HASH_CACHE:
+			chirp_hash_cache_enabled = 0;
+			break;
 		case 'h':
 		default:
 			show_help(argv[0]);
@@ -2190,6 +2197,11 @@ int main(int argc, char *argv[])
 
 	cfs = cfs_lookup(chirp_url);
 
+	/* The allocation table is shared by every process serving clients; it must exist before any of them are forked. */
+	if(root_quota > 0 && chirp_alloc_share() == -1) {
+		fatal("couldn't create allocation table: %s", strerror(errno));
+	}
+
 	if(run_in_child_process(backend_bootstrap, chirp_url, "backend bootstrap") != 0) {
 		fatal("couldn't setup %s", chirp_url);
 	}
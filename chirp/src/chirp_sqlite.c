@@ -7,15 +7,30 @@ See the file COPYING for details.
 #include "buffer.h"
 #include "catch.h"
 #include "debug.h"
+#include "itable.h"
 #include "json.h"
 #include "json_aux.h"
+#include "xxmalloc.h"
 
 #include "sqlite3.h"
 
 #include <errno.h>
 #include <float.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
+struct cached_stmt {
+	sqlite3_stmt *stmt;
+	const char *tail;
+	int busy;
+};
+
+/* Cached statements of each connection, keyed by the address of their SQL. */
+static struct itable *connections;
+/* Every cached statement, so chirp_sqlite3_finalize can tell them apart. */
+static struct itable *cached;
+
 int chirp_sqlite3_column_jsonify(sqlite3_stmt *stmt, int n, buffer_t *B)
 {
 	int rc;
@@ -65,4 +80,85 @@ out:
 	return rc;
 }
 
+int chirp_sqlite3_prepare(sqlite3 *db, const char *sql, sqlite3_stmt **stmt, const char **tail)
+{
+	int rc;
+	struct itable *statements;
+	struct cached_stmt *entry;
+
+	if (!connections) {
+		connections = itable_create(0);
+		cached = itable_create(0);
+	}
+
+	statements = itable_lookup(connections, (uintptr_t)db);
+	if (!statements) {
+		statements = itable_create(0);
+		itable_insert(connections, (uintptr_t)db, statements);
+	}
+
+	entry = itable_lookup(statements, (uintptr_t)sql);
+	if (entry) {
+		if (entry->busy) {
+			/* recursive use of the same statement, fall back to an uncached copy */
+			return sqlite3_prepare_v2(db, sql, -1, stmt, tail);
+		}
+		entry->busy = 1;
+		*stmt = entry->stmt;
+		if (tail)
+			*tail = entry->tail;
+		return SQLITE_OK;
+	}
+
+	rc = sqlite3_prepare_v2(db, sql, -1, stmt, tail);
+	if (rc == SQLITE_OK && *stmt) {
+		entry = xxmalloc(sizeof(*entry));
+		entry->stmt = *stmt;
+		entry->tail = tail ? *tail : NULL;
+		entry->busy = 1;
+		itable_insert(statements, (uintptr_t)sql, entry);
+		itable_insert(cached, (uintptr_t)*stmt, entry);
+	}
+	return rc;
+}
+
+int chirp_sqlite3_finalize(sqlite3_stmt *stmt)
+{
+	struct cached_stmt *entry = NULL;
+
+	if (stmt && cached)
+		entry = itable_lookup(cached, (uintptr_t)stmt);
+
+	if (entry) {
+		int rc = sqlite3_reset(stmt);
+		sqlite3_clear_bindings(stmt);
+		entry->busy = 0;
+		return rc;
+	} else {
+		return sqlite3_finalize(stmt);
+	}
+}
+
+void chirp_sqlite3_uncache(sqlite3 *db)
+{
+	struct itable *statements;
+	UINT64_T key;
+	struct cached_stmt *entry;
+
+	if (!connections)
+		return;
+
+	statements = itable_remove(connections, (uintptr_t)db);
+	if (!statements)
+		return;
+
+	itable_firstkey(statements);
+	while (itable_nextkey(statements, &key, (void **)&entry)) {
+		itable_remove(cached, (uintptr_t)entry->stmt);
+		sqlite3_finalize(entry->stmt);
+		free(entry);
+	}
+	itable_delete(statements);
+}
+
 /* vim: set noexpandtab tabstop=4: */
@@ -50,7 +50,7 @@ do {\
 				rc = EIO;\
 			}\
 		}\
-		sqlite3_finalize(stmt);\
+		chirp_sqlite3_finalize(stmt);\
 		stmt = NULL;\
 		goto out;\
 	}\
@@ -70,7 +70,7 @@ do {\
 				rc = EIO;\
 			}\
 		}\
-		sqlite3_finalize(stmt);\
+		chirp_sqlite3_finalize(stmt);\
 		stmt = NULL;\
 		goto out;\
 	}\
@@ -135,4 +135,19 @@ do {\
 int chirp_sqlite3_column_jsonify(sqlite3_stmt *stmt, int n, buffer_t *B);
 int chirp_sqlite3_row_jsonify(sqlite3_stmt *stmt, buffer_t *B);
 
+/* Prepared statement cache.
+ *
+ * chirp_sqlite3_prepare is a drop-in replacement for sqlite3_prepare_v2 (with
+ * nByte = -1) for SQL text in static storage: the statement (and its tail) is
+ * remembered per connection, keyed by the address of the SQL text, so the same
+ * statement is only parsed once. chirp_sqlite3_finalize must be used to
+ * release statements obtained this way; cached statements are reset and their
+ * bindings cleared instead of being finalized. Other statements are simply
+ * finalized. chirp_sqlite3_uncache finalizes every cached statement of a
+ * connection and must be called before closing it.
+ */
+int chirp_sqlite3_prepare(sqlite3 *db, const char *sql, sqlite3_stmt **stmt, const char **tail);
+int chirp_sqlite3_finalize(sqlite3_stmt *stmt);
+void chirp_sqlite3_uncache(sqlite3 *db);
+
 /* vim: set noexpandtab tabstop=4: */
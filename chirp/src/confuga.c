@@ -281,6 +281,16 @@ static int dbupgrade (confuga *C)
 			sqlcatchexec(db,SQL);
 		}
 				/* falls through */
+		case 2: {
+			static const char SQL[] =
+				"ALTER TABLE Confuga.TransferJob ADD COLUMN stripe_offset INTEGER;"
+				"ALTER TABLE Confuga.TransferJob ADD COLUMN stripe_length INTEGER;"
+				;
+
+			debug(D_DEBUG, "upgrading db to v3");
+			sqlcatchexec(db,SQL);
+		}
+				/* falls through */
 		default: {
 			static const char SQL[] =
 				"INSERT OR REPLACE INTO Confuga.State (key, value)"
@@ -455,6 +465,8 @@ static int dbload (confuga *C)
 		"	source TEXT NOT NULL REFERENCES TransferJobSource (source),"
 		"	source_id INTEGER," /* ConfugaJob id */
 		"	state TEXT NOT NULL REFERENCES TransferJobState (state),"
+		"	stripe_length INTEGER," /* NULL if the whole file is transferred */
+		"	stripe_offset INTEGER,"
 		"	tag TEXT NOT NULL DEFAULT '(unknown)',"
 		"	time_create DATETIME,"
 		"	time_commit DATETIME,"
@@ -612,6 +624,7 @@ CONFUGA_IAPI int confugaI_dbclose (confuga *C)
 	sqlite3 *db = C->db;
 	sqlite3_stmt *stmt = NULL; /* unused */
 
+	chirp_sqlite3_uncache(db);
 	do {
 		debug(D_DEBUG, "disconnecting from sqlite3 db");
 		rc = sqlite3_close_v2(db);
@@ -702,6 +715,8 @@ static int parse_uri (confuga *C, const char *uri, int *explicit_auth)
 			} else if (strcmp(option, "scheduler") == 0) {
 				if (pattern_match(value, "^fifo%-?(%d*)$", &subvalue) >= 0) {
 					CATCH(confuga_scheduler_strategy(C, CONFUGA_SCHEDULER_FIFO, strtoul(subvalue, NULL, 10)));
+				} else if (pattern_match(value, "^locality%-?(%d*)$", &subvalue) >= 0) {
+					CATCH(confuga_scheduler_strategy(C, CONFUGA_SCHEDULER_LOCALITY, strtoul(subvalue, NULL, 10)));
 				} else CATCH(EINVAL);
 			} else if (strcmp(option, "replication") == 0) {
 				if (pattern_match(value, "^push%-sync%-?(%d*)$", &subvalue) >= 0) {
@@ -825,6 +840,8 @@ CONFUGA_API int confuga_concurrency (confuga *C, uint64_t n)
 
 CONFUGA_API int confuga_scheduler_strategy (confuga *C, int strategy, uint64_t n)
 {
+	if (!(strategy == CONFUGA_SCHEDULER_FIFO || strategy == CONFUGA_SCHEDULER_LOCALITY))
+		return EINVAL;
 	debug(D_CONFUGA, "setting scheduler strategy to %d-%" PRIu64, strategy, n);
 	C->scheduler = strategy;
 	C->scheduler_n = n;
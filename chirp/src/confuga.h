@@ -115,7 +115,8 @@ CONFUGA_API int confuga_snadd (confuga *C, const char *id, const char *root, con
 CONFUGA_API int confuga_snrm (confuga *C, const char *id, int flag);
 CONFUGA_API int confuga_nodes (confuga *C, const char *nodes); /* deprecated */
 
-#define CONFUGA_SCHEDULER_FIFO 1
+#define CONFUGA_SCHEDULER_FIFO     1
+#define CONFUGA_SCHEDULER_LOCALITY 2
 CONFUGA_API int confuga_scheduler_strategy (confuga *C, int strategy, uint64_t n);
 
 CONFUGA_API int confuga_pull_threshold (confuga *C, uint64_t n);
@@ -82,7 +82,7 @@ CONFUGA_IAPI int confugaS_node_insert (confuga *C, const char *hostport, const c
 
 CONFUGA_IAPI int confugaJ_schedule (confuga *C);
 
-#define CONFUGA_DB_VERSION  2
+#define CONFUGA_DB_VERSION  3
 
 #define str(s) #s
 #define xstr(s) str(s)
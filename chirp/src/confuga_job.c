@@ -9,6 +9,7 @@ See the file COPYING for details.
 #include "debug.h"
 #include "json.h"
 #include "json_aux.h"
+#include "timestamp.h"
 
 #include "catch.h"
 #include "chirp_reli.h"
@@ -168,7 +169,7 @@ out:
 static int fail (confuga *C, chirp_jobid_t id, const char *tag, const char *error)
 {
 	static const char SQL[] =
-		"BEGIN TRANSACTION;"
+		"SAVEPOINT fail;"
 		"UPDATE Job"
 		"	SET"
 		"		error = ?,"
@@ -181,7 +182,7 @@ static int fail (confuga *C, chirp_jobid_t id, const char *tag, const char *erro
 		"		state = 'ERRORED',"
 		"		time_errored = strftime('%s', 'now')"
 		"	WHERE id = ?;"
-		"END TRANSACTION;";
+		"RELEASE SAVEPOINT fail;";
 
 	int rc;
 	sqlite3 *db = C->db;
@@ -190,31 +191,31 @@ static int fail (confuga *C, chirp_jobid_t id, const char *tag, const char *erro
 
 	jdebug(D_DEBUG, id, tag, "fatal error: %s", error);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_text(stmt, 1, error, -1, SQLITE_STATIC));
 	sqlcatch(sqlite3_bind_int64(stmt, 2, id));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_text(stmt, 1, error, -1, SQLITE_STATIC));
 	sqlcatch(sqlite3_bind_int64(stmt, 2, id));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
-	sqlend(db);
+	chirp_sqlite3_finalize(stmt);
+	sqlendsavepoint(fail);
 	return rc;
 }
 
@@ -222,7 +223,7 @@ out:
 static int reschedule (confuga *C, chirp_jobid_t id, const char *tag, int reason)
 {
 	static const char SQL[] =
-		"BEGIN TRANSACTION;"
+		"SAVEPOINT reschedule;"
 		"DELETE FROM ConfugaOutputFile"
 		"	WHERE jid = ?;"
 		"DELETE FROM ConfugaJobWaitResult"
@@ -246,7 +247,7 @@ static int reschedule (confuga *C, chirp_jobid_t id, const char *tag, int reason
 		"		time_bound_outputs = NULL,"
 		"		time_killed = NULL"
 		"	WHERE id = ?;"
-		"END TRANSACTION;";
+		"RELEASE SAVEPOINT reschedule;";
 
 	int rc;
 	sqlite3 *db = C->db;
@@ -255,34 +256,34 @@ static int reschedule (confuga *C, chirp_jobid_t id, const char *tag, int reason
 
 	jdebug(D_DEBUG, id, tag, "attempting to reschedule due to `%s'", strerror(reason));
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_int64(stmt, 1, id));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_int64(stmt, 1, id));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_int64(stmt, 1, id));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
-	sqlend(db);
+	chirp_sqlite3_finalize(stmt);
+	sqlendsavepoint(reschedule);
 	return rc;
 }
 
@@ -346,15 +347,15 @@ static int job_new (confuga *C)
 	sqlite3_stmt *stmt = NULL;
 	const char *current = SQL;
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
 	C->operations += sqlite3_changes(db);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	return rc;
 }
 
@@ -373,12 +374,12 @@ static int bindinput (confuga *C, chirp_jobid_t id, const char *tag, const char
 
 	rc = confuga_lookup(C, serv_path, &fid, NULL);
 	if (rc == 0) {
-		sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+		sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 		sqlcatch(sqlite3_bind_blob(stmt, 1, confugaF_id(fid), confugaF_size(fid), SQLITE_STATIC));
 		sqlcatch(sqlite3_bind_int64(stmt, 2, id));
 		sqlcatch(sqlite3_bind_text(stmt, 3, task_path, -1, SQLITE_STATIC));
 		sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-		sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+		sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 	} else if (rc == EISDIR) {
 		struct confuga_dir *dir;
 		CATCH(confuga_opendir(C, serv_path, &dir));
@@ -402,14 +403,14 @@ static int bindinput (confuga *C, chirp_jobid_t id, const char *tag, const char
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	return rc;
 }
 
 static int bindinputs (confuga *C, chirp_jobid_t id, const char *tag)
 {
 	static const char SQL[] =
-		"BEGIN TRANSACTION;"
+		"SAVEPOINT bindinputs;"
 		"SELECT serv_path, task_path"
 		"	FROM JobFile"
 		"	WHERE id = ? AND type = 'INPUT';"
@@ -418,40 +419,40 @@ static int bindinputs (confuga *C, chirp_jobid_t id, const char *tag)
 		"		state = 'BOUND_INPUTS',"
 		"		time_bound_inputs = (strftime('%s', 'now'))"
 		"	WHERE id = ?;"
-		"END TRANSACTION;";
+		"RELEASE SAVEPOINT bindinputs;";
 
 	int rc;
 	sqlite3 *db = C->db;
 	sqlite3_stmt *stmt = NULL;
 	const char *current = SQL;
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	/* FIXME input file mode may need executable bit */
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_int64(stmt, 1, id));
 	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
 		CATCH(bindinput(C, id, tag, (const char *)sqlite3_column_text(stmt, 0), (const char *)sqlite3_column_text(stmt, 1)));
 	}
 	sqlcatchcode(rc, SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_int64(stmt, 1, id));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
-	sqlend(db);
+	chirp_sqlite3_finalize(stmt);
+	sqlendsavepoint(bindinputs);
 	return rc;
 }
 
@@ -468,7 +469,7 @@ static int job_bind_inputs (confuga *C)
 	sqlite3_stmt *stmt = NULL;
 	const char *current = SQL;
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
 		chirp_jobid_t id = sqlite3_column_int64(stmt, 0);
 		const char *tag = (const char *)sqlite3_column_text(stmt, 1);
@@ -477,12 +478,12 @@ static int job_bind_inputs (confuga *C)
 		C->operations++;
 	}
 	sqlcatchcode(rc, SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	return rc;
 }
 
@@ -496,7 +497,7 @@ static int dispatch (confuga *C, chirp_jobid_t id, const char *tag)
 	 */
 	static const char SQL[] =
 		/* Find an available Storage Node with the most needed bytes. */
-		"BEGIN TRANSACTION;"
+		"SAVEPOINT dispatch;"
 		"WITH"
 			/* We want every active SN, even if it has no input file. */
 		"	StorageNodeAvailable AS ("
@@ -533,7 +534,7 @@ static int dispatch (confuga *C, chirp_jobid_t id, const char *tag)
 		"UPDATE Job"
 		"	SET status = 'STARTED', time_start = strftime('%s', 'now')"
 		"	WHERE id = ?;"
-		"END TRANSACTION;";
+		"RELEASE SAVEPOINT dispatch;";
 
 	int rc;
 	sqlite3 *db = C->db;
@@ -543,11 +544,11 @@ static int dispatch (confuga *C, chirp_jobid_t id, const char *tag)
 	struct job_stats stats;
 	memset(&stats, 0, sizeof(stats));
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_int64(stmt, 1, id));
 	rc = sqlite3_step(stmt);
 	if (rc == SQLITE_ROW) {
@@ -570,34 +571,249 @@ static int dispatch (confuga *C, chirp_jobid_t id, const char *tag)
 		C->operations++;
 		sqlcatch(rc);
 	}
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_int64(stmt, 1, id));
 	sqlcatch(sqlite3_bind_int64(stmt, 2, sid));
 	sqlcatch(sqlite3_bind_int64(stmt, 3, stats.repl_bytes));
 	sqlcatch(sqlite3_bind_int64(stmt, 4, stats.repl_count));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_int64(stmt, 1, id));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
-	sqlend(db);
+	chirp_sqlite3_finalize(stmt);
+	sqlendsavepoint(dispatch);
 	return rc;
 }
 
-static int job_schedule (confuga *C)
+/* A job scheduled by the locality scheduler may wait this long for a busy
+ * storage node that already holds (much) more of its inputs than any idle
+ * storage node.
+ */
+#define LOCALITY_DELAY (60)
+
+/* Upper bound on the number of waiting jobs considered in one scheduling pass. */
+#define LOCALITY_WINDOW (256)
+
+static int dispatch_locality (confuga *C, chirp_jobid_t id, const char *tag, time_t waited)
+{
+	static const char SQL[] =
+		"SAVEPOINT dispatch_locality;"
+		/* Rank every active Storage Node by the cost of running the job there.
+		 * The cost is the number of input bytes that must still be replicated
+		 * to the SN, scaled by the number of transfers the SN is already
+		 * participating in (a rough estimate of its available bandwidth).
+		 */
+		"WITH"
+		"	JobInput AS ("
+		"		SELECT DISTINCT File.id AS fid, File.size AS size"
+		"			FROM ConfugaInputFile JOIN Confuga.File ON ConfugaInputFile.fid = File.id"
+		"			WHERE ConfugaInputFile.jid = ?1"
+		"	),"
+		"	StorageNodeResident AS ("
+		"		SELECT Replica.sid AS sid, COUNT(*) AS count, SUM(JobInput.size) AS size"
+		"			FROM JobInput JOIN Confuga.Replica ON JobInput.fid = Replica.fid"
+		"			GROUP BY Replica.sid"
+		"	),"
+		"	StorageNodeLoad AS ("
+		"		SELECT StorageNodeActive.id AS sid, COUNT(ConfugaJobAllocated.id) AS jobs"
+		"			FROM Confuga.StorageNodeActive LEFT OUTER JOIN ConfugaJobAllocated ON StorageNodeActive.id = ConfugaJobAllocated.sid"
+		"			GROUP BY StorageNodeActive.id"
+		"	),"
+		"	StorageNodeTransfers AS ("
+		"		SELECT StorageNodeActive.id AS sid, COUNT(ActiveTransfers.id) AS transfers"
+		"			FROM Confuga.StorageNodeActive LEFT OUTER JOIN Confuga.ActiveTransfers ON StorageNodeActive.id = ActiveTransfers.tsid OR StorageNodeActive.id = ActiveTransfers.fsid"
+		"			GROUP BY StorageNodeActive.id"
+		"	),"
+		"	StorageNodeCost AS ("
+		"		SELECT"
+		"				StorageNodeLoad.sid AS sid,"
+		"				StorageNodeLoad.jobs AS jobs,"
+		"				IFNULL(StorageNodeResident.count, 0) AS count,"
+		"				IFNULL(StorageNodeResident.size, 0) AS size,"
+		"				(SELECT IFNULL(SUM(size), 0) FROM JobInput) - IFNULL(StorageNodeResident.size, 0) AS missing,"
+		"				StorageNodeTransfers.transfers AS transfers"
+		"			FROM"
+		"				StorageNodeLoad"
+		"				JOIN StorageNodeTransfers ON StorageNodeLoad.sid = StorageNodeTransfers.sid"
+		"				LEFT OUTER JOIN StorageNodeResident ON StorageNodeLoad.sid = StorageNodeResident.sid"
+		"	)"
+		"SELECT sid, jobs, count, size, missing, missing*(1+transfers) AS cost"
+		"	FROM StorageNodeCost"
+		"	ORDER BY cost ASC, jobs ASC, RANDOM();" /* choose a random storage node if equally desirable */
+		"UPDATE ConfugaJob"
+		"	SET"
+		"		sid = ?2,"
+		"		state = 'SCHEDULED',"
+		"		repl_bytes = ?3,"
+		"		repl_count = ?4,"
+		"		time_scheduled = (strftime('%s', 'now'))"
+		"	WHERE id = ?1;"
+		"UPDATE Job"
+		"	SET status = 'STARTED', time_start = strftime('%s', 'now')"
+		"	WHERE id = ?;"
+		"RELEASE SAVEPOINT dispatch_locality;";
+
+	int rc;
+	sqlite3 *db = C->db;
+	sqlite3_stmt *stmt = NULL;
+	const char *current = SQL;
+	confuga_sid_t sid = 0;
+	confuga_sid_t best_sid = 0;
+	uint64_t best_missing = 0;
+	uint64_t best_cost = 0;
+	struct job_stats stats;
+	memset(&stats, 0, sizeof(stats));
+
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
+	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
+
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
+	sqlcatch(sqlite3_bind_int64(stmt, 1, id));
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		uint64_t jobs = sqlite3_column_int64(stmt, 1);
+		uint64_t missing = sqlite3_column_int64(stmt, 4);
+		uint64_t cost = sqlite3_column_int64(stmt, 5);
+		if (best_sid == 0) {
+			best_sid = sqlite3_column_int64(stmt, 0);
+			best_missing = missing;
+			best_cost = cost;
+		}
+		if (jobs == 0) { /* TODO: allow more than one job on a SN */
+			sid = sqlite3_column_int64(stmt, 0);
+			stats.repl_count = sqlite3_column_int64(stmt, 2);
+			stats.repl_bytes = sqlite3_column_int64(stmt, 3);
+			if (cost > best_cost && missing > best_missing && missing-best_missing >= C->pull_threshold && waited < LOCALITY_DELAY) {
+				jdebug(D_DEBUG, id, tag, "waiting for busy storage node " CONFUGA_SID_DEBFMT " (%" PRIu64 " fewer bytes to replicate than " CONFUGA_SID_DEBFMT ")", best_sid, missing-best_missing, sid);
+				THROW_QUIET(EAGAIN); /* come back later */
+			}
+			break;
+		}
+	}
+	if (rc != SQLITE_ROW && rc != SQLITE_DONE) {
+		C->operations++;
+		sqlcatch(rc);
+	}
+	if (sid == 0) {
+		jdebug(D_DEBUG, id, tag, "could not schedule yet");
+		THROW_QUIET(EAGAIN); /* come back later */
+	}
+	assert(sid > 0);
+	jdebug(D_CONFUGA, id, tag, "scheduling on " CONFUGA_SID_DEBFMT " (%" PRIu64 " bytes already replicated)", sid, stats.repl_bytes);
+	C->operations++;
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
+
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
+	sqlcatch(sqlite3_bind_int64(stmt, 1, id));
+	sqlcatch(sqlite3_bind_int64(stmt, 2, sid));
+	sqlcatch(sqlite3_bind_int64(stmt, 3, stats.repl_bytes));
+	sqlcatch(sqlite3_bind_int64(stmt, 4, stats.repl_count));
+	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
+
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
+	sqlcatch(sqlite3_bind_int64(stmt, 1, id));
+	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
+
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
+	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
+
+	rc = 0;
+	goto out;
+out:
+	chirp_sqlite3_finalize(stmt);
+	sqlendsavepoint(dispatch_locality);
+	return rc;
+}
+
+/* Unlike the FIFO scheduler, which only ever considers the job at the head of
+ * the queue, the locality scheduler looks at a window of waiting jobs (in
+ * priority order) so that a job whose inputs live on a busy storage node does
+ * not block jobs which can run well on an idle one.
+ */
+static int job_schedule_locality (confuga *C)
+{
+	static const char SQL[] =
+		"SELECT COUNT(*)"
+		"	FROM ConfugaJob"
+		"	WHERE ConfugaJob.state = 'SCHEDULED';"
+		"SELECT ConfugaJob.id, ConfugaJob.tag, strftime('%s', 'now')-IFNULL(ConfugaJob.time_bound_inputs, ConfugaJob.time_new)"
+		"	FROM Job INNER JOIN ConfugaJob ON Job.id = ConfugaJob.id"
+		"	WHERE ConfugaJob.state = 'BOUND_INPUTS'"
+		"	ORDER BY Job.priority, Job.time_commit"
+		"	LIMIT ?1;";
+
+	int rc;
+	sqlite3 *db = C->db;
+	sqlite3_stmt *stmt = NULL;
+	const char *current = SQL;
+	uint64_t scheduled = 0;
+	size_t i, n = 0;
+	struct {
+		chirp_jobid_t id;
+		char *tag;
+		time_t waited;
+	} jobs[LOCALITY_WINDOW];
+
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
+	sqlcatchcode(sqlite3_step(stmt), SQLITE_ROW);
+	scheduled = sqlite3_column_int64(stmt, 0);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
+
+	if (C->scheduler_n && scheduled >= C->scheduler_n) {
+		rc = 0;
+		goto out;
+	}
+
+	/* Copy the window out first so no read lock is held while dispatching. */
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
+	sqlcatch(sqlite3_bind_int64(stmt, 1, LOCALITY_WINDOW));
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW && n < LOCALITY_WINDOW) {
+		jobs[n].id = sqlite3_column_int64(stmt, 0);
+		jobs[n].tag = strdup((const char *)sqlite3_column_text(stmt, 1));
+		jobs[n].waited = sqlite3_column_int64(stmt, 2);
+		if (jobs[n].tag == NULL)
+			CATCH(ENOMEM);
+		n++;
+	}
+	if (rc != SQLITE_ROW)
+		sqlcatchcode(rc, SQLITE_DONE);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
+
+	for (i = 0; i < n; i++) {
+		if (C->scheduler_n && scheduled >= C->scheduler_n)
+			break;
+		rc = dispatch_locality(C, jobs[i].id, jobs[i].tag, jobs[i].waited);
+		CATCHJOB(C, jobs[i].id, jobs[i].tag, rc);
+		if (rc == 0)
+			scheduled++;
+	}
+
+	rc = 0;
+	goto out;
+out:
+	for (i = 0; i < n; i++)
+		free(jobs[i].tag);
+	chirp_sqlite3_finalize(stmt);
+	return rc;
+}
+
+static int job_schedule_fifo (confuga *C)
 {
 	static const char SQL[] =
 		"WITH"
@@ -617,9 +833,7 @@ static int job_schedule (confuga *C)
 	sqlite3_stmt *stmt = NULL;
 	const char *current = SQL;
 
-	assert(C->scheduler == CONFUGA_SCHEDULER_FIFO);
-
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_int64(stmt, 1, C->scheduler_n));
 	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
 		chirp_jobid_t id = sqlite3_column_int64(stmt, 0);
@@ -627,15 +841,28 @@ static int job_schedule (confuga *C)
 		CATCHJOB(C, id, tag, dispatch(C, id, tag));
 	}
 	sqlcatchcode(rc, SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	return rc;
 }
 
+static int job_schedule (confuga *C)
+{
+	switch (C->scheduler) {
+		case CONFUGA_SCHEDULER_FIFO:
+			return job_schedule_fifo(C);
+		case CONFUGA_SCHEDULER_LOCALITY:
+			return job_schedule_locality(C);
+		default:
+			assert(0);
+	}
+	return EINVAL;
+}
+
 static int replicate_push_synchronous (confuga *C)
 {
 	static const char SQL[] =
@@ -658,7 +885,7 @@ static int replicate_push_synchronous (confuga *C)
 	time_t start = time(0);
 	char *tag = NULL;
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_int64(stmt, 1, C->pull_threshold));
 	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
 		chirp_jobid_t id = sqlite3_column_int64(stmt, 0);
@@ -681,12 +908,12 @@ static int replicate_push_synchronous (confuga *C)
 			break;
 		}
 	}
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	free(tag);
 	return rc;
 }
@@ -799,35 +1026,35 @@ static int replicate_push_asynchronous (confuga *C)
 	const char *current = SQL;
 	uint64_t count;
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_int64(stmt, 1, C->pull_threshold));
 	sqlcatch(sqlite3_bind_int64(stmt, 2, C->replication_n));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_ROW);
 	if (sqlite3_column_int(stmt, 0) == 0) {
 		rc = 0;
 		goto out;
 	}
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &insert, &current));
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &select, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &insert, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &select, &current));
 
 	/* don't schedule more than 100 transfer jobs per cycle */
 	for (count = 0; count < 100; count++) {
@@ -859,19 +1086,19 @@ static int replicate_push_asynchronous (confuga *C)
 		} else assert(0);
 	}
 
-	sqlcatch(sqlite3_finalize(insert); insert = NULL);
-	sqlcatch(sqlite3_finalize(select); select = NULL);
+	sqlcatch(chirp_sqlite3_finalize(insert); insert = NULL);
+	sqlcatch(chirp_sqlite3_finalize(select); select = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
-	sqlite3_finalize(insert);
-	sqlite3_finalize(select);
+	chirp_sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(insert);
+	chirp_sqlite3_finalize(select);
 	sqlend(db);
 	return rc;
 }
@@ -891,15 +1118,15 @@ static int set_replicated (confuga *C, chirp_jobid_t id)
 	sqlite3_stmt *stmt = NULL;
 	const char *current = SQL;
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_int64(stmt, 1, id));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	return rc;
 }
 
@@ -931,7 +1158,7 @@ static int job_replicate (confuga *C)
 	const char *current = SQL;
 
 	/* check for jobs with all dependencies replicated */
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_int64(stmt, 1, C->pull_threshold));
 	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
 		chirp_jobid_t id = sqlite3_column_int64(stmt, 0);
@@ -941,10 +1168,10 @@ static int job_replicate (confuga *C)
 		C->operations++;
 	}
 	sqlcatchcode(rc, SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	/* check for jobs scheduled on inactive storage nodes */
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
 		chirp_jobid_t id = sqlite3_column_int64(stmt, 0);
 		const char *tag = (const char *)sqlite3_column_text(stmt, 1);
@@ -952,7 +1179,7 @@ static int job_replicate (confuga *C)
 		reschedule(C, id, tag, ESRCH); /* someone else killed it? reschedule */
 	}
 	sqlcatchcode(rc, SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	/* now replicate missing dependencies */
 	if (C->replication == CONFUGA_REPLICATION_PUSH_ASYNCHRONOUS)
@@ -964,7 +1191,7 @@ static int job_replicate (confuga *C)
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	return rc;
 }
 
@@ -1051,7 +1278,7 @@ static int encode (confuga *C, chirp_jobid_t id, const char *tag, buffer_t *B, s
 
 	CATCHUNIX(buffer_putliteral(B, "{"));
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_int64(stmt, 1, id));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_ROW);
 	CATCHUNIX(buffer_putliteral(B, "\"executable\":"));
@@ -1059,11 +1286,11 @@ static int encode (confuga *C, chirp_jobid_t id, const char *tag, buffer_t *B, s
 	CATCHUNIX(buffer_putliteral(B, ",\"tag\":"));
 	CATCH(chirp_sqlite3_column_jsonify(stmt, 1, B));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	first0 = 1;
 	CATCHUNIX(buffer_putliteral(B, ",\"arguments\":["));
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_int64(stmt, 1, id));
 	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
 		if (!first0)
@@ -1072,12 +1299,12 @@ static int encode (confuga *C, chirp_jobid_t id, const char *tag, buffer_t *B, s
 		CATCH(chirp_sqlite3_column_jsonify(stmt, 0, B));
 	}
 	sqlcatchcode(rc, SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 	CATCHUNIX(buffer_putliteral(B, "]"));
 
 	first0 = 1;
 	CATCHUNIX(buffer_putliteral(B, ",\"environment\":{"));
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_int64(stmt, 1, (sqlite3_int64)id));
 	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
 		if (!first0)
@@ -1088,12 +1315,12 @@ static int encode (confuga *C, chirp_jobid_t id, const char *tag, buffer_t *B, s
 		CATCH(chirp_sqlite3_column_jsonify(stmt, 1, B));
 	}
 	sqlcatchcode(rc, SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 	CATCHUNIX(buffer_putliteral(B, "}"));
 
 	first0 = 1;
 	CATCHUNIX(buffer_putliteral(B, ",\"files\":["));
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_int64(stmt, 1, (sqlite3_int64)id));
 	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
 		if (!first0)
@@ -1114,7 +1341,7 @@ static int encode (confuga *C, chirp_jobid_t id, const char *tag, buffer_t *B, s
 		CATCH(chirp_sqlite3_row_jsonify(stmt, B));
 	}
 	sqlcatchcode(rc, SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 	CATCHUNIX(buffer_putliteral(B, "]"));
 
 	CATCHUNIX(buffer_putliteral(B, "}"));
@@ -1122,7 +1349,7 @@ static int encode (confuga *C, chirp_jobid_t id, const char *tag, buffer_t *B, s
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	return rc;
 }
 
@@ -1154,32 +1381,32 @@ static int jcreate (confuga *C, chirp_jobid_t id, const char *tag, const char *h
 
 	jdebug(D_DEBUG, id, tag, "creating job on storage node");
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	CATCH(encode(C, id, tag, B, &stats));
 	debug(D_DEBUG, "json = `%s'", buffer_tostring(B));
 
 	CATCHUNIX(chirp_reli_job_create(hostport, buffer_tostring(B), &cid, STOPTIME));
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_int64(stmt, 1, id));
 	sqlcatch(sqlite3_bind_int64(stmt, 2, cid));
 	sqlcatch(sqlite3_bind_int64(stmt, 3, stats.pull_bytes));
 	sqlcatch(sqlite3_bind_int64(stmt, 4, stats.pull_count));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
 	buffer_free(B);
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	sqlend(db);
 	return rc;
 }
@@ -1198,7 +1425,7 @@ static int job_create (confuga *C)
 	sqlite3_stmt *stmt = NULL;
 	const char *current = SQL;
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_int64(stmt, 1, C->concurrency));
 	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
 		chirp_jobid_t id = sqlite3_column_int64(stmt, 0);
@@ -1208,12 +1435,12 @@ static int job_create (confuga *C)
 		C->operations++;
 	}
 	sqlcatchcode(rc, SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	return rc;
 }
 
@@ -1236,15 +1463,15 @@ static int jcommit (confuga *C, chirp_jobid_t id, const char *tag, const char *h
 
 	CATCHUNIX(chirp_reli_job_commit(hostport, buffer_tostring(B), STOPTIME));
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_int64(stmt, 1, id));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	return rc;
 }
 
@@ -1260,7 +1487,7 @@ static int job_commit (confuga *C)
 	sqlite3_stmt *stmt = NULL;
 	const char *current = SQL;
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
 		chirp_jobid_t id = sqlite3_column_int64(stmt, 0);
 		const char *tag = (const char *)sqlite3_column_text(stmt, 1);
@@ -1270,12 +1497,12 @@ static int job_commit (confuga *C)
 		C->operations++;
 	}
 	sqlcatchcode(rc, SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	return rc;
 }
 
@@ -1320,9 +1547,9 @@ static int jwait (confuga *C, chirp_jobid_t id, const char *tag, confuga_sid_t s
 			jdebug(D_CONFUGA, id, tag, "storage node job %" PRICHIRP_JOBID_T " finished", cid);
 			C->operations++;
 
-			sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+			sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 			sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-			sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+			sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 			/* UPDATE ConfugaOutputFile */
 			json_value *error = jsonA_getname(job, "error", json_string);
@@ -1331,7 +1558,7 @@ static int jwait (confuga *C, chirp_jobid_t id, const char *tag, confuga_sid_t s
 			json_value *exit_status = jsonA_getname(job, "exit_status", json_string);
 			json_value *status = jsonA_getname(job, "status", json_string);
 
-			sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+			sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 			if (status && strcmp(status->u.string.ptr, "FINISHED") == 0 && exit_status && strcmp(exit_status->u.string.ptr, "EXITED") == 0) {
 				json_value *files = jsonA_getname(job, "files", json_array);
 				if (files) {
@@ -1379,9 +1606,9 @@ static int jwait (confuga *C, chirp_jobid_t id, const char *tag, confuga_sid_t s
 				/* This indicates the job failed startup, probably could not source a URL. We should retry the job! */
 				CATCH(EIO);
 			}
-			sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+			sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-			sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+			sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 			sqlcatch(sqlite3_bind_int64(stmt, 1, id));
 			if (error)
 				sqlcatch(sqlite3_bind_text(stmt, 2, error->u.string.ptr, -1, SQLITE_STATIC));
@@ -1394,16 +1621,16 @@ static int jwait (confuga *C, chirp_jobid_t id, const char *tag, confuga_sid_t s
 			if (status)
 				sqlcatch(sqlite3_bind_text(stmt, 6, status->u.string.ptr, -1, SQLITE_STATIC));
 			sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-			sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+			sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-			sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+			sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 			sqlcatch(sqlite3_bind_int64(stmt, 1, id));
 			sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-			sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+			sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-			sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+			sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 			sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-			sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+			sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 		}
 	}
 
@@ -1412,7 +1639,7 @@ static int jwait (confuga *C, chirp_jobid_t id, const char *tag, confuga_sid_t s
 out:
 	free(status);
 	json_value_free(J);
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	sqlend(db);
 	return rc;
 }
@@ -1430,7 +1657,7 @@ static int job_wait (confuga *C)
 	sqlite3_stmt *stmt = NULL;
 	const char *current = SQL;
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
 		chirp_jobid_t id = sqlite3_column_int64(stmt, 0);
 		const char *tag = (const char *)sqlite3_column_text(stmt, 1);
@@ -1440,12 +1667,12 @@ static int job_wait (confuga *C)
 		CATCHJOB(C, id, tag, jwait(C, id, tag, sid, hostport, cid));
 	}
 	sqlcatchcode(rc, SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	return rc;
 }
 
@@ -1468,15 +1695,15 @@ static int jreap (confuga *C, chirp_jobid_t id, const char *tag, const char *hos
 
 	CATCHUNIX(chirp_reli_job_reap(hostport, buffer_tostring(B), STOPTIME));
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_int64(stmt, 1, id));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	return rc;
 }
 
@@ -1492,7 +1719,7 @@ static int job_reap (confuga *C)
 	sqlite3_stmt *stmt = NULL;
 	const char *current = SQL;
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
 		chirp_jobid_t id = sqlite3_column_int64(stmt, 0);
 		const char *tag = (const char *)sqlite3_column_text(stmt, 1);
@@ -1502,12 +1729,12 @@ static int job_reap (confuga *C)
 		C->operations++;
 	}
 	sqlcatchcode(rc, SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	return rc;
 }
 
@@ -1545,11 +1772,11 @@ static int bindoutputs (confuga *C, chirp_jobid_t id, const char *tag)
 
 	jdebug(D_DEBUG, id, tag, "binding outputs");
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_int64(stmt, 1, id));
 	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
 		confuga_fid_t fid;
@@ -1562,31 +1789,31 @@ static int bindoutputs (confuga *C, chirp_jobid_t id, const char *tag)
 		CATCH(confuga_update(C, path, fid, size, 0));
 	}
 	sqlcatchcode(rc, SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_int64(stmt, 1, id));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_int64(stmt, 1, id));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_int64(stmt, 1, id));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	sqlend(db);
 	return rc;
 }
@@ -1604,7 +1831,7 @@ static int job_complete (confuga *C)
 	sqlite3_stmt *stmt = NULL;
 	const char *current = SQL;
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
 		chirp_jobid_t id = sqlite3_column_int64(stmt, 0);
 		const char *tag = (const char *)sqlite3_column_text(stmt, 1);
@@ -1628,12 +1855,12 @@ static int job_complete (confuga *C)
 		C->operations++;
 	}
 	sqlcatchcode(rc, SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	return rc;
 }
 
@@ -1667,28 +1894,28 @@ static int jkill (confuga *C, chirp_jobid_t id, const char *tag, const char *hos
 			CATCH(errno);
 	}
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_int64(stmt, 1, id));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_int64(stmt, 1, id));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	sqlend(db);
 	return rc;
 }
@@ -1709,7 +1936,7 @@ static int job_kill (confuga *C)
 	sqlite3_stmt *stmt = NULL;
 	const char *current = SQL;
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
 		chirp_jobid_t id = sqlite3_column_int64(stmt, 0);
 		const char *tag = (const char *)sqlite3_column_text(stmt, 1);
@@ -1719,12 +1946,12 @@ static int job_kill (confuga *C)
 		C->operations++;
 	}
 	sqlcatchcode(rc, SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	return rc;
 }
 
@@ -1758,34 +1985,34 @@ static int job_stats (confuga *C)
 	}
 	C->job_stats = now;
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
 		const char *state = (const char *)sqlite3_column_text(stmt, 0);
 		buffer_putfstring(B, "%s; ", state);
 	}
 	sqlcatchcode(rc, SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
 		buffer_putfstring(B, "Active SN (%d); ", sqlite3_column_int(stmt, 0));
 	}
 	sqlcatchcode(rc, SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
 		buffer_putfstring(B, "Allocated SN (%d); ", sqlite3_column_int(stmt, 0));
 	}
 	sqlcatchcode(rc, SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
 		buffer_putfstring(B, "Executing SN (%d); ", sqlite3_column_int(stmt, 0));
 	}
 	sqlcatchcode(rc, SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	if (buffer_pos(B))
 		debug(D_DEBUG, "%s", buffer_tostring(B));
@@ -1794,18 +2021,59 @@ static int job_stats (confuga *C)
 	goto out;
 out:
 	buffer_free(B);
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	return rc;
 }
 
-CONFUGA_IAPI int confugaJ_schedule (confuga *C)
+/* The NEW -> BOUND_INPUTS -> SCHEDULED transitions only touch the database
+ * (and the local namespace), so a whole pass of them is committed as a single
+ * transaction. Each job's own transition is a savepoint within it.
+ */
+static int job_schedule_batch (confuga *C)
 {
 	int rc;
+	sqlite3 *db = C->db;
+	timestamp_t start = timestamp_get();
+	uint64_t operations = C->operations;
+
+	rc = sqlite3_exec(db, "BEGIN IMMEDIATE TRANSACTION;", NULL, NULL, NULL);
+	if (rc) {
+		/* The Job database is busy, fall back to a transaction per job. */
+		debug(D_DEBUG, "could not batch scheduling pass: %s", sqlite3_errstr(rc));
+		job_new(C);
+		job_bind_inputs(C);
+		job_schedule(C);
+		rc = 0;
+		goto out;
+	}
 
-	job_stats(C);
 	job_new(C);
 	job_bind_inputs(C);
 	job_schedule(C);
+
+	rc = sqlite3_exec(db, "END TRANSACTION;", NULL, NULL, NULL);
+	if (rc) {
+		debug(D_DEBUG, "could not commit scheduling pass: %s", sqlite3_errstr(rc));
+		sqlite3_exec(db, "ROLLBACK TRANSACTION;", NULL, NULL, NULL);
+		rc = rc == SQLITE_BUSY ? EAGAIN : EIO;
+		goto out;
+	}
+
+	if (C->operations > operations)
+		debug(D_DEBUG, "scheduling pass: %" PRIu64 " operations in %" PRIu64 "us", C->operations-operations, (uint64_t)(timestamp_get()-start));
+
+	rc = 0;
+	goto out;
+out:
+	return rc;
+}
+
+CONFUGA_IAPI int confugaJ_schedule (confuga *C)
+{
+	int rc;
+
+	job_stats(C);
+	job_schedule_batch(C);
 	job_replicate(C);
 	job_create(C);
 	job_commit(C);
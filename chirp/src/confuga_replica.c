@@ -20,6 +20,7 @@ See the file COPYING for details.
 #include "stringtools.h"
 
 #include <sys/socket.h>
+#include <sys/stat.h>
 
 #include <assert.h>
 #include <errno.h>
@@ -29,6 +30,11 @@ See the file COPYING for details.
 
 #define STOPTIME (time(NULL)+30)
 
+/* Files at least twice this size are striped across several source replicas. */
+#define STRIPE_MINIMUM (((confuga_off_t)1)<<26) /* 64MB */
+#define STRIPE_MAXIMUM 8
+#define STRIPE_ALIGN   (1<<20)
+
 struct confuga_replica {
 	confuga *C;
 	confuga_fid_t fid;
@@ -73,44 +79,44 @@ CONFUGA_IAPI int confugaR_delete (confuga *C, confuga_sid_t sid, confuga_fid_t f
 
 	debug(D_DEBUG, "deleting Replica fid = " CONFUGA_FID_PRIFMT " sid = " CONFUGA_SID_PRIFMT, CONFUGA_FID_PRIARGS(fid), sid);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_blob(stmt, 1, confugaF_id(fid), confugaF_size(fid), SQLITE_STATIC));
 	sqlcatch(sqlite3_bind_int64(stmt, 2, sid));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_blob(stmt, 1, confugaF_id(fid), confugaF_size(fid), SQLITE_STATIC));
 	sqlcatch(sqlite3_bind_int64(stmt, 2, sid));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
 	if (sqlite3_changes(db))
 		debug(D_DEBUG, "deleted Replica fid = " CONFUGA_FID_PRIFMT " sid = " CONFUGA_SID_PRIFMT, CONFUGA_FID_PRIARGS(fid), sid);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_blob(stmt, 1, confugaF_id(fid), confugaF_size(fid), SQLITE_STATIC));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_blob(stmt, 1, confugaF_id(fid), confugaF_size(fid), SQLITE_STATIC));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
 	if (sqlite3_changes(db))
 		debug(D_DEBUG, "deleted File fid = " CONFUGA_FID_PRIFMT, CONFUGA_FID_PRIARGS(fid));
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	sqlendsavepoint(confugaR_delete);
 	return rc;
 }
@@ -134,34 +140,34 @@ CONFUGA_IAPI int confugaR_register (confuga *C, confuga_fid_t fid, confuga_off_t
 	sqlite3_stmt *stmt = NULL;
 	const char *current = SQL;
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_blob(stmt, 1, confugaF_id(fid), confugaF_size(fid), SQLITE_STATIC));
 	sqlcatch(sqlite3_bind_int64(stmt, 2, size));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
 	if (sqlite3_changes(db))
 		debug(D_DEBUG, "created new file fid = " CONFUGA_FID_PRIFMT " size = %" PRICONFUGA_OFF_T, CONFUGA_FID_PRIARGS(fid), size);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_blob(stmt, 1, confugaF_id(fid), confugaF_size(fid), SQLITE_STATIC));
 	sqlcatch(sqlite3_bind_int64(stmt, 2, sid));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
 	if (sqlite3_changes(db))
 		debug(D_DEBUG, "created new replica fid = " CONFUGA_FID_PRIFMT " sid = " CONFUGA_SID_PRIFMT, CONFUGA_FID_PRIARGS(fid), sid);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	sqlendsavepoint(confugaR_register);
 	return rc;
 }
@@ -205,11 +211,11 @@ CONFUGA_IAPI int confugaR_replicate (confuga *C, confuga_fid_t fid, confuga_sid_
 
 	debug(D_DEBUG, "synchronously replicating " CONFUGA_FID_DEBFMT " to " CONFUGA_SID_DEBFMT, CONFUGA_FID_PRIARGS(fid), sid);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_blob(stmt, 1, confugaF_id(fid), confugaF_size(fid), SQLITE_STATIC));
 	sqlcatch(sqlite3_bind_int64(stmt, 2, sid));
 	rc = sqlite3_step(stmt);
@@ -219,9 +225,9 @@ CONFUGA_IAPI int confugaR_replicate (confuga *C, confuga_fid_t fid, confuga_sid_
 	} else if (rc != SQLITE_DONE) {
 		sqlcatch(rc);
 	}
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_int64(stmt, 1, sid));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_ROW);
 
@@ -231,9 +237,9 @@ CONFUGA_IAPI int confugaR_replicate (confuga *C, confuga_fid_t fid, confuga_sid_
 	string_nformat(replica_closed, sizeof(replica_closed), "%s/file/" CONFUGA_FID_PRIFMT, host_to.root, CONFUGA_FID_PRIARGS(fid));
 
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_blob(stmt, 1, confugaF_id(fid), confugaF_size(fid), SQLITE_STATIC));
 	if (chirp_reli_access(host_to.hostport, replica_closed, R_OK, STOPTIME) == 0)
 		goto replicated; /* already there, just not in DB yet */
@@ -271,16 +277,16 @@ CONFUGA_IAPI int confugaR_replicate (confuga *C, confuga_fid_t fid, confuga_sid_
 	sqlcatchcode(rc, SQLITE_DONE);
 	CATCH(EIO);
 replicated:
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_blob(stmt, 1, confugaF_id(fid), confugaF_size(fid), SQLITE_STATIC));
 	sqlcatch(sqlite3_bind_int64(stmt, 2, sid));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
 	assert(sqlite3_changes(db));
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	if (fsid) {
 		/* fsid is 0 if it was already there... (access) */
 		debug(D_DEBUG, CONFUGA_FID_DEBFMT " from " CONFUGA_SID_DEBFMT " to " CONFUGA_SID_DEBFMT " size=%" PRICONFUGA_OFF_T, CONFUGA_FID_PRIARGS(fid), fsid, sid, size);
@@ -293,16 +299,16 @@ replicated:
 		sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
 		assert(sqlite3_changes(db));
 	}
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	sqlendsavepoint(confugaR_replicate);
 	return rc;
 }
@@ -334,16 +340,16 @@ CONFUGA_API int confuga_replica_open (confuga *C, confuga_fid_t fid, confuga_rep
 	replica->C =C;
 	replica->fid = fid;
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_blob(stmt, 1, confugaF_id(fid), confugaF_size(fid), SQLITE_STATIC));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
 		n += 1;
 
@@ -360,7 +366,7 @@ CONFUGA_API int confuga_replica_open (confuga *C, confuga_fid_t fid, confuga_rep
 		}
 	}
 	sqlcatchcode(rc, SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	if (n == 0)
 		CATCH(ENOENT); /* no replicas */
@@ -369,7 +375,7 @@ CONFUGA_API int confuga_replica_open (confuga *C, confuga_fid_t fid, confuga_rep
 out:
 	if (rc)
 		free(replica);
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	sqlite3_exec(db, "DROP TABLE IF EXISTS ConfugaResults;", NULL, NULL, NULL);
 	debug(D_CONFUGA, "= %d (%s)", rc, strerror(rc));
 	return rc;
@@ -439,15 +445,15 @@ CONFUGA_API int confuga_file_create (confuga *C, confuga_file **filep, time_t st
 	sha1_init(&file->context);
 	file->stream = NULL;
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
 		file->sid = sqlite3_column_int64(stmt, 0);
 		snprintf(file->host.hostport, sizeof(file->host.hostport), "%s", (const char *) sqlite3_column_text(stmt, 1));
@@ -464,14 +470,14 @@ CONFUGA_API int confuga_file_create (confuga *C, confuga_file **filep, time_t st
 		/* this storage node is no good, let's move on... */
 	}
 	sqlcatchcode(rc, SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	debug(D_CONFUGA, "there is no Storage Node available?");
 	CATCH(EIO);
 out:
 	if (rc)
 		free(file);
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	sqlite3_exec(db, "DROP TABLE IF EXISTS ConfugaFileTargets;", NULL, NULL, NULL);
 	debug(D_CONFUGA, "= %d (%s)", rc, strerror(rc));
 	return rc;
@@ -580,18 +586,18 @@ CONFUGA_API int confuga_setrep (confuga *C, confuga_fid_t fid, int nreps)
 
 	debug(D_CONFUGA, "setrep(" CONFUGA_FID_DEBFMT ", %d)", CONFUGA_FID_PRIARGS(fid), nreps);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_int64(stmt, 1, nreps));
 	sqlcatch(sqlite3_bind_blob(stmt, 2, confugaF_id(fid), confugaF_size(fid), SQLITE_STATIC));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
 	if (sqlite3_changes(db) == 0)
 		CATCH(EINVAL); /* invalid StorageNode, File ID */
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	debug(D_CONFUGA, "= %d (%s)", rc, strerror(rc));
 	return rc;
 }
@@ -633,7 +639,51 @@ out:
 	return rc;
 }
 
+/* Split [0, size) into one stripe per source, proportional to the observed
+ * bandwidth of each source so that all stripes finish at about the same time.
+ * Sources are sorted fastest first; the fastest source takes the remainder.
+ * Sources with no recent history are assumed to be as fast as the average.
+ */
+static void stripe_plan (confuga_off_t size, int n, const double bandwidth[], confuga_off_t offset[], confuga_off_t length[])
+{
+	int i, known = 0;
+	double total = 0.0, mean;
+	double bw[STRIPE_MAXIMUM];
+	confuga_off_t assigned = 0;
+
+	for (i = 0; i < n; i++) {
+		if (bandwidth[i] > 0.0) {
+			total += bandwidth[i];
+			known++;
+		}
+	}
+	mean = known ? total/known : 1.0;
+	total = 0.0;
+	for (i = 0; i < n; i++) {
+		bw[i] = bandwidth[i] > 0.0 ? bandwidth[i] : mean;
+		total += bw[i];
+	}
+
+	for (i = 1; i < n; i++) {
+		length[i] = (confuga_off_t)(size*(bw[i]/total));
+		length[i] -= length[i] % STRIPE_ALIGN;
+		assigned += length[i];
+	}
+	length[0] = size-assigned;
+
+	offset[0] = 0;
+	for (i = 1; i < n; i++)
+		offset[i] = offset[i-1]+length[i-1];
+}
+
 /* Schedule replication of degraded files with unsatisfied minimum_replicas.
+ *
+ * Large files are split into stripes pulled in parallel from several existing
+ * replicas. Each stripe is a separate TransferJob writing a disjoint range of
+ * the same open file on the target; the last stripe to complete renames it
+ * into place. A Storage Node serves at most `replication_n' transfers at once
+ * (0 for unlimited) and faster sources, by throughput of recently completed
+ * transfers, are preferred.
  *
  * TODO: If there is an error, the retry should have some delay.
  *
@@ -643,6 +693,31 @@ out:
 static int schedule_replication (confuga *C)
 {
 	static const char SQL[] =
+		"CREATE TEMPORARY TABLE IF NOT EXISTS TransferScheduleParameters__schedule_replication ("
+		"	key TEXT PRIMARY KEY,"
+		"	value INTEGER"
+		");"
+		"INSERT OR REPLACE INTO TransferScheduleParameters__schedule_replication"
+		"	VALUES ('transfer-slots', ?1);"
+		/* This is a StorageNode we are able to use as the source of a replica (or a stripe of one). */
+		"CREATE TEMPORARY VIEW IF NOT EXISTS SourceStorageNode__schedule_replication AS"
+		"	WITH"
+		"		TransferSlots AS ("
+		"			SELECT value FROM TransferScheduleParameters__schedule_replication WHERE key = 'transfer-slots'"
+		"		),"
+				/* Throughput (bytes/second) of transfers completed from each StorageNode in the last hour. */
+		"		Bandwidth AS ("
+		"			SELECT fsid AS sid, SUM(progress)*1.0/MAX(1, SUM(time_complete-COALESCE(time_create, time_commit))) AS bandwidth"
+		"				FROM Confuga.TransferJob"
+		"				WHERE state = 'COMPLETED' AND progress > 0 AND time_complete >= (strftime('%s', 'now')-3600)"
+		"				GROUP BY fsid"
+		"		)"
+		"	SELECT Replica.fid, StorageNodeAuthenticated.id AS sid, Bandwidth.bandwidth"
+		"		FROM"
+		"			Confuga.Replica"
+		"			JOIN Confuga.StorageNodeAuthenticated ON Replica.sid = StorageNodeAuthenticated.id"
+		"			LEFT OUTER JOIN Bandwidth ON StorageNodeAuthenticated.id = Bandwidth.sid"
+		"		WHERE (SELECT * FROM TransferSlots) = 0 OR (SELECT COUNT(*) FROM Confuga.ActiveTransfers WHERE fsid = StorageNodeAuthenticated.id) < (SELECT * FROM TransferSlots);"
 		/* TODO: Unfortunately, there seems to be a bug in SQLite [1] which
 		 * will always do a commit (resulting in a write) on this usually NO-OP
 		 * INSERT. The workaround is to check for rows in the select before
@@ -653,17 +728,6 @@ static int schedule_replication (confuga *C)
 		 */
 		"CREATE TEMPORARY VIEW IF NOT EXISTS TransferSchedule__schedule_replication AS"
 		"	WITH"
-				/* This a StorageNode we are able to use to transfer a replica. If it is currently transferring a file, it is excluded. */
-		"		StorageNodeActiveRandom AS ("
-		"			SELECT StorageNodeAuthenticated.*, RANDOM() AS _r"
-		"				FROM StorageNodeAuthenticated"
-		"		),"
-		"		SourceStorageNode AS ("
-		"			SELECT Replica.fid, StorageNodeActiveRandom.id AS sid, MIN(StorageNodeActiveRandom._r)"
-		"				FROM Confuga.Replica JOIN StorageNodeActiveRandom ON Replica.sid = StorageNodeActiveRandom.id"
-		"				WHERE NOT EXISTS (SELECT fsid FROM Confuga.ActiveTransfers WHERE fsid = StorageNodeActiveRandom.id)"
-		"				GROUP BY Replica.fid"
-		"		),"
 				/* This contains all the Replica of a File AND ongoing transfers of the File to some StorageNode */
 		"		Replicas AS ("
 		"				SELECT FileReplicas.id AS fid, FileReplicas.sid"
@@ -674,75 +738,155 @@ static int schedule_replication (confuga *C)
 		"				SELECT File.id AS fid, ActiveTransfers.tsid AS sid"
 		"					FROM Confuga.File JOIN Confuga.ActiveTransfers ON File.id = ActiveTransfers.fid"
 		"		),"
-				/* These are degraded files, insufficient replicas exist. */
+				/* These are degraded files, insufficient replicas exist. A striped transfer counts once. */
 		"		DegradedFile AS ("
-		"			SELECT File.id, File.size, COUNT(Replicas.sid) AS count, File.minimum_replicas AS min"
+		"			SELECT File.id, File.size, COUNT(DISTINCT Replicas.sid) AS count, File.minimum_replicas AS min"
 		"				FROM Confuga.File LEFT OUTER JOIN Replicas ON File.id = Replicas.fid"
 		"				WHERE File.time_create < (strftime('%s', 'now')-60)"
 		"				GROUP BY File.id"
-		"				HAVING COUNT(Replicas.sid) < File.minimum_replicas"
+		"				HAVING COUNT(DISTINCT Replicas.sid) < File.minimum_replicas"
 						/* We want to focus on degraded files which have low replica counts. */
 		"				ORDER BY count ASC"
 						/* This is an optimization because the complete SELECT query is limited to 1. */
 		"				LIMIT 1"
 		"		)"
-		"	SELECT 'NEW', 'HEALTH', DegradedFile.id, SourceStorageNode.sid, TargetStorageNode.id, '(replication)'"
+		"	SELECT DegradedFile.id, DegradedFile.size, TargetStorageNode.id, PRINTF('%s/open/%s', TargetStorageNode.root, UPPER(HEX(RANDOMBLOB(16))))"
 		"		FROM"
 		"			DegradedFile"
-		"			JOIN SourceStorageNode ON DegradedFile.id = SourceStorageNode.fid"
 		"			JOIN StorageNodeActive AS TargetStorageNode"
 				/* Originally, TargetStorageNode was a VIEW in the WITH clause. It JOINed on File so we could come up with a Target for each File. This was too expensive so the join is moved here, on DegradedFile. */
 		"		WHERE NOT EXISTS (SELECT sid FROM Replicas WHERE fid = DegradedFile.id AND sid = TargetStorageNode.id) AND TargetStorageNode.avail > DegradedFile.size"
-		"		GROUP BY DegradedFile.id"
+		"			AND EXISTS (SELECT fid FROM SourceStorageNode__schedule_replication WHERE fid = DegradedFile.id)"
 				/* Create a new Replica for a File which has a low minimum first. */
 		"		ORDER BY FLOOR(LOG(TargetStorageNode.avail+1)) DESC"
 				/* This limit is important because making a transfer job affects the next creation of subsequent transfer jobs. */
 		"		LIMIT 1;"
 		"SELECT COUNT(*) FROM TransferSchedule__schedule_replication;"
 		"BEGIN IMMEDIATE TRANSACTION;"
-		"INSERT INTO Confuga.TransferJob (state, source, fid, fsid, tsid, tag)"
-		"	SELECT * FROM TransferSchedule__schedule_replication;"
+		"SELECT * FROM TransferSchedule__schedule_replication;"
+		"SELECT sid, bandwidth"
+		"	FROM SourceStorageNode__schedule_replication"
+		"	WHERE fid = ?1"
+		"	ORDER BY COALESCE(bandwidth, 0) DESC, RANDOM()"
+		"	LIMIT ?2;"
+		"INSERT INTO Confuga.TransferJob (state, source, fid, fsid, tsid, open, stripe_offset, stripe_length, tag)"
+		"	VALUES ('NEW', 'HEALTH', ?1, ?2, ?3, ?4, ?5, ?6, '(replication)');"
 		"END TRANSACTION;"
 		;
 
 	int rc;
 	sqlite3 *db = C->db;
 	sqlite3_stmt *stmt = NULL;
+	sqlite3_stmt *select = NULL;
+	sqlite3_stmt *sources = NULL;
+	sqlite3_stmt *insert = NULL;
 	const char *current = SQL;
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
+	sqlcatch(sqlite3_bind_int64(stmt, 1, C->replication_n));
+	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
+
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
+	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
+
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
+	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
+
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_ROW);
 	if (sqlite3_column_int(stmt, 0) == 0) {
 		rc = 0;
 		goto out;
 	}
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
-	do {
-		/* continue inserting until we stop making TransferJobs */
-		sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
+	sqlcatch(chirp_sqlite3_prepare(db, current, &select, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &sources, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &insert, &current));
+
+	/* continue until we stop making TransferJobs */
+	while ((rc = sqlite3_step(select)) == SQLITE_ROW) {
+		confuga_fid_t fid;
+		confuga_off_t size;
+		confuga_sid_t tsid;
+		char open[CONFUGA_PATH_MAX];
+		confuga_sid_t fsid[STRIPE_MAXIMUM];
+		double bandwidth[STRIPE_MAXIMUM];
+		confuga_off_t offset[STRIPE_MAXIMUM];
+		confuga_off_t length[STRIPE_MAXIMUM];
+		int i, n, stripes;
+
+		CATCH(confugaF_set(C, &fid, sqlite3_column_blob(select, 0)));
+		size = sqlite3_column_int64(select, 1);
+		tsid = sqlite3_column_int64(select, 2);
+		string_nformat(open, sizeof(open), "%s", (const char *)sqlite3_column_text(select, 3));
+		sqlcatch(sqlite3_reset(select));
+
+		stripes = size/STRIPE_MINIMUM;
+		if (stripes < 1)
+			stripes = 1;
+		else if (stripes > STRIPE_MAXIMUM)
+			stripes = STRIPE_MAXIMUM;
+
+		sqlcatch(sqlite3_bind_blob(sources, 1, confugaF_id(fid), confugaF_size(fid), SQLITE_STATIC));
+		sqlcatch(sqlite3_bind_int(sources, 2, stripes));
+		for (n = 0; (rc = sqlite3_step(sources)) == SQLITE_ROW; n++) {
+			fsid[n] = sqlite3_column_int64(sources, 0);
+			bandwidth[n] = sqlite3_column_type(sources, 1) == SQLITE_NULL ? 0.0 : sqlite3_column_double(sources, 1);
+		}
+		sqlcatchcode(rc, SQLITE_DONE);
+		sqlcatch(sqlite3_reset(sources));
+		assert(n > 0);
+
+		if (n > 1)
+			stripe_plan(size, n, bandwidth, offset, length);
+
+		for (i = 0; i < n; i++) {
+			sqlcatch(sqlite3_reset(insert));
+			sqlcatch(sqlite3_clear_bindings(insert));
+			sqlcatch(sqlite3_bind_blob(insert, 1, confugaF_id(fid), confugaF_size(fid), SQLITE_STATIC));
+			sqlcatch(sqlite3_bind_int64(insert, 2, fsid[i]));
+			sqlcatch(sqlite3_bind_int64(insert, 3, tsid));
+			if (n > 1) {
+				if (length[i] == 0)
+					continue;
+				debug(D_DEBUG, "stripe %d of " CONFUGA_FID_DEBFMT " [%" PRICONFUGA_OFF_T ", +%" PRICONFUGA_OFF_T ") from " CONFUGA_SID_DEBFMT " to " CONFUGA_SID_DEBFMT, i, CONFUGA_FID_PRIARGS(fid), offset[i], length[i], fsid[i], tsid);
+				sqlcatch(sqlite3_bind_text(insert, 4, open, -1, SQLITE_STATIC));
+				sqlcatch(sqlite3_bind_int64(insert, 5, offset[i]));
+				sqlcatch(sqlite3_bind_int64(insert, 6, length[i]));
+			}
+			sqlcatchcode(sqlite3_step(insert), SQLITE_DONE);
+		}
 		C->operations++;
-	} while (sqlite3_changes(db));
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	}
+	sqlcatchcode(rc, SQLITE_DONE);
+	sqlcatch(chirp_sqlite3_finalize(select); select = NULL);
+	sqlcatch(chirp_sqlite3_finalize(sources); sources = NULL);
+	sqlcatch(chirp_sqlite3_finalize(insert); insert = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(select);
+	chirp_sqlite3_finalize(sources);
+	chirp_sqlite3_finalize(insert);
 	sqlend(db);
 	return rc;
 }
@@ -764,16 +908,16 @@ static int fail (confuga *C, chirp_jobid_t id, const char *error)
 
 	debug(D_DEBUG, "transfer job error: `%s'", error);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_text(stmt, 1, error, -1, SQLITE_STATIC));
 	sqlcatch(sqlite3_bind_int64(stmt, 2, id));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	return rc;
 }
 
@@ -834,7 +978,7 @@ static void handle_error (confuga *C, chirp_jobid_t id, int error)
 		}\
 	} while (0)
 
-static int create (confuga *C, chirp_jobid_t id, const char *fhostport, const char *ffile, const char *fticket, const char *fdebug, const char *thostport, const char *topen, const char *tag)
+static int create (confuga *C, chirp_jobid_t id, const char *fhostport, const char *ffile, const char *fticket, const char *fdebug, const char *thostport, const char *topen, confuga_off_t offset, confuga_off_t length, const char *tag)
 {
 	static const char SQL[] =
 		"UPDATE Confuga.TransferJob"
@@ -865,6 +1009,8 @@ static int create (confuga *C, chirp_jobid_t id, const char *fhostport, const ch
 	CATCHUNIX(buffer_putliteral(B, ",\"")); jsonA_escapestring(B, thostport); CATCHUNIX(buffer_putliteral(B, "\""));
 	CATCHUNIX(buffer_putliteral(B, ",\"file\""));
 	CATCHUNIX(buffer_putliteral(B, ",\"")); jsonA_escapestring(B, topen); CATCHUNIX(buffer_putliteral(B, "\""));
+	if (length) /* only a stripe of the file */
+		CATCHUNIX(buffer_putfstring(B, ",\"%" PRICONFUGA_OFF_T "\",\"%" PRICONFUGA_OFF_T "\"", offset, length));
 	CATCHUNIX(buffer_putliteral(B, "]"));
 
 	CATCHUNIX(buffer_putliteral(B, ",\"environment\":{\"CHIRP_CLIENT_TICKETS\":\"./confuga.ticket\"}"));
@@ -886,17 +1032,17 @@ static int create (confuga *C, chirp_jobid_t id, const char *fhostport, const ch
 	debug(D_DEBUG, "json = `%s'", buffer_tostring(B));
 	CATCHUNIX(chirp_reli_job_create(fhostport, buffer_tostring(B), &cid, STOPTIME));
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_int64(stmt, 1, cid));
 	sqlcatch(sqlite3_bind_text(stmt, 2, topen, -1, SQLITE_STATIC));
 	sqlcatch(sqlite3_bind_int64(stmt, 3, id));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	buffer_free(B);
 	return rc;
 }
@@ -911,8 +1057,10 @@ static int transfer_create (confuga *C)
 		"		PRINTF('%s/ticket', fsn.root),"
 		"		PRINTF('%s/debug.%%j', fsn.root),"
 		"		tsn.hostport,"
-		"		PRINTF('%s/open/%s', tsn.root, UPPER(HEX(RANDOMBLOB(16)))),"
-		"		State.value"
+		"		COALESCE(TransferJob.open, PRINTF('%s/open/%s', tsn.root, UPPER(HEX(RANDOMBLOB(16))))),"
+		"		State.value,"
+		"		TransferJob.stripe_offset,"
+		"		TransferJob.stripe_length"
 		"	FROM"
 		"		Confuga.State,"
 		"		Confuga.TransferJob"
@@ -927,7 +1075,7 @@ static int transfer_create (confuga *C)
 	sqlite3_stmt *stmt = NULL;
 	const char *current = SQL;
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
 		chirp_jobid_t id = sqlite3_column_int64(stmt, 0);
 		const char *fhostport = (const char *)sqlite3_column_text(stmt, 1);
@@ -937,17 +1085,19 @@ static int transfer_create (confuga *C)
 		const char *thostport = (const char *)sqlite3_column_text(stmt, 5);
 		const char *topen = (const char *)sqlite3_column_text(stmt, 6);
 		const char *tag = (const char *)sqlite3_column_text(stmt, 7);
+		confuga_off_t offset = sqlite3_column_int64(stmt, 8);
+		confuga_off_t length = sqlite3_column_int64(stmt, 9); /* 0 (NULL) for the whole file */
 
-		CATCHJOB(create(C, id, fhostport, ffile, fticket, fdebug, thostport, topen, tag));
+		CATCHJOB(create(C, id, fhostport, ffile, fticket, fdebug, thostport, topen, offset, length, tag));
 		C->operations++;
 	}
 	sqlcatchcode(rc, SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	return rc;
 }
 
@@ -976,7 +1126,7 @@ static int commit (confuga *C, confuga_sid_t sid, const char *hostport, const ch
 
 	CATCHUNIX(chirp_reli_job_commit(hostport, cids, STOPTIME));
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	for (i = 0; i < J->u.array.length; i++) {
 		json_value *id = J->u.array.values[i];
 		assert(jistype(id, json_integer));
@@ -984,13 +1134,13 @@ static int commit (confuga *C, confuga_sid_t sid, const char *hostport, const ch
 		sqlcatch(sqlite3_bind_int64(stmt, 1, id->u.integer));
 		sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
 	}
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
 	json_value_free(J);
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	return rc;
 }
 
@@ -1009,7 +1159,7 @@ static int transfer_commit (confuga *C)
 	sqlite3_stmt *stmt = NULL;
 	const char *current = SQL;
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
 		confuga_sid_t sid = sqlite3_column_int64(stmt, 0);
 		const char *hostport = (const char *)sqlite3_column_text(stmt, 1);
@@ -1019,12 +1169,12 @@ static int transfer_commit (confuga *C)
 		C->operations++;
 	}
 	sqlcatchcode(rc, SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	return rc;
 }
 
@@ -1042,7 +1192,7 @@ static int lookuptjid (confuga *C, confuga_sid_t sid, chirp_jobid_t cid, chirp_j
 	sqlite3_stmt *stmt = NULL;
 	const char *current = SQL;
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_int64(stmt, 1, cid));
 	sqlcatch(sqlite3_bind_int64(stmt, 2, sid));
 	rc = sqlite3_step(stmt);
@@ -1054,12 +1204,12 @@ static int lookuptjid (confuga *C, confuga_sid_t sid, chirp_jobid_t cid, chirp_j
 	} else {
 		sqlcatch(rc);
 	}
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	sqlend(db);
 	return rc;
 }
@@ -1104,11 +1254,11 @@ static int waitall (confuga *C, confuga_sid_t fsid, const char *fhostport)
 		goto out;
 	}
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	for (i = 0; i < J->u.array.length; i++) {
 		json_value *job = J->u.array.values[i];
 		assert(jistype(job, json_object));
@@ -1147,17 +1297,17 @@ static int waitall (confuga *C, confuga_sid_t fsid, const char *fhostport)
 			debug(D_DEBUG, "transfer job %" PRICHIRP_JOBID_T " job not set to WAITED!", id);
 		}
 	}
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
 	json_value_free(J);
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	sqlend(db);
 	return rc;
 }
@@ -1178,19 +1328,19 @@ static int transfer_wait (confuga *C)
 	sqlite3_stmt *stmt = NULL;
 	const char *current = SQL;
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
 		confuga_sid_t fsid = sqlite3_column_int64(stmt, 0);
 		const char *fhostport = (const char *)sqlite3_column_text(stmt, 1);
 		waitall(C, fsid, fhostport);
 	}
 	sqlcatchcode(rc, SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	return rc;
 }
 
@@ -1219,7 +1369,7 @@ static int reap (confuga *C, confuga_sid_t sid, const char *hostport, const char
 
 	CATCHUNIX(chirp_reli_job_reap(hostport, cids, STOPTIME));
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	for (i = 0; i < J->u.array.length; i++) {
 		json_value *id = J->u.array.values[i];
 		assert(jistype(id, json_integer));
@@ -1227,13 +1377,13 @@ static int reap (confuga *C, confuga_sid_t sid, const char *hostport, const char
 		sqlcatch(sqlite3_bind_int64(stmt, 1, id->u.integer));
 		sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
 	}
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
 	json_value_free(J);
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	return rc;
 }
 
@@ -1252,7 +1402,7 @@ static int transfer_reap (confuga *C)
 	sqlite3_stmt *stmt = NULL;
 	const char *current = SQL;
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
 		confuga_sid_t sid = sqlite3_column_int64(stmt, 0);
 		const char *hostport = (const char *)sqlite3_column_text(stmt, 1);
@@ -1262,27 +1412,33 @@ static int transfer_reap (confuga *C)
 		C->operations++;
 	}
 	sqlcatchcode(rc, SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	return rc;
 }
 
-static int complete (confuga *C, chirp_jobid_t id, const char *hostport, const char *open, const char *file)
+static int complete (confuga *C, chirp_jobid_t id, const char *hostport, const char *open, const char *file, int striped)
 {
 	static const char SQL[] =
+		/* Other stripes of this transfer still outstanding (or failed). */
+		"SELECT COUNT(*)"
+		"	FROM Confuga.TransferJob AS Stripe"
+		"	WHERE Stripe.id != ?1 AND Stripe.state != 'COMPLETED' AND EXISTS ("
+		"		SELECT 1 FROM Confuga.TransferJob WHERE id = ?1 AND tsid = Stripe.tsid AND open = Stripe.open"
+		"	);"
 		"BEGIN TRANSACTION;"
 		"INSERT OR IGNORE INTO Confuga.Replica (fid, sid)"
 		"	SELECT TransferJob.fid, TransferJob.tsid"
 		"	FROM Confuga.TransferJob"
-		"	WHERE TransferJob.id = ?;"
+		"	WHERE TransferJob.id = ? AND ?;"
 		"UPDATE Confuga.TransferJob"
 		"	SET"
 		"		state = 'COMPLETED',"
-		"		progress = (SELECT size FROM Confuga.File WHERE File.id = TransferJob.id),"
+		"		progress = COALESCE(stripe_length, (SELECT size FROM Confuga.File WHERE File.id = TransferJob.fid)),"
 		"		time_complete = strftime('%s', 'now')"
 		"	WHERE id = ?;"
 		"END TRANSACTION;";
@@ -1291,40 +1447,57 @@ static int complete (confuga *C, chirp_jobid_t id, const char *hostport, const c
 	sqlite3 *db = C->db;
 	sqlite3_stmt *stmt = NULL;
 	const char *current = SQL;
+	int last = 1;
 
 	debug(D_DEBUG, "transfer job %" PRICHIRP_JOBID_T ": completing", id);
 
-	rc = chirp_reli_rename(hostport, open, file, STOPTIME);
-	if (rc == -1 && errno == ENOENT) {
-		/* previous rename succeeded? but we were not able to update the SQL db... */
-		if (chirp_reli_access(hostport, file, R_OK, STOPTIME) == -1)
-			CATCH(ENOENT); /* rename errno */
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
+	if (striped) {
+		sqlcatch(sqlite3_bind_int64(stmt, 1, id));
+		sqlcatchcode(sqlite3_step(stmt), SQLITE_ROW);
+		last = sqlite3_column_int64(stmt, 0) == 0;
+	}
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
+
+	if (last) {
+		/* the last stripe in moves the file into place */
+		if (striped)
+			CATCHUNIXIGNORE(chirp_reli_chmod(hostport, open, S_IRUSR, STOPTIME), ENOENT);
+		rc = chirp_reli_rename(hostport, open, file, STOPTIME);
+		if (rc == -1 && errno == ENOENT) {
+			/* previous rename succeeded? but we were not able to update the SQL db... */
+			if (chirp_reli_access(hostport, file, R_OK, STOPTIME) == -1)
+				CATCH(ENOENT); /* rename errno */
+		} else {
+			CATCHUNIX(rc);
+		}
 	} else {
-		CATCHUNIX(rc);
+		debug(D_DEBUG, "transfer job %" PRICHIRP_JOBID_T ": waiting for other stripes", id);
 	}
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_int64(stmt, 1, id));
+	sqlcatch(sqlite3_bind_int(stmt, 2, last));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatch(sqlite3_bind_int64(stmt, 1, id));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	sqlend(db);
 	return rc;
 }
@@ -1335,7 +1508,16 @@ static int transfer_complete (confuga *C)
 		"UPDATE Confuga.TransferJob"
 		"	SET state = 'ERRORED'"
 		"	WHERE state = 'REAPED' AND NOT (status = 'FINISHED' AND exit_status = 'EXITED' AND exit_code = 0);"
-		"SELECT TransferJob.id, StorageNode.hostport, TransferJob.open, PRINTF('%s/file/%s', StorageNode.root, UPPER(HEX(TransferJob.fid)))"
+		/* Do not start the remaining stripes of a transfer which can no longer complete. */
+		"UPDATE Confuga.TransferJob"
+		"	SET"
+		"		error = 'another stripe failed',"
+		"		state = 'ERRORED',"
+		"		time_error = strftime('%s', 'now')"
+		"	WHERE state = 'NEW' AND stripe_length IS NOT NULL AND EXISTS ("
+		"		SELECT 1 FROM Confuga.TransferJob AS Stripe WHERE Stripe.tsid = TransferJob.tsid AND Stripe.open = TransferJob.open AND Stripe.state = 'ERRORED'"
+		"	);"
+		"SELECT TransferJob.id, StorageNode.hostport, TransferJob.open, PRINTF('%s/file/%s', StorageNode.root, UPPER(HEX(TransferJob.fid))), TransferJob.stripe_length IS NOT NULL"
 		"	FROM Confuga.TransferJob JOIN Confuga.StorageNode ON TransferJob.tsid = StorageNode.id"
 		"	WHERE TransferJob.state = 'REAPED'"
 		"	ORDER BY RANDOM()" /* to ensure no starvation, complete may result in a ROLLBACK that aborts this SELECT */
@@ -1346,26 +1528,88 @@ static int transfer_complete (confuga *C)
 	sqlite3_stmt *stmt = NULL;
 	const char *current = SQL;
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
+	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
+
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
 		chirp_jobid_t id = sqlite3_column_int64(stmt, 0);
 		const char *hostport = (const char *)sqlite3_column_text(stmt, 1);
 		const char *open = (const char *)sqlite3_column_text(stmt, 2);
 		const char *file = (const char *)sqlite3_column_text(stmt, 3);
-		CATCHJOB(complete(C, id, hostport, open, file));
+		int striped = sqlite3_column_int(stmt, 4);
+		CATCHJOB(complete(C, id, hostport, open, file, striped));
+		C->operations++;
+	}
+	sqlcatchcode(rc, SQLITE_DONE);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
+
+	rc = 0;
+	goto out;
+out:
+	chirp_sqlite3_finalize(stmt);
+	return rc;
+}
+
+/* Remove the open file of a striped transfer in which a stripe failed, once
+ * none of its stripes are still running (an earlier unlink would be undone by
+ * a stripe still writing to it). Clearing open marks the file as gone.
+ */
+static int transfer_abandon (confuga *C)
+{
+	static const char SQL[] =
+		"SELECT TransferJob.tsid, StorageNode.hostport, TransferJob.open"
+		"	FROM Confuga.TransferJob JOIN Confuga.StorageNode ON TransferJob.tsid = StorageNode.id"
+		"	WHERE TransferJob.state = 'ERRORED' AND TransferJob.stripe_length IS NOT NULL AND TransferJob.open IS NOT NULL AND NOT EXISTS ("
+		"		SELECT 1"
+		"			FROM Confuga.TransferJob AS Stripe JOIN Confuga.TransferJobState ON Stripe.state = TransferJobState.state"
+		"			WHERE Stripe.tsid = TransferJob.tsid AND Stripe.open = TransferJob.open AND TransferJobState.active"
+		"	)"
+		"	ORDER BY RANDOM()" /* to ensure no starvation when a node is unreachable */
+		"	LIMIT 1;"
+		"UPDATE Confuga.TransferJob"
+		"	SET open = NULL"
+		"	WHERE tsid = ? AND open = ?;";
+
+	int rc;
+	sqlite3 *db = C->db;
+	sqlite3_stmt *stmt = NULL;
+	sqlite3_stmt *select = NULL;
+	sqlite3_stmt *update = NULL;
+	const char *current = SQL;
+
+	sqlcatch(chirp_sqlite3_prepare(db, current, &select, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &update, &current));
+	while ((rc = sqlite3_step(select)) == SQLITE_ROW) {
+		sqlite3_int64 tsid = sqlite3_column_int64(select, 0);
+		char hostport[256+8];
+		char open[CONFUGA_PATH_MAX];
+		string_nformat(hostport, sizeof(hostport), "%s", (const char *)sqlite3_column_text(select, 1));
+		string_nformat(open, sizeof(open), "%s", (const char *)sqlite3_column_text(select, 2));
+		sqlcatch(sqlite3_reset(select));
+
+		debug(D_DEBUG, "removing partial file %s:%s of failed striped transfer", hostport, open);
+		CATCHUNIXIGNORE(chirp_reli_unlink(hostport, open, STOPTIME), ENOENT);
+
+		sqlcatch(sqlite3_bind_int64(update, 1, tsid));
+		sqlcatch(sqlite3_bind_text(update, 2, open, -1, SQLITE_STATIC));
+		sqlcatchcode(sqlite3_step(update), SQLITE_DONE);
+		sqlcatch(sqlite3_reset(update));
 		C->operations++;
 	}
 	sqlcatchcode(rc, SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(select);
+	chirp_sqlite3_finalize(update);
 	return rc;
 }
 
@@ -1395,20 +1639,20 @@ static int transfer_stats (confuga *C)
 
 	buffer_putliteral(B, "TJ: ");
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
 		const char *state = (const char *)sqlite3_column_text(stmt, 0);
 		buffer_putfstring(B, "%s; ", state);
 	}
 	sqlcatchcode(rc, SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	debug(D_DEBUG, "%s", buffer_tostring(B));
 
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	buffer_free(B);
 	return rc;
 }
@@ -1417,8 +1661,9 @@ static int progress (confuga *C, chirp_jobid_t id, const char *thostport, const
 {
 	static const char SQL[] =
 		"UPDATE Confuga.TransferJob"
-		"   SET progress = ?"
-		"   WHERE id = ?"
+			/* a stripe has written at most its own range of the open file */
+		"   SET progress = MAX(0, MIN(?1-COALESCE(stripe_offset, 0), COALESCE(stripe_length, ?1)))"
+		"   WHERE id = ?2"
 		";"
 		;
 
@@ -1429,7 +1674,7 @@ static int progress (confuga *C, chirp_jobid_t id, const char *thostport, const
 	struct chirp_stat info;
 
 	debug(D_DEBUG, "transfer job %" PRICHIRP_JOBID_T ": checking progress...", id);
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	CATCHUNIXIGNORE(chirp_reli_stat(thostport, topen, &info, time(NULL)+2), ENOENT);
 	if (rc == 0) {
 		debug(D_DEBUG, "... is %" PRICONFUGA_OFF_T, (confuga_off_t)info.cst_size);
@@ -1439,12 +1684,12 @@ static int progress (confuga *C, chirp_jobid_t id, const char *thostport, const
 	} else if (rc == -1 && errno == ENOENT) {
 		debug(D_DEBUG, "... not created yet");
 	}
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	return rc;
 }
 
@@ -1465,7 +1710,7 @@ static int transfer_progress (confuga *C)
 	sqlite3_stmt *stmt = NULL;
 	const char *current = SQL;
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
 		chirp_jobid_t id = sqlite3_column_int64(stmt, 0);
 		const char *thostport = (const char *)sqlite3_column_text(stmt, 1);
@@ -1473,12 +1718,12 @@ static int transfer_progress (confuga *C)
 		CATCHJOB(progress(C, id, thostport, topen));
 	}
 	sqlcatchcode(rc, SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(stmt);
 	return rc;
 }
 
@@ -1512,16 +1757,16 @@ static int unlinkthedead (confuga *C)
 	sqlite3_stmt *delete = NULL;
 	const char *current = SQL;
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &select, &current));
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &delete, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &select, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &delete, &current));
 
 	while ((rc = sqlite3_step(select)) == SQLITE_ROW) {
 		confuga_fid_t fid;
@@ -1544,19 +1789,19 @@ static int unlinkthedead (confuga *C)
 		sqlcatch(sqlite3_reset(delete));
 	}
 	sqlcatchcode(rc, SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(select); select = NULL);
-	sqlcatch(sqlite3_finalize(delete); delete = NULL);
+	sqlcatch(chirp_sqlite3_finalize(select); select = NULL);
+	sqlcatch(chirp_sqlite3_finalize(delete); delete = NULL);
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(chirp_sqlite3_prepare(db, current, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	sqlcatch(chirp_sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
-	sqlite3_finalize(select);
-	sqlite3_finalize(delete);
+	chirp_sqlite3_finalize(stmt);
+	chirp_sqlite3_finalize(select);
+	chirp_sqlite3_finalize(delete);
 	sqlend(db);
 	return rc;
 }
@@ -1573,6 +1818,7 @@ CONFUGA_IAPI int confugaR_manager (confuga *C)
 	transfer_wait(C);
 	transfer_reap(C);
 	transfer_complete(C);
+	transfer_abandon(C);
 	transfer_progress(C);
 
 	unlinkthedead(C);
@@ -41,13 +41,45 @@ run()
 	dd if=/dev/zero bs=4k count=1 | chirp "$hostport1" put /dev/stdin /data/mydata/foo1 || return 1
 	dd if=/dev/zero bs=4k count=1 | chirp "$hostport1" put /dev/stdin /data/mydata/foo2 && return 1
 
+	# removing an allocation gives its space back, and its slot
+	chirp "$hostport1" rm /data/mydata || return 1
+	dd if=/dev/zero bs=64k count=1 | chirp "$hostport1" put /dev/stdin /data/foo || return 1
+	chirp "$hostport1" rm /data/foo
+	i=0
+	while [ $i -lt 1100 ]; do
+		echo "mkalloc /data/a$i 4096"
+		echo "rmdir /data/a$i"
+		i=$((i+1))
+	done | chirp "$hostport1" > chirp.alloc.out 2>&1
+	grep -q "couldn't" chirp.alloc.out && return 1
+	chirp "$hostport1" ls /data | grep -q '^a' && return 1
+
+	# a renamed allocation keeps its usage and its quota
+	chirp "$hostport1" mkalloc /data/r 8192 || return 1
+	dd if=/dev/zero bs=4k count=1 | chirp "$hostport1" put /dev/stdin /data/r/foo || return 1
+	chirp "$hostport1" mv /data/r /data/s || return 1
+	chirp "$hostport1" lsalloc /data/s | grep -q '^4.0 KB INUSE' || return 1
+	dd if=/dev/zero bs=8k count=1 | chirp "$hostport1" put /dev/stdin /data/s/bar && return 1
+	dd if=/dev/zero bs=4k count=1 | chirp "$hostport1" put /dev/stdin /data/s/bar || return 1
+
+	# a server starts on a tree with more allocations than the table first holds
+	i=0
+	while [ $i -lt 1100 ]; do
+		echo "mkalloc /data/b$i 1"
+		i=$((i+1))
+	done | chirp "$hostport1" > chirp.alloc.out 2>&1
+	grep -q "couldn't" chirp.alloc.out && return 1
+	chirp_start "$(ls -d ./chirp.root.*)" --root-quota=65536 || return 1
+	chirp "$hostport" lsalloc /data/b1099 | grep -q '^/data/b1099' || return 1
+	dd if=/dev/zero bs=1 count=1 | chirp "$hostport" put /dev/stdin /data/b1099/foo && return 1
+
 	return 0
 }
 
 clean()
 {
 	chirp_clean
-	rm -f "$c1"
+	rm -f "$c1" chirp.alloc.out
 	return 0
 }
 
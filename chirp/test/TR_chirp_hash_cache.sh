@@ -0,0 +1,68 @@
+#!/bin/sh
+
+set -ex
+
+. ../../dttools/test/test_runner_common.sh
+. ./chirp-common.sh
+
+c="./hostport.$PPID"
+data="./hash_cache.data.$PPID"
+
+prepare()
+{
+	chirp_start local
+	echo "$hostport" > "$c"
+	return 0
+}
+
+# The digest of a file as computed by the server, in the form of md5sum.
+remote_md5()
+{
+	chirp "$1" md5 "$2" | awk '{print tolower($1)}'
+}
+
+local_md5()
+{
+	md5sum "$1" | awk '{print $1}'
+}
+
+run()
+{
+	if ! [ -s "$c" ]; then
+		return 0
+	fi
+	hostport=$(cat "$c")
+
+	dd if=/dev/urandom of="$data" bs=64k count=4
+	chirp "$hostport" put "$data" /foo || return 1
+
+	# Digests of recently modified files are not remembered.
+	sleep 3
+
+	expected=$(local_md5 "$data")
+	[ "$(remote_md5 "$hostport" /foo)" = "$expected" ] || return 1
+	[ "$(remote_md5 "$hostport" /foo)" = "$expected" ] || return 1
+	grep -q "hash cache hit: md5 \`/foo'" ./chirp.debug.* || return 1
+
+	# A file rewritten with the same size must not get the old digest.
+	dd if=/dev/urandom of="$data" bs=64k count=4
+	chirp "$hostport" put "$data" /foo || return 1
+	sleep 3
+
+	expected=$(local_md5 "$data")
+	[ "$(remote_md5 "$hostport" /foo)" = "$expected" ] || return 1
+	[ "$(remote_md5 "$hostport" /foo)" = "$expected" ] || return 1
+
+	return 0
+}
+
+clean()
+{
+	chirp_clean
+	rm -f "$c" "$data"
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
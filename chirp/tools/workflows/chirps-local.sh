@@ -0,0 +1,28 @@
+#!/bin/bash
+
+# Run the storage nodes as local Chirp servers, for benchmarking on a single machine.
+
+N="${N:-8}"
+CCTOOLS_INSTALL="${CCTOOLS_INSTALL:-${HOME}/cctools-install/bin}"
+USERNAME="${USERNAME:-$(whoami)}"
+LOCAL_ROOT="${LOCAL_ROOT:-${TMPDIR:-/tmp}/${USERNAME}-confuga-sn}"
+CONFUGA_ROOT="/.confuga/"
+
+CHIRP="${CHIRP:-${CCTOOLS_INSTALL}/chirp}"
+CHIRP_SERVER="${CHIRP_SERVER:-${CCTOOLS_INSTALL}/chirp_server}"
+
+CONFUGA_NODE_LIST=""
+CONFUGA_NODE_NUKE=""
+for ((i = 0; i < N; i++)); do
+	sn="$(printf '%s/sn.%.2d' "$LOCAL_ROOT" "$i")"
+	rm -rf "$sn"
+	mkdir -p "$sn"
+	"$CHIRP_SERVER" --parent-death --background --auth=unix --auth=ticket --challenge-dir="$sn" --interface=127.0.0.1 --transient="$sn"/chirp.transient --root="$sn"/chirp.root --port=0 --port-file="$sn"/chirp.port --pid-file="$sn"/chirp.pid --catalog-update=10s --debug=all --debug-file="$sn"/chirp.debug --debug-rotate-max=0 --jobs --job-concurrency=2 --idle-clients=30m
+	while ! [ -s "$sn"/chirp.port ]; do sleep 1; done
+	hostport="localhost:$(cat "$sn"/chirp.port)"
+	CONFUGA_NODE_LIST="${CONFUGA_NODE_LIST},chirp://${hostport}${CONFUGA_ROOT}"
+	CONFUGA_NODE_NUKE="${CONFUGA_NODE_NUKE} ${CHIRP} --auth=unix ${hostport} rm ${CONFUGA_ROOT};"
+done
+export CONFUGA_NODE_LIST
+
+# vim: set noexpandtab tabstop=4:
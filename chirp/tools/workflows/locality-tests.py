@@ -0,0 +1,35 @@
+import binascii
+import os
+
+from weaver.stack import WeaverNests
+from weaver.util import Stash
+
+# A few large datasets shared by groups of tasks: a good scheduler runs each
+# group where its dataset already lives instead of replicating it again.
+DATASETS = 4
+TASKS_PER_DATASET = 8
+
+def dfs():
+    return 1*2**30
+def ufs():
+    return 1*2**20
+
+consumer = ShellFunction('''
+    /bin/cat "$@" > /dev/null
+    sleep 10
+''', cmd_format = "{EXE} {ARG}")
+producer = ShellFunction('openssl enc -aes-256-ctr -nosalt -pass pass:"$1" < /dev/zero 2> /dev/null | head -c "$2"')
+
+def makerandom(name, size):
+    producer(arguments = [binascii.hexlify(os.urandom(64)), size], outputs = [name])
+    return name
+
+for dataset in range(DATASETS):
+    ddir = os.path.join(CurrentNest().work_dir, 'dataset.%08d' % dataset)
+    os.mkdir(ddir)
+    data = makerandom(os.path.join(ddir, 'data'), dfs())
+    for task in range(TASKS_PER_DATASET):
+        inputs = [data, makerandom(os.path.join(ddir, 'unique.%08d' % task), ufs())]
+        consumer(arguments = inputs, inputs = inputs)
+
+# vim: set sts=4 sw=4 ts=8 expandtab ft=python:
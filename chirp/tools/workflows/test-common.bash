@@ -50,6 +50,6 @@ function testrun {
 	sleep 10
 }
 
-. "$(dirname "$0")/chirps-ssh.sh"
+. "$(dirname "$0")/${CHIRPS:-chirps-ssh.sh}"
 
 # vim: set noexpandtab tabstop=4:
@@ -32,6 +32,10 @@ See the file COPYING for details.
 #include "copy_stream.h"
 #include "zlib.h"
 #include "b64.h"
+#include "buffer.h"
+#include "hash_table.h"
+#include "hash_cache.h"
+#include "address.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -41,28 +45,56 @@ See the file COPYING for details.
 #include <unistd.h>
 #include <time.h>
 #include <sys/wait.h>
-#include <sys/select.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
 
 #ifndef LINE_MAX
 #define LINE_MAX 1024
 #endif
 
-#define MAX_TABLE_SIZE 10000
-
 /* Timeout in communicating with the querying client */
 #define HANDLE_QUERY_TIMEOUT 15
 
-/* Very short timeout to deal with TCP update, which blocks the server. */
+/* Very short timeout to deal with TCP update. */
 #define HANDLE_TCP_UPDATE_TIMEOUT 5
 
 /* Maximum size of a JX record arriving via TCP is 1MB. */
 #define TCP_PAYLOAD_MAX 1024*1024
 
+/* Maximum size of the request line and headers of a query. */
+#define QUERY_HEADER_MAX 65536
+
+/* Maximum number of connections handled at once. */
+#define MAX_CLIENTS 1000
+
+/* Maximum total size of the pages cached with one snapshot. */
+#define PAGE_CACHE_MAX (64*1024*1024)
+
+/* Pages smaller than this are not worth compressing. */
+#define PAGE_COMPRESS_MIN 1024
+
+/* Size of the buffer holding UDP updates not yet received. */
+#define UDP_RECV_BUFFER_SIZE (16*1024*1024)
+
+/* Batches of UDP updates handled before attending to other clients. */
+#define UDP_BATCHES_MAX 16
+
+/* Batches smaller than this are decoded by the main thread alone. */
+#define DECODE_BATCH_MIN 8
+
+/* Limit on the number of decode threads chosen automatically. */
+#define DECODE_THREADS_DEFAULT_MAX 4
+
 /* The table of record, hashed on address:port */
 static struct deltadb *table = 0;
 
-/* An array of jxs used to sort for display */
-static struct jx *array[MAX_TABLE_SIZE];
+/* True if the table has changed since the current snapshot was taken. */
+static int table_changed = 1;
+
+/* The minimum time between snapshots of the table. */
+static int snapshot_interval = 1;
 
 /* The time for which updated data lives before automatic deletion */
 static int lifetime = 1800;
@@ -91,7 +123,7 @@ static char owner[USERNAME_MAX];
 /* Time when the process was started. */
 static time_t starttime;
 
-/* If true, for for every query */
+/* If true, fork for every history query */
 static int fork_mode = 1;
 
 /* The maximum number of simultaneous children that can be running. */
@@ -100,6 +132,9 @@ static int child_procs_max = 50;
 /* Number of query processses currently running. */
 static int child_procs_count = 0;
 
+/* Number of threads decoding updates besides the main thread, or -1 for one per additional core. */
+static int decode_threads = -1;
+
 /* Maximum time to allow a child process to run. */
 static int child_procs_timeout = 60;
 
@@ -124,6 +159,80 @@ static char data[1024*1024];
 struct datagram *update_dgram = 0;
 struct link *update_port = 0;
 
+/*
+A page is the body of a response to a query.  The pages rendered from a
+snapshot are kept with it until it is replaced, so that the many clients
+asking the same question, such as factories polling for their managers,
+share one answer instead of each walking and printing the whole table.
+*/
+
+struct catalog_page {
+	int refcount;
+	int code;
+	const char *message;
+	const char *content_type;
+	char *data;
+	size_t length;
+	char etag[64];
+	char compressed_etag[64];
+	int compress_tried;
+	char *compressed;
+	size_t compressed_length;
+};
+
+/*
+A snapshot is a copy of the table, sorted by name, from which queries
+are answered.  It is never changed, but replaced by a new one when the
+table has changed and snapshot_interval has passed.
+*/
+
+struct catalog_snapshot {
+	unsigned serial;
+	time_t time;
+	int count;
+	struct jx **records;
+	struct hash_table *keys;
+	struct hash_table *pages;
+	size_t pages_size;
+};
+
+static struct catalog_snapshot *snapshot = 0;
+static unsigned snapshot_serial = 0;
+
+/*
+A client is a TCP connection carrying a query or an update.
+The main loop reads and writes each one only as far as it can
+without blocking, so that no client can hold up the others.
+*/
+
+typedef enum {
+	CLIENT_QUERY,
+	CLIENT_UPDATE
+} client_type_t;
+
+typedef enum {
+	CLIENT_READING,
+	CLIENT_WRITING,
+	CLIENT_DONE
+} client_state_t;
+
+struct catalog_client {
+	struct link *link;
+	client_type_t type;
+	client_state_t state;
+	char addr[LINK_ADDRESS_MAX];
+	int port;
+	time_t stoptime;
+	buffer_t input;
+	buffer_t header;
+	struct catalog_page *page;
+	int compressed;
+	size_t sent;
+};
+
+static struct catalog_client *clients[MAX_CLIENTS];
+static int client_count = 0;
+
 void shutdown_clean(int sig)
 {
 	exit(0);
@@ -186,6 +295,7 @@ static void remove_expired_records()
 		if( (current-lastheardfrom) > this_lifetime ) {
 				j = deltadb_remove(table,key);
 			if(j) jx_delete(j);
+			table_changed = 1;
 		}
 	}
 
@@ -236,50 +346,134 @@ static void make_hash_key(struct jx *j, char *key)
 			uuid ? uuid : "");
 }
 
-static void handle_update( const char *addr, int port, const char *raw_data, int raw_data_length, const char *protocol )
+/*
+Decoding an update (decompressing and parsing it) and resolving the name
+of its sender are most of the cost of handling it, and depend only on the
+message itself, so they may be done by the decode threads.  The rest,
+which changes the table, is always done by the main thread.  Nothing here may call debug(), which is not safe to
+use from several threads; failures are reported by the caller instead.
+*/
+
+typedef enum {
+	UPDATE_OK,
+	UPDATE_BAD_COMPRESSION,
+	UPDATE_BAD_JSON,
+	UPDATE_NOT_CONSTANT,
+	UPDATE_BAD_NVPAIR,
+} update_status_t;
+
+static update_status_t decode_update( const char *raw_data, int raw_data_length, char *buffer, unsigned long buffer_size, struct jx **jout )
 {
-	char key[LINE_MAX];
 	unsigned long data_length;
 	struct jx *j;
 
-		// If the packet starts with Control-Z (0x1A), it is compressed,
-		// so uncompress it to data[].  Otherwise just copy to data[];.
+	// If the packet starts with Control-Z (0x1A), it is compressed,
+	// so uncompress it to buffer[].  Otherwise just copy to buffer[];.
 
-		if(raw_data[0]==0x1A) {
-			data_length = sizeof(data);
-			int success = uncompress((Bytef*)data,&data_length,(const Bytef*)&raw_data[1],raw_data_length-1);
-			if(success!=Z_OK) {
-				debug(D_DEBUG,"warning: %s:%d sent invalid compressed data (ignoring it)\n",addr,port);
-				return;
-			}
-		} else {
-			memcpy(data,raw_data,raw_data_length);
-			data_length = raw_data_length;
+	if(raw_data[0]==0x1A) {
+		data_length = buffer_size-1;
+		int success = uncompress((Bytef*)buffer,&data_length,(const Bytef*)&raw_data[1],raw_data_length-1);
+		if(success!=Z_OK) return UPDATE_BAD_COMPRESSION;
+	} else {
+		memcpy(buffer,raw_data,raw_data_length);
+		data_length = raw_data_length;
+	}
+
+	// Make sure the string data is null terminated.
+	buffer[data_length] = 0;
+
+	// Once uncompressed, if it starts with a bracket,
+	// then it is JX/JSON, otherwise it is the legacy nvpair format.
+
+	if(buffer[0]=='{') {
+		struct jx_parser *p = jx_parser_create(0);
+		jx_parser_read_string(p, buffer);
+		j = jx_parse(p);
+		int errors = jx_parser_errors(p);
+		jx_parser_delete(p);
+		if(errors || !j) {
+			jx_delete(j);
+			return UPDATE_BAD_JSON;
+		}
+		if(!jx_is_constant(j)) {
+			jx_delete(j);
+			return UPDATE_NOT_CONSTANT;
 		}
+	} else {
+		struct nvpair *nv = nvpair_create();
+		if(!nv) return UPDATE_BAD_NVPAIR;
+		nvpair_parse(nv, buffer);
+		j = nvpair_to_jx(nv);
+		nvpair_delete(nv);
+	}
+
+	*jout = j;
+	return UPDATE_OK;
+}
+
+/*
+Names are cached like domain_name_cache does, but the cache is shared by
+the decode threads, so it is locked while looking in it, and not while
+waiting on the name server.  getnameinfo is called directly, because
+domain_name_lookup_reverse calls debug().
+*/
+
+#define NAME_CACHE_LIFETIME 300
+
+static pthread_mutex_t name_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct hash_cache *name_cache = 0;
+
+static int lookup_name( const char *addr, char *name )
+{
+	struct sockaddr_storage saddr;
+	SOCKLEN_T saddr_length;
+	char *found, *copy;
+
+	pthread_mutex_lock(&name_cache_mutex);
+	if(!name_cache) name_cache = hash_cache_create(127, hash_string, free);
+	found = name_cache ? hash_cache_lookup(name_cache, addr) : 0;
+	if(found) strcpy(name, found);
+	pthread_mutex_unlock(&name_cache_mutex);
+
+	if(found)
+		return 1;
+
+	if(!address_to_sockaddr(addr, 0, &saddr, &saddr_length))
+		return 0;
+	if(getnameinfo((struct sockaddr *) &saddr, saddr_length, name, DOMAIN_NAME_MAX, 0, 0, 0) != 0)
+		return 0;
+
+	copy = strdup(name);
+	if(copy) {
+		pthread_mutex_lock(&name_cache_mutex);
+		if(name_cache) hash_cache_insert(name_cache, addr, copy, NAME_CACHE_LIFETIME);
+		else free(copy);
+		pthread_mutex_unlock(&name_cache_mutex);
+	}
+
+	return 1;
+}
 
-		// Make sure the string data is null terminated.
-		data[data_length] = 0;
+/* name is the name that addr resolves to, or null if it does not. */
 
-		// Once uncompressed, if it starts with a bracket,
-		// then it is JX/JSON, otherwise it is the legacy nvpair format.
+static void apply_update( const char *addr, int port, const char *name, const char *raw_data, update_status_t status, struct jx *j, const char *protocol )
+{
+	char key[LINE_MAX];
 
-		if(data[0]=='{') {
-			j = jx_parse_string(data);
-			if(!j) {
-				debug(D_DEBUG,"warning: %s:%d sent invalid JSON data (ignoring it)\n%s\n",addr,port,data);
+		switch(status) {
+			case UPDATE_OK:
+				break;
+			case UPDATE_BAD_COMPRESSION:
+				debug(D_DEBUG,"warning: %s:%d sent invalid compressed data (ignoring it)\n",addr,port);
 				return;
-			}
-			if(!jx_is_constant(j)) {
-				debug(D_DEBUG,"warning: %s:%d sent non-constant JX data (ignoring it)\n%s\n",addr,port,data);
-				jx_delete(j);
+			case UPDATE_BAD_JSON:
+				debug(D_DEBUG,"warning: %s:%d sent invalid JSON data (ignoring it)\n%s\n",addr,port,raw_data[0]==0x1A ? "" : raw_data);
+				return;
+			case UPDATE_NOT_CONSTANT:
+				debug(D_DEBUG,"warning: %s:%d sent non-constant JX data (ignoring it)\n%s\n",addr,port,raw_data[0]==0x1A ? "" : raw_data);
+				return;
+			case UPDATE_BAD_NVPAIR:
 				return;
-			}
-		} else {
-			struct nvpair *nv = nvpair_create();
-			if(!nv) return;
-			nvpair_parse(nv, data);
-			j = nvpair_to_jx(nv);
-			nvpair_delete(nv);
 		}
 
 		jx_insert_string(j, "address", addr);
@@ -299,8 +493,7 @@ static void handle_update( const char *addr, int port, const char *raw_data, int
 
 		/* Do not believe the server's reported name, just resolve it backwards. */
 
-		char name[DOMAIN_NAME_MAX];
-		if(domain_name_cache_lookup_reverse(addr, name)) {
+		if(name) {
 			/*
 			Special case: Prior bug resulted in multiple name
 			entries in logged data.  When removing the name property,
@@ -335,58 +528,167 @@ static void handle_update( const char *addr, int port, const char *raw_data, int
 		}
 
 		deltadb_insert(table, key, j);
+		table_changed = 1;
 
 		debug(D_DEBUG, "received %s update from %s",protocol,key);
 }
 
+static void handle_update( const char *addr, int port, const char *raw_data, int raw_data_length, const char *protocol )
+{
+	struct jx *j = 0;
+	char name[DOMAIN_NAME_MAX];
+	update_status_t status = decode_update(raw_data, raw_data_length, data, sizeof(data), &j);
+	int named = status==UPDATE_OK && lookup_name(addr, name);
+	apply_update(addr, port, named ? name : 0, raw_data, status, j, protocol);
+}
+
 /*
 Where possible, we prefer to accept short updates via UDP,
 because these can be accepted quickly in a non-blocking manner.
+A busy catalog receives many at once, so they are received in
+batches, decoded by all of the decode threads, and then applied
+to the table in the order they arrived.
 */
 
-static void handle_udp_updates(struct datagram *update_port)
+struct catalog_update {
+	struct datagram_message *msg;
+	update_status_t status;
+	struct jx *j;
+	char name[DOMAIN_NAME_MAX];
+	int named;
+};
+
+static char udp_buffers[DATAGRAM_BATCH_MAX][DATAGRAM_PAYLOAD_MAX+1];
+static struct datagram_message udp_messages[DATAGRAM_BATCH_MAX];
+static struct catalog_update udp_updates[DATAGRAM_BATCH_MAX];
+
+/*
+The decode threads take updates from the current batch one at a time,
+and the main thread takes its share as well, so a batch is done as soon
+as its slowest update is.
+*/
+
+static struct {
+	pthread_mutex_t mutex;
+	pthread_cond_t ready;
+	pthread_cond_t done;
+	struct catalog_update *updates;
+	int count;
+	int next;
+	int pending;
+} decode_batch = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0, 0, 0 };
+
+static void decode_one( struct catalog_update *u, char *buffer, unsigned long buffer_size )
 {
-	char data[DATAGRAM_PAYLOAD_MAX];
-	char addr[DATAGRAM_ADDRESS_MAX];
-	int port;
+	u->msg->data[u->msg->length] = 0;
+	u->j = 0;
+	u->status = decode_update(u->msg->data, u->msg->length, buffer, buffer_size, &u->j);
+	u->named = u->status==UPDATE_OK && lookup_name(u->msg->addr, u->name);
+}
 
-	while(1) {
-		int result = datagram_recv(update_port, data, DATAGRAM_PAYLOAD_MAX, addr, &port, 0);
-		if(result <= 0)
-			return;
+/* Decode updates from the current batch until none are left, with the mutex held. */
 
-		data[result] = 0;
-		handle_update(addr,port,data,result,"udp");
+static void decode_batch_work( char *buffer, unsigned long buffer_size )
+{
+	while(decode_batch.next < decode_batch.count) {
+		struct catalog_update *u = &decode_batch.updates[decode_batch.next++];
+		pthread_mutex_unlock(&decode_batch.mutex);
+		decode_one(u, buffer, buffer_size);
+		pthread_mutex_lock(&decode_batch.mutex);
+		if(--decode_batch.pending==0) pthread_cond_signal(&decode_batch.done);
 	}
 }
 
-/*
-Where necessary, we accept updates via TCP, but they cause
-the server to block, and so we impose a very short timeout on top.
-*/
+static void * decode_thread( void *arg )
+{
+	char *buffer = xxmalloc(sizeof(data));
+
+	pthread_mutex_lock(&decode_batch.mutex);
+	while(1) {
+		while(decode_batch.next >= decode_batch.count) {
+			pthread_cond_wait(&decode_batch.ready, &decode_batch.mutex);
+		}
+		decode_batch_work(buffer, sizeof(data));
+	}
 
-void handle_tcp_update( struct link *update_port )
+	return 0;
+}
+
+static void udp_pipeline_start()
 {
-	char data[TCP_PAYLOAD_MAX];
+	int i;
 
-	time_t stoptime = time(0) + HANDLE_TCP_UPDATE_TIMEOUT;
+	for(i=0;i<DATAGRAM_BATCH_MAX;i++) {
+		udp_messages[i].data = udp_buffers[i];
+		udp_messages[i].size = DATAGRAM_PAYLOAD_MAX;
+		udp_updates[i].msg = &udp_messages[i];
+	}
 
-	struct link *l = link_accept(update_port,stoptime);
-	if(!l) return;
+	if(decode_threads<0) {
+		long n = sysconf(_SC_NPROCESSORS_ONLN);
+		decode_threads = MIN(MAX(n-1,0),DECODE_THREADS_DEFAULT_MAX);
+	}
 
-	char addr[LINK_ADDRESS_MAX];
-	int port;
+	for(i=0;i<decode_threads;i++) {
+		pthread_t thread;
+		if(pthread_create(&thread, 0, decode_thread, 0)!=0) {
+			fatal("couldn't start decode thread: %s",strerror(errno));
+		}
+		pthread_detach(thread);
+	}
+
+	debug(D_DEBUG, "decoding updates with %d additional threads", decode_threads);
+}
 
-	link_address_remote(l,addr,&port);
+static void decode_updates( struct catalog_update *updates, int count )
+{
+	int i;
 
-	int length = link_read(l,data,sizeof(data)-1,stoptime);
+	/* Small batches are not worth waking the other threads. */
 
-	if(length>0) {
-		data[length] = 0;
-		handle_update(addr,port,data,length,"tcp");
+	if(decode_threads<1 || count<DECODE_BATCH_MIN) {
+		for(i=0;i<count;i++) decode_one(&updates[i], data, sizeof(data));
+		return;
 	}
 
-	link_close(l);
+	pthread_mutex_lock(&decode_batch.mutex);
+	decode_batch.updates = updates;
+	decode_batch.count = count;
+	decode_batch.next = 0;
+	decode_batch.pending = count;
+	pthread_cond_broadcast(&decode_batch.ready);
+
+	decode_batch_work(data, sizeof(data));
+	while(decode_batch.pending>0) {
+		pthread_cond_wait(&decode_batch.done, &decode_batch.mutex);
+	}
+
+	decode_batch.count = 0;
+	decode_batch.next = 0;
+	pthread_mutex_unlock(&decode_batch.mutex);
+}
+
+static void handle_udp_updates(struct datagram *update_port)
+{
+	int i, batch;
+
+	/* Return to the other clients now and then, even if more keep arriving. */
+
+	for(batch=0;batch<UDP_BATCHES_MAX;batch++) {
+		int count = datagram_recv_many(update_port, udp_messages, DATAGRAM_BATCH_MAX, 0);
+		if(count <= 0)
+			return;
+
+		decode_updates(udp_updates, count);
+
+		for(i=0;i<count;i++) {
+			struct catalog_update *u = &udp_updates[i];
+			apply_update(u->msg->addr, u->msg->port, u->named ? u->name : 0, u->msg->data, u->status, u->j, "udp");
+		}
+
+		if(count < DATAGRAM_BATCH_MAX)
+			return;
+	}
 }
 
 static struct jx_table html_headers[] = {
@@ -420,80 +722,141 @@ void send_http_response( FILE *stream, int code, const char *message, const char
 	fprintf(stream, "Content-type: %s\n\n",content_type);
 }
 
-static void handle_query(struct link *query_link)
+static void page_release( struct catalog_page *p )
 {
-	FILE *stream;
-	char line[LINE_MAX];
-	char url[LINE_MAX];
-	char path[LINE_MAX];
-	char action[LINE_MAX];
-	char version[LINE_MAX];
-	char hostport[LINE_MAX];
-	char addr[LINK_ADDRESS_MAX];
-	char key[LINE_MAX];
-	char strexpr[LINE_MAX];
-	int port;
-	long time_start, time_stop;
+	if(!p || --p->refcount>0) return;
+	free(p->data);
+	free(p->compressed);
+	free(p);
+}
 
-	char *hkey;
-	struct jx *j;
-	int i, n;
+static void page_status( struct catalog_page *p, int code, const char *message, const char *content_type )
+{
+	p->code = code;
+	p->message = message;
+	p->content_type = content_type;
+}
 
-	link_address_remote(query_link, addr, &port);
-	debug(D_DEBUG, "www query from %s:%d", addr, port);
+/*
+Compress a page with gzip framing, once, for clients that accept it.
+If compression fails or does not help, the page is sent as it is.
+*/
 
-	if(link_readline(query_link, line, LINE_MAX, time(0) + HANDLE_QUERY_TIMEOUT)) {
-		string_chomp(line);
-		if(sscanf(line, "%s %s %s", action, url, version) != 3) {
-			return;
-		}
+static void page_compress( struct catalog_page *p )
+{
+	z_stream z;
 
-		// Consume the rest of the query
-		while(1) {
-			if(!link_readline(query_link, line, LINE_MAX, time(0) + HANDLE_QUERY_TIMEOUT)) {
-				return;
-			}
+	if(p->compress_tried) return;
+	p->compress_tried = 1;
 
-			if(line[0] == 0) {
-				break;
-			}
-		}
+	if(p->length<PAGE_COMPRESS_MIN) return;
+
+	memset(&z,0,sizeof(z));
+	if(deflateInit2(&z,Z_DEFAULT_COMPRESSION,Z_DEFLATED,15+16,8,Z_DEFAULT_STRATEGY)!=Z_OK) return;
+
+	size_t bound = deflateBound(&z,p->length);
+	char *out = xxmalloc(bound);
+
+	z.next_in = (Bytef*)p->data;
+	z.avail_in = p->length;
+	z.next_out = (Bytef*)out;
+	z.avail_out = bound;
+
+	if(deflate(&z,Z_FINISH)==Z_STREAM_END && z.total_out<p->length) {
+		p->compressed = out;
+		p->compressed_length = z.total_out;
 	} else {
-		return;
+		free(out);
 	}
 
-	// Output response
-	stream = fdopen(link_fd(query_link), "w");
-	if(!stream) {
-		return;
+	deflateEnd(&z);
+}
+
+static struct catalog_snapshot * snapshot_create()
+{
+	struct catalog_snapshot *s = xxcalloc(1,sizeof(*s));
+	int max = 0;
+	char *key;
+	struct jx *j;
+
+	s->serial = ++snapshot_serial;
+	s->time = time(0);
+	s->keys = hash_table_create(0,0);
+	s->pages = hash_table_create(0,0);
+
+	deltadb_firstkey(table);
+	while(deltadb_nextkey(table, &key, &j)) {
+		if(s->count>=max) {
+			max = max ? max*2 : 1024;
+			s->records = xxrealloc(s->records,max*sizeof(*s->records));
+		}
+		struct jx *copy = jx_copy(j);
+		s->records[s->count++] = copy;
+		hash_table_insert(s->keys,key,copy);
 	}
-	link_nonblocking(query_link, 0);
 
-	if(sscanf(url, "http://%[^/]%s", hostport, path) == 2) {
-		// continue on
-	} else {
-		strcpy(path, url);
+	/* sort the records by name before displaying */
+
+	qsort(s->records, s->count, sizeof(struct jx *), compare_jx);
+
+	debug(D_DEBUG, "snapshot %u of %d records", s->serial, s->count);
+
+	return s;
+}
+
+static void snapshot_delete( struct catalog_snapshot *s )
+{
+	char *path;
+	struct catalog_page *p;
+	int i;
+
+	if(!s) return;
+
+	hash_table_firstkey(s->pages);
+	while(hash_table_nextkey(s->pages, &path, (void**)&p)) {
+		page_release(p);
 	}
+	hash_table_delete(s->pages);
+	hash_table_delete(s->keys);
+
+	for(i = 0; i < s->count; i++)
+		jx_delete(s->records[i]);
+	free(s->records);
+	free(s);
+}
 
-	/* load the hash table entries into one big array */
+/* Return a snapshot that is no older than snapshot_interval unless the table is unchanged. */
 
-	n = 0;
-	deltadb_firstkey(table);
-	while(deltadb_nextkey(table, &hkey, &j)) {
-		array[n] = j;
-		n++;
+static struct catalog_snapshot * snapshot_current()
+{
+	if(!snapshot || (table_changed && time(0)-snapshot->time >= snapshot_interval)) {
+		snapshot_delete(snapshot);
+		snapshot = snapshot_create();
+		table_changed = 0;
 	}
+	return snapshot;
+}
 
-	/* sort the array by name before displaying */
+/*
+Write the body of the page at path, as seen in snapshot s,
+and set its status and content type.
+*/
 
-	qsort(array, n, sizeof(struct jx *), compare_jx);
+static void render_page( struct catalog_snapshot *s, const char *path, struct catalog_page *p, FILE *stream )
+{
+	char url[LINE_MAX];
+	char key[LINE_MAX];
+	char strexpr[LINE_MAX];
+	struct jx *j;
+	struct jx **array = s->records;
+	int i, n = s->count;
 
 	if(!strcmp(path, "/query.text")) {
-		send_http_response(stream,200,"OK","text/plain");
+		page_status(p,200,"OK","text/plain");
 		for(i = 0; i < n; i++)
 			jx_export_nvpair(array[i], stream);
 	} else if(!strcmp(path, "/query.json")) {
-		send_http_response(stream,200,"OK","text/plain");
+		page_status(p,200,"OK","text/plain");
 		fprintf(stream,"[\n");
 		for(i = 0; i < n; i++) {
 			jx_print_stream(array[i],stream);
@@ -507,7 +870,7 @@ static void handle_query(struct link *query_link)
 		if(b64_decode(strexpr,&buf)==0) {
 			struct jx *expr = jx_parse_string(buffer_tostring(&buf));
 			if(expr) {
-				send_http_response(stream,200,"OK","text/plain");
+				page_status(p,200,"OK","text/plain");
 				fprintf(stream,"[\n");
 
 				int first = 1;
@@ -521,61 +884,33 @@ static void handle_query(struct link *query_link)
 				fprintf(stream,"\n]\n");
 				jx_delete(expr);
 			} else {
-				send_http_response(stream,400,"Bad Request","text/plain");
-				fprintf(stream,"Invalid query text.\n");
-			}
-		} else {
-			send_http_response(stream,400,"Bad Request","text/plain");
-			fprintf(stream,"Invalid base-64 encoding.\n");
-		}
-		buffer_free(&buf);
-
-
-	} else if(3==sscanf(path, "/history/%ld/%ld/%[^/]",&time_start,&time_stop,strexpr)) {
-
-		struct buffer buf;
-		buffer_init(&buf);
-		if(b64_decode(strexpr,&buf)==0) {
-			struct jx *expr = jx_parse_string(buffer_tostring(&buf));
-			if(expr) {
-				send_http_response(stream,200,"OK","text/plain");
-				struct deltadb_query *query = deltadb_query_create();
-				deltadb_query_set_filter(query,expr);
-				deltadb_query_set_output(query,stream);
-				deltadb_query_set_display(query,DELTADB_DISPLAY_STREAM);
-				deltadb_query_execute_dir(query,history_dir,time_start,time_stop);
-				deltadb_query_delete(query);
-				jx_delete(expr);
-			} else {
-				send_http_response(stream,400,"Bad Request","text/plain");
+				page_status(p,400,"Bad Request","text/plain");
 				fprintf(stream,"Invalid query text.\n");
 			}
 		} else {
-			send_http_response(stream,400,"Bad Request","text/plain");
+			page_status(p,400,"Bad Request","text/plain");
 			fprintf(stream,"Invalid base-64 encoding.\n");
 		}
 		buffer_free(&buf);
 
-
 	} else if(!strcmp(path, "/query.oldclassads")) {
-		send_http_response(stream,200,"OK","text/plain");
+		page_status(p,200,"OK","text/plain");
 		for(i = 0; i < n; i++)
 			jx_export_old_classads(array[i], stream);
 	} else if(!strcmp(path, "/query.newclassads")) {
-		send_http_response(stream,200,"OK","text/plain");
+		page_status(p,200,"OK","text/plain");
 		for(i = 0; i < n; i++)
 			jx_export_new_classads(array[i], stream);
 	} else if(!strcmp(path, "/query.xml")) {
-		send_http_response(stream,200,"OK","text/xml");
+		page_status(p,200,"OK","text/xml");
 		fprintf(stream, "<?xml version=\"1.0\" standalone=\"yes\"?>\n");
 		fprintf(stream, "<catalog>\n");
 		for(i = 0; i < n; i++)
 			jx_export_xml(array[i], stream);
 		fprintf(stream, "</catalog>\n");
 	} else if(sscanf(path, "/detail/%s", key) == 1) {
-		struct jx *j;
-		send_http_response(stream,200,"OK","text/html");
-		j = deltadb_lookup(table, key);
+		page_status(p,200,"OK","text/html");
+		j = hash_table_lookup(s->keys, key);
 		if(j) {
 			const char *name = jx_lookup_string(j, "name");
 			if(!name)
@@ -601,7 +936,7 @@ static void handle_query(struct link *query_link)
 		INT64_T sum_avail = 0;
 		INT64_T sum_devices = 0;
 
-		send_http_response(stream,200,"OK","text/html");
+		page_status(p,200,"OK","text/html");
 		fprintf(stream, "<title>%s catalog server</title>\n", preferred_hostname);
 		fprintf(stream, "<center>\n");
 		fprintf(stream, "<h1>%s catalog server</h1>\n", preferred_hostname);
@@ -634,12 +969,299 @@ static void handle_query(struct link *query_link)
 		jx_export_html_footer(stream, html_headers);
 		fprintf(stream, "</center>\n");
 	} else {
-		send_http_response(stream,404,"Not Found","text/html");
+		page_status(p,404,"Not Found","text/html");
 		fprintf(stream,"<p>Error 404: Invalid URL</p>");
-		fprintf(stream,"<pre>%s</pre>",url);
+		fprintf(stream,"<pre>%s</pre>",path);
 		fprintf(stream,"<p><a href=/>Return to Index</a></p>");
 	}
+}
+
+/*
+Return the page at path from the cache of snapshot s, rendering it if needed.
+The caller must release the page when done with it.
+*/
+
+static struct catalog_page * snapshot_page( struct catalog_snapshot *s, const char *path )
+{
+	struct catalog_page *p = hash_table_lookup(s->pages, path);
+	if(p) {
+		p->refcount++;
+		return p;
+	}
+
+	p = xxcalloc(1,sizeof(*p));
+	p->refcount = 1;
+
+	FILE *stream = open_memstream(&p->data, &p->length);
+	if(!stream) fatal("couldn't allocate memory: %s", strerror(errno));
+	render_page(s, path, p, stream);
 	fclose(stream);
+
+	/* The same content gets the same tag, even in a later snapshot. */
+	snprintf(p->etag, sizeof(p->etag), "\"%zx-%x\"", p->length, hash_string(p->data));
+	snprintf(p->compressed_etag, sizeof(p->compressed_etag), "\"%zx-%x-gz\"", p->length, hash_string(p->data));
+
+	if(s->pages_size + p->length <= PAGE_CACHE_MAX) {
+		hash_table_insert(s->pages, path, p);
+		s->pages_size += p->length;
+		p->refcount++;
+	}
+
+	return p;
+}
+
+/*
+History queries read the log from disk, which may take a long time,
+so unless in single mode they are handled by a child process.
+*/
+
+static void handle_history( struct link *query_link, const char *path )
+{
+	long time_start, time_stop;
+	char strexpr[LINE_MAX];
+
+	if(3!=sscanf(path, "/history/%ld/%ld/%[^/]",&time_start,&time_stop,strexpr)) return;
+
+	FILE *stream = fdopen(link_fd(query_link), "w");
+	if(!stream) {
+		return;
+	}
+	link_nonblocking(query_link, 0);
+
+	struct buffer buf;
+	buffer_init(&buf);
+	if(b64_decode(strexpr,&buf)==0) {
+		struct jx *expr = jx_parse_string(buffer_tostring(&buf));
+		if(expr) {
+			send_http_response(stream,200,"OK","text/plain");
+			struct deltadb_query *query = deltadb_query_create();
+			deltadb_query_set_filter(query,expr);
+			deltadb_query_set_output(query,stream);
+			deltadb_query_set_display(query,DELTADB_DISPLAY_STREAM);
+			deltadb_query_execute_dir(query,history_dir,time_start,time_stop);
+			/* The query owns and deletes the filter expression. */
+			deltadb_query_delete(query);
+		} else {
+			send_http_response(stream,400,"Bad Request","text/plain");
+			fprintf(stream,"Invalid query text.\n");
+		}
+	} else {
+		send_http_response(stream,400,"Bad Request","text/plain");
+		fprintf(stream,"Invalid base-64 encoding.\n");
+	}
+	buffer_free(&buf);
+
+	fclose(stream);
+}
+
+static struct catalog_client * client_create( struct link *l, client_type_t type, time_t stoptime )
+{
+	struct catalog_client *c = xxcalloc(1,sizeof(*c));
+	c->link = l;
+	c->type = type;
+	c->state = CLIENT_READING;
+	c->stoptime = stoptime;
+	link_address_remote(l, c->addr, &c->port);
+	buffer_init(&c->input);
+	buffer_init(&c->header);
+	return c;
+}
+
+static void client_delete( struct catalog_client *c )
+{
+	link_close(c->link);
+	buffer_free(&c->input);
+	buffer_free(&c->header);
+	page_release(c->page);
+	free(c);
+}
+
+/* Return the value of the named header in a request, or null. */
+
+static const char * find_header( const char *request, const char *name, char *value )
+{
+	size_t length = strlen(name);
+	const char *line = strchr(request,'\n');
+
+	while(line) {
+		line++;
+		if(!strncasecmp(line,name,length) && line[length]==':') {
+			line += length+1;
+			while(*line==' ' || *line=='\t') line++;
+			size_t n = strcspn(line,"\r\n");
+			if(n>=LINE_MAX) n = LINE_MAX-1;
+			memcpy(value,line,n);
+			value[n] = 0;
+			return value;
+		}
+		line = strchr(line,'\n');
+	}
+
+	return 0;
+}
+
+/* Once the whole request has arrived, prepare the response. */
+
+static void client_respond( struct catalog_client *c, const char *request )
+{
+	char line[LINE_MAX];
+	char url[LINE_MAX];
+	char path[LINE_MAX];
+	char action[LINE_MAX];
+	char version[LINE_MAX];
+	char hostport[LINE_MAX];
+	char value[LINE_MAX];
+
+	debug(D_DEBUG, "www query from %s:%d", c->addr, c->port);
+
+	c->state = CLIENT_DONE;
+
+	size_t n = strcspn(request,"\r\n");
+	if(n>=LINE_MAX) return;
+	memcpy(line,request,n);
+	line[n] = 0;
+
+	if(sscanf(line, "%s %s %s", action, url, version) != 3) {
+		return;
+	}
+
+	if(sscanf(url, "http://%[^/]%s", hostport, path) == 2) {
+		// continue on
+	} else {
+		strcpy(path, url);
+	}
+
+	if(!strncmp(path, "/history/", 9)) {
+		if(!fork_mode) {
+			handle_history(c->link, path);
+		} else if(child_procs_count >= child_procs_max) {
+			buffer_putfstring(&c->header, "HTTP/1.1 503 Service Unavailable\nServer: catalog_server\nConnection: close\n\n");
+			c->state = CLIENT_WRITING;
+		} else {
+			pid_t pid = fork();
+			if(pid == 0) {
+				change_process_title("catalog_server [%s]", c->addr);
+				alarm(child_procs_timeout);
+				handle_history(c->link, path);
+				_exit(0);
+			} else if (pid>0) {
+				child_procs_count++;
+			}
+		}
+		return;
+	}
+
+	c->page = snapshot_page(snapshot_current(), path);
+
+	/* The compressed page is a different representation, with its own tag. */
+
+	const char *accept = find_header(request, "Accept-Encoding", value);
+	if(accept && strstr(accept, "gzip")) {
+		page_compress(c->page);
+		c->compressed = c->page->compressed!=0;
+	}
+
+	const char *etag = c->compressed ? c->page->compressed_etag : c->page->etag;
+
+	time_t current = time(0);
+	const char *match = find_header(request, "If-None-Match", value);
+	int modified = !match || strcmp(match, etag);
+
+	if(modified) {
+		buffer_putfstring(&c->header, "HTTP/1.1 %d %s\n", c->page->code, c->page->message);
+	} else {
+		buffer_putfstring(&c->header, "HTTP/1.1 304 Not Modified\n");
+	}
+
+	buffer_putfstring(&c->header, "Date: %s", ctime(&current));
+	buffer_putfstring(&c->header, "Server: catalog_server\n");
+	buffer_putfstring(&c->header, "Connection: close\n");
+	buffer_putfstring(&c->header, "Access-Control-Allow-Origin: *\n");
+	buffer_putfstring(&c->header, "Vary: Accept-Encoding\n");
+	buffer_putfstring(&c->header, "ETag: %s\n", etag);
+
+	if(modified) {
+		if(c->compressed) buffer_putfstring(&c->header, "Content-Encoding: gzip\n");
+		buffer_putfstring(&c->header, "Content-Length: %zu\n", c->compressed ? c->page->compressed_length : c->page->length);
+		buffer_putfstring(&c->header, "Content-type: %s\n", c->page->content_type);
+	} else {
+		page_release(c->page);
+		c->page = 0;
+		c->compressed = 0;
+	}
+
+	buffer_putfstring(&c->header, "\n");
+	c->state = CLIENT_WRITING;
+}
+
+static void client_read( struct catalog_client *c )
+{
+	char data[65536];
+
+	ssize_t length = read(link_fd(c->link), data, sizeof(data));
+	if(length<0 && errno_is_temporary(errno)) return;
+
+	if(length>0) buffer_putlstring(&c->input, data, length);
+
+	size_t size;
+	const char *input = buffer_tolstring(&c->input, &size);
+
+	if(c->type==CLIENT_UPDATE) {
+		/* An update is everything sent until the connection is closed. */
+		if(length<=0 || size>=TCP_PAYLOAD_MAX-1) {
+			if(size>0) handle_update(c->addr, c->port, input, MIN(size,TCP_PAYLOAD_MAX-1), "tcp");
+			c->state = CLIENT_DONE;
+		}
+	} else if(length<=0 || size>QUERY_HEADER_MAX) {
+		c->state = CLIENT_DONE;
+	} else if(strstr(input, "\n\n") || strstr(input, "\n\r\n")) {
+		client_respond(c, input);
+	}
+}
+
+static void client_write( struct catalog_client *c )
+{
+	size_t header_length;
+	const char *header = buffer_tolstring(&c->header, &header_length);
+
+	while(1) {
+		const char *data;
+		size_t length;
+
+		if(c->sent < header_length) {
+			data = header + c->sent;
+			length = header_length - c->sent;
+		} else if(c->page) {
+			size_t offset = c->sent - header_length;
+			data = c->compressed ? c->page->compressed : c->page->data;
+			length = c->compressed ? c->page->compressed_length : c->page->length;
+			data += offset;
+			length -= offset;
+		} else {
+			length = 0;
+		}
+
+		if(length==0) {
+			c->state = CLIENT_DONE;
+			return;
+		}
+
+		ssize_t result = write(link_fd(c->link), data, length);
+		if(result<0) {
+			if(!errno_is_temporary(errno)) c->state = CLIENT_DONE;
+			return;
+		}
+		c->sent += result;
+	}
+}
+
+static void client_accept( struct link *port, client_type_t type, time_t timeout )
+{
+	struct link *l;
+
+	while(client_count<MAX_CLIENTS && (l = link_accept(port, LINK_NOWAIT))) {
+		clients[client_count++] = client_create(l, type, time(0) + timeout);
+	}
 }
 
 static void show_help(const char *cmd)
@@ -654,7 +1276,7 @@ static void show_help(const char *cmd)
 	fprintf(stdout, " %-30s Listen only on this network interface.\n", "-I,--interface=<addr>");
 	fprintf(stdout, " %-30s Lifetime of data, in seconds (default is %d)\n", "-l,--lifetime=<secs>", lifetime);
 	fprintf(stdout, " %-30s Log new updates to this file.\n", "-L,--update-log=<file>");
-	fprintf(stdout, " %-30s Maximum number of child processes.\n", "-m,--max-jobs=<n>");
+	fprintf(stdout, " %-30s Maximum number of history query processes.\n", "-m,--max-jobs=<n>");
 	fprintf(stdout, " %-30s (default is %d)\n", "", child_procs_max);
 	fprintf(stdout, " %-30s Maximum size of a server to be believed.\n", "-M,--server-size=<size>");
 	fprintf(stdout, " %-30s (default is any)\n", "");
@@ -664,8 +1286,13 @@ static void show_help(const char *cmd)
 	fprintf(stdout, " %-30s Rotate debug file once it reaches this size.\n", "-O,--debug-rotate-max=<bytes>");
 	fprintf(stdout, " %-30s (default 10M, 0 disables)\n", "");
 	fprintf(stdout, " %-30s Port number to listen on (default is %d)\n", "-p,--port=<port>", port);
-	fprintf(stdout, " %-30s Single process mode; do not work on queries.\n", "-S,--single");
-	fprintf(stdout, " %-30s Maximum time to allow a query process to run.\n", "-T,--timeout=<time>");
+	fprintf(stdout, " %-30s Minimum time between snapshots of the table\n", "-s,--snapshot-interval=<time>");
+	fprintf(stdout, " %-30s used to answer queries. (default is %ds)\n", "", snapshot_interval);
+	fprintf(stdout, " %-30s Single process mode; do not fork for history queries.\n", "-S,--single");
+	fprintf(stdout, " %-30s Number of threads decoding updates, besides\n", "-t,--threads=<n>");
+	fprintf(stdout, " %-30s the main one. (default is one per additional\n", "");
+	fprintf(stdout, " %-30s core, up to %d)\n", "", DECODE_THREADS_DEFAULT_MAX);
+	fprintf(stdout, " %-30s Maximum time to allow a query to run.\n", "-T,--timeout=<time>");
 	fprintf(stdout, " %-30s (default is %ds)\n", "", child_procs_timeout);
 	fprintf(stdout, " %-30s Send status updates to this host. (default is\n", "-u,--update-host=<host>");
 	fprintf(stdout, " %-30s %s)\n", "", CATALOG_HOST_DEFAULT);
@@ -678,14 +1305,13 @@ static void show_help(const char *cmd)
 
 int main(int argc, char *argv[])
 {
-	struct link *link, *query_port = 0;
+	struct link *query_port = 0;
 	signed char ch;
 	time_t current;
 	int is_daemon = 0;
 	char *pidfile = NULL;
 	char *interface = NULL;
-	char raddr[LINK_ADDRESS_MAX];
-	int rport;
+	int i;
 
 	outgoing_host_list = list_create();
 
@@ -708,7 +1334,9 @@ int main(int argc, char *argv[])
 		{"debug-file", required_argument, 0, 'o'},
 		{"debug-rotate-max", required_argument, 0, 'O'},
 		{"port", required_argument, 0, 'p'},
+		{"snapshot-interval", required_argument, 0, 's'},
 		{"single", no_argument, 0, 'S'},
+		{"threads", required_argument, 0, 't'},
 		{"timeout", required_argument, 0, 'T'},
 		{"update-host", required_argument, 0, 'u'},
 		{"update-interval", required_argument, 0, 'U'},
@@ -717,7 +1345,7 @@ int main(int argc, char *argv[])
 		{0,0,0,0}};
 
 
-	while((ch = getopt_long(argc, argv, "bB:d:hH:I:l:L:m:M:n:o:O:p:ST:u:U:vZ:", long_options, NULL)) > -1) {
+	while((ch = getopt_long(argc, argv, "bB:d:hH:I:l:L:m:M:n:o:O:p:s:St:T:u:U:vZ:", long_options, NULL)) > -1) {
 		switch (ch) {
 			case 'b':
 				is_daemon = 1;
@@ -764,9 +1392,15 @@ int main(int argc, char *argv[])
 			case 'p':
 				port = atoi(optarg);
 				break;
+			case 's':
+				snapshot_interval = string_time_parse(optarg);
+				break;
 			case 'S':
 				fork_mode = 0;
 				break;
+			case 't':
+				decode_threads = atoi(optarg);
+				break;
 			case 'T':
 				child_procs_timeout = string_time_parse(optarg);
 				break;
@@ -850,6 +1484,9 @@ int main(int argc, char *argv[])
 			fatal("couldn't listen on UDP port %d", port);
 	}
 
+	int size = datagram_recv_buffer_set(update_dgram, UDP_RECV_BUFFER_SIZE);
+	debug(D_DEBUG, "UDP receive buffer is %d bytes", size);
+
 	update_port = link_serve_address(interface,port+1);
 	if(!update_port) {
 		if(interface)
@@ -858,16 +1495,21 @@ int main(int argc, char *argv[])
 			fatal("couldn't listen on TCP port %d", port+1);
 	}
 
+	/*
+	Connections may arrive in bursts faster than one pass of the main
+	loop, so allow many more to wait for accept than link_serve does.
+	*/
+
+	listen(link_fd(query_port), MAX_CLIENTS);
+	listen(link_fd(update_port), MAX_CLIENTS);
+
 	opts_write_port_file(port_file,port);
 
-	while(1) {
-		fd_set rfds;
-		int dfd = datagram_fd(update_dgram);
-		int lfd = link_fd(query_port);
-		int ufd = link_fd(update_port);
+	udp_pipeline_start();
 
-		int result, maxfd;
-		struct timeval timeout;
+	while(1) {
+		struct pollfd fds[3+MAX_CLIENTS];
+		int nfds = 3;
 
 		remove_expired_records();
 
@@ -887,47 +1529,67 @@ int main(int argc, char *argv[])
 			}
 		}
 
-		FD_ZERO(&rfds);
-		FD_SET(dfd, &rfds);
-		FD_SET(ufd, &rfds);
-		if(child_procs_count < child_procs_max) {
-			FD_SET(lfd, &rfds);
-		}
-		maxfd = MAX(ufd,MAX(dfd, lfd)) + 1;
+		/* Stop accepting connections while the client table is full. */
+
+		int accepting = client_count < MAX_CLIENTS;
 
-		timeout.tv_sec = 5;
-		timeout.tv_usec = 0;
+		fds[0].fd = datagram_fd(update_dgram);
+		fds[0].events = POLLIN;
+		fds[1].fd = accepting ? link_fd(update_port) : -1;
+		fds[1].events = POLLIN;
+		fds[2].fd = accepting ? link_fd(query_port) : -1;
+		fds[2].events = POLLIN;
 
-		result = select(maxfd, &rfds, 0, 0, &timeout);
-		if(result <= 0)
+		for(i = 0; i < client_count; i++) {
+			fds[nfds].fd = link_fd(clients[i]->link);
+			fds[nfds].events = clients[i]->state==CLIENT_WRITING ? POLLOUT : POLLIN;
+			nfds++;
+		}
+
+		int result = poll(fds, nfds, client_count ? 1000 : 5000);
+		if(result < 0)
 			continue;
 
-		if(FD_ISSET(dfd, &rfds)) {
+		if(fds[0].revents) {
 			handle_udp_updates(update_dgram);
 		}
 
-		if(FD_ISSET(ufd, &rfds)) {
-			handle_tcp_update(update_port);
+		if(fds[1].revents) {
+			client_accept(update_port, CLIENT_UPDATE, HANDLE_TCP_UPDATE_TIMEOUT);
 		}
 
-		if(FD_ISSET(lfd, &rfds)) {
-			link = link_accept(query_port, time(0) + 5);
-			if(link) {
-				if(fork_mode) {
-					pid_t pid = fork();
-					if(pid == 0) {
-						link_address_remote(link, raddr, &rport);
-						change_process_title("catalog_server [%s]", raddr);
-						alarm(child_procs_timeout);
-						handle_query(link);
-						_exit(0);
-					} else if (pid>0) {
-						child_procs_count++;
-					}
-				} else {
-					handle_query(link);
+		/* Clients accepted now are not in fds, and wait for the next pass. */
+
+		int old_count = nfds - 3;
+
+		if(fds[2].revents) {
+			client_accept(query_port, CLIENT_QUERY, child_procs_timeout);
+		}
+
+		current = time(0);
+
+		for(i = old_count-1; i >= 0; i--) {
+			struct catalog_client *c = clients[i];
+
+			if(fds[3+i].revents) {
+				if(c->state==CLIENT_READING) {
+					client_read(c);
+				} else if(c->state==CLIENT_WRITING) {
+					client_write(c);
 				}
-				link_close(link);
+			}
+
+			if(c->state==CLIENT_READING && current > c->stoptime && c->type==CLIENT_UPDATE) {
+				/* As with a blocking read, take what arrived before the timeout. */
+				size_t size;
+				const char *input = buffer_tolstring(&c->input, &size);
+				if(size>0) handle_update(c->addr, c->port, input, size, "tcp");
+				c->state = CLIENT_DONE;
+			}
+
+			if(c->state==CLIENT_DONE || current > c->stoptime) {
+				client_delete(c);
+				clients[i] = clients[--client_count];
 			}
 		}
 	}
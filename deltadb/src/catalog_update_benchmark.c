@@ -0,0 +1,242 @@
+/*
+Copyright (C) 2026- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+/*
+Send a stream of UDP updates to a catalog server, as a large number of
+reporting workers would, and measure how many of them it keeps.
+
+Every update carries a distinct uuid, so each one that is accepted
+becomes a record of its own.  After sending, the catalog is queried
+until the number of records from this run stops growing, and the
+difference from the number sent is the loss.  Use a catalog started
+for the purpose, since every update stays in its table for the
+lifetime of records.
+
+With -w, the updates instead come from a fixed number of workers in
+rounds, so that most of them change an existing record, as heartbeats
+do.  Only the updates of the last round can then be counted.
+*/
+
+#include "catalog_query.h"
+#include "datagram.h"
+#include "domain_name_cache.h"
+#include "jx.h"
+#include "jx_parse.h"
+#include "jx_print.h"
+#include "stringtools.h"
+#include "timestamp.h"
+#include "zlib.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char *catalog_host = "localhost";
+static int catalog_port = CATALOG_PORT_DEFAULT;
+static int update_count = 100000;
+static int worker_count = 0;
+static int update_rate = 0;
+static int update_size = 512;
+static int compress_updates = 0;
+
+static void show_help( const char *cmd )
+{
+	fprintf(stdout, "Use: %s [options]\n", cmd);
+	fprintf(stdout, "where options are:\n");
+	fprintf(stdout, " %-20s Catalog host. (default is %s)\n", "-c <host>", catalog_host);
+	fprintf(stdout, " %-20s Catalog port. (default is %d)\n", "-p <port>", catalog_port);
+	fprintf(stdout, " %-20s Number of updates to send. (default is %d)\n", "-n <count>", update_count);
+	fprintf(stdout, " %-20s Updates to send per second. (default is as fast as possible)\n", "-r <rate>");
+	fprintf(stdout, " %-20s Number of workers sending updates in turn. (default is one per update)\n", "-w <count>");
+	fprintf(stdout, " %-20s Approximate size of each update in bytes. (default is %d)\n", "-s <size>", update_size);
+	fprintf(stdout, " %-20s Compress updates, as large updates are.\n", "-z");
+	fprintf(stdout, " %-20s Show this help screen.\n", "-h");
+}
+
+/* An update looks like a worker report, padded out to the requested size. */
+
+static char * make_update( const char *run, int n, int *length )
+{
+	int worker = n%worker_count;
+	int round = n/worker_count;
+
+	struct jx *j = jx_object(0);
+	jx_insert_string(j, "type", "catalog_benchmark");
+	jx_insert_string(j, "run", run);
+	jx_insert(j, jx_string("uuid"), jx_format("%s-%d", run, worker));
+
+	/* The round is sent as uptime, whose changes deltadb does not log, as for real heartbeats. */
+	jx_insert_integer(j, "uptime", round);
+
+	/* A worker's resources stay the same, and its tasks change every few rounds. */
+	jx_insert_integer(j, "port", 9123);
+	jx_insert_integer(j, "cores", 1 + worker%64);
+	jx_insert_integer(j, "memory", 1024 * (1 + worker%256));
+	jx_insert_integer(j, "disk", 4096 * (1 + worker%1024));
+	jx_insert_integer(j, "tasks_running", (worker + round/8)%16);
+
+	char *text = jx_print_string(j);
+	int pad = update_size - (int)strlen(text) - 12;
+	if(pad > 0) {
+		char *padding = malloc(pad+1);
+		memset(padding, 'x', pad);
+		padding[pad] = 0;
+		jx_insert_string(j, "padding", padding);
+		free(padding);
+		free(text);
+		text = jx_print_string(j);
+	}
+	jx_delete(j);
+
+	if(!compress_updates) {
+		*length = strlen(text);
+		return text;
+	}
+
+	uLongf clength = compressBound(strlen(text));
+	char *data = malloc(clength+1);
+	data[0] = 0x1A;
+	compress((Bytef*)&data[1], &clength, (const Bytef*)text, strlen(text));
+	free(text);
+	*length = clength+1;
+	return data;
+}
+
+static int count_records( const char *run, int round )
+{
+	char *hosts = string_format("%s:%d", catalog_host, catalog_port);
+	char *expr = string_format("type==\"catalog_benchmark\" && run==\"%s\" && uptime==%d", run, round);
+	struct jx *filter = jx_parse_string(expr);
+	time_t stoptime = time(0) + 60;
+	int count = -1;
+
+	/* The query takes ownership of the filter. */
+	struct catalog_query *q = catalog_query_create(hosts, filter, stoptime);
+	if(q) {
+		struct jx *j;
+		count = 0;
+		while((j = catalog_query_read(q, stoptime))) {
+			count++;
+			jx_delete(j);
+		}
+		catalog_query_delete(q);
+	}
+
+	free(expr);
+	free(hosts);
+	return count;
+}
+
+int main( int argc, char *argv[] )
+{
+	char address[DATAGRAM_ADDRESS_MAX];
+	int c;
+
+	while((c = getopt(argc, argv, "c:p:n:r:s:w:zh")) != -1) {
+		switch(c) {
+			case 'c':
+				catalog_host = optarg;
+				break;
+			case 'p':
+				catalog_port = atoi(optarg);
+				break;
+			case 'n':
+				update_count = atoi(optarg);
+				break;
+			case 'r':
+				update_rate = atoi(optarg);
+				break;
+			case 's':
+				update_size = atoi(optarg);
+				break;
+			case 'w':
+				worker_count = atoi(optarg);
+				break;
+			case 'z':
+				compress_updates = 1;
+				break;
+			default:
+				show_help(argv[0]);
+				return c=='h' ? 0 : 1;
+		}
+	}
+
+	if(worker_count<=0 || worker_count>update_count) worker_count = update_count;
+
+	/* The last round may be partly sent. */
+	int last_round = (update_count-1)/worker_count;
+	int last_round_count = update_count - last_round*worker_count;
+
+	if(!domain_name_cache_lookup(catalog_host, address)) {
+		fprintf(stderr, "couldn't look up %s\n", catalog_host);
+		return 1;
+	}
+
+	struct datagram *d = datagram_create(DATAGRAM_PORT_ANY);
+	if(!d) {
+		fprintf(stderr, "couldn't create datagram port\n");
+		return 1;
+	}
+
+	char *run = string_format("%d-%d", (int)getpid(), (int)time(0));
+
+	/* Prepare the updates beforehand, so that only sending is timed. */
+
+	char **updates = malloc(update_count*sizeof(*updates));
+	int *lengths = malloc(update_count*sizeof(*lengths));
+	int i;
+
+	for(i=0;i<update_count;i++) {
+		updates[i] = make_update(run, i, &lengths[i]);
+	}
+
+	if(count_records(run,0)<0) {
+		fprintf(stderr, "couldn't query %s:%d\n", catalog_host, catalog_port);
+		return 1;
+	}
+
+	timestamp_t start = timestamp_get();
+	int errors = 0;
+
+	for(i=0;i<update_count;i++) {
+		if(update_rate>0) {
+			timestamp_t due = start + (timestamp_t)i * 1000000 / update_rate;
+			timestamp_t now = timestamp_get();
+			if(due > now + 1000) usleep(due - now);
+		}
+		if(datagram_send(d, updates[i], lengths[i], address, catalog_port) < 0) errors++;
+	}
+
+	double elapsed = (timestamp_get() - start) / 1000000.0;
+
+	printf("sent %d updates of %d bytes in %.2fs: %.0f updates/s", update_count, lengths[0], elapsed, update_count/elapsed);
+	if(errors) printf(" (%d failed to send)", errors);
+	printf("\n");
+
+	/* Wait for the catalog to work through whatever it has queued. */
+
+	int received = -1;
+	int last;
+	do {
+		sleep(1);
+		last = received;
+		received = count_records(run,last_round);
+	} while(received != last && received < last_round_count);
+
+	if(last_round>0) printf("of the %d updates in the last round, ", last_round_count);
+	printf("received %d updates: %.2f%% lost\n", received, 100.0 * (last_round_count - received) / last_round_count);
+
+	for(i=0;i<update_count;i++) free(updates[i]);
+	free(updates);
+	free(lengths);
+	free(run);
+	datagram_delete(d);
+
+	return 0;
+}
+
+/* vim: set noexpandtab tabstop=4: */
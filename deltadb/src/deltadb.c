@@ -5,6 +5,7 @@ See the file COPYING for details.
 */
 
 #include "deltadb.h"
+#include "deltadb_snapshot.h"
 #include "jx_print.h"
 #include "jx_parse.h"
 
@@ -22,26 +23,30 @@ See the file COPYING for details.
 #include <sys/types.h>
 #include <stdarg.h>
 
+/* How often to append an intra-day snapshot of the table, in seconds. */
+#ifndef DELTADB_SNAPSHOT_INTERVAL
+#define DELTADB_SNAPSHOT_INTERVAL 3600
+#endif
+
 struct deltadb {
 	struct hash_table *table;
+	struct hash_table *fingerprints;
 	const char *logdir;
 	int logyear;
 	int logday;
 	FILE *logfile;
 	time_t last_log_time;
+	time_t last_snapshot_time;
 };
 
-/* Take the current state of the table and write it out verbatim to a checkpoint file. */
+/* Write the current state of the table verbatim to a stream. */
 
-static int checkpoint_write( struct deltadb *db, const char *filename )
+static int checkpoint_write_stream( struct deltadb *db, FILE *file )
 {
 	char *key;
 	struct jx *jobject;
 	int first = 1;
 
-	FILE *file = fopen(filename,"w");
-	if(!file) return 0;
-
 	fprintf(file,"{\n");
 
 	hash_table_firstkey(db->table);
@@ -57,9 +62,19 @@ static int checkpoint_write( struct deltadb *db, const char *filename )
 
 	fprintf(file,"}\n");
 
-	fclose(file);
+	return !ferror(file);
+}
 
-	return 1;
+/* Take the current state of the table and write it out verbatim to a checkpoint file. */
+
+static int checkpoint_write( struct deltadb *db, const char *filename )
+{
+	FILE *file = fopen(filename,"w");
+	if(!file) return 0;
+
+	int result = checkpoint_write_stream(db,file);
+
+	return fclose(file)==0 && result;
 }
 
 /*
@@ -160,6 +175,7 @@ static void log_select( struct deltadb *db )
 	if(write_checkpoint_file) {
 		sprintf(filename,"%s/%d/%d.ckpt",db->logdir,db->logyear,db->logday);
 		checkpoint_write(db,filename);
+		db->last_snapshot_time = current;
 	}
 
 	// Reset the time so that an absolute time record comes next.
@@ -167,6 +183,45 @@ static void log_select( struct deltadb *db )
 
 }
 
+/*
+Every DELTADB_SNAPSHOT_INTERVAL seconds, append the table to the day's
+snapshot file and record where the snapshot and the log stand in the day's
+index (see deltadb_snapshot.h).  This must be called before the table is
+modified, so that the snapshot matches the log up to the recorded offset.
+*/
+
+static void log_snapshot( struct deltadb *db )
+{
+	time_t current = time(0);
+	char filename[PATH_MAX];
+
+	log_select(db);
+
+	if(current - db->last_snapshot_time < DELTADB_SNAPSHOT_INTERVAL) return;
+	db->last_snapshot_time = current;
+
+	fflush(db->logfile);
+	fseek(db->logfile,0,SEEK_END);
+	long log_offset = ftell(db->logfile);
+
+	sprintf(filename,"%s/%d/%d.snap",db->logdir,db->logyear,db->logday);
+	FILE *file = fopen(filename,"a");
+	if(!file) return;
+	fseek(file,0,SEEK_END);
+	long snapshot_offset = ftell(file);
+	int result = checkpoint_write_stream(db,file);
+	if(fclose(file)!=0 || !result) return;
+
+	sprintf(filename,"%s/%d/%d.idx",db->logdir,db->logyear,db->logday);
+	file = fopen(filename,"a");
+	if(!file) return;
+	fprintf(file,"%lld %ld %ld\n",(long long)current,log_offset,snapshot_offset);
+	fclose(file);
+
+	// Readers start at log_offset, so an absolute time record must come next.
+	db->last_log_time = 0;
+}
+
 /* If time has advanced since the last event, log a time record. */
 
 static void log_time( struct deltadb *db )
@@ -196,18 +251,75 @@ static void log_message( struct deltadb *db, const char *fmt, ... )
 	va_end(args);
 }
 
+/* Log a message followed by an object and a newline. */
+
+static void log_object( struct deltadb *db, const char *type, const char *key, struct jx *j )
+{
+	log_message(db,"%s %s ",type,key);
+	jx_print_stream(j,db->logfile);
+	fputc('\n',db->logfile);
+}
+
 /* Log an event indicating that an object was created, followed by object itself */
 
 static void log_create( struct deltadb *db, const char *key, struct jx *j )
 {
-	char *str = jx_print_string(j);
-	log_message(db,"C %s %s\n",key,str);
-	free(str);
+	log_object(db,"C",key,j);
+}
+
+/* These fields change with every update, but do not carry new information. */
+
+static int field_is_ignored( const char *name )
+{
+	return !strcmp(name,"lastheardfrom") || !strcmp(name,"uptime");
+}
+
+/*
+A fingerprint summarizes a record as it was last inserted: a hash of the
+value of each field, in order, and a hash of the whole record leaving out
+the values of ignored fields.  A new version of the record is compared
+against the fingerprint of the old one instead of against its values,
+and a record that has not changed, as for most heartbeats, is recognized
+without looking at its fields one by one.  Values are taken to be equal
+when their 64-bit hashes are equal.
+*/
+
+struct deltadb_fingerprint {
+	uint64_t hash;
+	int count;
+	uint64_t fields[];
+};
+
+static uint64_t fingerprint_combine( uint64_t h, uint64_t x )
+{
+	return h ^ (x + 0x9e3779b97f4a7c15ULL + (h<<6) + (h>>2));
+}
+
+static struct deltadb_fingerprint * fingerprint_create( struct jx *j )
+{
+	struct jx_pair *p;
+	int count = 0;
+	int i;
+
+	for(p=j->u.pairs;p;p=p->next) count++;
+
+	struct deltadb_fingerprint *f = malloc(sizeof(*f)+count*sizeof(f->fields[0]));
+	f->hash = 0;
+	f->count = count;
+
+	for(p=j->u.pairs,i=0;p;p=p->next,i++) {
+		f->fields[i] = jx_hash(p->value);
+		f->hash = fingerprint_combine(f->hash,jx_hash(p->key));
+		if(p->key->type==JX_STRING && field_is_ignored(p->key->u.string_value)) continue;
+		f->hash = fingerprint_combine(f->hash,f->fields[i]);
+	}
+
+	return f;
 }
 
-/* Log update events that indicate the difference between objects a (old) and b (new)*/
+/* Log update events for the difference between objects a (old) and b (new), by name. */
 
-static void log_updates( struct deltadb *db, const char *key, struct jx *a, struct jx *b )
+static void log_updates_by_name( struct deltadb *db, const char *key, struct jx *a, struct jx *b )
 {
 	// u is the object containing the update
 	struct jx *u = jx_object(0);
@@ -223,8 +335,7 @@ static void log_updates( struct deltadb *db, const char *key, struct jx *a, stru
 		struct jx *avalue = p->value;
 
 		// Do not log these special cases, because they do not carry new information:
-		if(!strcmp(name,"lastheardfrom")) continue;
-		if(!strcmp(name,"uptime")) continue;
+		if(field_is_ignored(name)) continue;
 
 		struct jx *bvalue = jx_lookup(b,name);
 		if(bvalue) {
@@ -236,7 +347,7 @@ static void log_updates( struct deltadb *db, const char *key, struct jx *a, stru
 			}
 		} else {
 			// item was removed, log a remove record instead
-			log_message(db,"R %s %s",key,name);
+			log_message(db,"R %s %s\n",key,name);
 		}
 	}
 
@@ -256,12 +367,43 @@ static void log_updates( struct deltadb *db, const char *key, struct jx *a, stru
 	}
 
 	// If the update is not empty, log it as a merge (M) event.
-	if(u->u.pairs) {
-		char *str = jx_print_string(u);
-		log_message(db,"M %s %s\n",key,str);
-		free(str);
+	if(u->u.pairs) log_object(db,"M",key,u);
+
+	jx_delete(u);
+}
+
+/*
+Log update events for the difference between objects a (old) and b (new),
+given their fingerprints fa and fb.  Updates nearly always carry the same
+fields in the same order, so the two are walked side by side, and only if
+the fields differ are they compared by name.
+*/
+
+static void log_updates( struct deltadb *db, const char *key, struct jx *a, struct deltadb_fingerprint *fa, struct jx *b, struct deltadb_fingerprint *fb )
+{
+	if(fa->hash==fb->hash && fa->count==fb->count) return;
+
+	struct jx *u = jx_object(0);
+	struct jx_pair *p, *q;
+	int i;
+
+	for(p=a->u.pairs,q=b->u.pairs,i=0;p && q;p=p->next,q=q->next,i++) {
+		const char *name = q->key->u.string_value;
+		if(strcmp(p->key->u.string_value,name)) break;
+		if(field_is_ignored(name)) continue;
+		if(fa->fields[i]!=fb->fields[i]) {
+			jx_insert(u,jx_string(name),jx_copy(q->value));
+		}
+	}
+
+	if(p || q) {
+		jx_delete(u);
+		log_updates_by_name(db,key,a,b);
+		return;
 	}
 
+	if(u->u.pairs) log_object(db,"M",key,u);
+
 	jx_delete(u);
 }
 
@@ -308,7 +450,7 @@ Returns true if file could be open and played, false otherwise.
 
 #define LOG_LINE_MAX 65536
 
-static int log_replay( struct deltadb *db, const char *filename, time_t snapshot)
+static int log_replay( struct deltadb *db, const char *filename, long offset, time_t snapshot)
 {
 	char line[LOG_LINE_MAX];
 	char value[LOG_LINE_MAX];
@@ -322,6 +464,11 @@ static int log_replay( struct deltadb *db, const char *filename, time_t snapshot
 	FILE *file = fopen(filename,"r");
 	if(!file) return 0;
 
+	if(offset && fseek(file,offset,SEEK_SET)!=0) {
+		fclose(file);
+		return 0;
+	}
+
 	while(fgets(line,sizeof(line),file)) {
 		if(line[0]=='C') {
 			n = sscanf(line,"C %s %[^\n]",key,value);
@@ -421,8 +568,35 @@ static int log_replay( struct deltadb *db, const char *filename, time_t snapshot
 }
 
 /*
-Recover the state of the table by loading the appropriate checkpoint
-file, then playing the corresponding log until the snapshot time is reached.
+Load the latest intra-day snapshot taken no later than the given time.
+Returns the log offset at which to continue, or -1 if there is none.
+*/
+
+static long snapshot_read( struct deltadb *db, int year, int day, time_t snapshot )
+{
+	long log_offset, snapshot_offset;
+
+	if(!deltadb_snapshot_find(db->logdir,year,day,snapshot,&log_offset,&snapshot_offset)) return -1;
+
+	struct jx *jsnapshot = deltadb_snapshot_read(db->logdir,year,day,snapshot_offset);
+	if(!jsnapshot) return -1;
+
+	struct jx_pair *p;
+	for(p=jsnapshot->u.pairs;p;p=p->next) {
+		if(p->key->type!=JX_STRING) continue;
+		hash_table_insert(db->table,p->key->u.string_value,p->value);
+		p->value = 0;
+	}
+
+	jx_delete(jsnapshot);
+
+	return log_offset;
+}
+
+/*
+Recover the state of the table by loading the latest snapshot or the
+appropriate checkpoint file, then playing the corresponding log until
+the snapshot time is reached.
 Returns true if successful, false if files could not be played.
 */
 
@@ -435,11 +609,15 @@ static int log_recover( struct deltadb *db, time_t snapshot )
 	int year = t->tm_year + 1900;
 	int day = t->tm_yday;
 
-	sprintf(filename,"%s/%d/%d.ckpt",db->logdir,year,day);
-	checkpoint_read(db,filename);
+	long offset = snapshot_read(db,year,day,snapshot);
+	if(offset<0) {
+		offset = 0;
+		sprintf(filename,"%s/%d/%d.ckpt",db->logdir,year,day);
+		checkpoint_read(db,filename);
+	}
 
 	sprintf(filename,"%s/%d/%d.log",db->logdir,year,day);
-	log_replay(db,filename,snapshot);
+	log_replay(db,filename,offset,snapshot);
 
 	return 1;
 }
@@ -453,10 +631,12 @@ struct deltadb * deltadb_create( const char *logdir )
 
 	struct deltadb *db = malloc(sizeof(*db));
 	db->table = hash_table_create(0,0);
+	db->fingerprints = hash_table_create(0,0);
 	db->logyear = 0;
 	db->logday = 0;
 	db->logfile = 0;
 	db->last_log_time = 0;
+	db->last_snapshot_time = 0;
 	db->logdir = 0;
 
 	if(logdir) {
@@ -469,16 +649,36 @@ struct deltadb * deltadb_create( const char *logdir )
 
 void deltadb_insert( struct deltadb *db, const char *key, struct jx *nv )
 {
+	if(db->logdir) log_snapshot(db);
+
 	struct jx *old = hash_table_remove(db->table,key);
 
 	hash_table_insert(db->table,key,nv);
 
 	if(db->logdir) {
+		struct deltadb_fingerprint *fnew = fingerprint_create(nv);
+		struct deltadb_fingerprint *fold = hash_table_lookup(db->fingerprints,key);
 		if(old) {
-			log_updates(db,key,old,nv);
+			if(fold) {
+				log_updates(db,key,old,fold,nv,fnew);
+			} else {
+				/* Records recovered from disk have not been fingerprinted yet. */
+				struct deltadb_fingerprint *f = fingerprint_create(old);
+				log_updates(db,key,old,f,nv,fnew);
+				free(f);
+			}
 		} else {
 			log_create(db,key,nv);
 		}
+
+		/* A record usually keeps its fields, so its fingerprint can be overwritten in place. */
+		if(fold && fold->count==fnew->count) {
+			memcpy(fold,fnew,sizeof(*fnew)+fnew->count*sizeof(fnew->fields[0]));
+			free(fnew);
+		} else {
+			free(hash_table_remove(db->fingerprints,key));
+			hash_table_insert(db->fingerprints,key,fnew);
+		}
 	}
 
 	if(old) jx_delete(old);
@@ -495,7 +695,10 @@ struct jx * deltadb_remove( struct deltadb *db, const char *key )
 {
 	const char *nkey = strdup(key);
 
+	if(db->logdir) log_snapshot(db);
+
 	struct jx *j = hash_table_remove(db->table,key);
+	free(hash_table_remove(db->fingerprints,key));
 	if(db->logdir && j) {
 		log_delete(db,nkey);
 		log_flush(db);
@@ -39,6 +39,11 @@ log file is named DIR/YEAR/DAY.log
 The checkpoint file is simply a json object containing
 the keys and values of all the objects in the database.
 
+So that a query need not replay a whole day to reach a time late in it,
+a snapshot of the table is also appended to DIR/YEAR/DAY.snap every hour,
+and indexed by time and log offset in DIR/YEAR/DAY.idx.
+See deltadb_snapshot.h for the details.
+
 The log file consists of a series of entries,
 each one a json array in the following formats:
 
@@ -0,0 +1,517 @@
+/*
+Copyright (C) 2015- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "deltadb_binary.h"
+#include "deltadb_stream.h"
+
+#include "jx_binary.h"
+
+#include "debug.h"
+#include "hash_table.h"
+#include "xxmalloc.h"
+
+#include <zlib.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct block_entry {
+	int64_t time;
+	int64_t text_offset;
+	int64_t block_offset;
+};
+
+struct deltadb_binary_writer {
+	FILE *stream;
+	FILE *block;
+	char *block_data;
+	size_t block_length;
+	struct hash_table *strings;
+	int64_t block_time;
+	int64_t block_text_offset;
+	int64_t current;
+	long next_text_offset;
+	struct block_entry *index;
+	uint32_t nblocks;
+	int errors;
+};
+
+static void write_varint( FILE *stream, uint64_t v )
+{
+	while(v>=0x80) {
+		putc((v&0x7f)|0x80,stream);
+		v >>= 7;
+	}
+	putc(v,stream);
+}
+
+static int read_varint( FILE *stream, uint64_t *v )
+{
+	int shift = 0;
+	int c;
+
+	*v = 0;
+	while((c=getc(stream))!=EOF) {
+		*v |= (uint64_t)(c&0x7f) << shift;
+		if(!(c&0x80)) return 1;
+		shift += 7;
+		if(shift>63) return 0;
+	}
+	return 0;
+}
+
+static void block_begin( struct deltadb_binary_writer *w )
+{
+	w->block = open_memstream(&w->block_data,&w->block_length);
+	if(!w->block) fatal("couldn't allocate log block: %s",strerror(errno));
+	hash_table_clear(w->strings);
+	w->block_time = w->current;
+	w->block_text_offset = w->next_text_offset;
+}
+
+/* Compress the current block, if it has anything in it, and append it to the file. */
+
+static int block_flush( struct deltadb_binary_writer *w )
+{
+	if(!w->block) return 1;
+
+	fclose(w->block);
+	w->block = 0;
+
+	if(w->block_length==0) {
+		free(w->block_data);
+		return 1;
+	}
+
+	uLongf clength = compressBound(w->block_length);
+	Bytef *cdata = xxmalloc(clength);
+	if(compress(cdata,&clength,(Bytef*)w->block_data,w->block_length)!=Z_OK) {
+		w->errors++;
+	}
+
+	w->index = realloc(w->index,(w->nblocks+1)*sizeof(*w->index));
+	struct block_entry *e = &w->index[w->nblocks++];
+	e->time = w->block_time;
+	e->text_offset = w->block_text_offset;
+	e->block_offset = ftell(w->stream);
+
+	uint32_t rlen = w->block_length;
+	uint32_t clen = clength;
+	putc('B',w->stream);
+	fwrite(&rlen,sizeof(rlen),1,w->stream);
+	fwrite(&clen,sizeof(clen),1,w->stream);
+	fwrite(&e->time,sizeof(e->time),1,w->stream);
+	fwrite(&e->text_offset,sizeof(e->text_offset),1,w->stream);
+	fwrite(cdata,clen,1,w->stream);
+
+	free(cdata);
+	free(w->block_data);
+	w->block_data = 0;
+	w->block_length = 0;
+
+	return !ferror(w->stream);
+}
+
+/* Start a record, cutting the block if it is full or an absolute time is next. */
+
+static FILE * record_begin( struct deltadb_binary_writer *w, int type )
+{
+	if(w->block && (type=='T' || ftell(w->block)>=DELTADB_BINARY_BLOCK_SIZE)) {
+		if(!block_flush(w)) w->errors++;
+	}
+	if(!w->block) block_begin(w);
+	putc(type,w->block);
+	return w->block;
+}
+
+static void write_string( struct deltadb_binary_writer *w, const char *s )
+{
+	uintptr_t n = (uintptr_t) hash_table_lookup(w->strings,s);
+	if(n) {
+		write_varint(w->block,n);
+	} else {
+		size_t length = strlen(s);
+		write_varint(w->block,0);
+		write_varint(w->block,length);
+		fwrite(s,length,1,w->block);
+		hash_table_insert(w->strings,s,(void*)(uintptr_t)(hash_table_size(w->strings)+1));
+	}
+}
+
+static int write_object( struct deltadb_binary_writer *w, struct jx *j )
+{
+	struct jx_pair *p;
+	uint64_t count = 0;
+
+	if(!jx_istype(j,JX_OBJECT)) return 0;
+
+	for(p=j->u.pairs;p;p=p->next) {
+		if(p->key->type==JX_STRING) count++;
+	}
+
+	write_varint(w->block,count);
+
+	for(p=j->u.pairs;p;p=p->next) {
+		if(p->key->type!=JX_STRING) continue;
+		write_string(w,p->key->u.string_value);
+		if(!jx_binary_write(w->block,p->value)) {
+			struct jx *jnull = jx_null();
+			jx_binary_write(w->block,jnull);
+			jx_delete(jnull);
+			w->errors++;
+		}
+	}
+
+	return 1;
+}
+
+struct deltadb_binary_writer * deltadb_binary_writer_create( FILE *stream )
+{
+	struct deltadb_binary_writer *w = xxcalloc(1,sizeof(*w));
+	w->stream = stream;
+	w->strings = hash_table_create(0,0);
+	fwrite(DELTADB_BINARY_MAGIC,DELTADB_BINARY_MAGIC_LENGTH,1,stream);
+	return w;
+}
+
+void deltadb_binary_writer_mark( struct deltadb_binary_writer *w, long text_offset )
+{
+	w->next_text_offset = text_offset;
+}
+
+int deltadb_binary_write_time( struct deltadb_binary_writer *w, time_t current )
+{
+	int64_t t = current;
+	FILE *b = record_begin(w,'T');
+	w->current = w->block_time = t;
+	return fwrite(&t,sizeof(t),1,b);
+}
+
+int deltadb_binary_write_delta( struct deltadb_binary_writer *w, time_t change )
+{
+	if(change<0) return 0;
+	FILE *b = record_begin(w,'t');
+	w->current += change;
+	write_varint(b,change);
+	return 1;
+}
+
+int deltadb_binary_write_create( struct deltadb_binary_writer *w, const char *key, struct jx *jobject )
+{
+	record_begin(w,'C');
+	write_string(w,key);
+	return write_object(w,jobject);
+}
+
+int deltadb_binary_write_merge( struct deltadb_binary_writer *w, const char *key, struct jx *jobject )
+{
+	record_begin(w,'M');
+	write_string(w,key);
+	return write_object(w,jobject);
+}
+
+int deltadb_binary_write_delete( struct deltadb_binary_writer *w, const char *key )
+{
+	record_begin(w,'D');
+	write_string(w,key);
+	return 1;
+}
+
+int deltadb_binary_write_update( struct deltadb_binary_writer *w, const char *key, const char *name, struct jx *jvalue )
+{
+	FILE *b = record_begin(w,'U');
+	write_string(w,key);
+	write_string(w,name);
+	return jx_binary_write(b,jvalue);
+}
+
+int deltadb_binary_write_remove( struct deltadb_binary_writer *w, const char *key, const char *name )
+{
+	record_begin(w,'R');
+	write_string(w,key);
+	write_string(w,name);
+	return 1;
+}
+
+int deltadb_binary_writer_close( struct deltadb_binary_writer *w )
+{
+	if(!block_flush(w)) w->errors++;
+
+	int64_t index_offset = ftell(w->stream);
+	putc('I',w->stream);
+	fwrite(w->index,sizeof(*w->index),w->nblocks,w->stream);
+	fwrite(&index_offset,sizeof(index_offset),1,w->stream);
+	fwrite(&w->nblocks,sizeof(w->nblocks),1,w->stream);
+	fwrite(DELTADB_BINARY_MAGIC,DELTADB_BINARY_MAGIC_LENGTH,1,w->stream);
+
+	int result = !w->errors && !ferror(w->stream);
+
+	hash_table_delete(w->strings);
+	free(w->index);
+	free(w);
+
+	return result;
+}
+
+int deltadb_binary_detect( FILE *stream )
+{
+	int c = getc(stream);
+	if(c==EOF) return 0;
+	ungetc(c,stream);
+	return c==(DELTADB_BINARY_MAGIC[0]&0xff);
+}
+
+/* The strings interned by the block being read. */
+
+struct string_table {
+	char **strings;
+	uint64_t count;
+	uint64_t size;
+};
+
+static void string_table_clear( struct string_table *t )
+{
+	uint64_t i;
+	for(i=0;i<t->count;i++) free(t->strings[i]);
+	t->count = 0;
+}
+
+static const char * read_string( FILE *stream, struct string_table *t )
+{
+	uint64_t n;
+
+	if(!read_varint(stream,&n)) return 0;
+
+	if(n>0) {
+		return n<=t->count ? t->strings[n-1] : 0;
+	}
+
+	uint64_t length;
+	if(!read_varint(stream,&length)) return 0;
+
+	char *s = malloc(length+1);
+	if(!s || fread(s,1,length,stream)!=length) {
+		free(s);
+		return 0;
+	}
+	s[length] = 0;
+
+	if(t->count==t->size) {
+		t->size = t->size ? t->size*2 : 256;
+		t->strings = realloc(t->strings,t->size*sizeof(*t->strings));
+	}
+	t->strings[t->count++] = s;
+
+	return s;
+}
+
+static struct jx * read_object( FILE *stream, struct string_table *t )
+{
+	uint64_t count;
+
+	if(!read_varint(stream,&count)) return 0;
+
+	struct jx *j = jx_object(0);
+	struct jx_pair **tail = &j->u.pairs;
+
+	for(;count>0;count--) {
+		const char *name = read_string(stream,t);
+		struct jx *value = name ? jx_binary_read(stream) : 0;
+		if(!value) {
+			jx_delete(j);
+			return 0;
+		}
+		*tail = jx_pair(jx_string(name),value,0);
+		tail = &(*tail)->next;
+	}
+
+	return j;
+}
+
+static void corrupt_data( const char *what )
+{
+	fprintf(stderr,"corrupt data in binary log: %s\n",what);
+}
+
+/*
+Replay the records of one block.  Returns 1 to continue with the next
+block, 0 if the query is done and -1 if the stop time was passed,
+mirroring the cases of deltadb_process_stream.
+*/
+
+static int replay_block( struct deltadb_query *query, FILE *stream, struct string_table *t, int64_t *current, time_t starttime, time_t stoptime )
+{
+	const char *key, *name;
+	struct jx *jvalue;
+	int type;
+
+	while((type=getc(stream))!=EOF) {
+		if(type=='C' || type=='M') {
+			key = read_string(stream,t);
+			jvalue = key ? read_object(stream,t) : 0;
+			if(!jvalue) {
+				corrupt_data("bad object");
+				return 1;
+			}
+			if(type=='C') {
+				if(!deltadb_create_event(query,key,jvalue)) return 0;
+			} else {
+				if(!deltadb_merge_event(query,key,jvalue)) return 0;
+			}
+		} else if(type=='D') {
+			key = read_string(stream,t);
+			if(!key) {
+				corrupt_data("bad key");
+				return 1;
+			}
+			if(!deltadb_delete_event(query,key)) return 0;
+		} else if(type=='U') {
+			key = read_string(stream,t);
+			name = key ? read_string(stream,t) : 0;
+			jvalue = name ? jx_binary_read(stream) : 0;
+			if(!jvalue) {
+				corrupt_data("bad update");
+				return 1;
+			}
+			if(!deltadb_update_event(query,key,name,jvalue)) return 0;
+		} else if(type=='R') {
+			key = read_string(stream,t);
+			name = key ? read_string(stream,t) : 0;
+			if(!name) {
+				corrupt_data("bad remove");
+				return 1;
+			}
+			if(!deltadb_remove_event(query,key,name)) return 0;
+		} else if(type=='T' || type=='t') {
+			if(type=='T') {
+				if(fread(current,sizeof(*current),1,stream)!=1) {
+					corrupt_data("bad time");
+					return 1;
+				}
+			} else {
+				uint64_t change;
+				if(!read_varint(stream,&change)) {
+					corrupt_data("bad time");
+					return 1;
+				}
+				*current += change;
+			}
+			if(!deltadb_time_event(query,starttime,stoptime,*current)) return 0;
+			if(stoptime && *current>stoptime) return -1;
+		} else {
+			corrupt_data("unknown record type");
+			return 1;
+		}
+	}
+
+	return 1;
+}
+
+/* Find the block that starts at the given offset of the text log. */
+
+static int seek_text_offset( FILE *stream, long text_offset )
+{
+	int64_t index_offset;
+	uint32_t nblocks;
+	char magic[DELTADB_BINARY_MAGIC_LENGTH];
+	long trailer = sizeof(index_offset)+sizeof(nblocks)+DELTADB_BINARY_MAGIC_LENGTH;
+
+	if(fseek(stream,-trailer,SEEK_END)!=0) return 0;
+	if(fread(&index_offset,sizeof(index_offset),1,stream)!=1) return 0;
+	if(fread(&nblocks,sizeof(nblocks),1,stream)!=1) return 0;
+	if(fread(magic,sizeof(magic),1,stream)!=1) return 0;
+	if(memcmp(magic,DELTADB_BINARY_MAGIC,sizeof(magic))) return 0;
+
+	if(fseek(stream,index_offset+1,SEEK_SET)!=0) return 0;
+
+	uint32_t i;
+	for(i=0;i<nblocks;i++) {
+		struct block_entry e;
+		if(fread(&e,sizeof(e),1,stream)!=1) return 0;
+		if(e.text_offset==text_offset) {
+			return fseek(stream,e.block_offset,SEEK_SET)==0;
+		}
+	}
+
+	return 0;
+}
+
+int deltadb_process_binary_stream( struct deltadb_query *query, FILE *stream, long text_offset, time_t starttime, time_t stoptime )
+{
+	char magic[DELTADB_BINARY_MAGIC_LENGTH];
+	struct string_table strings = {0,0,0};
+	Bytef *cdata = 0;
+	char *rdata = 0;
+	uint32_t csize = 0, rsize = 0;
+	int64_t current = 0;
+	int result = 1;
+
+	if(fread(magic,sizeof(magic),1,stream)!=1 || memcmp(magic,DELTADB_BINARY_MAGIC,sizeof(magic))) {
+		corrupt_data("bad header");
+		return 1;
+	}
+
+	if(text_offset && !seek_text_offset(stream,text_offset)) {
+		fprintf(stderr,"no block of the binary log starts at offset %ld of the text log\n",text_offset);
+		return 1;
+	}
+
+	while(getc(stream)=='B') {
+		uint32_t rlen, clen;
+		int64_t time, offset;
+
+		if(fread(&rlen,sizeof(rlen),1,stream)!=1 ||
+		   fread(&clen,sizeof(clen),1,stream)!=1 ||
+		   fread(&time,sizeof(time),1,stream)!=1 ||
+		   fread(&offset,sizeof(offset),1,stream)!=1) {
+			corrupt_data("bad block header");
+			break;
+		}
+
+		if(clen>csize) {
+			csize = clen;
+			cdata = realloc(cdata,csize);
+		}
+		if(rlen>rsize) {
+			rsize = rlen;
+			rdata = realloc(rdata,rsize);
+		}
+
+		if(fread(cdata,1,clen,stream)!=clen) {
+			corrupt_data("short block");
+			break;
+		}
+
+		uLongf length = rlen;
+		if(uncompress((Bytef*)rdata,&length,cdata,clen)!=Z_OK || length!=rlen) {
+			corrupt_data("bad block compression");
+			continue;
+		}
+
+		FILE *block = fmemopen(rdata,rlen,"r");
+		if(!block) fatal("couldn't read log block: %s",strerror(errno));
+
+		current = time;
+		result = replay_block(query,block,&strings,&current,starttime,stoptime);
+
+		fclose(block);
+		string_table_clear(&strings);
+
+		if(result<=0) break;
+	}
+
+	free(strings.strings);
+	free(cdata);
+	free(rdata);
+
+	/* As in deltadb_process_stream, only passing the stop time ends the query. */
+	return result>=0;
+}
+
+/* vim: set noexpandtab tabstop=4: */
@@ -0,0 +1,87 @@
+/*
+Copyright (C) 2015- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef DELTADB_BINARY_H
+#define DELTADB_BINARY_H
+
+#include "jx.h"
+
+#include <stdio.h>
+#include <time.h>
+
+/*
+A binary encoding of the deltadb log, for compact archives that can be
+replayed without parsing text.  deltadb_upgrade_log -b converts a text log,
+and readers recognize the format by its first byte, so a converted log may
+replace the DIR/YEAR/DAY.log of a day that is complete.
+
+The file consists of a header, a sequence of blocks, a block index and a
+trailer, with integers in host byte order as in jx_binary:
+
+<pre>
+header:  DELTADB_BINARY_MAGIC
+block:   'B' [raw length:4] [compressed length:4] [time:8] [text offset:8] [zlib data]
+index:   'I' then for each block [time:8] [text offset:8] [block offset:8]
+trailer: [index offset:8] [block count:4] DELTADB_BINARY_MAGIC
+</pre>
+
+Each block can be decoded on its own: the time at its start is in its
+header, and the keys and field names it uses are interned in a table that
+starts out empty.  The text offset is that of the block's first record in
+the original log.  A new block begins at every absolute time record of
+the original, which is where intra-day snapshots resume (see
+deltadb_snapshot.h), so a snapshot's log offset leads to a block by way
+of the index.
+
+Within a block, each record is a one-byte type followed by its fields:
+
+<pre>
+T [time:8]             t [secs]
+C [key] [object]       M [key] [object]
+D [key]                U [key] [name] [value]      R [key] [name]
+</pre>
+
+secs is an unsigned LEB128 varint.  A key or name is a varint n: zero
+introduces a new string, given as a varint length and its bytes, and n
+refers to the n-th string introduced in the block.  An object is a varint
+count of pairs, each a name and a value, and a value is in jx_binary form.
+*/
+
+#define DELTADB_BINARY_MAGIC "\xdb" "DDBLOG1"
+#define DELTADB_BINARY_MAGIC_LENGTH 8
+
+/* Blocks are cut at the first record boundary past this many bytes. */
+#define DELTADB_BINARY_BLOCK_SIZE (256*1024)
+
+struct deltadb_query;
+struct deltadb_binary_writer;
+
+struct deltadb_binary_writer * deltadb_binary_writer_create( FILE *stream );
+
+/* Give the offset in the text log of the record about to be written. */
+void deltadb_binary_writer_mark( struct deltadb_binary_writer *w, long text_offset );
+
+int deltadb_binary_write_time( struct deltadb_binary_writer *w, time_t current );
+int deltadb_binary_write_delta( struct deltadb_binary_writer *w, time_t change );
+int deltadb_binary_write_create( struct deltadb_binary_writer *w, const char *key, struct jx *jobject );
+int deltadb_binary_write_merge( struct deltadb_binary_writer *w, const char *key, struct jx *jobject );
+int deltadb_binary_write_delete( struct deltadb_binary_writer *w, const char *key );
+int deltadb_binary_write_update( struct deltadb_binary_writer *w, const char *key, const char *name, struct jx *jvalue );
+int deltadb_binary_write_remove( struct deltadb_binary_writer *w, const char *key, const char *name );
+
+/* Write out the last block and the index.  Returns false on any write error. */
+int deltadb_binary_writer_close( struct deltadb_binary_writer *w );
+
+/* Return true if the stream, positioned at its start, holds a binary log. */
+int deltadb_binary_detect( FILE *stream );
+
+/*
+Replay a binary log like deltadb_process_stream.  If text_offset is not
+zero, replay begins at the block that starts at that offset of the text log.
+*/
+int deltadb_process_binary_stream( struct deltadb_query *query, FILE *stream, long text_offset, time_t starttime, time_t stoptime );
+
+#endif
@@ -0,0 +1,648 @@
+/*
+Copyright (C) 2015- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "deltadb_columns.h"
+
+#include "jx_binary.h"
+
+#include "debug.h"
+#include "hash_table.h"
+#include "stringtools.h"
+#include "xxmalloc.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define TAG_ABSENT  0
+#define TAG_INTEGER 1
+#define TAG_DOUBLE  2
+#define TAG_STRING  3
+#define TAG_TRUE    4
+#define TAG_FALSE   5
+#define TAG_NULL    6
+#define TAG_OTHER   7
+
+#define ZIGZAG_ENCODE(n) (((uint64_t)(n)<<1) ^ (uint64_t)((int64_t)(n)>>63))
+#define ZIGZAG_DECODE(n) ((int64_t)((n)>>1) ^ -(int64_t)((n)&1))
+
+/* The last values written for a record, to write only what changes. */
+
+struct writer_key {
+	uint64_t id;
+	struct jx **values;
+	int64_t *bases;
+};
+
+struct writer_column {
+	char *name;
+	FILE *stream;
+	char *data;
+	size_t length;
+	uint64_t seq;
+};
+
+struct deltadb_columns_writer {
+	FILE *index;
+	char *index_data;
+	size_t index_length;
+	struct hash_table *keys;
+	uint64_t nkeys;
+	struct writer_column *columns;
+	int ncolumns;
+	uint64_t nops;
+	int64_t time;
+	int creating;
+	int errors;
+};
+
+static void write_varint( FILE *stream, uint64_t v )
+{
+	while(v>=0x80) {
+		putc((v&0x7f)|0x80,stream);
+		v >>= 7;
+	}
+	putc(v,stream);
+}
+
+static FILE * open_section( char **data, size_t *length )
+{
+	FILE *stream = open_memstream(data,length);
+	if(!stream) fatal("couldn't allocate column: %s",strerror(errno));
+	return stream;
+}
+
+struct deltadb_columns_writer * deltadb_columns_writer_create( struct list *fields )
+{
+	struct deltadb_columns_writer *w = xxcalloc(1,sizeof(*w));
+	w->index = open_section(&w->index_data,&w->index_length);
+	w->keys = hash_table_create(0,0);
+	w->columns = xxcalloc(list_size(fields),sizeof(*w->columns));
+
+	list_first_item(fields);
+	for(const char *name; (name = list_next_item(fields));) {
+		struct writer_column *c = &w->columns[w->ncolumns++];
+		c->name = xxstrdup(name);
+		c->stream = open_section(&c->data,&c->length);
+	}
+
+	return w;
+}
+
+static void write_op( struct deltadb_columns_writer *w, int type )
+{
+	putc(type,w->index);
+	w->nops++;
+	w->creating = 0;
+}
+
+static struct writer_key * write_key( struct deltadb_columns_writer *w, const char *key )
+{
+	struct writer_key *k = hash_table_lookup(w->keys,key);
+	if(k) {
+		write_varint(w->index,k->id);
+		return k;
+	}
+
+	size_t length = strlen(key);
+	write_varint(w->index,0);
+	write_varint(w->index,length);
+	fwrite(key,1,length,w->index);
+
+	k = xxcalloc(1,sizeof(*k));
+	k->id = ++w->nkeys;
+	k->values = xxcalloc(w->ncolumns,sizeof(*k->values));
+	k->bases = xxcalloc(w->ncolumns,sizeof(*k->bases));
+	hash_table_insert(w->keys,key,k);
+
+	return k;
+}
+
+static void clear_values( struct deltadb_columns_writer *w, struct writer_key *k )
+{
+	int i;
+	for(i=0;i<w->ncolumns;i++) {
+		jx_delete(k->values[i]);
+		k->values[i] = 0;
+	}
+}
+
+static void write_value( struct deltadb_columns_writer *w, FILE *stream, struct jx *value, int64_t *base )
+{
+	if(!value) {
+		putc(TAG_ABSENT,stream);
+		return;
+	}
+
+	switch(value->type) {
+		case JX_INTEGER:
+			putc(TAG_INTEGER,stream);
+			write_varint(stream,ZIGZAG_ENCODE(value->u.integer_value-*base));
+			*base = value->u.integer_value;
+			break;
+		case JX_DOUBLE:
+			putc(TAG_DOUBLE,stream);
+			fwrite(&value->u.double_value,sizeof(value->u.double_value),1,stream);
+			break;
+		case JX_STRING: {
+			size_t length = strlen(value->u.string_value);
+			putc(TAG_STRING,stream);
+			write_varint(stream,length);
+			fwrite(value->u.string_value,1,length,stream);
+			break;
+		}
+		case JX_BOOLEAN:
+			putc(value->u.boolean_value ? TAG_TRUE : TAG_FALSE,stream);
+			break;
+		case JX_NULL:
+			putc(TAG_NULL,stream);
+			break;
+		default:
+			putc(TAG_OTHER,stream);
+			if(!jx_binary_write(stream,value)) w->errors++;
+			break;
+	}
+}
+
+/* Write a change to each field whose value differs from the last one written. */
+
+static void write_values( struct deltadb_columns_writer *w, struct writer_key *k, struct jx *jobject )
+{
+	int i;
+
+	for(i=0;i<w->ncolumns;i++) {
+		struct writer_column *c = &w->columns[i];
+		struct jx *value = jobject->type==JX_OBJECT ? jx_lookup(jobject,c->name) : 0;
+		struct jx *last = k->values[i];
+
+		if(!value && !last) continue;
+		if(value && last && jx_equals(value,last)) continue;
+
+		write_varint(c->stream,w->nops-c->seq);
+		write_varint(c->stream,k->id);
+		write_value(w,c->stream,value,&k->bases[i]);
+		c->seq = w->nops;
+
+		jx_delete(last);
+		k->values[i] = value ? jx_copy(value) : 0;
+	}
+}
+
+void deltadb_columns_write_time( struct deltadb_columns_writer *w, time_t current )
+{
+	write_op(w,'T');
+	write_varint(w->index,ZIGZAG_ENCODE((int64_t)current-w->time));
+	w->time = current;
+}
+
+static void write_record( struct deltadb_columns_writer *w, int type, const char *key, struct jx *jobject )
+{
+	write_op(w,type);
+	struct writer_key *k = write_key(w,key);
+	clear_values(w,k);
+	write_values(w,k,jobject);
+	w->creating = 1;
+}
+
+void deltadb_columns_write_initial( struct deltadb_columns_writer *w, const char *key, struct jx *jobject )
+{
+	write_record(w,'I',key,jobject);
+}
+
+void deltadb_columns_write_create( struct deltadb_columns_writer *w, const char *key, struct jx *jobject )
+{
+	write_record(w,'C',key,jobject);
+}
+
+void deltadb_columns_write_delete( struct deltadb_columns_writer *w, const char *key )
+{
+	write_op(w,'D');
+	struct writer_key *k = write_key(w,key);
+	clear_values(w,k);
+}
+
+void deltadb_columns_write_change( struct deltadb_columns_writer *w, const char *key, struct jx *jobject )
+{
+	struct writer_key *k = hash_table_lookup(w->keys,key);
+	if(!k) return;
+
+	/* Keep the values a record was created with apart from later changes. */
+	if(w->creating) write_op(w,'S');
+
+	write_values(w,k,jobject);
+}
+
+static void write_int64( FILE *stream, int64_t v )
+{
+	fwrite(&v,sizeof(v),1,stream);
+}
+
+int deltadb_columns_writer_close( struct deltadb_columns_writer *w, FILE *stream, long log_size )
+{
+	int i;
+
+	fclose(w->index);
+	for(i=0;i<w->ncolumns;i++) fclose(w->columns[i].stream);
+
+	int64_t offset = DELTADB_COLUMNS_MAGIC_LENGTH + 3*sizeof(int64_t) + sizeof(uint32_t);
+	for(i=0;i<w->ncolumns;i++) {
+		offset += sizeof(uint32_t) + strlen(w->columns[i].name) + 2*sizeof(int64_t);
+	}
+
+	uint32_t ncolumns = w->ncolumns;
+	fwrite(DELTADB_COLUMNS_MAGIC,DELTADB_COLUMNS_MAGIC_LENGTH,1,stream);
+	write_int64(stream,log_size);
+	write_int64(stream,offset);
+	write_int64(stream,w->index_length);
+	fwrite(&ncolumns,sizeof(ncolumns),1,stream);
+
+	offset += w->index_length;
+	for(i=0;i<w->ncolumns;i++) {
+		struct writer_column *c = &w->columns[i];
+		uint32_t length = strlen(c->name);
+		fwrite(&length,sizeof(length),1,stream);
+		fwrite(c->name,1,length,stream);
+		write_int64(stream,offset);
+		write_int64(stream,c->length);
+		offset += c->length;
+	}
+
+	fwrite(w->index_data,1,w->index_length,stream);
+	for(i=0;i<w->ncolumns;i++) {
+		fwrite(w->columns[i].data,1,w->columns[i].length,stream);
+	}
+
+	int result = !w->errors && !ferror(stream);
+
+	char *key;
+	struct writer_key *k;
+	hash_table_firstkey(w->keys);
+	while(hash_table_nextkey(w->keys,&key,(void**)&k)) {
+		clear_values(w,k);
+		free(k->values);
+		free(k->bases);
+		free(k);
+	}
+	hash_table_delete(w->keys);
+
+	for(i=0;i<w->ncolumns;i++) {
+		free(w->columns[i].name);
+		free(w->columns[i].data);
+	}
+	free(w->columns);
+	free(w->index_data);
+	free(w);
+
+	return result;
+}
+
+/* A column being read, with the integer bases of each key. */
+
+struct reader_column {
+	char *name;
+	int64_t offset;
+	int64_t length;
+	int selected;
+	unsigned char *data;
+	const unsigned char *p;
+	const unsigned char *end;
+	uint64_t seq;
+	int64_t *bases;
+	uint64_t nbases;
+};
+
+struct deltadb_columns {
+	FILE *file;
+	int64_t index_offset;
+	int64_t index_length;
+	unsigned char *index;
+	const unsigned char *p;
+	const unsigned char *end;
+	struct reader_column *columns;
+	uint32_t ncolumns;
+	char **keys;
+	uint64_t nkeys;
+	uint64_t keys_size;
+	uint64_t nops;
+	int64_t time;
+	int loaded;
+};
+
+static int read_int64( FILE *stream, int64_t *v )
+{
+	return fread(v,sizeof(*v),1,stream)==1;
+}
+
+struct deltadb_columns * deltadb_columns_open( const char *logdir, int year, int day )
+{
+	char *logname = string_format("%s/%d/%d.log",logdir,year,day);
+	char *filename = string_format("%s/%d/%d.cols",logdir,year,day);
+	struct deltadb_columns *c = 0;
+	struct stat info;
+	char magic[DELTADB_COLUMNS_MAGIC_LENGTH];
+	int64_t log_size;
+	uint32_t i;
+
+	FILE *file = fopen(filename,"r");
+	if(!file) goto failure;
+
+	if(fread(magic,sizeof(magic),1,file)!=1) goto failure;
+	if(memcmp(magic,DELTADB_COLUMNS_MAGIC,sizeof(magic))) goto failure;
+
+	/* An export describes the log as it was, and is no good once the log has grown. */
+	if(!read_int64(file,&log_size)) goto failure;
+	if(stat(logname,&info)<0 || info.st_size!=log_size) goto failure;
+
+	c = xxcalloc(1,sizeof(*c));
+	c->file = file;
+
+	if(!read_int64(file,&c->index_offset)) goto failure;
+	if(!read_int64(file,&c->index_length)) goto failure;
+	if(fread(&c->ncolumns,sizeof(c->ncolumns),1,file)!=1) goto failure;
+
+	c->columns = xxcalloc(c->ncolumns,sizeof(*c->columns));
+	for(i=0;i<c->ncolumns;i++) {
+		struct reader_column *col = &c->columns[i];
+		uint32_t length;
+		if(fread(&length,sizeof(length),1,file)!=1) goto failure;
+		col->name = xxmalloc(length+1);
+		if(fread(col->name,1,length,file)!=length) goto failure;
+		col->name[length] = 0;
+		if(!read_int64(file,&col->offset)) goto failure;
+		if(!read_int64(file,&col->length)) goto failure;
+	}
+
+	free(logname);
+	free(filename);
+	return c;
+
+failure:
+	if(c) {
+		deltadb_columns_close(c);
+	} else if(file) {
+		fclose(file);
+	}
+	free(logname);
+	free(filename);
+	return 0;
+}
+
+int deltadb_columns_select( struct deltadb_columns *c, const char *name )
+{
+	uint32_t i;
+	for(i=0;i<c->ncolumns;i++) {
+		if(!strcmp(c->columns[i].name,name)) {
+			c->columns[i].selected = 1;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static unsigned char * read_section( FILE *file, int64_t offset, int64_t length )
+{
+	unsigned char *data = xxmalloc(length+1);
+	if(fseek(file,offset,SEEK_SET)!=0 || fread(data,1,length,file)!=(size_t)length) {
+		free(data);
+		return 0;
+	}
+	return data;
+}
+
+static int get_varint( const unsigned char **p, const unsigned char *end, uint64_t *v )
+{
+	int shift = 0;
+
+	*v = 0;
+	while(*p<end) {
+		unsigned char b = *(*p)++;
+		*v |= (uint64_t)(b&0x7f) << shift;
+		if(!(b&0x80)) return 1;
+		shift += 7;
+		if(shift>63) return 0;
+	}
+	return 0;
+}
+
+/* Find the position of the next change of a column, or mark it finished. */
+
+static int next_seq( struct reader_column *col )
+{
+	uint64_t delta;
+
+	if(col->p>=col->end) {
+		col->seq = UINT64_MAX;
+		return 1;
+	}
+	if(!get_varint(&col->p,col->end,&delta)) return 0;
+	col->seq += delta;
+	return 1;
+}
+
+static int load( struct deltadb_columns *c )
+{
+	uint32_t i;
+
+	c->index = read_section(c->file,c->index_offset,c->index_length);
+	if(!c->index) return 0;
+	c->p = c->index;
+	c->end = c->index + c->index_length;
+
+	for(i=0;i<c->ncolumns;i++) {
+		struct reader_column *col = &c->columns[i];
+		if(!col->selected) continue;
+		col->data = read_section(c->file,col->offset,col->length);
+		if(!col->data) return 0;
+		col->p = col->data;
+		col->end = col->data + col->length;
+		if(!next_seq(col)) return 0;
+	}
+
+	c->loaded = 1;
+	return 1;
+}
+
+static const char * get_key( struct deltadb_columns *c, const unsigned char **p, const unsigned char *end )
+{
+	uint64_t n, length;
+
+	if(!get_varint(p,end,&n)) return 0;
+
+	if(n>0) {
+		return n<=c->nkeys ? c->keys[n-1] : 0;
+	}
+
+	if(!get_varint(p,end,&length) || length>(uint64_t)(end-*p)) return 0;
+
+	if(c->nkeys==c->keys_size) {
+		c->keys_size = c->keys_size ? c->keys_size*2 : 256;
+		c->keys = xxrealloc(c->keys,c->keys_size*sizeof(*c->keys));
+	}
+
+	char *key = xxmalloc(length+1);
+	memcpy(key,*p,length);
+	key[length] = 0;
+	*p += length;
+
+	c->keys[c->nkeys++] = key;
+	return key;
+}
+
+static struct jx * get_value( struct reader_column *col, uint64_t id, int *ok )
+{
+	uint64_t n;
+	double d;
+	struct jx *value = 0;
+
+	*ok = 0;
+	if(col->p>=col->end) return 0;
+
+	switch(*col->p++) {
+		case TAG_ABSENT:
+			break;
+		case TAG_INTEGER:
+			if(!get_varint(&col->p,col->end,&n)) return 0;
+			if(id>col->nbases) {
+				col->bases = xxrealloc(col->bases,id*sizeof(*col->bases));
+				memset(&col->bases[col->nbases],0,(id-col->nbases)*sizeof(*col->bases));
+				col->nbases = id;
+			}
+			col->bases[id-1] += ZIGZAG_DECODE(n);
+			value = jx_integer(col->bases[id-1]);
+			break;
+		case TAG_DOUBLE:
+			if(col->end-col->p<(long)sizeof(d)) return 0;
+			memcpy(&d,col->p,sizeof(d));
+			col->p += sizeof(d);
+			value = jx_double(d);
+			break;
+		case TAG_STRING: {
+			if(!get_varint(&col->p,col->end,&n) || n>(uint64_t)(col->end-col->p)) return 0;
+			char *s = xxmalloc(n+1);
+			memcpy(s,col->p,n);
+			s[n] = 0;
+			col->p += n;
+			value = jx_string_nocopy(s);
+			break;
+		}
+		case TAG_TRUE:
+			value = jx_boolean(1);
+			break;
+		case TAG_FALSE:
+			value = jx_boolean(0);
+			break;
+		case TAG_NULL:
+			value = jx_null();
+			break;
+		case TAG_OTHER: {
+			FILE *stream = fmemopen((void*)col->p,col->end-col->p,"r");
+			if(!stream) return 0;
+			value = jx_binary_read(stream);
+			col->p += ftell(stream);
+			fclose(stream);
+			if(!value) return 0;
+			break;
+		}
+		default:
+			return 0;
+	}
+
+	*ok = 1;
+	return value;
+}
+
+static int next_change( struct deltadb_columns *c, struct reader_column *col, struct deltadb_columns_event *e )
+{
+	uint64_t id;
+	int ok;
+
+	if(!get_varint(&col->p,col->end,&id) || id<1 || id>c->nkeys) return -1;
+
+	e->type = DELTADB_COLUMNS_CHANGE;
+	e->key = c->keys[id-1];
+	e->name = col->name;
+	e->value = get_value(col,id,&ok);
+	if(!ok || !next_seq(col)) {
+		jx_delete(e->value);
+		e->value = 0;
+		return -1;
+	}
+
+	return 1;
+}
+
+int deltadb_columns_next( struct deltadb_columns *c, struct deltadb_columns_event *e )
+{
+	uint32_t i;
+	uint64_t delta;
+
+	if(!c->loaded && !load(c)) return -1;
+
+	memset(e,0,sizeof(*e));
+
+	/* Changes made since the last operation come before the next one. */
+	for(i=0;i<c->ncolumns;i++) {
+		struct reader_column *col = &c->columns[i];
+		if(col->selected && col->seq==c->nops) return next_change(c,col,e);
+	}
+
+	if(c->p>=c->end) return 0;
+
+	int type = *c->p++;
+	c->nops++;
+
+	switch(type) {
+		case 'T':
+			if(!get_varint(&c->p,c->end,&delta)) return -1;
+			c->time += ZIGZAG_DECODE(delta);
+			e->type = DELTADB_COLUMNS_TIME;
+			e->time = c->time;
+			return 1;
+		case 'I':
+			e->type = DELTADB_COLUMNS_INITIAL;
+			break;
+		case 'C':
+			e->type = DELTADB_COLUMNS_CREATE;
+			break;
+		case 'D':
+			e->type = DELTADB_COLUMNS_DELETE;
+			break;
+		case 'S':
+			e->type = DELTADB_COLUMNS_SYNC;
+			return 1;
+		default:
+			return -1;
+	}
+
+	e->key = get_key(c,&c->p,c->end);
+	return e->key ? 1 : -1;
+}
+
+void deltadb_columns_close( struct deltadb_columns *c )
+{
+	uint32_t i;
+	uint64_t k;
+
+	if(!c) return;
+
+	for(i=0;i<c->ncolumns;i++) {
+		free(c->columns[i].name);
+		free(c->columns[i].data);
+		free(c->columns[i].bases);
+	}
+	for(k=0;k<c->nkeys;k++) free(c->keys[k]);
+
+	free(c->columns);
+	free(c->keys);
+	free(c->index);
+	fclose(c->file);
+	free(c);
+}
+
+/* vim: set noexpandtab tabstop=4: */
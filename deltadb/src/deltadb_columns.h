@@ -0,0 +1,115 @@
+/*
+Copyright (C) 2015- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef DELTADB_COLUMNS_H
+#define DELTADB_COLUMNS_H
+
+#include "jx.h"
+#include "list.h"
+
+#include <stdio.h>
+#include <time.h>
+
+/*
+Columnar exports of selected fields, so that queries that only look at
+a few fields of each record can be answered without replaying the log.
+
+deltadb_query --export writes DIR/YEAR/DAY.cols for each day of a query.
+It holds the history of that day's checkpoint and log reduced to the
+selected fields: an index of the time records and of the records
+created and deleted, in log order, and one section per field with the
+changes to that field.  The size of DAY.log at the time of the export
+is kept, so that an export is only used while the log is unchanged.
+
+The file consists of a header, a table of contents, and the sections,
+with integers in host byte order as in deltadb_binary.h:
+
+<pre>
+header:  DELTADB_COLUMNS_MAGIC [log size:8] [index offset:8] [index length:8] [column count:4]
+column:  [name length:4] [name] [offset:8] [length:8]
+</pre>
+
+The index is a sequence of operations, each a one-byte type:
+
+<pre>
+T [time]    I [key]    C [key]    D [key]    S
+</pre>
+
+time is the zigzag varint difference from the previous time record.
+I is a record of the day's checkpoint, and C a record created by the log.
+A key is a varint n: zero introduces a new key, given as a varint length
+and its bytes, and n refers to the n-th key introduced in the file.
+The values a record is created with follow its I or C, and S ends them
+when the record is changed again before the next operation.
+
+A column is a sequence of changes:
+
+<pre>
+[seq] [key] [tag] [value]
+</pre>
+
+seq is the varint difference from the previous change in the column of
+the number of index operations before the change, and key is the number
+of a key introduced by the index.  Integers are stored as the zigzag
+varint difference from the last integer of the same field of the same
+key, doubles as 8 bytes, strings as a varint length and their bytes,
+and other values in jx_binary form.  A change of the absent tag means
+that the field was removed.
+*/
+
+#define DELTADB_COLUMNS_MAGIC "\xdb" "DDBCOL1"
+#define DELTADB_COLUMNS_MAGIC_LENGTH 8
+
+typedef enum {
+	DELTADB_COLUMNS_TIME,
+	DELTADB_COLUMNS_INITIAL,
+	DELTADB_COLUMNS_CREATE,
+	DELTADB_COLUMNS_DELETE,
+	DELTADB_COLUMNS_SYNC,
+	DELTADB_COLUMNS_CHANGE
+} deltadb_columns_event_t;
+
+struct deltadb_columns_event {
+	deltadb_columns_event_t type;
+	time_t time;
+	const char *key;
+	const char *name;
+	struct jx *value;
+};
+
+struct deltadb_columns_writer;
+struct deltadb_columns;
+
+/* Create a writer of the given list of field names. */
+struct deltadb_columns_writer * deltadb_columns_writer_create( struct list *fields );
+
+void deltadb_columns_write_time( struct deltadb_columns_writer *w, time_t current );
+void deltadb_columns_write_initial( struct deltadb_columns_writer *w, const char *key, struct jx *jobject );
+void deltadb_columns_write_create( struct deltadb_columns_writer *w, const char *key, struct jx *jobject );
+void deltadb_columns_write_delete( struct deltadb_columns_writer *w, const char *key );
+
+/* Record the state of an existing record after it has been changed. */
+void deltadb_columns_write_change( struct deltadb_columns_writer *w, const char *key, struct jx *jobject );
+
+/* Write out the file and delete the writer.  Returns false on any write error. */
+int deltadb_columns_writer_close( struct deltadb_columns_writer *w, FILE *stream, long log_size );
+
+/* Open the export of a day, or return null if there is none or its log has changed since. */
+struct deltadb_columns * deltadb_columns_open( const char *logdir, int year, int day );
+
+/* Read this field when iterating.  Returns false if the export does not have it. */
+int deltadb_columns_select( struct deltadb_columns *c, const char *name );
+
+/*
+Get the next event of the day, in log order.  The value of a change belongs
+to the caller, and is null if the field was removed.  Returns zero at the
+end of the day, or -1 if the file is corrupt.
+*/
+int deltadb_columns_next( struct deltadb_columns *c, struct deltadb_columns_event *e );
+
+void deltadb_columns_close( struct deltadb_columns *c );
+
+#endif
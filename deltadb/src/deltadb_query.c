@@ -7,6 +7,9 @@ See the file COPYING for details.
 #include "deltadb_stream.h"
 #include "deltadb_reduction.h"
 #include "deltadb_query.h"
+#include "deltadb_binary.h"
+#include "deltadb_snapshot.h"
+#include "deltadb_columns.h"
 
 #include "jx_eval.h"
 #include "jx_print.h"
@@ -28,6 +31,9 @@ See the file COPYING for details.
 #include <sys/types.h>
 #include <stdarg.h>
 #include <ctype.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <limits.h>
 
 struct deltadb_query {
 	struct hash_table *table;
@@ -42,6 +48,10 @@ struct deltadb_query {
 	time_t deferred_time;
 	time_t last_output_time;
 	deltadb_display_mode_t display_mode;
+	int parallel;
+	int displays;
+	long first_display_end;
+	struct deltadb_columns_writer *columns;
 };
 
 struct deltadb_query * deltadb_query_create()
@@ -57,7 +67,15 @@ struct deltadb_query * deltadb_query_create()
 
 void deltadb_query_delete( struct deltadb_query *query )
 {
+	char *key;
+	struct jx *jobject;
+
 	if(!query) return;
+
+	hash_table_firstkey(query->table);
+	while(hash_table_nextkey(query->table,&key,(void**)&jobject)) {
+		jx_delete(jobject);
+	}
 	hash_table_delete(query->table);
 	jx_delete(query->filter_expr);
 	jx_delete(query->where_expr);
@@ -96,6 +114,11 @@ void deltadb_query_set_interval( struct deltadb_query *query, int interval )
 	query->display_every = interval;
 }
 
+void deltadb_query_set_parallel( struct deltadb_query *query, int nprocs )
+{
+	query->parallel = nprocs;
+}
+
 void deltadb_query_add_output( struct deltadb_query *query, struct jx *expr )
 {
 	list_push_tail(query->output_exprs,expr);
@@ -134,7 +157,9 @@ static int compat_checkpoint_read( struct deltadb_query *query, const char *file
 				struct jx *j = nvpair_to_jx(nv);
 				/* skip objects that don't match the filter */
 				if(deltadb_boolean_expr(query->filter_expr,j)) {
-					hash_table_insert(query->table,key,j);
+					if(hash_table_insert(query->table,key,j) && query->columns) {
+						deltadb_columns_write_initial(query->columns,key,j);
+					}
 				} else {
 					jx_delete(j);
 				}
@@ -151,6 +176,29 @@ static int compat_checkpoint_read( struct deltadb_query *query, const char *file
 	return 1;
 }
 
+/* Move the objects of a checkpoint into the table, then delete it. */
+
+static void checkpoint_load( struct deltadb_query *query, struct jx *jcheckpoint )
+{
+	/* For each key and value, move the value over to the hash table. */
+
+	/* Skip objects that don't match the filter. */
+
+	struct jx_pair *p;
+	for(p=jcheckpoint->u.pairs;p;p=p->next) {
+		if(p->key->type!=JX_STRING) continue;
+		if(!deltadb_boolean_expr(query->filter_expr,p->value)) continue;
+		if(hash_table_insert(query->table,p->key->u.string_value,p->value) && query->columns) {
+			deltadb_columns_write_initial(query->columns,p->key->u.string_value,p->value);
+		}
+		p->value = 0;
+	}
+
+	/* Delete the leftover object with empty pairs. */
+
+	jx_delete(jcheckpoint);
+}
+
 /* Get a complete checkpoint file and reconstitute the state of the table. */
 
 static int checkpoint_read( struct deltadb_query *query, const char *filename )
@@ -168,23 +216,28 @@ static int checkpoint_read( struct deltadb_query *query, const char *filename )
 		return compat_checkpoint_read(query,filename);
 	}
 
-	/* For each key and value, move the value over to the hash table. */
+	checkpoint_load(query,jcheckpoint);
 
-	/* Skip objects that don't match the filter. */
+	return 1;
+}
 
-	struct jx_pair *p;
-	for(p=jcheckpoint->u.pairs;p;p=p->next) {
-		if(p->key->type!=JX_STRING) continue;
-		if(!deltadb_boolean_expr(query->filter_expr,p->value)) continue;
-		hash_table_insert(query->table,p->key->u.string_value,p->value);
-		p->value = 0;
-	}
+/*
+Load the latest intra-day snapshot taken no later than starttime.
+Returns the log offset at which to continue, or -1 if there is none.
+*/
 
-	/* Delete the leftover object with empty pairs. */
+static long snapshot_read( struct deltadb_query *query, const char *logdir, int year, int day, time_t starttime )
+{
+	long log_offset, snapshot_offset;
 
-	jx_delete(jcheckpoint);
+	if(!deltadb_snapshot_find(logdir,year,day,starttime,&log_offset,&snapshot_offset)) return -1;
 
-	return 1;
+	struct jx *jsnapshot = deltadb_snapshot_read(logdir,year,day,snapshot_offset);
+	if(!jsnapshot) return -1;
+
+	checkpoint_load(query,jsnapshot);
+
+	return log_offset;
 }
 
 static void display_reduce_exprs( struct deltadb_query *query, time_t current )
@@ -338,7 +391,9 @@ int deltadb_create_event( struct deltadb_query *query, const char *key, struct j
 		return 1;
 	}
 
-	hash_table_insert(query->table,key,jobject);
+	if(hash_table_insert(query->table,key,jobject) && query->columns) {
+		deltadb_columns_write_create(query->columns,key,jobject);
+	}
 
 	if(query->display_mode==DELTADB_DISPLAY_STREAM) {
 		display_deferred_time(query);
@@ -356,6 +411,8 @@ int deltadb_delete_event( struct deltadb_query *query, const char *key )
 	if(jobject) {
 		jx_delete(jobject);
 
+		if(query->columns) deltadb_columns_write_delete(query->columns,key);
+
 		if(query->display_mode==DELTADB_DISPLAY_STREAM) {
 			display_deferred_time(query);
 			fprintf(query->output_stream,"D %s\n",key);
@@ -410,6 +467,8 @@ int deltadb_merge_event( struct deltadb_query *query, const char *key, struct jx
 
 	jx_delete(update);
 
+	if(query->columns) deltadb_columns_write_change(query->columns,key,current);
+
 	return 1;
 }
 
@@ -425,6 +484,8 @@ int deltadb_update_event( struct deltadb_query *query, const char *key, const ch
 	jx_delete(jx_remove(jobject,jname));
 	jx_insert(jobject,jname,jvalue);
 
+	if(query->columns) deltadb_columns_write_change(query->columns,key,jobject);
+
 	if(query->display_mode==DELTADB_DISPLAY_STREAM) {
 		display_deferred_time(query);
 		char *str = jx_print_string(jvalue);
@@ -444,6 +505,8 @@ int deltadb_remove_event( struct deltadb_query *query, const char *key, const ch
 	jx_delete(jx_remove(jobject,jname));
 	jx_delete(jname);
 
+	if(query->columns) deltadb_columns_write_change(query->columns,key,jobject);
+
 	if(query->display_mode==DELTADB_DISPLAY_STREAM) {
 		display_deferred_time(query);
 		fprintf(query->output_stream,"R %s %s\n",key,name);
@@ -457,6 +520,12 @@ int deltadb_time_event( struct deltadb_query *query, time_t starttime, time_t st
 {
 	if(current>stoptime) return 0;
 
+	/* An export records every time and displays nothing. */
+	if(query->columns) {
+		deltadb_columns_write_time(query->columns,current);
+		return 1;
+	}
+
 	if(current < (query->display_next)) return 1;
 
 	query->display_next += query->display_every;
@@ -472,6 +541,8 @@ int deltadb_time_event( struct deltadb_query *query, time_t starttime, time_t st
 		display_reduce_exprs(query,current);
 	}
 
+	if(query->displays++==0) query->first_display_end = ftell(query->output_stream);
+
 	return 1;
 }
 
@@ -505,34 +576,40 @@ int deltadb_query_execute_stream( struct deltadb_query *query, FILE *stream, tim
 }
 
 /*
-Execute a query on a directory structure.
-Play the log from starttime to stoptime by opening the appropriate
-checkpoint file and working ahead in the various log files.
+Play the logs of the days from year/day to stopyear/stopday, starting
+from the latest snapshot before starttime, or else (and always in
+stream mode) the first day's checkpoint file.  Returns false if the stop time was reached.
 */
 
-int deltadb_query_execute_dir( struct deltadb_query *query, const char *logdir, time_t starttime, time_t stoptime )
+static int execute_days( struct deltadb_query *query, const char *logdir, int year, int day, int stopyear, int stopday, time_t starttime, time_t stoptime )
 {
 	int file_errors = 0;
+	int keepgoing = 1;
 
-	query->display_next = starttime;
-
-	struct tm *starttm = localtime(&starttime);
-
-	int year = starttm->tm_year + 1900;
-	int day = starttm->tm_yday;
-
-	struct tm *stoptm = localtime(&stoptime);
+	/*
+	A stream replays every change of the first day from midnight,
+	so it cannot skip ahead to a snapshot.
+	*/
 
-	int stopyear = stoptm->tm_year + 1900;
-	int stopday = stoptm->tm_yday;
-
-	char *filename = string_format("%s/%d/%d.ckpt",logdir,year,day);
-	checkpoint_read(query,filename);
-	free(filename);
+	long offset = -1;
+	if(query->display_mode!=DELTADB_DISPLAY_STREAM) {
+		offset = snapshot_read(query,logdir,year,day,starttime);
+	}
+	if(offset<0) {
+		offset = 0;
+		char *filename = string_format("%s/%d/%d.ckpt",logdir,year,day);
+		checkpoint_read(query,filename);
+		free(filename);
+	}
 
 	while(1) {
 		char *filename = string_format("%s/%d/%d.log",logdir,year,day);
 		FILE *file = fopen(filename,"r");
+
+		// Only the first log may start at a snapshot.
+		long seek = offset;
+		offset = 0;
+
 		if(!file) {
 			file_errors += 1;
 			fprintf(stderr,"couldn't open %s: %s\n",filename,strerror(errno));
@@ -541,8 +618,21 @@ int deltadb_query_execute_dir( struct deltadb_query *query, const char *logdir,
 				break;
 
 		} else {
+			// A binary log finds the block at the text offset by itself.
+			int binary = deltadb_binary_detect(file);
+			if(seek && !binary && fseek(file,seek,SEEK_SET)!=0) {
+				fprintf(stderr,"couldn't seek in %s: %s\n",filename,strerror(errno));
+				free(filename);
+				fclose(file);
+				break;
+			}
 			free(filename);
-			int keepgoing = deltadb_process_stream(query,file,starttime,stoptime);
+
+			if(binary) {
+				keepgoing = deltadb_process_binary_stream(query,file,seek,starttime,stoptime);
+			} else {
+				keepgoing = deltadb_process_stream(query,file,starttime,stoptime);
+			}
 			starttime = 0;
 
 			fclose(file);
@@ -558,10 +648,555 @@ int deltadb_query_execute_dir( struct deltadb_query *query, const char *logdir,
 		}
 
 		// If we have passed the file, stop.
-		if(year>=stopyear && day>stopday) break;
+		if(year>stopyear || (year==stopyear && day>stopday)) break;
+	}
+
+	return keepgoing;
+}
+
+/*
+A run of days that can be replayed on its own, because its first day
+has a checkpoint or is the first day of the query.  The output of the
+run is kept in a temporary file until the runs before it are written.
+The worker reports where its display times stopped through a pipe.
+*/
+
+struct deltadb_run_result {
+	time_t display_next;
+	int displays;
+	long first_display_end;
+};
+
+struct deltadb_run {
+	int year, day;
+	int stopyear, stopday;
+	time_t starttime;
+	time_t display_next;
+	FILE *output;
+	int result_fd;
+	struct deltadb_run_result result;
+	pid_t pid;
+	int done;
+	int failed;
+};
+
+static void run_start( struct deltadb_query *query, const char *logdir, struct deltadb_run *run, time_t stoptime )
+{
+	int fds[2];
+
+	run->output = tmpfile();
+	if(!run->output) fatal("couldn't create temporary file: %s",strerror(errno));
+	if(pipe(fds)<0) fatal("couldn't create pipe: %s",strerror(errno));
+
+	fflush(0);
+
+	run->pid = fork();
+	if(run->pid==0) {
+		close(fds[0]);
+		query->output_stream = run->output;
+		query->display_next = run->display_next;
+		execute_days(query,logdir,run->year,run->day,run->stopyear,run->stopday,run->starttime,stoptime);
+		if(fflush(run->output)!=0 || ferror(run->output)) _exit(1);
+
+		struct deltadb_run_result result;
+		memset(&result,0,sizeof(result));
+		result.display_next = query->display_next;
+		result.displays = query->displays;
+		result.first_display_end = query->first_display_end;
+		if(write(fds[1],&result,sizeof(result))!=sizeof(result)) _exit(1);
+		_exit(0);
+	} else if(run->pid<0) {
+		fatal("couldn't fork: %s",strerror(errno));
+	}
+
+	close(fds[1]);
+	run->result_fd = fds[0];
+}
+
+static void run_wait( struct deltadb_run *run, int status )
+{
+	run->done = 1;
+
+	if(!WIFEXITED(status) || WEXITSTATUS(status)!=0) {
+		run->failed = 1;
+	} else if(read(run->result_fd,&run->result,sizeof(run->result))!=sizeof(run->result)) {
+		run->failed = 1;
+	}
+	close(run->result_fd);
+
+	if(run->failed) fprintf(stderr,"deltadb_query: query of %d/%d failed\n",run->year,run->day);
+}
+
+/*
+Write out the output of a run.  A run that does not start the query
+begins with the last display time before its first day, in case the
+previous run ended before reaching it.  If the previous run did reach
+it, the first display of this run repeats it and is skipped.
+*/
+
+static void run_finish( struct deltadb_query *query, struct deltadb_run *run, struct deltadb_run *prev )
+{
+	char buffer[65536];
+	size_t n;
+
+	rewind(run->output);
+
+	if(prev && !prev->failed && !run->failed && run->result.displays>0 && prev->result.display_next>run->display_next) {
+		fseek(run->output,run->result.first_display_end,SEEK_SET);
+	}
+
+	while((n=fread(buffer,1,sizeof(buffer),run->output))>0) {
+		fwrite(buffer,1,n,query->output_stream);
+	}
+	fclose(run->output);
+	run->output = 0;
+}
+
+/*
+Replay runs of days in up to query->parallel processes at once,
+then write out their results in time order.  Each run starts from
+its own checkpoint, and the output times are those of the sequential
+query, as long as the log has a time record in every display interval.
+Returns false if any run failed.
+*/
+
+static int execute_parallel( struct deltadb_query *query, const char *logdir, int year, int day, int stopyear, int stopday, time_t starttime, time_t stoptime )
+{
+	struct deltadb_run *runs = 0;
+	int nruns = 0;
+
+	while(1) {
+		char *filename = string_format("%s/%d/%d.ckpt",logdir,year,day);
+		int has_checkpoint = access(filename,R_OK)==0;
+		free(filename);
+
+		if(nruns==0 || has_checkpoint) {
+			struct tm t;
+			memset(&t,0,sizeof(t));
+			t.tm_year = year - 1900;
+			t.tm_mday = day + 1;
+			t.tm_isdst = -1;
+			time_t daystart = mktime(&t);
+
+			runs = realloc(runs,(nruns+1)*sizeof(*runs));
+			struct deltadb_run *run = &runs[nruns++];
+			memset(run,0,sizeof(*run));
+			run->year = year;
+			run->day = day;
+			if(nruns==1) {
+				run->starttime = starttime;
+				run->display_next = starttime;
+			} else {
+				run->starttime = daystart;
+				run->display_next = starttime;
+				if(query->display_every>0 && daystart>starttime) {
+					run->display_next += (daystart-starttime)/query->display_every*query->display_every;
+				}
+			}
+		}
+
+		struct deltadb_run *run = &runs[nruns-1];
+		run->stopyear = year;
+		run->stopday = day;
+
+		day++;
+		if(day>=days_in_year(year)) {
+			year++;
+			day = 0;
+		}
+
+		if(year>stopyear || (year==stopyear && day>stopday)) break;
 	}
 
+	int started = 0;
+	int finished = 0;
+	int running = 0;
+	int failed = 0;
+
+	while(finished<nruns) {
+		while(running<query->parallel && started<nruns) {
+			run_start(query,logdir,&runs[started++],stoptime);
+			running++;
+		}
+
+		int status;
+		pid_t pid = wait(&status);
+		if(pid<0) break;
+
+		for(int i=0;i<started;i++) {
+			if(runs[i].pid==pid) {
+				run_wait(&runs[i],status);
+				if(runs[i].failed) failed = 1;
+				running--;
+				break;
+			}
+		}
+
+		while(finished<started && runs[finished].done) {
+			run_finish(query,&runs[finished],finished>0 ? &runs[finished-1] : 0);
+			finished++;
+		}
+	}
+
+	free(runs);
+
+	return !failed && finished==nruns;
+}
+
+/*
+Execute a query on a directory structure.
+Play the log from starttime to stoptime by opening the latest snapshot
+before starttime, or else the day's checkpoint file, and working ahead
+in the various log files.
+*/
+
+int deltadb_query_execute_dir( struct deltadb_query *query, const char *logdir, time_t starttime, time_t stoptime )
+{
+	query->display_next = starttime;
+
+	struct tm *starttm = localtime(&starttime);
+
+	int year = starttm->tm_year + 1900;
+	int day = starttm->tm_yday;
+
+	struct tm *stoptm = localtime(&stoptime);
+
+	int stopyear = stoptm->tm_year + 1900;
+	int stopday = stoptm->tm_yday;
+
+	/* Streams must carry the state from one day to the next. */
+	if(query->parallel>1 && query->display_mode!=DELTADB_DISPLAY_STREAM) {
+		return execute_parallel(query,logdir,year,day,stopyear,stopday,starttime,stoptime);
+	}
+
+	execute_days(query,logdir,year,day,stopyear,stopday,starttime,stoptime);
+
 	return 1;
 }
 
+/*
+Replay one day from its checkpoint, and write the given fields of its
+records into DIR/YEAR/DAY.cols.
+*/
+
+static int export_day( const char *logdir, struct list *fields, int year, int day )
+{
+	char *logname = string_format("%s/%d/%d.log",logdir,year,day);
+	char *ckptname = string_format("%s/%d/%d.ckpt",logdir,year,day);
+	char *filename = string_format("%s/%d/%d.cols",logdir,year,day);
+	char *tmpname = string_format("%s.tmp",filename);
+	int result = 0;
+
+	FILE *log = fopen(logname,"r");
+	if(!log) {
+		fprintf(stderr,"couldn't open %s: %s\n",logname,strerror(errno));
+		goto done;
+	}
+
+	FILE *output = fopen(tmpname,"w");
+	if(!output) {
+		fprintf(stderr,"couldn't create %s: %s\n",tmpname,strerror(errno));
+		fclose(log);
+		goto done;
+	}
+
+	/* Only a stream is displayed as the events are played. */
+	struct deltadb_query *query = deltadb_query_create();
+	query->display_mode = DELTADB_DISPLAY_EXPRS;
+	query->columns = deltadb_columns_writer_create(fields);
+
+	checkpoint_read(query,ckptname);
+
+	/* The export describes the log up to where it was read. */
+	long log_size;
+	if(deltadb_binary_detect(log)) {
+		deltadb_process_binary_stream(query,log,0,0,LONG_MAX);
+		struct stat info;
+		fstat(fileno(log),&info);
+		log_size = info.st_size;
+	} else {
+		deltadb_process_stream(query,log,0,LONG_MAX);
+		log_size = ftell(log);
+	}
+	fclose(log);
+
+	result = deltadb_columns_writer_close(query->columns,output,log_size);
+	query->columns = 0;
+	deltadb_query_delete(query);
+
+	if(fclose(output)!=0) result = 0;
+
+	if(result && rename(tmpname,filename)!=0) result = 0;
+
+	if(!result) {
+		fprintf(stderr,"couldn't write %s: %s\n",filename,strerror(errno));
+		unlink(tmpname);
+	}
+
+done:
+	free(logname);
+	free(ckptname);
+	free(filename);
+	free(tmpname);
+	return result;
+}
+
+/*
+Export the given fields of every day from starttime to stoptime,
+each replayed on its own.  Returns false if any day failed.
+*/
+
+int deltadb_query_export_columns( const char *logdir, struct list *fields, time_t starttime, time_t stoptime )
+{
+	struct tm *starttm = localtime(&starttime);
+
+	int year = starttm->tm_year + 1900;
+	int day = starttm->tm_yday;
+
+	struct tm *stoptm = localtime(&stoptime);
+
+	int stopyear = stoptm->tm_year + 1900;
+	int stopday = stoptm->tm_yday;
+
+	int errors = 0;
+
+	while(1) {
+		if(!export_day(logdir,fields,year,day)) errors++;
+
+		day++;
+		if(day>=days_in_year(year)) {
+			year++;
+			day = 0;
+		}
+
+		if(year>stopyear || (year==stopyear && day>stopday)) break;
+	}
+
+	return errors==0;
+}
+
+/*
+Add the fields that an expression refers to, or return false
+if it may depend on the whole record.
+*/
 
+static int expr_fields( struct jx *j, struct hash_table *fields )
+{
+	if(!j) return 1;
+
+	switch(j->type) {
+		case JX_SYMBOL:
+			if(!hash_table_lookup(fields,j->u.symbol_name)) {
+				hash_table_insert(fields,j->u.symbol_name,(void*)1);
+			}
+			return 1;
+		case JX_OPERATOR:
+			if(j->u.oper.type==JX_OP_CALL) {
+				/* template() is given the record itself, other functions only their arguments. */
+				struct jx *func = j->u.oper.left;
+				if(jx_istype(func,JX_SYMBOL) && !strcmp(func->u.symbol_name,"template")) return 0;
+				return expr_fields(j->u.oper.right,fields);
+			}
+			return expr_fields(j->u.oper.left,fields) && expr_fields(j->u.oper.right,fields);
+		case JX_ARRAY:
+			for(struct jx_item *i=j->u.items;i;i=i->next) {
+				if(!expr_fields(i->value,fields)) return 0;
+				for(struct jx_comprehension *c=i->comp;c;c=c->next) {
+					if(!expr_fields(c->elements,fields) || !expr_fields(c->condition,fields)) return 0;
+				}
+			}
+			return 1;
+		case JX_OBJECT:
+			for(struct jx_pair *p=j->u.pairs;p;p=p->next) {
+				if(!expr_fields(p->key,fields) || !expr_fields(p->value,fields)) return 0;
+			}
+			return 1;
+		default:
+			return 1;
+	}
+}
+
+static int query_fields( struct deltadb_query *query, struct hash_table *fields )
+{
+	if(!expr_fields(query->filter_expr,fields)) return 0;
+	if(!expr_fields(query->where_expr,fields)) return 0;
+
+	list_first_item(query->output_exprs);
+	for(struct jx *j; (j = list_next_item(query->output_exprs));) {
+		if(!expr_fields(j,fields)) return 0;
+	}
+
+	list_first_item(query->reduce_exprs);
+	for(struct deltadb_reduction *r; (r = list_next_item(query->reduce_exprs));) {
+		if(!expr_fields(r->expr,fields)) return 0;
+	}
+
+	return 1;
+}
+
+static int select_fields( struct deltadb_columns *c, struct hash_table *fields )
+{
+	char *name;
+	void *unused;
+
+	hash_table_firstkey(fields);
+	while(hash_table_nextkey(fields,&name,&unused)) {
+		if(!deltadb_columns_select(c,name)) return 0;
+	}
+
+	return 1;
+}
+
+/*
+Play the events of one day's export into a table of records that only
+have the exported fields.  Records are filtered once the values they
+were created with are known, and the checkpoints of later days are
+skipped, since the table carries over from the day before, as in a
+replay of the log.  Returns false if the stop time was reached.
+*/
+
+static int execute_columns_day( struct deltadb_query *query, struct deltadb_columns *c, int first, time_t starttime, time_t stoptime )
+{
+	struct deltadb_columns_event e;
+	const char *creating = 0;
+	struct jx *created = 0;
+	int keepgoing = 1;
+	int result = 0;
+
+	while(keepgoing && (result = deltadb_columns_next(c,&e))>0) {
+		if(e.type==DELTADB_COLUMNS_CHANGE) {
+			struct jx *jobject;
+			if(creating && !strcmp(e.key,creating)) {
+				jobject = created;
+			} else {
+				jobject = hash_table_lookup(query->table,e.key);
+			}
+
+			if(jobject) {
+				struct jx *jname = jx_string(e.name);
+				jx_delete(jx_remove(jobject,jname));
+				if(e.value) {
+					jx_insert(jobject,jname,e.value);
+				} else {
+					jx_delete(jname);
+				}
+			} else {
+				jx_delete(e.value);
+			}
+			continue;
+		}
+
+		if(created) {
+			if(deltadb_boolean_expr(query->filter_expr,created)) {
+				hash_table_insert(query->table,creating,created);
+			} else {
+				jx_delete(created);
+			}
+		}
+		creating = 0;
+		created = 0;
+
+		switch(e.type) {
+			case DELTADB_COLUMNS_TIME:
+				keepgoing = deltadb_time_event(query,starttime,stoptime,e.time);
+				break;
+			case DELTADB_COLUMNS_INITIAL:
+			case DELTADB_COLUMNS_CREATE:
+				creating = e.key;
+				if(e.type==DELTADB_COLUMNS_CREATE || first) {
+					/* As in a replay, a record that exists is not replaced. */
+					if(!hash_table_lookup(query->table,e.key)) created = jx_object(0);
+				}
+				break;
+			case DELTADB_COLUMNS_DELETE:
+				jx_delete(hash_table_remove(query->table,e.key));
+				break;
+			default:
+				break;
+		}
+	}
+
+	if(created) {
+		if(deltadb_boolean_expr(query->filter_expr,created)) {
+			hash_table_insert(query->table,creating,created);
+		} else {
+			jx_delete(created);
+		}
+	}
+
+	if(keepgoing && result<0) {
+		fprintf(stderr,"corrupt column data\n");
+		return 0;
+	}
+
+	return keepgoing;
+}
+
+/*
+Answer a query from the exports of its days, if every one of them is
+current and has all the fields that the query refers to.  Returns false,
+having displayed nothing, if the query must be replayed instead.
+*/
+
+int deltadb_query_execute_columns( struct deltadb_query *query, const char *logdir, time_t starttime, time_t stoptime )
+{
+	if(query->display_mode!=DELTADB_DISPLAY_EXPRS && query->display_mode!=DELTADB_DISPLAY_REDUCE) return 0;
+
+	struct tm *starttm = localtime(&starttime);
+
+	int startyear = starttm->tm_year + 1900;
+	int startday = starttm->tm_yday;
+
+	struct tm *stoptm = localtime(&stoptime);
+
+	int stopyear = stoptm->tm_year + 1900;
+	int stopday = stoptm->tm_yday;
+
+	struct hash_table *fields = hash_table_create(0,0);
+	int ok = query_fields(query,fields);
+	int year, day;
+
+	/* Check every day before displaying anything. */
+	for(year=startyear,day=startday;ok;) {
+		struct deltadb_columns *c = deltadb_columns_open(logdir,year,day);
+		ok = c && select_fields(c,fields);
+		deltadb_columns_close(c);
+
+		day++;
+		if(day>=days_in_year(year)) {
+			year++;
+			day = 0;
+		}
+
+		if(year>stopyear || (year==stopyear && day>stopday)) break;
+	}
+
+	if(ok) {
+		query->display_next = starttime;
+
+		for(year=startyear,day=startday;;) {
+			struct deltadb_columns *c = deltadb_columns_open(logdir,year,day);
+			if(!c || !select_fields(c,fields)) {
+				fprintf(stderr,"columns of %d/%d changed during the query\n",year,day);
+				deltadb_columns_close(c);
+				break;
+			}
+
+			int keepgoing = execute_columns_day(query,c,year==startyear && day==startday,starttime,stoptime);
+			deltadb_columns_close(c);
+			if(!keepgoing) break;
+
+			day++;
+			if(day>=days_in_year(year)) {
+				year++;
+				day = 0;
+			}
+
+			if(year>stopyear || (year==stopyear && day>stopday)) break;
+		}
+	}
+
+	hash_table_delete(fields);
+
+	return ok;
+}
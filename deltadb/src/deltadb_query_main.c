@@ -15,6 +15,7 @@
 #include "jx_print.h"
 #include "stringtools.h"
 #include "b64.h"
+#include "list.h"
 
 #include "deltadb_query.h"
 #include "deltadb_stream.h"
@@ -90,6 +91,8 @@ static struct option long_options[] =
 	{"every", required_argument, 0, 'e'},
 	{"json", no_argument, 0, 'j' },
 	{"epoch", no_argument, 0, 't'},
+	{"parallel", required_argument, 0, 'P'},
+	{"export", required_argument, 0, 'x'},
 	{"version", no_argument, 0, 'v'},
 	{"help", no_argument, 0, 'h'},
 	{0,0,0,0}
@@ -111,6 +114,8 @@ void show_help()
 	printf("  --every <interval>  Compute output at this time interval.\n");
 	printf("  --json              Output raw JSON objects.\n");
 	printf("  --epoch             Display time column in Unix epoch format.\n");
+	printf("  --parallel <n>      Replay days in up to n processes at once.\n");
+	printf("  --export <fields>   Export these fields of each day into columns.\n");
 	printf("  --version           Show software version.\n");
 	printf("  --help              Show this help text.\n");
 }
@@ -136,6 +141,7 @@ int main( int argc, char *argv[] )
 	int epoch_mode = 0;
 	int nreduces = 0;
 	int noutputs = 0;
+	struct list *export_fields = 0;
 
 	char reduce_name[1024];
 	char reduce_attr[1024];
@@ -235,6 +241,15 @@ int main( int argc, char *argv[] )
 			epoch_mode = 1;
 			deltadb_query_set_epoch_mode(query,epoch_mode);
 			break;
+		case 'P':
+			deltadb_query_set_parallel(query,atoi(optarg));
+			break;
+		case 'x':
+			if(!export_fields) export_fields = list_create();
+			for(char *name=strtok(optarg,","); name; name=strtok(0,",")) {
+				list_push_tail(export_fields,name);
+			}
+			break;
 		case 'v':
 			cctools_version_print(stdout,"deltadb_query");
 			break;
@@ -263,6 +278,17 @@ int main( int argc, char *argv[] )
 		return 1;
 	}
 
+	if(export_fields) {
+		if(!dbdir) {
+			fprintf(stderr,"deltadb_query: --export requires --db.\n");
+			return 1;
+		}
+		int ok = deltadb_query_export_columns(dbdir,export_fields,start_time,stop_time);
+		list_delete(export_fields);
+		deltadb_query_delete(query);
+		return ok ? 0 : 1;
+	}
+
 	if(dbfile) {
 		FILE *file = fopen(dbfile,"r");
 		if(!file) {
@@ -272,7 +298,13 @@ int main( int argc, char *argv[] )
 		deltadb_query_execute_stream(query,file,start_time,stop_time);
 		fclose(file);
 	} else if(dbdir) {
-		deltadb_query_execute_dir(query,dbdir,start_time,stop_time);
+		/* Outputs of exported fields need not replay the log. */
+		if(!deltadb_query_execute_columns(query,dbdir,start_time,stop_time)) {
+			if(!deltadb_query_execute_dir(query,dbdir,start_time,stop_time)) {
+				deltadb_query_delete(query);
+				return 1;
+			}
+		}
 	} else if(dbhost) {
 
 		if(!filter_expr) filter_expr = jx_boolean(1);
@@ -0,0 +1,65 @@
+/*
+Copyright (C) 2015- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "deltadb_snapshot.h"
+
+#include "jx_parse.h"
+
+#include "debug.h"
+#include "stringtools.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int deltadb_snapshot_find( const char *logdir, int year, int day, time_t when, long *log_offset, long *snapshot_offset )
+{
+	long long t;
+	long l, s;
+	int found = 0;
+
+	char *filename = string_format("%s/%d/%d.idx",logdir,year,day);
+	FILE *file = fopen(filename,"r");
+	free(filename);
+	if(!file) return 0;
+
+	/* Snapshots are indexed in order, and an incomplete last line is ignored. */
+	while(fscanf(file,"%lld %ld %ld\n",&t,&l,&s)==3) {
+		if(t>when) break;
+		*log_offset = l;
+		*snapshot_offset = s;
+		found = 1;
+	}
+
+	fclose(file);
+	return found;
+}
+
+struct jx * deltadb_snapshot_read( const char *logdir, int year, int day, long snapshot_offset )
+{
+	char *filename = string_format("%s/%d/%d.snap",logdir,year,day);
+	FILE *file = fopen(filename,"r");
+	if(!file) {
+		free(filename);
+		return 0;
+	}
+
+	struct jx *j = 0;
+	if(fseek(file,snapshot_offset,SEEK_SET)==0) {
+		j = jx_parse_stream(file);
+	}
+	fclose(file);
+
+	if(!j || j->type!=JX_OBJECT) {
+		debug(D_NOTICE,"could not parse snapshot at offset %ld of %s",snapshot_offset,filename);
+		jx_delete(j);
+		j = 0;
+	}
+
+	free(filename);
+	return j;
+}
+
+/* vim: set noexpandtab tabstop=4: */
@@ -0,0 +1,37 @@
+/*
+Copyright (C) 2015- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef DELTADB_SNAPSHOT_H
+#define DELTADB_SNAPSHOT_H
+
+#include "jx.h"
+
+#include <time.h>
+
+/*
+Intra-day snapshots let a reader start replaying a day's log near the time
+it is interested in, rather than from the checkpoint at midnight.
+
+During the day, deltadb appends a copy of the whole table to DIR/YEAR/DAY.snap
+at regular intervals, in the same format as a checkpoint.  For each snapshot,
+it then appends a line to DIR/YEAR/DAY.idx:
+
+<pre>
+[time] [log offset] [snapshot offset]
+</pre>
+
+The snapshot is the state of the table before the log record at the given
+byte offset of DAY.log, which always begins with an absolute T record.
+The index line is written last, so it only refers to complete snapshots.
+*/
+
+/* Find the latest snapshot of the given day taken no later than when. */
+int deltadb_snapshot_find( const char *logdir, int year, int day, time_t when, long *log_offset, long *snapshot_offset );
+
+/* Read the snapshot at the given offset, returning a jx object or null. */
+struct jx * deltadb_snapshot_read( const char *logdir, int year, int day, long snapshot_offset );
+
+#endif
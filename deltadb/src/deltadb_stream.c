@@ -5,6 +5,7 @@ See the file COPYING for details.
 */
 
 #include "deltadb_stream.h"
+#include "deltadb_binary.h"
 
 #include "jx.h"
 #include "jx_parse.h"
@@ -35,6 +36,10 @@ int deltadb_process_stream( struct deltadb_query *query, FILE *stream, time_t st
 
 	const char *filename = "stream";
 
+	if(deltadb_binary_detect(stream)) {
+		return deltadb_process_binary_stream(query,stream,0,starttime,stoptime);
+	}
+
 	while(fgets(line,sizeof(line),stream)) {
 		if(line[0]=='C') {
 			n = sscanf(line,"C %s %[^\n]",key,value);
@@ -9,19 +9,26 @@ A limited-use program to upgrade (still-valid) log files
 in two ways that save space:
 1 - Adjacent U records are combined into one M record.
 2 - T records are reduced to one per minute.
+
+With -b, the log is instead converted record for record
+into the binary format described in deltadb_binary.h.
 */
 
 
+#include "deltadb_binary.h"
+
 #include "jx.h"
 #include "jx_print.h"
 #include "jx_parse.h"
+#include "nvpair.h"
+#include "nvpair_jx.h"
 
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
 #include <stdlib.h>
 
-#define LOG_LINE_MAX 4096
+#define LOG_LINE_MAX 65536
 
 void corrupt_data( const char *line, int lineno )
 {
@@ -38,10 +45,92 @@ static void emit_merge( FILE * output, struct jx *merge, const char *lastkey )
 	jx_delete(merge);
 }
 
+static char line[LOG_LINE_MAX];
+static char key[LOG_LINE_MAX];
+static char name[LOG_LINE_MAX];
+static char value[LOG_LINE_MAX];
+
+static struct jx * parse_value( const char *str, int lineno )
+{
+	struct jx *j = jx_parse_string(str);
+	if(!j) corrupt_data(line,lineno);
+	return j;
+}
+
+/* Convert a text log into the binary format, one record at a time. */
+
+static int convert_binary( FILE *input, FILE *output )
+{
+	struct deltadb_binary_writer *w = deltadb_binary_writer_create(output);
+	struct jx *jvalue = 0;
+	long long t;
+	int lineno = 0;
+
+	while(1) {
+		long offset = ftell(input);
+		if(!fgets(line,sizeof(line),input)) break;
+		lineno++;
+
+		deltadb_binary_writer_mark(w,offset);
+
+		if(line[0]=='C') {
+			int n = sscanf(line,"C %s %[^\n]",key,value);
+			if(n==1) {
+				/* backwards compatibility with old log format */
+				struct nvpair *nv = nvpair_create();
+				nvpair_parse_stream(nv,input);
+				jvalue = nvpair_to_jx(nv);
+				nvpair_delete(nv);
+			} else if(n==2) {
+				jvalue = parse_value(value,lineno);
+			} else {
+				corrupt_data(line,lineno);
+			}
+			deltadb_binary_write_create(w,key,jvalue);
+			jx_delete(jvalue);
+		} else if(line[0]=='M') {
+			if(sscanf(line,"M %s %[^\n]",key,value)!=2) corrupt_data(line,lineno);
+			jvalue = parse_value(value,lineno);
+			deltadb_binary_write_merge(w,key,jvalue);
+			jx_delete(jvalue);
+		} else if(line[0]=='U') {
+			if(sscanf(line,"U %s %s %[^\n]",key,name,value)!=3) corrupt_data(line,lineno);
+			jvalue = jx_parse_string(value);
+			if(!jvalue) jvalue = jx_string(value);
+			deltadb_binary_write_update(w,key,name,jvalue);
+			jx_delete(jvalue);
+		} else if(line[0]=='D') {
+			if(sscanf(line,"D %s",key)!=1) corrupt_data(line,lineno);
+			deltadb_binary_write_delete(w,key);
+		} else if(line[0]=='R') {
+			if(sscanf(line,"R %s %s",key,name)!=2) corrupt_data(line,lineno);
+			deltadb_binary_write_remove(w,key,name);
+		} else if(line[0]=='T') {
+			if(sscanf(line,"T %lld",&t)!=1) corrupt_data(line,lineno);
+			deltadb_binary_write_time(w,t);
+		} else if(line[0]=='t') {
+			if(sscanf(line,"t %lld",&t)!=1 || t<0) corrupt_data(line,lineno);
+			deltadb_binary_write_delta(w,t);
+		} else if(line[0]!='\n') {
+			corrupt_data(line,lineno);
+		}
+	}
+
+	return deltadb_binary_writer_close(w);
+}
+
 int main( int argc, char *argv[] )
 {
+	int binary = 0;
+
+	if(argc==4 && !strcmp(argv[1],"-b")) {
+		binary = 1;
+		argc--;
+		argv++;
+	}
+
 	if(argc!=3) {
-		fprintf(stderr,"use: %s <infile> <outfile>\n",argv[0]);
+		fprintf(stderr,"use: %s [-b] <infile> <outfile>\n",argv[0]);
 		return 1;
 	}
 
@@ -52,15 +141,20 @@ int main( int argc, char *argv[] )
 	}
 
 	FILE *output = fopen(argv[2],"w");
-	if(!input) {
+	if(!output) {
 		fprintf(stderr,"couldn't open %s: %s\n",argv[2],strerror(errno));
 		return 1;
 	}
 
-	char line[LOG_LINE_MAX] = "";
-	char key[LOG_LINE_MAX] = "";
-	char name[LOG_LINE_MAX] = "";
-	char value[LOG_LINE_MAX] = "";
+	if(binary) {
+		int ok = convert_binary(input,output);
+		fclose(input);
+		if(fclose(output)!=0 || !ok) {
+			fprintf(stderr,"couldn't write %s: %s\n",argv[2],strerror(errno));
+			return 1;
+		}
+		return 0;
+	}
 
 	char lastkey[LOG_LINE_MAX] = "";
 
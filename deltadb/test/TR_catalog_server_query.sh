@@ -0,0 +1,109 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+. ./catalog-common.sh
+
+record=catalog.query.record
+expected=catalog.query.expected
+out=catalog.query.out
+
+check_needed()
+{
+	command -v curl >/dev/null 2>&1 || return 1
+}
+
+prepare()
+{
+	return 0
+}
+
+# Print the uuids of the test records in a listing, in order.
+uuids()
+{
+	grep -o '"uuid":"u[0-9]*"' | sort
+}
+
+etag()
+{
+	tr -d '\r' < "$1" | sed -n 's/^ETag: //p'
+}
+
+run()
+{
+	catalog_start --snapshot-interval=0 || return 1
+	url="http://$hostport"
+
+	for i in $(seq 1 20)
+	do
+		echo "{\"type\":\"test\",\"uuid\":\"u$i\",\"n\":$i,\"parity\":$((i % 2))}" > "$record"
+		catalog_update -c "$hostport" -f "$record" || return 1
+	done
+	catalog_wait_records "$hostport" 20 || return 1
+
+	# The snapshot lists the records the history replay creates.
+	now=$(date +%s)
+	filter=$(printf '%s' 'type=="test"' | base64)
+	curl -s "$url/history/$((now - 300))/$((now + 60))/$filter" | grep '^C ' | uuids > "$expected"
+	curl -s "$url/query.json" | uuids > "$out"
+	[ $(wc -l < "$expected") -eq 20 ] || return 1
+	diff "$expected" "$out" || return 1
+
+	# A filtered query gives the records of the full listing that match.
+	curl -s "$url/query.json" | grep '"parity":1' | uuids > "$expected"
+	filter=$(printf '%s' 'parity==1' | base64)
+	curl -s "$url/query/$filter" | uuids > "$out"
+	[ $(wc -l < "$expected") -eq 10 ] || return 1
+	diff "$expected" "$out" || return 1
+
+	# A page served again from the cache is the same, with the same tag.
+	curl -s -D "$out.h1" -o "$out.b1" "$url/query.json" || return 1
+	curl -s -D "$out.h2" -o "$out.b2" "$url/query.json" || return 1
+	cmp "$out.b1" "$out.b2" || return 1
+	tag=$(etag "$out.h1")
+	[ -n "$tag" ] || return 1
+	[ "$tag" = "$(etag "$out.h2")" ] || return 1
+	length=$(tr -d '\r' < "$out.h1" | sed -n 's/^Content-Length: //p')
+	[ "$length" -eq $(wc -c < "$out.b1") ] || return 1
+
+	# A client that has the page is told so, without the body.
+	code=$(curl -s -D "$out.h3" -o "$out.b3" -w '%{http_code}' -H "If-None-Match: $tag" "$url/query.json")
+	[ "$code" = 304 ] || return 1
+	[ -s "$out.b3" ] && return 1
+	[ "$(etag "$out.h3")" = "$tag" ] || return 1
+
+	# A compressed page decompresses to the same listing, and has its own tag.
+	curl -s --compressed -D "$out.h4" -o "$out.b4" "$url/query.json" || return 1
+	tr -d '\r' < "$out.h4" | grep -q '^Content-Encoding: gzip' || return 1
+	cmp "$out.b1" "$out.b4" || return 1
+	gztag=$(etag "$out.h4")
+	[ -n "$gztag" ] || return 1
+	[ "$gztag" != "$tag" ] || return 1
+	code=$(curl -s --compressed -D "$out.h4" -o "$out.b4" -w '%{http_code}' -H "If-None-Match: $gztag" "$url/query.json")
+	[ "$code" = 304 ] || return 1
+	[ "$(etag "$out.h4")" = "$gztag" ] || return 1
+	code=$(curl -s --compressed -o "$out.b4" -w '%{http_code}' -H "If-None-Match: $tag" "$url/query.json")
+	[ "$code" = 200 ] || return 1
+	cmp "$out.b1" "$out.b4" || return 1
+
+	# An update makes a new snapshot, with a new tag.
+	echo '{"type":"test","uuid":"u21","n":21,"parity":1}' > "$record"
+	catalog_update -c "$hostport" -f "$record" || return 1
+	catalog_wait_records "$hostport" 21 || return 1
+	code=$(curl -s -D "$out.h5" -o "$out.b5" -w '%{http_code}' -H "If-None-Match: $tag" "$url/query.json")
+	[ "$code" = 200 ] || return 1
+	[ "$(etag "$out.h5")" != "$tag" ] || return 1
+	grep -q '"uuid":"u21"' "$out.b5" || return 1
+
+	return 0
+}
+
+clean()
+{
+	catalog_clean
+	rm -f "$record" "$expected" "$out" "$out".*
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -0,0 +1,163 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+. ./catalog-common.sh
+
+exe="catalog_send.test"
+records=catalog.udp.records
+udp=catalog.udp.out
+tcp=catalog.tcp.out
+
+check_needed()
+{
+	command -v curl >/dev/null 2>&1 || return 1
+}
+
+prepare()
+{
+	${CC} -g -o "$exe" -I ../../dttools/src/ -x c - -x none ../../dttools/src/libdttools.a -lz -lm <<EOF || return 1
+#include "datagram.h"
+#include "link.h"
+
+#include <zlib.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+Send each line of a file as an update, either all over one UDP socket
+in bursts, so that the catalog receives them in batches, or each over
+its own TCP connection, which the catalog decodes one at a time.
+Every third update is compressed, as large updates are.
+Tabs stand for the newlines that separate the lines of the
+older name-value updates.
+*/
+
+int main(int argc, char **argv) {
+	char line[65536];
+	char data[65536];
+	int n = 0;
+
+	if(argc != 5) return 1;
+	int tcp = !strcmp(argv[1], "tcp");
+	const char *addr = argv[2];
+	int port = atoi(argv[3]);
+
+	FILE *file = fopen(argv[4], "r");
+	if(!file) return 1;
+
+	struct datagram *d = datagram_create(DATAGRAM_PORT_ANY);
+	if(!d) return 1;
+
+	while(fgets(line, sizeof(line), file)) {
+		unsigned long length = strlen(line);
+		if(line[length-1] == '\n') line[--length] = 0;
+
+		char *tab;
+		for(tab = line; (tab = strchr(tab, '\t')); tab++) *tab = '\n';
+
+		const char *msg = line;
+		if(n % 3 == 2) {
+			unsigned long clength = sizeof(data) - 1;
+			if(compress((Bytef *) &data[1], &clength, (const Bytef *) line, length) != Z_OK) return 1;
+			data[0] = 0x1A;
+			msg = data;
+			length = clength + 1;
+		}
+
+		if(tcp) {
+			struct link *l = link_connect(addr, port + 1, time(0) + 10);
+			if(!l) return 1;
+			if(link_write(l, msg, length, time(0) + 10) != (ssize_t) length) return 1;
+			link_close(l);
+		} else {
+			datagram_send(d, msg, length, addr, port);
+			if(n % 64 == 63) usleep(10000);
+		}
+		n++;
+	}
+
+	datagram_delete(d);
+	fclose(file);
+	return 0;
+}
+EOF
+
+	# Records of all sizes, in JSON and among them in name-value lines,
+	# then updates to some of them, bad updates that must be dropped,
+	# and last a record to show that all arrived.
+	awk 'BEGIN {
+		for(i = 1; i <= 300; i++) {
+			pad = ""
+			for(k = 0; k < (i * 37) % 2000; k++) pad = pad "x"
+			printf("{\"type\":\"test\",\"uuid\":\"u%d\",\"n\":%d,\"f\":%d.5,\"ok\":%s,\"list\":[%d,\"s%d\",{\"k\":null}],\"pad\":\"%s\"}\n", i, i, i, i % 2 ? "true" : "false", i, i, pad)
+			if(i % 2 == 0) {
+				printf("type test\tuuid v%d\tn %d\tf %d.5\tok %s\towner user%d\tpad %s\n", i, i, i, i % 2 ? "true" : "false", i, pad)
+			}
+		}
+		for(i = 1; i <= 50; i++) {
+			printf("{\"type\":\"test\",\"uuid\":\"u%d\",\"n\":%d,\"updated\":true}\n", i * 5, -i)
+			if(i % 2 == 0) {
+				printf("type test\tuuid v%d\tn %d\tupdated true\n", i * 3, -i)
+			}
+		}
+		printf("{\"type\":\"test\",\"uuid\":\"bad1\" \"n\" 1}\n")
+		printf("{\"type\":\"test\",\"uuid\":\"bad2\",\"n\":1+x}\n")
+		printf("{\"type\":\"test\",\"uuid\":\"last\"}\n")
+	}' > "$records" || return 1
+
+	return 0
+}
+
+# The records of a listing, one per line, without the time they were heard from.
+listing()
+{
+	curl -s "http://$1/query.json" | grep '"type":"test"' | sed -e 's/"lastheardfrom":[0-9]*,//' -e 's/,$//' | sort
+}
+
+run()
+{
+	catalog_start --snapshot-interval=0 --threads=3 || return 1
+	udp_hostport=$hostport
+	catalog_start --snapshot-interval=0 --threads=0 || return 1
+	tcp_hostport=$hostport
+
+	./"$exe" udp 127.0.0.1 "${udp_hostport#*:}" "$records" || return 1
+	./"$exe" tcp 127.0.0.1 "${tcp_hostport#*:}" "$records" || return 1
+
+	catalog_wait_records "$udp_hostport" 451 || return 1
+	catalog_wait_records "$tcp_hostport" 451 || return 1
+
+	# TCP updates may be applied out of order, so wait for the last of them.
+	i=0
+	while [ $i -lt 10 ]; do
+		listing "$udp_hostport" > "$udp"
+		listing "$tcp_hostport" > "$tcp"
+		if [ $(grep -c '"updated":true' "$tcp") -eq 75 ] && [ $(grep -c '"updated":true' "$udp") -eq 75 ]; then
+			break
+		fi
+		sleep 1
+		i=$(expr $i + 1)
+	done
+
+	[ $(grep -c '"updated":true' "$tcp") -eq 75 ] || return 1
+	[ $(grep -c '"uuid":"v' "$tcp") -eq 150 ] || return 1
+	grep -q '"bad' "$tcp" && return 1
+	diff "$tcp" "$udp" || return 1
+
+	return 0
+}
+
+clean()
+{
+	catalog_clean
+	rm -f "$exe" "$records" "$udp" "$tcp"
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
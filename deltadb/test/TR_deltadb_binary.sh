@@ -0,0 +1,103 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+text=deltadb.binary.text
+binary=deltadb.binary.bin
+expected=deltadb.binary.expected
+out=deltadb.binary.out
+
+TZ=UTC
+export TZ
+
+prepare()
+{
+	rm -rf "$text" "$binary"
+
+	# Two days of creates, deletes, updates, removals and merges
+	# of values of every type.
+	awk -v db="$text" '
+	BEGIN {
+		t = 1640995200
+		system("mkdir -p " db "/2022")
+		for(d = 0; d < 2; d++) {
+			ckpt = db "/2022/" d ".ckpt"
+			logf = db "/2022/" d ".log"
+			printf("{") > ckpt
+			n = 0
+			for(h = 0; h < 20; h++) {
+				if(!alive[h]) continue
+				printf("%s\"host%d\":{\"name\":\"host%d\",\"load\":%d,\"owner\":\"user%d\"}", n++ ? "," : "", h, h, load[h], h % 4) > ckpt
+			}
+			printf("}\n") > ckpt
+			close(ckpt)
+			for(i = 0; i < 500; i++) {
+				printf("T %d\n", t) > logf
+				h = (i * 7 + d) % 20
+				op = i % 6
+				if(!alive[h]) {
+					alive[h] = 1
+					load[h] = i % 13
+					printf("C host%d {\"name\":\"host%d\",\"load\":%d,\"owner\":\"user%d\",\"tags\":[1,\"a\",{\"x\":2.5}],\"ok\":true}\n", h, h, load[h], h % 4) > logf
+				} else if(op == 0) {
+					alive[h] = 0
+					printf("D host%d\n", h) > logf
+				} else if(op == 1) {
+					printf("U host%d load %d\n", h, load[h] = (i * 3) % 17 - 5) > logf
+				} else if(op == 2) {
+					printf("U host%d speed %d.%d\n", h, i % 9, i % 7) > logf
+				} else if(op == 3) {
+					printf("R host%d owner\n", h) > logf
+				} else if(op == 4) {
+					printf("M host%d {\"load\":%d,\"note\":\"merged \\\"%d\\\"\",\"extra\":null}\n", h, load[h] = i % 11, i) > logf
+				} else {
+					printf("U host%d owner \"user%d\"\n", h, i % 5) > logf
+				}
+				t += 173
+			}
+			close(logf)
+		}
+	}' || return 1
+
+	mkdir -p "$binary/2022" || return 1
+	for day in 0 1
+	do
+		cp "$text/2022/$day.ckpt" "$binary/2022/$day.ckpt" || return 1
+		../src/deltadb_upgrade_log -b "$text/2022/$day.log" "$binary/2022/$day.log" || return 1
+	done
+
+	return 0
+}
+
+run()
+{
+	# The binary log must not be the text log.
+	cmp -s "$text/2022/0.log" "$binary/2022/0.log" && return 1
+
+	for args in "" "--json" "-o name -o load -o speed -o owner -o note -e 1h" "-o COUNT(name) -o SUM(load) -e 10m"
+	do
+		../src/deltadb_query --db "$text" --from "2022-01-01 03:00:00" --to "2022-01-02 20:00:00" $args > "$expected" || return 1
+		../src/deltadb_query --db "$binary" --from "2022-01-01 03:00:00" --to "2022-01-02 20:00:00" $args > "$out" || return 1
+
+		[ -s "$expected" ] || return 1
+		diff "$expected" "$out" || return 1
+	done
+
+	# A single binary file reads the same as the text file.
+	../src/deltadb_query --file "$text/2022/1.log" --from "2022-01-02 00:00:00" --to "2022-01-02 23:00:00" > "$expected" || return 1
+	../src/deltadb_query --file "$binary/2022/1.log" --from "2022-01-02 00:00:00" --to "2022-01-02 23:00:00" > "$out" || return 1
+	[ -s "$expected" ] || return 1
+	diff "$expected" "$out" || return 1
+
+	return 0
+}
+
+clean()
+{
+	rm -rf "$text" "$binary" "$expected" "$out"
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
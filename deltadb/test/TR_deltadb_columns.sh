@@ -0,0 +1,147 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+db=deltadb.columns.db
+blank=deltadb.columns.blank
+replay=deltadb.columns.replay
+expected=deltadb.columns.expected
+out=deltadb.columns.out
+
+from="2022-01-01 03:00:00"
+to="2022-01-03 23:00:00"
+fields="type,name,load,owner,speed,ok,tags"
+
+TZ=UTC
+export TZ
+
+prepare()
+{
+	rm -rf "$db"
+
+	# Three days of creates, deletes and re-creates, changes of type,
+	# removals and merges of fields the queries refer to.
+	awk -v db="$db" '
+	BEGIN {
+		system("mkdir -p " db "/2022")
+		for(d = 0; d < 3; d++) {
+			ckpt = db "/2022/" d ".ckpt"
+			logf = db "/2022/" d ".log"
+			printf("{") > ckpt
+			n = 0
+			for(h = 0; h < 24; h++) {
+				if(!alive[h]) continue
+				printf("%s\"host%d\":{\"type\":\"%s\",\"name\":\"host%d\",\"load\":%d,\"owner\":\"user%d\"}", n++ ? "," : "", h, h % 3 ? "wq_master" : "chirp", h, load[h], h % 4) > ckpt
+			}
+			printf("}\n") > ckpt
+			close(ckpt)
+			t = 1640995200 + d * 86400
+			for(i = 0; i < 600; i++) {
+				printf("T %d\n", t) > logf
+				h = (i * 7 + d) % 24
+				op = i % 8
+				if(!alive[h]) {
+					alive[h] = 1
+					load[h] = i % 13
+					printf("C host%d {\"type\":\"%s\",\"name\":\"host%d\",\"load\":%d,\"owner\":\"user%d\",\"tags\":[1,\"a\"],\"ok\":true}\n", h, h % 3 ? "wq_master" : "chirp", h, load[h], h % 4) > logf
+				} else if(op == 0) {
+					alive[h] = 0
+					printf("D host%d\n", h) > logf
+					if(i % 16 == 0) {
+						alive[h] = 1
+						printf("C host%d {\"type\":\"chirp\",\"name\":\"host%d\",\"load\":0}\n", h, h) > logf
+					}
+				} else if(op == 1) {
+					printf("U host%d load %d\n", h, load[h] = (i * 3) % 17 - 5) > logf
+				} else if(op == 2) {
+					printf("U host%d speed %d.%d\n", h, i % 9, i % 7) > logf
+				} else if(op == 3) {
+					printf("R host%d owner\n", h) > logf
+				} else if(op == 4) {
+					printf("M host%d {\"load\":%d,\"ok\":%s,\"note\":\"%d\"}\n", h, load[h] = i % 11, i % 3 ? "false" : "null", i) > logf
+				} else if(op == 5) {
+					printf("U host%d speed \"fast\"\n", h) > logf
+				} else if(op == 6) {
+					printf("U host%d load %d\n", h, load[h] = i * 100003) > logf
+				} else {
+					printf("U host%d owner \"user%d\"\n", h, i % 5) > logf
+				}
+				t += 120
+			}
+			close(logf)
+		}
+	}' || return 1
+
+	return 0
+}
+
+# Run queries of the exported fields against the database $1.
+queries()
+{
+	for args in \
+		"-o name -o load -o speed -o owner -e 1h" \
+		"-o name -o load -o ok -o tags -w load>3 -e 30m" \
+		"-o name -o speed -f type==\"chirp\" -e 2h" \
+		"-o COUNT(name) -o SUM(load) -o MAX(load) -o MIN(speed) -o AVERAGE(load) -e 10m" \
+		"-o COUNT(owner) -o FIRST(load) -o LAST(load) -o INC(load) -f type==\"wq_master\" -w ok -e 1h"
+	do
+		../src/deltadb_query --db "$1" --from "$from" --to "$to" $args || return 1
+	done
+}
+
+run()
+{
+	rm -rf "$replay" "$blank"
+	cp -r "$db" "$replay" || return 1
+
+	queries "$db" > "$expected" || return 1
+	[ $(wc -l < "$expected") -gt 100 ] || return 1
+
+	../src/deltadb_query --db "$db" --from "$from" --to "$to" --export "$fields" || return 1
+	for day in 0 1 2
+	do
+		[ -s "$db/2022/$day.cols" ] || return 1
+	done
+
+	# The exported columns answer the same as the replay.
+	queries "$db" > "$out" || return 1
+	diff "$expected" "$out" || return 1
+
+	# They do so without reading the logs: blanking them out, but keeping
+	# their sizes, leaves the answers as they were.
+	cp -r "$db" "$blank" || return 1
+	for day in 0 1 2
+	do
+		tr -c '\n' ' ' < "$db/2022/$day.log" > "$blank/2022/$day.log" || return 1
+	done
+	queries "$blank" > "$out" || return 1
+	diff "$expected" "$out" || return 1
+
+	# A query of a field that was not exported replays the log.
+	../src/deltadb_query --db "$replay" --from "$from" --to "$to" -o name -o note -e 1h > "$expected" || return 1
+	../src/deltadb_query --db "$db" --from "$from" --to "$to" -o name -o note -e 1h > "$out" || return 1
+	[ -s "$expected" ] || return 1
+	diff "$expected" "$out" || return 1
+
+	# A day whose log grew after the export is replayed as well.
+	for dir in "$db" "$replay"
+	do
+		printf 'T 1641245400\nC host99 {"type":"chirp","name":"host99","load":123456789,"speed":1.5}\nT 1641247200\n' >> "$dir/2022/2.log" || return 1
+	done
+	queries "$replay" > "$expected" || return 1
+	queries "$db" > "$out" || return 1
+	grep -q 123456789 "$expected" || return 1
+	diff "$expected" "$out" || return 1
+
+	return 0
+}
+
+clean()
+{
+	rm -rf "$db" "$blank" "$replay" "$expected" "$out"
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
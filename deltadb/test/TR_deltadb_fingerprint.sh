@@ -0,0 +1,211 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+exe="fingerprint.test"
+dbs="deltadb.fingerprint.fast deltadb.fingerprint.byname deltadb.fingerprint.full"
+
+prepare()
+{
+	${CC} -g -o "$exe" -I ../src/ -I ../../dttools/src/ -x c - -x none ../src/libdeltadb.a ../../dttools/src/libdttools.a -lz -lm <<EOF
+#include "deltadb.h"
+#include "hash_table.h"
+#include "jx.h"
+#include "jx_print.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+Apply the same random history of records to three databases, and check
+that replaying each log from disk gives the records last inserted:
+- fast gets each record as is, so that it is mostly compared by fingerprint;
+- byname gets the fields of every other version of a record in reverse,
+  so that it is always compared by name, as before fingerprints;
+- full deletes and creates a record on every change, so that it logs the
+  whole record instead of the differences.
+*/
+
+#define NKEYS 40
+#define NFIELDS 8
+
+static int ignored(const char *name) {
+	return !strcmp(name, "lastheardfrom") || !strcmp(name, "uptime");
+}
+
+static struct jx *random_value(void) {
+	int r = rand() % 8;
+	int n = rand() % 4;
+	switch(r) {
+	case 0: return jx_integer(n);
+	case 1: return jx_double(n + 0.25);
+	case 2: return jx_double(n + 0.5);
+	case 3: return jx_string(n % 2 ? "1" : "one");
+	case 4: return jx_boolean(n % 2);
+	case 5: return jx_null();
+	case 6: return jx_arrayv(jx_integer(n), jx_string("a"), NULL);
+	default: return jx_objectv("x", jx_integer(n), "y", jx_arrayv(jx_double(n + 0.75), NULL), NULL);
+	}
+}
+
+static void set(struct jx *j, const char *name, struct jx *value) {
+	struct jx *key = jx_string(name);
+	jx_delete(jx_remove(j, key));
+	jx_delete(key);
+	jx_insert(j, jx_string(name), value);
+}
+
+static struct jx *reversed(struct jx *j) {
+	struct jx *r = jx_object(NULL);
+	struct jx_pair *p;
+	for(p = j->u.pairs; p; p = p->next) jx_insert(r, jx_copy(p->key), jx_copy(p->value));
+	return r;
+}
+
+/* Records are equal when they have the same fields, apart from the ignored ones. */
+static int same_record(struct jx *a, struct jx *b) {
+	int na = 0, nb = 0;
+	struct jx_pair *p;
+	for(p = a->u.pairs; p; p = p->next) {
+		if(ignored(p->key->u.string_value)) continue;
+		struct jx *v = jx_lookup(b, p->key->u.string_value);
+		if(!v || !jx_equals(v, p->value)) return 0;
+		na++;
+	}
+	for(p = b->u.pairs; p; p = p->next) {
+		if(!ignored(p->key->u.string_value)) nb++;
+	}
+	return na == nb;
+}
+
+static int check(const char *dir, struct hash_table *truth) {
+	struct deltadb *db = deltadb_create(dir);
+	char *key;
+	struct jx *j;
+	int errors = 0;
+
+	hash_table_firstkey(truth);
+	while(hash_table_nextkey(truth, &key, (void **) &j)) {
+		struct jx *r = deltadb_lookup(db, key);
+		if(!r || !same_record(j, r)) {
+			char *s = jx_print_string(j);
+			char *t = r ? jx_print_string(r) : 0;
+			fprintf(stderr, "%s: %s is\n%s\ninstead of\n%s\n", dir, key, t ? t : "missing", s);
+			free(s);
+			free(t);
+			errors++;
+		}
+	}
+
+	int n = 0;
+	deltadb_firstkey(db);
+	while(deltadb_nextkey(db, &key, &j)) n++;
+	if(n != hash_table_size(truth)) {
+		fprintf(stderr, "%s: %d records instead of %d\n", dir, n, hash_table_size(truth));
+		errors++;
+	}
+
+	return errors == 0;
+}
+
+int main(int argc, char **argv) {
+	struct deltadb *fast = deltadb_create(argv[1]);
+	struct deltadb *byname = deltadb_create(argv[2]);
+	struct deltadb *full = deltadb_create(argv[3]);
+	struct hash_table *truth = hash_table_create(0, 0);
+	int flip[NKEYS] = {0};
+	char key[32], name[32];
+	int i;
+
+	assert(fast && byname && full);
+	srand(49);
+
+	for(i = 1; i <= 4000; i++) {
+		int k = rand() % NKEYS;
+		snprintf(key, sizeof(key), "host%d", k);
+
+		struct jx *old = hash_table_lookup(truth, key);
+		struct jx *j;
+		int op = rand() % 100;
+
+		if(old && op < 5) {
+			jx_delete(deltadb_remove(fast, key));
+			jx_delete(deltadb_remove(byname, key));
+			jx_delete(deltadb_remove(full, key));
+			jx_delete(hash_table_remove(truth, key));
+			continue;
+		}
+
+		if(!old) {
+			j = jx_object(NULL);
+			jx_insert(j, jx_string("name"), jx_string(key));
+			int f;
+			for(f = 0; f < NFIELDS; f++) {
+				if(rand() % 3 == 0) continue;
+				snprintf(name, sizeof(name), "f%d", f);
+				jx_insert(j, jx_string(name), random_value());
+			}
+		} else {
+			j = jx_copy(old);
+			snprintf(name, sizeof(name), "f%d", rand() % NFIELDS);
+			if(op < 45) {
+				/* A heartbeat changes nothing but the ignored fields. */
+			} else if(op < 75) {
+				set(j, name, random_value());
+			} else if(op < 90) {
+				struct jx *n = jx_string(name);
+				jx_delete(jx_remove(j, n));
+				jx_delete(n);
+			} else {
+				set(j, name, random_value());
+				snprintf(name, sizeof(name), "f%d", rand() % NFIELDS);
+				set(j, name, random_value());
+			}
+		}
+
+		set(j, "lastheardfrom", jx_integer(1000 + i));
+		if(rand() % 2) set(j, "uptime", jx_integer(i));
+
+		deltadb_insert(fast, key, jx_copy(j));
+		deltadb_insert(byname, key, (flip[k] = !flip[k]) ? reversed(j) : jx_copy(j));
+		if(old && !same_record(old, j)) jx_delete(deltadb_remove(full, key));
+		deltadb_insert(full, key, jx_copy(j));
+
+		jx_delete(hash_table_remove(truth, key));
+		hash_table_insert(truth, key, j);
+
+		if(i % 1000 == 0) {
+			if(!check(argv[1], truth) || !check(argv[2], truth) || !check(argv[3], truth)) return 1;
+		}
+	}
+
+	return 0;
+}
+EOF
+	return $?
+}
+
+run()
+{
+	rm -rf $dbs
+	./"$exe" $dbs || return 1
+
+	# Logging by fingerprint writes no more than logging by name.
+	fast=$(cat deltadb.fingerprint.fast/*/*.log | wc -c)
+	byname=$(cat deltadb.fingerprint.byname/*/*.log | wc -c)
+	[ "$fast" -le "$byname" ] || return 1
+
+	return 0
+}
+
+clean()
+{
+	rm -rf "$exe" $dbs
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -0,0 +1,74 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+db=deltadb.parallel.db
+serial=deltadb.parallel.serial
+parallel=deltadb.parallel.out
+
+# Days and times are local, so pin the zone.
+TZ=UTC
+export TZ
+
+prepare()
+{
+	rm -rf "$db"
+
+	# Six days with a time record every five minutes and a checkpoint
+	# for each day holding the state at its midnight.
+	awk -v db="$db" '
+	BEGIN {
+		split("2021 362 2021 363 2021 364 2022 0 2022 1 2022 2", days, " ")
+		t = 1640736000
+		for(h = 0; h < 3; h++) load[h] = h
+		for(d = 0; d < 6; d++) {
+			dir = db "/" days[2*d+1]
+			system("mkdir -p " dir)
+			ckpt = dir "/" days[2*d+2] ".ckpt"
+			logf = dir "/" days[2*d+2] ".log"
+			printf("{") > ckpt
+			for(h = 0; h < 3; h++) {
+				printf("%s\"host%d\":{\"name\":\"host%d\",\"load\":%d}", h ? "," : "", h, h, load[h]) > ckpt
+			}
+			printf("}\n") > ckpt
+			close(ckpt)
+			for(i = 0; i < 288; i++) {
+				printf("T %d\n", t) > logf
+				h = i % 3
+				load[h] = (i * 7 + d) % 11
+				printf("U host%d load %d\n", h, load[h]) > logf
+				t += 300
+			}
+			close(logf)
+		}
+	}'
+	return $?
+}
+
+run()
+{
+	for args in "-o COUNT(name) -e 25m" "-o MAX(load) -o SUM(load) -e 1h" "-o name -o load -e 7h"
+	do
+		../src/deltadb_query --db "$db" --from "2021-12-29 05:13:00" --to "2022-01-03 10:00:00" $args > "$serial" || return 1
+		../src/deltadb_query --db "$db" --from "2021-12-29 05:13:00" --to "2022-01-03 10:00:00" $args --parallel 4 > "$parallel" || return 1
+
+		[ -s "$serial" ] || return 1
+		diff "$serial" "$parallel" || return 1
+	done
+
+	# The display point just before midnight is shown at the next day's first record.
+	../src/deltadb_query --db "$db" --from "2021-12-29 05:13:00" --to "2022-01-03 10:00:00" -o "COUNT(name)" -e 25m --parallel 4 > "$parallel" || return 1
+	grep -q "^2021-12-30 00:00:00" "$parallel" || return 1
+
+	return 0
+}
+
+clean()
+{
+	rm -rf "$db" "$serial" "$parallel"
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
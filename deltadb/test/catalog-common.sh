@@ -0,0 +1,77 @@
+verbose() {
+	printf '%s\n' "$*" >&2
+	"$@"
+}
+
+catalog_server() {
+	verbose ../src/catalog_server "$@"
+}
+
+catalog_update() {
+	verbose ../../dttools/src/catalog_update "$@"
+}
+
+# Start a catalog server on a free port, with its history in a new directory.
+# On success, hostport is set to its address.
+catalog_start() {
+	debug=`mktemp ./catalog.debug.XXXXXX`
+	history=`mktemp -d ./catalog.history.XXXXXX`
+	pid=`mktemp ./catalog.pid.XXXXXX`
+	port=`mktemp ./catalog.port.XXXXXX`
+	catalog_server --background --debug=all --debug-file="$debug" --debug-rotate-max=0 --history="$history" --interface=127.0.0.1 --pid-file="$pid" --port-file="$port" --update-host=127.0.0.1:1 "$@"
+	result=$?
+	if [ "$result" -eq 0 ]; then
+		i=0
+		while [ $i -lt 10 ]; do
+			if [ -s "$pid" ]; then
+				if [ -s "$port" ]; then
+					hostport="127.0.0.1:$(cat "$port")"
+					unset debug history pid port result
+					return 0
+				elif ! kill -s 0 "$(cat "$pid")"; then
+					break;
+				fi
+			fi
+			echo $i sleeping waiting for server to start
+			sleep 1
+			i=$(expr $i + 1)
+		done
+		echo "catalog_server did not start:"
+	else
+		echo "catalog_server failed with code: $result"
+	fi
+	touch "$debug"
+	cat "$debug"
+	unset debug history pid port result
+	return 1
+}
+
+# Wait until the catalog at $1 lists $2 records of type "test".
+catalog_wait_records() {
+	i=0
+	while [ $i -lt 30 ]; do
+		n=$(curl -s "http://$1/query.json" | grep -c '"type":"test"')
+		if [ "$n" -eq "$2" ]; then
+			return 0
+		fi
+		sleep 1
+		i=$(expr $i + 1)
+	done
+	echo "catalog at $1 has $n records instead of $2"
+	return 1
+}
+
+catalog_clean() {
+	for pid in ./catalog.pid.*; do
+		[ -s "$pid" ] || continue
+		pid=$(cat "$pid")
+		echo kill $pid
+		if ! kill $pid; then
+			echo could not kill $pid
+		fi
+	done
+	verbose rm -rf ./catalog.debug.* ./catalog.history.* ./catalog.pid.* ./catalog.port.*
+	return 0
+}
+
+# vim: set noexpandtab tabstop=4:
@@ -46,14 +46,16 @@ OPTION_TRIPLET(-H, history, directory) Store catalog history in this directory.
 OPTION_TRIPLET(-I, interface, addr)Listen only on this network interface.
 OPTION_TRIPLET(-l, lifetime, secs)Lifetime of data, in seconds (default is 1800)
 OPTION_TRIPLET(-L, update-log,file)Log new updates to this file.
-OPTION_TRIPLET(-m, max-jobs,n)Maximum number of child processes.  (default is 50)
+OPTION_TRIPLET(-m, max-jobs,n)Maximum number of history query processes.  (default is 50)
 OPTION_TRIPLET(-M, server-size, size)Maximum size of a server to be believed.  (default is any)
 OPTION_TRIPLET(-n, name, name)Set the preferred hostname of this server.
 OPTION_TRIPLET(-o,debug-file,file)Write debugging output to this file. By default, debugging is sent to stderr (":stderr"). You may specify logs to be sent to stdout (":stdout") instead.
 OPTION_TRIPLET(-O, debug-rotate-max, bytes)Rotate debug file once it reaches this size (default 10M, 0 disables).
 OPTION_TRIPLET(-p,, port, port)Port number to listen on (default is 9097)
-OPTION_ITEM(`-S, --single')Single process mode; do not fork on queries.
-OPTION_TRIPLET(-T, timeout, time)Maximum time to allow a query process to run.  (default is 60s)
+OPTION_TRIPLET(-s, snapshot-interval, time)Minimum time between snapshots of the table used to answer queries.  (default is 1s)
+OPTION_ITEM(`-S, --single')Single process mode; do not fork for history queries.
+OPTION_TRIPLET(-t, threads, n)Number of threads decoding updates, besides the main one.  (default is one per additional core, up to 4)
+OPTION_TRIPLET(-T, timeout, time)Maximum time to allow a query to run.  (default is 60s)
 OPTION_TRIPLET(-u, update-host, host)Send status updates to this host. (default is catalog.cse.nd.edu,backup-catalog.cse.nd.edu)
 OPTION_TRIPLET(-U, update-interval, time)Send status updates at this interval. (default is 5m)
 OPTION_ITEM(`-v, --version')Show version string
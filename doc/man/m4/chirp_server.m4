@@ -38,6 +38,7 @@ OPTION_ITEM(`-h, --help')Give help information.
 OPTION_TRIPLET(-I, interface,addr)Listen only on this network interface.
 OPTION_TRIPLET(-M, max-clients,count)Set the maximum number of clients to accept at once. (default unlimited)
 OPTION_TRIPLET(-n, catalog-name,name)Use this name when reporting to the catalog.
+OPTION_ITEM(--no-hash-cache)Do not remember file digests between md5/hash requests.
 OPTION_TRIPLET(-o,debug-file,file)Write debugging output to this file. By default, debugging is sent to stderr (":stderr"). You may specify logs to be sent to stdout (":stdout") instead.
 OPTION_TRIPLET(-O, debug-rotate-max,bytes)Rotate debug file once it reaches this size.
 OPTION_TRIPLET(-P,superuser,user)Superuser for all directories. (default is none)
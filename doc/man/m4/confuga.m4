@@ -36,8 +36,8 @@ OPTIONS_BEGIN
 OPTION_PAIR(auth,method)Enable this method for Head Node to Storage Node authentication. The default is to enable all available authentication mechanisms.
 OPTION_PAIR(concurrency,limit)Limits the number of concurrent jobs executed by the cluster. The default is 0 for limitless.
 OPTION_PAIR(pull-threshold,bytes)Sets the threshold for pull transfers. The default is 128MB.
-OPTION_PAIR(replication,type)Sets the replication mode for satisfying job dependencies. BOLD(type) may be BOLD(push-sync) or BOLD(push-async-N). The default is BOLD(push-async-1).
-OPTION_PAIR(scheduler,type)Sets the scheduler used to assign jobs to storage nodes. The default is BOLD(fifo-0).
+OPTION_PAIR(replication,type)Sets the replication mode for satisfying job dependencies. BOLD(type) may be BOLD(push-sync) or BOLD(push-async-N), where N limits the transfers a storage node may serve at once (0 for limitless). The same limit applies to the background replication of files with too few replicas, which splits files of 128MB or more into stripes pulled in parallel from up to eight existing replicas, favoring storage nodes with the highest recent transfer throughput. The default is BOLD(push-async-1).
+OPTION_PAIR(scheduler,type)Sets the scheduler used to assign jobs to storage nodes. BOLD(type) may be BOLD(fifo-N) or BOLD(locality-N), where N limits the number of jobs scheduled but not yet running (0 for limitless). The BOLD(locality) scheduler considers waiting jobs beyond the head of the queue and prefers the storage node with the least input data left to replicate, weighted by the transfers that node is already serving. The default is BOLD(fifo-0).
 OPTION_PAIR(tickets,tickets)Sets tickets to use for authenticating with storage nodes. Paths must be absolute.
 OPTIONS_END
 
@@ -27,6 +27,8 @@ OPTION_ITEM(--from time) (required) The starting date and time of the query in a
 OPTION_ITEM(--to time) The ending time of the query, in the same format as the --from option.  If omitted, the current time is assumed.
 OPTION_ITEM(--every interval) The intervals at which output should be produced, like 5s, 5m, 5h, 5d to indicate five seconds, minutes, hours, or days ago, respectively.
 OPTION_ITEM(--epoch) Causes the output to be expressed in integer Unix epoch time, instead of a formatted time.
+OPTION_ITEM(--parallel n) Replay the history in up to n processes at once.  Each day with a checkpoint is replayed on its own, and the results are written in time order.  Output times match those of a sequential query as long as the history has a time record in every --every interval.  Queries without --output or --json are always replayed sequentially.
+OPTION_ITEM(--export fields) Instead of querying, export these comma-separated fields of each day from --from to --to into columns, stored alongside the logs.  Later queries with --output whose expressions only refer to exported fields are answered from the columns, without replaying the logs, as long as every day of the query has been exported and its log has not changed since.
 OPTION_ITEM(--filter expr) (multiple) If given, only records matching this expression will be processed.  Use --filter to apply expressions that do not change over time, such as the name or type of a record.
 OPTION_ITEM(--where expr)  (multiple) If given, only records matching this expression will be displayed.  Use --where to apply expressions that may change over time, such as load average or storage space consumed.
 OPTION_ITEM(--output expr) (multiple) Display this expression on the output.
@@ -65,6 +67,13 @@ LONGCODE_BEGIN
 % deltadb_query --file wq.data --from 2014-01-01 --output 'COUNT(name)' --output 'MAX(tasks_running)'
 LONGCODE_END
 
+Fields that are queried often can be exported once, after which queries of them take a fraction of the time:
+
+LONGCODE_BEGIN
+% deltadb_query --db /data/catalog.history --from 2014-01-01 --to 2015-01-01 --export type,name,tasks_running,workers
+% deltadb_query --db /data/catalog.history --from 2014-01-01 --to 2015-01-01 --filter 'type=="wq_master"' --output 'SUM(tasks_running)' --every 1d
+LONGCODE_END
+
 SECTION(COPYRIGHT)
 
 COPYRIGHT_BOILERPLATE
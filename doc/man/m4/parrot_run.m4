@@ -19,8 +19,11 @@ OPTIONS_BEGIN
 OPTION_PAIR(--check-driver,driver) Check for the presence of a given driver (e.g. http, ftp, etc) and return success if it is currently enabled.
 OPTION_TRIPLET(-a,chirp-auth,unix|hostname|ticket|globus|kerberos)Use this Chirp authentication method.  May be invoked multiple times to indicate a preferred list, in order.
 OPTION_TRIPLET(-b, block-size, bytes)Set the I/O block size hint.
+OPTION_PAIR(--cache-block-size,bytes)Cache read-only files from services that support ranged reads (such as HTTP and Chirp) one block of this size at a time, fetching only the blocks that are read. Zero caches whole files. The default is 1MB.
+OPTION_PAIR(--cache-size,bytes)Limit the file cache to this many bytes, evicting the least recently used files first. The limit applies to all sessions sharing the cache directory. By default the cache is unlimited.
 OPTION_TRIPLET(-c, status-file, file)Print exit status information to file.
 OPTION_ITEM(-C, channel-auth)Enable data channel authentication in GridFTP.
+OPTION_ITEM(--channel-huge-pages)Ask the kernel to back the I/O channel, through which Parrot passes the data of reads, writes and mmaped files, with transparent huge pages. Takes effect only if /sys/kernel/mm/transparent_hugepage/shmem_enabled allows it.
 OPTION_TRIPLET(-d, debug, flag)Enable debugging for this sub-system.
 OPTION_ITEM(-D, --no-optimize)Disable small file optimizations.
 OPTION_ITEM(--dynamic-mounts) Enable the use of parot_mount in this session.
@@ -36,12 +39,15 @@ OPTION_ITEM(-k, --no-checksums)Do not checksum files.
 OPTION_TRIPLET(-l, ld-path, path)Path to ld.so to use.
 OPTION_TRIPLET(-m, ftab-file, file)Use this file as a mountlist.
 OPTION_TRIPLET(-M, mount, /foo=/bar)Mount (redirect) /foo to /bar.
+OPTION_PAIR(--metadata-ttl,[service=]seconds)Cache remote stat and readlink results for this long, for one service or (without a service) for all. Zero disables the cache. The defaults are 5 seconds for chirp and hdfs and 60 seconds for http and cvmfs.
 OPTION_TRIPLET(-e, env-list, path)Record the environment variables.
+OPTION_ITEM(--native-io)Let the traced program open local files itself, so that reads, writes and mmaps run in the kernel without copies through Parrot (PARROT_NATIVE_IO). Parrot still sees opens, closes, dups and execs. fstat and /proc/self/fd on such files show the host file. With --seccomp, reads and writes on them stop the program only on entry.
 OPTION_TRIPLET(-n, name-list, path)Record all the file names.
 OPTION_ITEM(--no-set-foreground)Disable changing the foreground process group of the session.
 OPTION_TRIPLET(-N, hostname, name)Pretend that this is my hostname.
 OPTION_TRIPLET(-o,debug-file,file)Write debugging output to this file. By default, debugging is sent to stderr (":stderr"). You may specify logs to be sent to stdout (":stdout") instead.
 OPTION_TRIPLET(-O, debug-rotate-max, bytes)Rotate debug files of this size.
+OPTION_PAIR(--profile,file)Write a JSON profile of the trapped system calls to this file when Parrot exits, and again whenever Parrot receives SIGUSR2. For each system call and each service it gives the count, the time spent in Parrot, the time spent in the kernel between the entry and exit stops (trap_time when the kernel only ran a dummy call), the bytes read or written and a histogram of latencies in microseconds, bucketed by powers of two.
 OPTION_TRIPLET(-p, proxy, host:port)Use this proxy server for HTTP requests.
 OPTION_ITEM(-Q, --no-chirp-catalog)Inhibit catalog queries to list /chirp.
 OPTION_TRIPLET(-r, cvmfs-repos, repos)CVMFS repositories to enable (PARROT_CVMFS_REPO).
@@ -49,6 +55,7 @@ OPTION_ITEM(--cvmfs-repo-switching) Allow repository switching with CVMFS.
 OPTION_TRIPLET(-R, root-checksum, cksum)Enforce this root filesystem checksum, where available.
 OPTION_ITEM(-s, --stream-no-cache)Use streaming protocols without caching.
 OPTION_ITEM(-S, --session-caching)Enable whole session caching for all protocols.
+OPTION_ITEM(--seccomp)Install a seccomp filter in the traced program so that only the system calls Parrot must virtualize stop it (PARROT_SECCOMP). Requires Linux 4.8 or later. System calls run natively are not counted by --syscall-table.
 OPTION_ITEM(--syscall-disable-debug)Disable tracee access to the Parrot debug syscall.
 OPTION_TRIPLET(-t, tempdir, dir)Where to store temporary files.
 OPTION_TRIPLET(-T, timeout, time)Maximum amount of time to retry failures.
@@ -66,6 +73,7 @@ OPTION_ITEM(-W, --syscall-table)Display table of system calls trapped.
 OPTION_ITEM(-Y, --sync-write)Force synchronous disk writes.
 OPTION_ITEM(-Z, --auto-decompress)Enable automatic decompression on .gz files.
 OPTION_PAIR(--disable-service,service) Disable a compiled-in service (e.g. http, cvmfs, etc.)
+OPTION_PAIR(--http-streams,n)Split large reads of HTTP files into ranges fetched over this many keep-alive connections at once. The default is 4; 1 uses a single stream.
 OPTIONS_END
 
 SECTION(ENVIRONMENT VARIABLES)
@@ -89,14 +89,9 @@ static int errno_is_temporary(int e)
 	}
 }
 
-int datagram_recv(struct datagram *d, char *data, int length, char *addr, int *port, int timeout)
+static int datagram_wait(struct datagram *d, int timeout)
 {
 	int result;
-	struct sockaddr_storage iaddr;
-	SOCKLEN_T iaddr_length;
-	SOCKLEN_T addr_length = DATAGRAM_ADDRESS_MAX;
-	char port_string[16];
-	SOCKLEN_T port_string_length = 16;
 	fd_set fds;
 	struct timeval tm;
 
@@ -111,13 +106,32 @@ int datagram_recv(struct datagram *d, char *data, int length, char *addr, int *p
 		result = select(d->fd + 1, &fds, 0, 0, &tm);
 		if(result > 0) {
 			if(FD_ISSET(d->fd, &fds))
-				break;
+				return 1;
 		} else if(result < 0 && errno_is_temporary(errno)) {
 			continue;
 		} else {
-			return -1;
+			return 0;
 		}
 	}
+}
+
+static void datagram_sender(struct sockaddr_storage *iaddr, SOCKLEN_T iaddr_length, char *addr, int *port)
+{
+	char port_string[16];
+
+	getnameinfo((struct sockaddr *)iaddr,iaddr_length,addr,DATAGRAM_ADDRESS_MAX,port_string,sizeof(port_string),NI_NUMERICHOST|NI_NUMERICSERV);
+
+	*port = atoi(port_string);
+}
+
+int datagram_recv(struct datagram *d, char *data, int length, char *addr, int *port, int timeout)
+{
+	int result;
+	struct sockaddr_storage iaddr;
+	SOCKLEN_T iaddr_length;
+
+	if(!datagram_wait(d, timeout))
+		return -1;
 
 	iaddr_length = sizeof(iaddr);
 
@@ -125,13 +139,104 @@ int datagram_recv(struct datagram *d, char *data, int length, char *addr, int *p
 	if(result < 0)
 		return result;
 
-	getnameinfo((struct sockaddr *)&iaddr,iaddr_length,addr,addr_length,port_string,port_string_length,NI_NUMERICHOST|NI_NUMERICSERV);
+	datagram_sender(&iaddr, iaddr_length, addr, port);
 
-	*port = atoi(port_string);
+	return result;
+}
+
+#ifdef HAS_RECVMMSG
+
+/* Receive as many waiting datagrams as fit in msgs with one system call. */
+
+static int datagram_recv_batch(struct datagram *d, struct datagram_message *msgs, int count)
+{
+	struct mmsghdr hdrs[DATAGRAM_BATCH_MAX];
+	struct iovec iovs[DATAGRAM_BATCH_MAX];
+	struct sockaddr_storage iaddrs[DATAGRAM_BATCH_MAX];
+	int i, result;
+
+	if(count > DATAGRAM_BATCH_MAX)
+		count = DATAGRAM_BATCH_MAX;
+
+	memset(hdrs, 0, count * sizeof(*hdrs));
+
+	for(i = 0; i < count; i++) {
+		iovs[i].iov_base = msgs[i].data;
+		iovs[i].iov_len = msgs[i].size;
+		hdrs[i].msg_hdr.msg_iov = &iovs[i];
+		hdrs[i].msg_hdr.msg_iovlen = 1;
+		hdrs[i].msg_hdr.msg_name = &iaddrs[i];
+		hdrs[i].msg_hdr.msg_namelen = sizeof(iaddrs[i]);
+	}
+
+	result = recvmmsg(d->fd, hdrs, count, MSG_DONTWAIT, 0);
+	if(result <= 0)
+		return -1;
+
+	for(i = 0; i < result; i++) {
+		msgs[i].length = hdrs[i].msg_len;
+		datagram_sender(&iaddrs[i], hdrs[i].msg_hdr.msg_namelen, msgs[i].addr, &msgs[i].port);
+	}
 
 	return result;
 }
 
+#else
+
+static int datagram_recv_batch(struct datagram *d, struct datagram_message *msgs, int count)
+{
+	struct sockaddr_storage iaddr;
+	SOCKLEN_T iaddr_length;
+	int i, result;
+
+	for(i = 0; i < count; i++) {
+		iaddr_length = sizeof(iaddr);
+		result = recvfrom(d->fd, msgs[i].data, msgs[i].size, MSG_DONTWAIT, (struct sockaddr *) &iaddr, &iaddr_length);
+		if(result < 0)
+			break;
+		msgs[i].length = result;
+		datagram_sender(&iaddr, iaddr_length, msgs[i].addr, &msgs[i].port);
+	}
+
+	return i > 0 ? i : -1;
+}
+
+#endif
+
+int datagram_recv_many(struct datagram *d, struct datagram_message *msgs, int count, int timeout)
+{
+	int result;
+
+	while(1) {
+		result = datagram_recv_batch(d, msgs, count);
+		if(result > 0)
+			return result;
+		if(!errno_is_temporary(errno))
+			return -1;
+		if(!datagram_wait(d, timeout))
+			return -1;
+		/* Wait only once; after that, retry only while data is ready. */
+		timeout = 0;
+	}
+}
+
+int datagram_recv_buffer_set(struct datagram *d, int size)
+{
+	int actual;
+	SOCKLEN_T length = sizeof(actual);
+
+	/* A privileged process may exceed the system limit on buffer size. */
+#ifdef SO_RCVBUFFORCE
+	if(setsockopt(d->fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0)
+#endif
+		setsockopt(d->fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+	if(getsockopt(d->fd, SOL_SOCKET, SO_RCVBUF, &actual, &length) < 0)
+		return -1;
+
+	return actual;
+}
+
 int datagram_send(struct datagram *d, const char *data, int length, const char *addr, int port)
 {
 	int result;
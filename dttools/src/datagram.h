@@ -63,6 +63,9 @@ if(length>0) {
 /** Maximum number of bytes in a datagram payload */
 #define DATAGRAM_PAYLOAD_MAX 65536
 
+/** Maximum number of datagrams received by one call to @ref datagram_recv_many. */
+#define DATAGRAM_BATCH_MAX 64
+
 /** Used to indicate any available port. */
 #define DATAGRAM_PORT_ANY 0
 
@@ -98,6 +101,37 @@ void datagram_delete(struct datagram *d);
 */
 int datagram_recv(struct datagram *d, char *data, int length, char *addr, int *port, int timeout);
 
+/** A datagram received by @ref datagram_recv_many. */
+struct datagram_message {
+	char *data;                       /**< Where to store the message, provided by the caller. */
+	int size;                         /**< The length of the data buffer, provided by the caller. */
+	int length;                       /**< The number of bytes received. */
+	char addr[DATAGRAM_ADDRESS_MAX];  /**< The IP address of the sender. */
+	int port;                         /**< The port number of the sender. */
+};
+
+/** Receive several datagrams at once.
+A server receiving many small datagrams spends much of its time in the
+system call for each one.  Where the system supports it, this receives
+all the datagrams waiting, up to a limit, with a single system call.
+@param d The datagram object.
+@param msgs An array of messages, each with data and size filled in.
+@param count The number of messages in the array.  At most @ref DATAGRAM_BATCH_MAX are received at once.
+@param timeout Maximum time to wait for the first datagram, in microseconds.
+@return On success, returns the number of datagrams received into the first elements of msgs.  On failure, returns less than zero and sets errno appropriately.
+*/
+int datagram_recv_many(struct datagram *d, struct datagram_message *msgs, int count, int timeout);
+
+/** Set the size of the receive buffer of a datagram port.
+Datagrams that arrive while the buffer is full are dropped, so a server
+that receives bursts of datagrams should have a large buffer.
+The system may limit the size to less than requested.
+@param d The datagram object.
+@param size The desired size of the buffer, in bytes.
+@return The size of the buffer actually in effect, or less than zero on failure.
+*/
+int datagram_recv_buffer_set(struct datagram *d, int size);
+
 /** Send a datagram.
 @param d The datagram object.
 @param data The data to send.
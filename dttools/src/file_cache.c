@@ -11,6 +11,8 @@ See the file COPYING for details.
 #include "debug.h"
 #include "md5.h"
 #include "domain_name_cache.h"
+#include "full_io.h"
+#include "macros.h"
 
 #include <string.h>
 #include <errno.h>
@@ -18,11 +20,14 @@ See the file COPYING for details.
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/file.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <dirent.h>
 #include <limits.h>
 #include <signal.h>
 #include <time.h>
+#include <utime.h>
 
 /* Cygwin does not have 64-bit I/O, while Darwin has it by default. */
 
@@ -31,28 +36,112 @@ See the file COPYING for details.
 #define stat64 stat
 #define open64 open
 #define mkstemp64 mkstemp
+#define ftruncate64 ftruncate
 #endif
 
+#define SPARSE_MAGIC "fcspars2"
+#define INDEX_MAGIC "fcindex1"
+
+/* The index is an open-addressed table, kept at most this full. */
+#define INDEX_SLOTS 65536
+#define INDEX_LOAD_MAX (INDEX_SLOTS*3/4)
+
+/*
+Every process using the cache maps the same index file, which tracks the
+size and last use of each entry along with the total in use.  Changes are
+made under an exclusive flock on the index.  An entry with clock zero is
+an empty slot.
+*/
+
+struct index_entry {
+	unsigned char digest[MD5_DIGEST_LENGTH];
+	int64_t size;
+	int64_t clock;
+};
+
+struct index_header {
+	char magic[8];
+	int64_t used;
+	int64_t clock;
+	int64_t count;
+	int64_t padding[4];
+	struct index_entry entries[INDEX_SLOTS];
+};
+
 struct file_cache {
 	char *root;
+	int index_fd;
+	struct index_header *index;
+	INT64_T capacity;
+	struct hash_table *locks;
 };
 
-static void cached_name(struct file_cache *c, const char *path, char *lpath)
+struct sparse_header {
+	char magic[8];
+	int64_t size;
+	unsigned char version[MD5_DIGEST_LENGTH];
+	int32_t block_size;
+	int32_t padding;
+};
+
+struct file_cache_sparse {
+	int fd;
+	int mapfd;
+	int oldmapfd; /* locked map of the version being replaced */
+	INT64_T size;
+	time_t mtime;
+	unsigned char version[MD5_DIGEST_LENGTH];
+	int block_size;
+	INT64_T nblocks;
+	INT64_T present;
+	unsigned char *map;
+	struct file_cache *cache;
+	char *path;
+	unsigned char digest[MD5_DIGEST_LENGTH];
+	char lpath[PATH_MAX];
+	char dpath[PATH_MAX];
+	char mpath[PATH_MAX];
+};
+
+static void digest_name(struct file_cache *c, unsigned char digest[MD5_DIGEST_LENGTH], char *lpath, const char *suffix)
+{
+	sprintf(lpath, "%s/%02x/%s%s", c->root, digest[0], md5_string(digest), suffix);
+}
+
+static void cached_name_suffix(struct file_cache *c, const char *path, char *lpath, const char *suffix)
 {
 	unsigned char digest[MD5_DIGEST_LENGTH];
 	md5_buffer(path, strlen(path), digest);
-	sprintf(lpath, "%s/%02x/%s", c->root, digest[0], md5_string(digest));
+	digest_name(c, digest, lpath, suffix);
 }
 
-static void txn_name(struct file_cache *c, const char *path, char *txn)
+static void cached_name(struct file_cache *c, const char *path, char *lpath)
+{
+	cached_name_suffix(c, path, lpath, "");
+}
+
+static void txn_name_prefix(struct file_cache *c, const char *path, char *txn, const char *prefix)
 {
 	unsigned char digest[MD5_DIGEST_LENGTH];
 	char shortname[DOMAIN_NAME_MAX];
 	domain_name_cache_guess_short(shortname);
 	md5_buffer(path, strlen(path), digest);
-	sprintf(txn, "%s/txn/%s.%s.%d.XXXXXX", c->root, md5_string(digest), shortname, (int) getpid());
+	sprintf(txn, "%s/txn/%s%s.%s.%d.XXXXXX", c->root, prefix, md5_string(digest), shortname, (int) getpid());
 }
 
+static void txn_name(struct file_cache *c, const char *path, char *txn)
+{
+	txn_name_prefix(c, path, txn, "");
+}
+
+/*
+The process filling an entry holds an exclusive flock on its txn file
+until it commits or aborts, and the kernel drops the lock if it dies.  A
+waiter polls for a shared lock, but gives up on a txn which has not been
+written for a minute, in case its owner is stuck or leaked the lock.
+Returns true if the txn is finished and the entry should be looked up again.
+*/
+
 static int wait_for_running_txn(struct file_cache *c, const char *path)
 {
 	char txn[PATH_MAX];
@@ -61,6 +150,7 @@ static int wait_for_running_txn(struct file_cache *c, const char *path)
 	DIR *dir;
 	struct dirent *d;
 	const char *checksum;
+	int fd, result;
 
 	md5_buffer(path, strlen(path), digest);
 	checksum = md5_string(digest);
@@ -85,24 +175,253 @@ static int wait_for_running_txn(struct file_cache *c, const char *path)
 	if(!txn[0])
 		return 0;
 
+	fd = open64(txn, O_RDONLY, 0);
+	if(fd < 0)
+		return 1;
+
+	debug(D_CACHE, "wait %s", txn);
 	while(1) {
 		struct stat64 info;
 
-		debug(D_CACHE, "wait %s", txn);
-		if(stat64(txn, &info) < 0)
-			return 1;
+		result = flock(fd, LOCK_SH | LOCK_NB);
+		if(result == 0 || (errno != EWOULDBLOCK && errno != EINTR)) {
+			result = result == 0;
+			break;
+		}
+
+		if(fstat64(fd, &info) < 0 || info.st_nlink == 0) {
+			result = 1;
+			break;
+		} else if(time(0) - info.st_mtime >= 60) {
+			debug(D_CACHE, "override %s", txn);
+			result = 0;
+			break;
+		}
+
+		usleep(100000);
+	}
+	close(fd);
+
+	return result;
+}
+
+static unsigned index_home(const unsigned char digest[MD5_DIGEST_LENGTH])
+{
+	uint32_t h;
+	memcpy(&h, digest, sizeof(h));
+	return h % INDEX_SLOTS;
+}
+
+static struct index_entry *index_find(struct file_cache *c, unsigned char digest[MD5_DIGEST_LENGTH], int create)
+{
+	struct index_entry *e;
+	unsigned i;
+
+	for(i = index_home(digest);; i = (i + 1) % INDEX_SLOTS) {
+		e = &c->index->entries[i];
+		if(!e->clock)
+			break;
+		if(!memcmp(e->digest, digest, MD5_DIGEST_LENGTH))
+			return e;
+	}
+
+	if(!create || c->index->count >= INDEX_LOAD_MAX)
+		return 0;
+
+	memcpy(e->digest, digest, MD5_DIGEST_LENGTH);
+	e->size = 0;
+	e->clock = ++c->index->clock;
+	c->index->count++;
+	return e;
+}
+
+/* Remove an entry, shifting back any later entries of the same probe run. */
+static void index_remove(struct file_cache *c, struct index_entry *e)
+{
+	struct index_entry *entries = c->index->entries;
+	unsigned i = e - entries;
+	unsigned j, k;
+
+	c->index->used -= e->size;
+	c->index->count--;
+
+	for(j = (i + 1) % INDEX_SLOTS; entries[j].clock; j = (j + 1) % INDEX_SLOTS) {
+		k = index_home(entries[j].digest);
+		if((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j)) {
+			entries[i] = entries[j];
+			i = j;
+		}
+	}
+
+	memset(&entries[i], 0, sizeof(entries[i]));
+}
+
+static void index_evict_one(struct file_cache *c, struct index_entry *e)
+{
+	char lpath[PATH_MAX];
+
+	digest_name(c, e->digest, lpath, "");
+	debug(D_CACHE, "evict %s (%" PRId64 " bytes)", lpath, e->size);
+
+	/* Processes with the file open keep reading it until they close it. */
+	unlink(lpath);
+	digest_name(c, e->digest, lpath, ".sparse");
+	unlink(lpath);
+	digest_name(c, e->digest, lpath, ".map");
+	unlink(lpath);
 
-		time_t current = time(0);
+	index_remove(c, e);
+}
+
+static struct index_entry *index_oldest(struct file_cache *c, unsigned char *exclude)
+{
+	struct index_entry *e, *oldest = 0;
 
-		if((current - info.st_mtime) < 60) {
-			sleep(1);
+	for(e = c->index->entries; e < c->index->entries + INDEX_SLOTS; e++) {
+		if(!e->clock || (exclude && !memcmp(e->digest, exclude, MD5_DIGEST_LENGTH)))
 			continue;
-		} else {
-			debug(D_CACHE, "override %s", txn);
-			return 0;
+		if(!oldest || e->clock < oldest->clock)
+			oldest = e;
+	}
+
+	return oldest;
+}
+
+/* Evict the least recently used entries (other than exclude) until within capacity. */
+static void index_evict(struct file_cache *c, unsigned char *exclude)
+{
+	struct index_entry *e;
+
+	while(c->capacity > 0 && c->index->used > c->capacity && (e = index_oldest(c, exclude)))
+		index_evict_one(c, e);
+}
+
+/* Add delta bytes to an entry, or set its size if absolute, and mark it used. */
+static void index_charge(struct file_cache *c, unsigned char digest[MD5_DIGEST_LENGTH], INT64_T delta, int absolute)
+{
+	struct index_entry *e;
+
+	if(!c->index)
+		return;
+
+	flock(c->index_fd, LOCK_EX);
+
+	while(!(e = index_find(c, digest, 1))) {
+		struct index_entry *oldest = index_oldest(c, digest);
+		if(!oldest)
+			break;
+		index_evict_one(c, oldest);
+	}
+
+	if(e) {
+		if(absolute)
+			delta -= e->size;
+		e->size += delta;
+		c->index->used += delta;
+		e->clock = ++c->index->clock;
+		index_evict(c, digest);
+	}
+
+	flock(c->index_fd, LOCK_UN);
+}
+
+static void index_forget(struct file_cache *c, unsigned char digest[MD5_DIGEST_LENGTH])
+{
+	struct index_entry *e;
+
+	if(!c->index)
+		return;
+
+	flock(c->index_fd, LOCK_EX);
+	if((e = index_find(c, digest, 0)))
+		index_remove(c, e);
+	flock(c->index_fd, LOCK_UN);
+}
+
+/* Called with the index locked: account for whatever is already in the cache. */
+static void index_rebuild(struct file_cache *c)
+{
+	char path[PATH_MAX];
+	unsigned char digest[MD5_DIGEST_LENGTH];
+	struct stat64 info;
+	struct dirent *d;
+	DIR *dir;
+	int i, j;
+
+	debug(D_CACHE, "rebuilding index of %s", c->root);
+
+	for(i = 0; i <= 0xff; i++) {
+		sprintf(path, "%s/%02x", c->root, i);
+		dir = opendir(path);
+		if(!dir)
+			continue;
+		while((d = readdir(dir))) {
+			const char *suffix = d->d_name + MD5_DIGEST_LENGTH_HEX;
+			struct index_entry *e;
+			unsigned byte;
+
+			if(strlen(d->d_name) < MD5_DIGEST_LENGTH_HEX || (*suffix && strcmp(suffix, ".sparse")))
+				continue;
+			for(j = 0; j < MD5_DIGEST_LENGTH; j++) {
+				if(sscanf(d->d_name + 2 * j, "%2x", &byte) != 1)
+					break;
+				digest[j] = byte;
+			}
+			if(j < MD5_DIGEST_LENGTH)
+				continue;
+
+			sprintf(path, "%s/%02x/%s", c->root, i, d->d_name);
+			if(stat64(path, &info) < 0 || !(e = index_find(c, digest, 1)))
+				continue;
+
+			/* sparse files are charged for the blocks actually present */
+			e->size += *suffix ? (int64_t) info.st_blocks * 512 : (int64_t) info.st_size;
+			c->index->used += *suffix ? (int64_t) info.st_blocks * 512 : (int64_t) info.st_size;
 		}
+		closedir(dir);
 	}
+}
+
+static int index_open(struct file_cache *c)
+{
+	char path[PATH_MAX];
+	struct stat64 info;
+	void *index;
 
+	sprintf(path, "%s/index", c->root);
+	c->index_fd = open64(path, O_RDWR | O_CREAT, 0777);
+	if(c->index_fd < 0)
+		return -1;
+
+	flock(c->index_fd, LOCK_EX);
+
+	if(fstat64(c->index_fd, &info) < 0)
+		goto failure;
+
+	if(info.st_size != sizeof(struct index_header) && (ftruncate64(c->index_fd, 0) < 0 || ftruncate64(c->index_fd, sizeof(struct index_header)) < 0))
+		goto failure;
+
+	index = mmap(0, sizeof(struct index_header), PROT_READ | PROT_WRITE, MAP_SHARED, c->index_fd, 0);
+	if(index == MAP_FAILED)
+		goto failure;
+	c->index = index;
+
+	if(memcmp(c->index->magic, INDEX_MAGIC, sizeof(c->index->magic))) {
+		memset(c->index, 0, sizeof(struct index_header));
+		index_rebuild(c);
+		memcpy(c->index->magic, INDEX_MAGIC, sizeof(c->index->magic));
+	}
+
+	debug(D_CACHE, "%s holds %" PRId64 " bytes in %" PRId64 " entries", c->root, c->index->used, c->index->count);
+
+	flock(c->index_fd, LOCK_UN);
+	return 0;
+
+	  failure:
+	debug(D_CACHE, "couldn't open cache index %s: %s", path, strerror(errno));
+	close(c->index_fd);
+	c->index_fd = -1;
+	return -1;
 }
 
 static int mkdir_or_exists( const char *path, mode_t mode )
@@ -116,10 +435,12 @@ struct file_cache *file_cache_init(const char *root)
 	struct stat64 buf;
 	int result, i;
 
-	struct file_cache *f = malloc(sizeof(*f));
+	struct file_cache *f = calloc(1, sizeof(*f));
 	if(!f)
 		return 0;
 
+	f->index_fd = -1;
+
 	f->root = strdup(root);
 	if(!f->root) {
 		free(f);
@@ -142,6 +463,13 @@ struct file_cache *file_cache_init(const char *root)
 		}
 	}
 
+	f->locks = hash_table_create(0, 0);
+	if(!f->locks)
+		goto failure;
+
+	/* The cache still works without an index, just without a size limit. */
+	index_open(f);
+
 	return f;
 
 	  failure:
@@ -152,11 +480,30 @@ struct file_cache *file_cache_init(const char *root)
 void file_cache_fini(struct file_cache *f)
 {
 	if(f) {
+		if(f->locks) {
+			char *txn;
+			int *fd;
+			hash_table_firstkey(f->locks);
+			while(hash_table_nextkey(f->locks, &txn, (void **) &fd)) {
+				close(*fd);
+				free(fd);
+			}
+			hash_table_delete(f->locks);
+		}
+		if(f->index)
+			munmap(f->index, sizeof(struct index_header));
+		if(f->index_fd >= 0)
+			close(f->index_fd);
 		free(f->root);
 		free(f);
 	}
 }
 
+void file_cache_set_capacity(struct file_cache *f, INT64_T capacity)
+{
+	f->capacity = capacity;
+}
+
 void file_cache_cleanup(struct file_cache *f)
 {
 	char path[PATH_MAX];
@@ -202,6 +549,12 @@ void file_cache_cleanup(struct file_cache *f)
 	}
 
 	closedir(dir);
+
+	if(f->index) {
+		flock(f->index_fd, LOCK_EX);
+		index_evict(f, 0);
+		flock(f->index_fd, LOCK_UN);
+	}
 }
 
 int file_cache_stat(struct file_cache *c, const char *path, char *lpath, struct stat64 *info)
@@ -250,7 +603,10 @@ int file_cache_open(struct file_cache *c, const char *path, int flags, char *lpa
 
 		if (fstat64(fd, &info) == 0) {
 			if((size == 0 || (size == info.st_size)) && ((mtime == 0) || (info.st_mtime >= mtime))) {
+				unsigned char digest[MD5_DIGEST_LENGTH];
 				debug(D_CACHE, "hit %s %s", path, lpath);
+				md5_buffer(path, strlen(path), digest);
+				index_charge(c, digest, 0, 0);
 				return fd;
 			} else {
 				debug(D_CACHE, "stale %s %s", path, lpath);
@@ -273,8 +629,16 @@ int file_cache_open(struct file_cache *c, const char *path, int flags, char *lpa
 int file_cache_delete(struct file_cache *f, const char *path)
 {
 	char lpath[PATH_MAX];
+	char spath[PATH_MAX];
+	unsigned char digest[MD5_DIGEST_LENGTH];
+	md5_buffer(path, strlen(path), digest);
+	index_forget(f, digest);
 	cached_name(f, path, lpath);
 	debug(D_CACHE, "remove %s %s", path, lpath);
+	cached_name_suffix(f, path, spath, ".sparse");
+	unlink(spath);
+	cached_name_suffix(f, path, spath, ".map");
+	unlink(spath);
 	return unlink(lpath);
 }
 
@@ -284,28 +648,357 @@ int file_cache_begin(struct file_cache *f, const char *path, char *txn)
 	txn_name(f, path, txn);
 	result = mkstemp64(txn);
 	if(result >= 0) {
+		int *lock = malloc(sizeof(*lock));
 		debug(D_CACHE, "begin %s %s", path, txn);
 		fchmod(result, 0700);
+		/* A separate descriptor, so the lock ends with the txn rather than the file. */
+		if(lock && (*lock = open64(txn, O_RDONLY, 0)) >= 0 && flock(*lock, LOCK_EX) == 0) {
+			hash_table_insert(f->locks, txn, lock);
+		} else if(lock) {
+			if(*lock >= 0)
+				close(*lock);
+			free(lock);
+		}
 	}
 	return result;
 }
 
+static void txn_unlock(struct file_cache *f, const char *txn)
+{
+	int *lock = hash_table_remove(f->locks, txn);
+	if(lock) {
+		close(lock[0]);
+		free(lock);
+	}
+}
+
 int file_cache_abort(struct file_cache *f, const char *path, const char *txn)
 {
+	int result;
 	debug(D_CACHE, "abort %s %s", path, txn);
-	return unlink(txn);
+	result = unlink(txn);
+	txn_unlock(f, txn);
+	return result;
 }
 
 int file_cache_commit(struct file_cache *f, const char *path, const char *txn)
 {
 	int result;
 	char lpath[PATH_MAX];
+	unsigned char digest[MD5_DIGEST_LENGTH];
+	struct stat64 info;
 	cached_name(f, path, lpath);
 	debug(D_CACHE, "commit %s %s %s", path, txn, lpath);
-	result = rename(txn, lpath);
-	if(result < 0)
+	result = stat64(txn, &info);
+	if(result == 0)
+		result = rename(txn, lpath);
+	if(result < 0) {
 		debug(D_CACHE, "commit failed: %s", strerror(errno));
+	} else {
+		md5_buffer(path, strlen(path), digest);
+		index_charge(f, digest, info.st_size, 1);
+	}
+	txn_unlock(f, txn);
 	return result;
 }
 
+static void sparse_free(struct file_cache_sparse *s)
+{
+	if(s->fd >= 0)
+		close(s->fd);
+	if(s->mapfd >= 0)
+		close(s->mapfd);
+	if(s->oldmapfd >= 0)
+		close(s->oldmapfd);
+	free(s->map);
+	free(s->path);
+	free(s);
+}
+
+static int same_file(int fd, const char *path)
+{
+	struct stat64 a, b;
+	return fstat64(fd, &a) == 0 && stat64(path, &b) == 0 && a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+}
+
+/*
+Once every block is present, the data becomes an ordinary cache entry,
+unless the files have meanwhile been replaced by another version.
+*/
+static int sparse_commit(struct file_cache_sparse *s)
+{
+	struct utimbuf ut;
+	int result;
+
+	flock(s->mapfd, LOCK_EX);
+
+	if(!same_file(s->fd, s->dpath) || !same_file(s->mapfd, s->mpath)) {
+		debug(D_CACHE, "not committing %s: replaced or already committed", s->dpath);
+		flock(s->mapfd, LOCK_UN);
+		errno = ESTALE;
+		return -1;
+	}
+
+	ut.actime = ut.modtime = s->mtime;
+	utime(s->dpath, &ut);
+
+	debug(D_CACHE, "commit %s %s", s->dpath, s->lpath);
+	result = rename(s->dpath, s->lpath);
+	if(result == 0)
+		unlink(s->mpath);
+	else
+		debug(D_CACHE, "commit failed: %s", strerror(errno));
+
+	flock(s->mapfd, LOCK_UN);
+	return result;
+}
+
+static int sparse_tmp(struct file_cache_sparse *s, const char *prefix, char *tmp)
+{
+	int fd;
+	txn_name_prefix(s->cache, s->path, tmp, prefix);
+	fd = mkstemp64(tmp);
+	if(fd >= 0)
+		fchmod(fd, 0700);
+	return fd;
+}
+
+/*
+Start over with empty files of our version.  Other processes may still be
+reading the files of another version, so those are never truncated: new
+files are put in their place with rename, and the old ones remain with
+their readers, who can no longer commit them.  Called with the map locked.
+*/
+static int sparse_reset(struct file_cache_sparse *s)
+{
+	struct sparse_header h;
+	char dtmp[PATH_MAX];
+	char mtmp[PATH_MAX];
+	int fd = -1, mapfd = -1;
+
+	debug(D_CACHE, "reset %s", s->dpath);
+
+	dtmp[0] = mtmp[0] = 0;
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, SPARSE_MAGIC, sizeof(h.magic));
+	h.size = s->size;
+	memcpy(h.version, s->version, sizeof(h.version));
+	h.block_size = s->block_size;
+
+	if((fd = sparse_tmp(s, "sparse-", dtmp)) < 0 || ftruncate64(fd, s->size) < 0)
+		goto failure;
+	if((mapfd = sparse_tmp(s, "map-", mtmp)) < 0 || ftruncate64(mapfd, sizeof(h) + s->nblocks) < 0)
+		goto failure;
+	if(full_pwrite64(mapfd, &h, sizeof(h), 0) != sizeof(h))
+		goto failure;
+
+	/* the data first, so that a process finding the new map also finds its data */
+	if(rename(dtmp, s->dpath) < 0)
+		goto failure;
+	dtmp[0] = 0;
+	if(rename(mtmp, s->mpath) < 0)
+		goto failure;
+
+	index_charge(s->cache, s->digest, 0, 1);
+
+	if(s->fd >= 0)
+		close(s->fd);
+	s->fd = fd;
+	/* the caller unlocks the old map, which waiters will then find replaced */
+	s->oldmapfd = s->mapfd;
+	s->mapfd = mapfd;
+	memset(s->map, 0, s->nblocks);
+	s->present = 0;
+	return 0;
+
+	  failure:
+	if(fd >= 0)
+		close(fd);
+	if(mapfd >= 0)
+		close(mapfd);
+	if(dtmp[0])
+		unlink(dtmp);
+	if(mtmp[0])
+		unlink(mtmp);
+	return -1;
+}
+
+/* Called with the map locked: start over if the map describes another version of the file. */
+static int sparse_validate(struct file_cache_sparse *s)
+{
+	struct sparse_header h;
+	INT64_T i;
+
+	if(full_pread64(s->mapfd, &h, sizeof(h), 0) == sizeof(h) && !memcmp(h.magic, SPARSE_MAGIC, sizeof(h.magic)) && h.size == s->size && !memcmp(h.version, s->version, sizeof(h.version)) && h.block_size == s->block_size) {
+		s->fd = open64(s->dpath, O_RDWR, 0);
+		if(s->fd >= 0 && full_pread64(s->mapfd, s->map, s->nblocks, sizeof(h)) == s->nblocks) {
+			for(i = 0; i < s->nblocks; i++)
+				s->present += s->map[i] != 0;
+			debug(D_CACHE, "resume %s (%" PRId64 "/%" PRId64 " blocks)", s->dpath, s->present, s->nblocks);
+			index_charge(s->cache, s->digest, 0, 0);
+			return 0;
+		}
+	}
+
+	return sparse_reset(s);
+}
+
+struct file_cache_sparse *file_cache_sparse_open(struct file_cache *c, const char *path, INT64_T size, time_t mtime, const char *version, int block_size)
+{
+	struct file_cache_sparse *s;
+	int result;
+
+	if(size <= 0 || block_size <= 0) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	s = calloc(1, sizeof(*s));
+	if(!s)
+		return 0;
+
+	s->fd = s->mapfd = s->oldmapfd = -1;
+	s->cache = c;
+	s->path = strdup(path);
+	md5_buffer(path, strlen(path), s->digest);
+	md5_buffer(version, strlen(version), s->version);
+	s->size = size;
+	s->mtime = mtime;
+	s->block_size = block_size;
+	s->nblocks = (size + block_size - 1) / block_size;
+
+	cached_name(c, path, s->lpath);
+	cached_name_suffix(c, path, s->dpath, ".sparse");
+	cached_name_suffix(c, path, s->mpath, ".map");
+
+	s->map = calloc(s->nblocks, 1);
+	if(!s->map || !s->path)
+		goto failure;
+
+	while(1) {
+		s->mapfd = open64(s->mpath, O_RDWR | O_CREAT, 0700);
+		if(s->mapfd < 0)
+			goto failure;
+		flock(s->mapfd, LOCK_EX);
+		if(same_file(s->mapfd, s->mpath))
+			break;
+		/* replaced or committed while we waited for the lock */
+		close(s->mapfd);
+		s->mapfd = -1;
+	}
+
+	result = sparse_validate(s);
+	if(s->oldmapfd >= 0) {
+		close(s->oldmapfd);
+		s->oldmapfd = -1;
+	}
+	flock(s->mapfd, LOCK_UN);
+	if(result < 0)
+		goto failure;
+
+	if(file_cache_sparse_complete(s))
+		sparse_commit(s);
+
+	return s;
+
+	  failure:
+	debug(D_CACHE, "couldn't open sparse %s: %s", s->dpath, strerror(errno));
+	result = errno;
+	sparse_free(s);
+	errno = result;
+	return 0;
+}
+
+int file_cache_sparse_block_size(struct file_cache_sparse *s)
+{
+	return s->block_size;
+}
+
+/* Another process may have filled the block since we last looked. */
+static int sparse_present(struct file_cache_sparse *s, INT64_T block)
+{
+	if(!s->map[block] && full_pread64(s->mapfd, &s->map[block], 1, sizeof(struct sparse_header) + block) == 1 && s->map[block])
+		s->present++;
+	return s->map[block];
+}
+
+int file_cache_sparse_missing(struct file_cache_sparse *s, INT64_T offset, INT64_T length, INT64_T *start, INT64_T *count)
+{
+	INT64_T first, last, end;
+
+	if(length <= 0 || offset >= s->size)
+		return 0;
+
+	first = offset / s->block_size;
+	last = (MIN(offset + length, s->size) - 1) / s->block_size;
+
+	while(first <= last && sparse_present(s, first))
+		first++;
+	if(first > last)
+		return 0;
+
+	for(end = first + 1; end <= last && !sparse_present(s, end); end++) ;
+
+	*start = first * s->block_size;
+	*count = MIN(end * s->block_size, s->size) - *start;
+	return 1;
+}
+
+int file_cache_sparse_fill(struct file_cache_sparse *s, const void *data, INT64_T length, INT64_T offset)
+{
+	INT64_T first, last, i, added = 0;
+	struct stat64 info;
+
+	if(offset % s->block_size || length <= 0 || offset + length > s->size) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if(full_pwrite64(s->fd, data, length, offset) != length)
+		return -1;
+
+	/* A trailing partial block is only complete at the end of the file. */
+	first = offset / s->block_size;
+	last = offset + length == s->size ? s->nblocks : (offset + length) / s->block_size;
+
+	for(i = first; i < last; i++) {
+		if(!s->map[i]) {
+			s->present++;
+			added += MIN(s->block_size, s->size - i * s->block_size);
+		}
+		s->map[i] = 1;
+	}
+
+	/* Don't charge for a file that has since been evicted. */
+	if(added > 0 && fstat64(s->fd, &info) == 0 && info.st_nlink > 0)
+		index_charge(s->cache, s->digest, added, 0);
+
+	if(last > first && full_pwrite64(s->mapfd, &s->map[first], last - first, sizeof(struct sparse_header) + first) != last - first)
+		return -1;
+
+	if(file_cache_sparse_complete(s))
+		sparse_commit(s);
+
+	return 0;
+}
+
+INT64_T file_cache_sparse_read(struct file_cache_sparse *s, void *data, INT64_T length, INT64_T offset)
+{
+	if(offset >= s->size)
+		return 0;
+	return full_pread64(s->fd, data, MIN(length, s->size - offset), offset);
+}
+
+int file_cache_sparse_complete(struct file_cache_sparse *s)
+{
+	return s->present == s->nblocks;
+}
+
+int file_cache_sparse_close(struct file_cache_sparse *s)
+{
+	sparse_free(s);
+	return 0;
+}
+
 /* vim: set noexpandtab tabstop=4: */
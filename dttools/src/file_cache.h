@@ -16,6 +16,9 @@ struct file_cache *file_cache_init(const char *root);
 void file_cache_fini(struct file_cache *c);
 void file_cache_cleanup(struct file_cache *c);
 
+/* Evict least recently used entries to keep the cache under capacity bytes, or 0 for no limit. */
+void file_cache_set_capacity(struct file_cache *c, INT64_T capacity);
+
 int file_cache_open(struct file_cache *c, const char *path, int flags, char *lpath, INT64_T size, time_t mtime);
 int file_cache_delete(struct file_cache *f, const char *path);
 int file_cache_contains(struct file_cache *f, const char *path, char *lpath);
@@ -24,4 +27,25 @@ int file_cache_begin(struct file_cache *c, const char *path, char *txn);
 int file_cache_commit(struct file_cache *c, const char *path, const char *txn);
 int file_cache_abort(struct file_cache *c, const char *path, const char *txn);
 
+/*
+A sparse cache entry holds a remote file of known size one block at a
+time, alongside a map recording which blocks are present.  The map keeps
+one byte per block, so that processes sharing the cache may fill
+different blocks concurrently.  Once every block is present, the entry is
+committed as an ordinary whole-file entry with the given mtime.
+
+The entry is only reused for the same version, a string which must change
+whenever the contents of the file do (an ETag, or an mtime known to be
+real).  Opening another version starts a new entry, without disturbing
+processes still reading the old one.
+*/
+
+struct file_cache_sparse *file_cache_sparse_open(struct file_cache *c, const char *path, INT64_T size, time_t mtime, const char *version, int block_size);
+int file_cache_sparse_missing(struct file_cache_sparse *s, INT64_T offset, INT64_T length, INT64_T *start, INT64_T *count);
+int file_cache_sparse_fill(struct file_cache_sparse *s, const void *data, INT64_T length, INT64_T offset);
+INT64_T file_cache_sparse_read(struct file_cache_sparse *s, void *data, INT64_T length, INT64_T offset);
+int file_cache_sparse_block_size(struct file_cache_sparse *s);
+int file_cache_sparse_complete(struct file_cache_sparse *s);
+int file_cache_sparse_close(struct file_cache_sparse *s);
+
 #endif
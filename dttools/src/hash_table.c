@@ -73,6 +73,8 @@ void hash_table_clear(struct hash_table *h)
 	for(i = 0; i < h->bucket_count; i++) {
 		h->buckets[i] = 0;
 	}
+
+	h->size = 0;
 }
 
 
@@ -12,9 +12,11 @@ See the file COPYING for details.
 #include "debug.h"
 #include "domain_name_cache.h"
 #include "url_encode.h"
+#include "macros.h"
 
 #include <errno.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -23,6 +25,30 @@ See the file COPYING for details.
 #define HTTP_LINE_MAX 4096
 #define HTTP_PORT 80
 
+/* Idle keep-alive connections retained for later range requests. */
+#define HTTP_POOL_MAX 16
+/* Parallel range requests are never smaller than this. */
+#define HTTP_RANGE_MIN (256*1024)
+#define HTTP_STREAMS_MAX 16
+
+struct http_pooled {
+	char host[DOMAIN_NAME_MAX];
+	int port;
+	struct link *link;
+};
+
+static struct http_pooled http_pool[HTTP_POOL_MAX];
+
+struct http_range {
+	struct link *link;
+	int reused;
+	int keepalive;
+	char *data;
+	INT64_T offset;
+	INT64_T length;
+	INT64_T received;
+};
+
 static int http_response_to_errno(int response)
 {
 	if(response <= 299) {
@@ -62,10 +88,12 @@ struct link *http_query(const char *url, const char *action, time_t stoptime)
 	return http_query_size(url, action, &size, stoptime, 0);
 }
 
-struct link *http_query_size(const char *url, const char *action, INT64_T * size, time_t stoptime, int cache_reload)
+static struct link *http_query_range_via_proxy(const char *proxy, const char *urlin, const char *action, INT64_T offset, INT64_T length, INT64_T * size, char *validator, int validator_length, time_t stoptime, int cache_reload);
+
+static struct link *http_query_any_proxy(const char *url, const char *action, INT64_T offset, INT64_T length, INT64_T * size, char *validator, int validator_length, time_t stoptime, int cache_reload)
 {
 	if(!getenv("HTTP_PROXY")) {
-		return http_query_size_via_proxy(0, url, action, size, stoptime, cache_reload);
+		return http_query_range_via_proxy(0, url, action, offset, length, size, validator, validator_length, stoptime, cache_reload);
 	} else {
 		char proxies[HTTP_LINE_MAX];
 		char *proxy;
@@ -75,7 +103,7 @@ struct link *http_query_size(const char *url, const char *action, INT64_T * size
 
 		while(proxy) {
 			struct link *result;
-			result = http_query_size_via_proxy(proxy, url, action, size, stoptime, cache_reload);
+			result = http_query_range_via_proxy(proxy, url, action, offset, length, size, validator, validator_length, stoptime, cache_reload);
 			if(result)
 				return result;
 			proxy = strtok(0, ";");
@@ -84,7 +112,27 @@ struct link *http_query_size(const char *url, const char *action, INT64_T * size
 	}
 }
 
+struct link *http_query_size(const char *url, const char *action, INT64_T * size, time_t stoptime, int cache_reload)
+{
+	return http_query_any_proxy(url, action, -1, -1, size, 0, 0, stoptime, cache_reload);
+}
+
+struct link *http_query_validator(const char *url, const char *action, INT64_T * size, char *validator, int length, time_t stoptime)
+{
+	return http_query_any_proxy(url, action, -1, -1, size, validator, length, stoptime, 0);
+}
+
+struct link *http_query_range(const char *url, const char *action, INT64_T offset, INT64_T length, INT64_T * size, time_t stoptime)
+{
+	return http_query_any_proxy(url, action, offset, length, size, 0, 0, stoptime, 0);
+}
+
 struct link *http_query_size_via_proxy(const char *proxy, const char *urlin, const char *action, INT64_T * size, time_t stoptime, int cache_reload)
+{
+	return http_query_range_via_proxy(proxy, urlin, action, -1, -1, size, 0, 0, stoptime, cache_reload);
+}
+
+static struct link *http_query_range_via_proxy(const char *proxy, const char *urlin, const char *action, INT64_T offset, INT64_T length, INT64_T * size, char *validator, int validator_length, time_t stoptime, int cache_reload)
 {
 	char url[HTTP_LINE_MAX];
 	char newurl[HTTP_LINE_MAX];
@@ -95,7 +143,10 @@ struct link *http_query_size_via_proxy(const char *proxy, const char *urlin, con
 	int response;
 	char actual_host[HTTP_LINE_MAX];
 	int actual_port;
+	int etag = 0;
 	*size = 0;
+	if(validator)
+		validator[0] = 0;
 
 	url_encode(urlin, url, sizeof(url));
 
@@ -154,6 +205,10 @@ struct link *http_query_size_via_proxy(const char *proxy, const char *urlin, con
 		buffer_printf(&B, "%s %s HTTP/1.1\r\n", action, url);
 		if(cache_reload)
 			buffer_putliteral(&B, "Cache-Control: max-age=0\r\n");
+		if(offset >= 0 && length > 0)
+			buffer_printf(&B, "Range: bytes=%" PRId64 "-%" PRId64 "\r\n", offset, offset + length - 1);
+		else if(offset >= 0)
+			buffer_printf(&B, "Range: bytes=%" PRId64 "-\r\n", offset);
 		buffer_putliteral(&B, "Connection: close\r\n");
 		buffer_printf(&B, "Host: %s\r\n", actual_host);
 		if(getenv("HTTP_USER_AGENT"))
@@ -178,6 +233,15 @@ struct link *http_query_size_via_proxy(const char *proxy, const char *urlin, con
 				debug(D_HTTP, "%s", line);
 				sscanf(line, "Location: %s", newurl);
 				sscanf(line, "Content-Length: %" SCNd64, size);
+				if(validator) {
+					/* a weak ETag does not promise identical bytes, so ranges could not be combined */
+					if(!strncasecmp(line, "ETag: ", 6) && strncmp(line + 6, "W/", 2)) {
+						snprintf(validator, validator_length, "%s", line);
+						etag = 1;
+					} else if(!etag && !strncasecmp(line, "Last-Modified: ", 15)) {
+						snprintf(validator, validator_length, "%s", line);
+					}
+				}
 				if(strlen(line) <= 2) {
 					break;
 				}
@@ -185,6 +249,21 @@ struct link *http_query_size_via_proxy(const char *proxy, const char *urlin, con
 
 			switch (response) {
 			case 200:
+				if(offset > 0) {
+					/* The server ignored the range, so the data would start at the wrong offset. */
+					debug(D_HTTP, "server does not support ranges for %s", url);
+					link_close(link);
+					errno = ESPIPE;
+					return 0;
+				}
+				return link;
+				break;
+			case 206:
+				if(offset < 0) {
+					link_close(link);
+					errno = EIO;
+					return 0;
+				}
 				return link;
 				break;
 			case 301:
@@ -198,7 +277,7 @@ struct link *http_query_size_via_proxy(const char *proxy, const char *urlin, con
 						errno = EIO;
 						return 0;
 					} else {
-						return http_query_size_via_proxy(proxy,newurl,action,size,stoptime,cache_reload);
+						return http_query_range_via_proxy(proxy,newurl,action,offset,length,size,validator,validator_length,stoptime,cache_reload);
 					}
 				} else {
 					errno = ENOENT;
@@ -255,4 +334,262 @@ INT64_T http_fetch_to_file(const char *url, const char *filename, time_t stoptim
 
 }
 
+static int http_parse_url(const char *urlin, char *host, int *port, char *path)
+{
+	char url[HTTP_LINE_MAX];
+
+	url_encode(urlin, url, sizeof(url));
+
+	if(sscanf(url, "http://%255[^:/]:%d%4095s", host, port, path) == 3)
+		return 1;
+	*port = HTTP_PORT;
+	if(sscanf(url, "http://%255[^:/]%4095s", host, path) == 2)
+		return 1;
+
+	debug(D_HTTP, "malformed url: %s", url);
+	return 0;
+}
+
+static struct link *http_pool_get(const char *host, int port, int *reused, time_t stoptime)
+{
+	char addr[LINK_ADDRESS_MAX];
+	int i;
+
+	for(i = 0; i < HTTP_POOL_MAX; i++) {
+		if(http_pool[i].link && http_pool[i].port == port && !strcmp(http_pool[i].host, host)) {
+			struct link *link = http_pool[i].link;
+			http_pool[i].link = 0;
+			*reused = 1;
+			return link;
+		}
+	}
+
+	*reused = 0;
+	debug(D_HTTP, "connect %s port %d", host, port);
+	if(!domain_name_cache_lookup(host, addr))
+		return 0;
+	return link_connect(addr, port, stoptime);
+}
+
+static void http_pool_put(const char *host, int port, struct link *link)
+{
+	int i;
+
+	for(i = 0; i < HTTP_POOL_MAX; i++) {
+		if(!http_pool[i].link) {
+			strncpy(http_pool[i].host, host, sizeof(http_pool[i].host) - 1);
+			http_pool[i].port = port;
+			http_pool[i].link = link;
+			return;
+		}
+	}
+
+	link_close(link);
+}
+
+/* Close every idle connection to host and port, as after one is found dead. */
+static void http_pool_drop(const char *host, int port)
+{
+	int i;
+
+	for(i = 0; i < HTTP_POOL_MAX; i++) {
+		if(http_pool[i].link && http_pool[i].port == port && !strcmp(http_pool[i].host, host)) {
+			link_close(http_pool[i].link);
+			http_pool[i].link = 0;
+		}
+	}
+}
+
+/* Send the request for one range, on a pooled connection unless fresh is set. */
+static int http_range_send(struct http_range *r, const char *host, int port, const char *path, int fresh, time_t stoptime)
+{
+	char addr[LINK_ADDRESS_MAX];
+
+	if(fresh) {
+		r->reused = 0;
+		debug(D_HTTP, "connect %s port %d", host, port);
+		r->link = domain_name_cache_lookup(host, addr) ? link_connect(addr, port, stoptime) : 0;
+	} else {
+		r->link = http_pool_get(host, port, &r->reused, stoptime);
+	}
+	if(!r->link) {
+		errno = ECONNRESET;
+		return -1;
+	}
+
+	if(link_putfstring(r->link, "GET %s HTTP/1.1\r\nHost: %s\r\nRange: bytes=%" PRId64 "-%" PRId64 "\r\nUser-Agent: Mozilla/5.0 (compatible; CCTools %s Parrot; http://ccl.cse.nd.edu/)\r\n\r\n", stoptime, path, host, r->offset, r->offset + r->length - 1, CCTOOLS_VERSION) < 0) {
+		link_close(r->link);
+		r->link = 0;
+		errno = ECONNRESET;
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+Read the response header of a range that was sent. The server may have
+closed an idle connection, and then likely the others it kept as well, so
+a range that fails on a reused connection drops them and is sent again on
+a new one.
+*/
+static int http_range_header(struct http_range *r, const char *host, int port, const char *path, time_t stoptime)
+{
+	char line[HTTP_LINE_MAX];
+	INT64_T length = -1;
+	int response;
+
+	while(!r->link || !link_readline(r->link, line, sizeof(line), stoptime)) {
+		int reused = r->reused;
+		if(r->link)
+			link_close(r->link);
+		r->link = 0;
+		if(!reused) {
+			errno = ECONNRESET;
+			return -1;
+		}
+		http_pool_drop(host, port);
+		if(http_range_send(r, host, port, path, 1, stoptime) < 0)
+			return -1;
+	}
+
+	string_chomp(line);
+	if(sscanf(line, "HTTP/%*d.%*d %d", &response) != 1) {
+		debug(D_HTTP, "malformed response: %s", line);
+		errno = ECONNRESET;
+		return -1;
+	}
+
+	r->keepalive = strncmp(line, "HTTP/1.0", 8) != 0;
+	while(link_readline(r->link, line, sizeof(line), stoptime)) {
+		string_chomp(line);
+		if(!line[0])
+			break;
+		sscanf(line, "Content-Length: %" SCNd64, &length);
+		if(!strcasecmp(line, "Connection: close"))
+			r->keepalive = 0;
+	}
+
+	if(response != 206 || length != r->length) {
+		/* redirects and servers ignoring ranges are left to http_query_range */
+		debug(D_HTTP, "range %" PRId64 "+%" PRId64 " got response %d length %" PRId64, r->offset, r->length, response, length);
+		errno = (response == 200 || (response >= 300 && response <= 399)) ? ESPIPE : http_response_to_errno(response);
+		if(!errno)
+			errno = EIO;
+		return -1;
+	}
+
+	return 0;
+}
+
+INT64_T http_fetch_ranges(const char *url, void *data, INT64_T offset, INT64_T length, int streams, time_t stoptime)
+{
+	char host[DOMAIN_NAME_MAX];
+	char path[HTTP_LINE_MAX];
+	struct http_range ranges[HTTP_STREAMS_MAX];
+	struct link_info info[HTTP_STREAMS_MAX];
+	INT64_T chunk;
+	int port, n, i, active, save_errno;
+
+	if(length <= 0)
+		return 0;
+	if(!http_parse_url(url, host, &port, path)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	n = MAX(1, MIN(MIN(streams, HTTP_STREAMS_MAX), length / HTTP_RANGE_MIN));
+	chunk = (length + n - 1) / n;
+
+	memset(ranges, 0, sizeof(ranges));
+	for(i = 0; i < n; i++) {
+		ranges[i].offset = offset + i * chunk;
+		ranges[i].length = MIN(chunk, length - i * chunk);
+		ranges[i].data = (char *) data + i * chunk;
+	}
+
+	debug(D_HTTP, "fetching %s %" PRId64 "+%" PRId64 " in %d ranges", url, offset, length, n);
+
+	/* Send every request before waiting on any response, so the servers work in parallel. */
+	for(i = 0; i < n; i++) {
+		if(http_range_send(&ranges[i], host, port, path, 0, stoptime) < 0 && !ranges[i].reused)
+			goto failure;
+	}
+	for(i = 0; i < n; i++) {
+		if(http_range_header(&ranges[i], host, port, path, stoptime) < 0)
+			goto failure;
+	}
+
+	for(active = n; active > 0;) {
+		int m = 0;
+
+		for(i = 0; i < n; i++) {
+			struct http_range *r = &ranges[i];
+			if(!r->link)
+				continue;
+			/* data may already be buffered behind the header */
+			if(link_buffer_empty(r->link)) {
+				info[m].link = r->link;
+				info[m].events = LINK_READ;
+				info[m].revents = 0;
+				m++;
+				continue;
+			}
+			while(r->received < r->length && !link_buffer_empty(r->link)) {
+				ssize_t actual = link_read_avail(r->link, r->data + r->received, r->length - r->received, stoptime);
+				if(actual <= 0)
+					break;
+				r->received += actual;
+			}
+		}
+
+		if(m > 0 && link_poll(info, m, 1000) < 0 && errno != EINTR)
+			goto failure;
+
+		for(i = 0; i < n; i++) {
+			struct http_range *r = &ranges[i];
+			int j, ready = 0;
+			if(!r->link)
+				continue;
+			for(j = 0; j < m; j++) {
+				if(info[j].link == r->link && info[j].revents)
+					ready = 1;
+			}
+			if(ready) {
+				ssize_t actual = link_read_avail(r->link, r->data + r->received, r->length - r->received, stoptime);
+				if(actual <= 0) {
+					debug(D_HTTP, "range %" PRId64 "+%" PRId64 " lost after %" PRId64 " bytes", r->offset, r->length, r->received);
+					errno = ECONNRESET;
+					goto failure;
+				}
+				r->received += actual;
+			}
+			if(r->received == r->length) {
+				if(r->keepalive)
+					http_pool_put(host, port, r->link);
+				else
+					link_close(r->link);
+				r->link = 0;
+				active--;
+			}
+		}
+
+		if(active > 0 && time(0) >= stoptime) {
+			errno = ETIMEDOUT;
+			goto failure;
+		}
+	}
+
+	return length;
+
+	  failure:
+	save_errno = errno;
+	for(i = 0; i < n; i++) {
+		if(ranges[i].link)
+			link_close(ranges[i].link);
+	}
+	errno = save_errno;
+	return -1;
+}
+
 /* vim: set noexpandtab tabstop=4: */
@@ -14,8 +14,15 @@ See the file COPYING for details.
 struct link *http_query(const char *url, const char *action, time_t stoptime);
 struct link *http_query_no_cache(const char *url, const char *action, time_t stoptime);
 struct link *http_query_size(const char *url, const char *action, INT64_T * size, time_t stoptime, int cache_reload);
+/* Fetch length bytes (or everything, if length is negative) starting at offset, failing with ESPIPE if the server does not honor the range. */
+struct link *http_query_range(const char *url, const char *action, INT64_T offset, INT64_T length, INT64_T * size, time_t stoptime);
+/* As http_query_size, also giving the response's strong ETag or else its Last-Modified header in validator, which is empty if there is neither. */
+struct link *http_query_validator(const char *url, const char *action, INT64_T * size, char *validator, int length, time_t stoptime);
 struct link *http_query_size_via_proxy(const char *proxy, const char *url, const char *action, INT64_T * size, time_t stoptime, int cache_reload);
 
+/* Fetch length bytes at offset into data, split into ranges over up to streams pooled keep-alive connections at once. */
+INT64_T http_fetch_ranges(const char *url, void *data, INT64_T offset, INT64_T length, int streams, time_t stoptime);
+
 INT64_T http_fetch_to_file(const char *url, const char *filename, time_t stoptime);
 
 #endif
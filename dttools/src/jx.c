@@ -5,8 +5,10 @@ See the file COPYING for details.
 */
 
 #include "jx.h"
+#include "jx_arena.h"
 #include "stringtools.h"
 #include "buffer.h"
+#include "hash_table.h"
 #include "xxmalloc.h"
 
 #include <assert.h>
@@ -15,9 +17,41 @@ See the file COPYING for details.
 #include <stdlib.h>
 #include <string.h>
 
+/*
+While an arena is selected, new values are allocated in it.
+The selection is per thread, so that a thread parsing into an arena
+does not capture the values of other threads.
+*/
+static __thread struct jx_arena *jx_arena_current = 0;
+
+struct jx_arena * jx_arena_select( struct jx_arena *a )
+{
+	struct jx_arena *old = jx_arena_current;
+	jx_arena_current = a;
+	return old;
+}
+
+static void * jx_alloc( size_t size )
+{
+	if(jx_arena_current) {
+		return jx_arena_alloc(jx_arena_current,size);
+	} else {
+		return xxcalloc(1,size);
+	}
+}
+
+static char * jx_strdup( const char *str )
+{
+	if(jx_arena_current) {
+		return jx_arena_string(jx_arena_current,str);
+	} else {
+		return strdup(str);
+	}
+}
+
 struct jx_pair * jx_pair( struct jx *key, struct jx *value, struct jx_pair *next )
 {
-	struct jx_pair *pair = calloc(1, sizeof(*pair));
+	struct jx_pair *pair = jx_alloc(sizeof(*pair));
 	pair->key = key;
 	pair->value = value;
 	pair->next = next;
@@ -26,7 +60,7 @@ struct jx_pair * jx_pair( struct jx *key, struct jx *value, struct jx_pair *next
 
 struct jx_item * jx_item( struct jx *value, struct jx_item *next )
 {
-	struct jx_item *item = calloc(1, sizeof(*item));
+	struct jx_item *item = jx_alloc(sizeof(*item));
 	item->value = value;
 	item->next = next;
 	return item;
@@ -35,8 +69,8 @@ struct jx_item * jx_item( struct jx *value, struct jx_item *next )
 struct jx_comprehension *jx_comprehension(const char *variable, struct jx *elements, struct jx *condition, struct jx_comprehension *next) {
 	assert(variable);
 	assert(elements);
-	struct jx_comprehension *comp = calloc(1, sizeof(*comp));
-	comp->variable = strdup(variable);
+	struct jx_comprehension *comp = jx_alloc(sizeof(*comp));
+	comp->variable = jx_strdup(variable);
 	comp->elements = elements;
 	comp->condition = condition;
 	comp->next = next;
@@ -45,7 +79,7 @@ struct jx_comprehension *jx_comprehension(const char *variable, struct jx *eleme
 
 static struct jx * jx_create( jx_type_t type )
 {
-	struct jx *j = xxcalloc(1, sizeof(*j));
+	struct jx *j = jx_alloc(sizeof(*j));
 	j->type = type;
 	return j;
 }
@@ -58,20 +92,27 @@ struct jx * jx_null()
 struct jx * jx_symbol( const char *symbol_name )
 {
 	struct jx *j = jx_create(JX_SYMBOL);
-	j->u.symbol_name = strdup(symbol_name);
+	j->u.symbol_name = jx_strdup(symbol_name);
 	return j;
 }
 
 struct jx * jx_string( const char *string_value )
 {
 	assert(string_value);
-	return jx_string_nocopy(strdup(string_value));
+	struct jx *j = jx_create(JX_STRING);
+	j->u.string_value = jx_strdup(string_value);
+	return j;
 }
 
 struct jx * jx_string_nocopy( char *string_value )
 {
 	struct jx *j = jx_create(JX_STRING);
-	j->u.string_value = string_value;
+	if(jx_arena_current) {
+		j->u.string_value = jx_strdup(string_value);
+		free(string_value);
+	} else {
+		j->u.string_value = string_value;
+	}
 	return j;
 }
 
@@ -90,8 +131,7 @@ struct jx * jx_format( const char *fmt, ... )
 	buffer_dup(B, &str);
 	buffer_free(B);
 
-	j = jx_create(JX_STRING);
-	j->u.string_value = str;
+	j = jx_string_nocopy(str);
 
 	return j;
 }
@@ -121,6 +161,8 @@ struct jx * jx_object( struct jx_pair *pairs )
 {
 	struct jx *j = jx_create(JX_OBJECT);
 	j->u.pairs = pairs;
+	if(pairs) jx_object_index(j);
+	if(jx_arena_current) jx_arena_track(jx_arena_current,j);
 	return j;
 }
 
@@ -180,6 +222,258 @@ struct jx * jx_arrayv( struct jx *value, ... )
 	return array;
 }
 
+/*
+Objects with at least this many pairs get an index of their keys.
+Smaller objects are faster to search in order than to hash.
+*/
+
+#ifndef JX_INDEX_MIN_PAIRS
+#define JX_INDEX_MIN_PAIRS 32
+#endif
+
+/*
+The index is an open addressed hash table from each string key to
+the first pair with that key, along with the pair before it, so that
+jx_remove can unlink the pair without searching the list.
+*/
+
+struct jx_index_entry {
+	struct jx_pair *pair;
+	struct jx_pair *prev;
+	unsigned hash;
+};
+
+struct jx_index {
+	struct jx_pair *head;
+	int size;
+	int bucket_count;
+	int duplicates;
+	struct jx_index_entry *buckets;
+};
+
+static int jx_pair_has_string_key( struct jx_pair *p )
+{
+	return p->key && p->key->type==JX_STRING;
+}
+
+static struct jx_index_entry * jx_index_find( struct jx_index *x, const char *key, unsigned hash )
+{
+	unsigned mask = x->bucket_count-1;
+	unsigned i;
+
+	for(i=hash&mask;x->buckets[i].pair;i=(i+1)&mask) {
+		struct jx_index_entry *e = &x->buckets[i];
+		if(e->hash==hash && !strcmp(e->pair->key->u.string_value,key)) return e;
+	}
+
+	return 0;
+}
+
+static struct jx_index_entry * jx_index_slot( struct jx_index *x, unsigned hash )
+{
+	unsigned mask = x->bucket_count-1;
+	unsigned i = hash&mask;
+	while(x->buckets[i].pair) i = (i+1)&mask;
+	return &x->buckets[i];
+}
+
+static void jx_index_grow( struct jx_index *x )
+{
+	struct jx_index_entry *old = x->buckets;
+	int old_count = x->bucket_count;
+	int i;
+
+	x->bucket_count *= 2;
+	x->buckets = xxcalloc(x->bucket_count,sizeof(*x->buckets));
+
+	for(i=0;i<old_count;i++) {
+		if(old[i].pair) *jx_index_slot(x,old[i].hash) = old[i];
+	}
+
+	free(old);
+}
+
+/* Index a pair unless an earlier pair already has its key. */
+static void jx_index_add( struct jx_index *x, struct jx_pair *pair, struct jx_pair *prev, int shadow )
+{
+	if(!jx_pair_has_string_key(pair)) return;
+
+	const char *key = pair->key->u.string_value;
+	unsigned hash = hash_string(key);
+	struct jx_index_entry *e = jx_index_find(x,key,hash);
+
+	if(e) {
+		x->duplicates++;
+		if(!shadow) return;
+	} else {
+		if((x->size+1)*2 > x->bucket_count) jx_index_grow(x);
+		e = jx_index_slot(x,hash);
+		e->hash = hash;
+		x->size++;
+	}
+
+	e->pair = pair;
+	e->prev = prev;
+}
+
+/* Remove an entry, moving back any later entries of its probe sequence. */
+static void jx_index_delete( struct jx_index *x, struct jx_index_entry *e )
+{
+	unsigned mask = x->bucket_count-1;
+	unsigned i = e - x->buckets;
+	unsigned j = i;
+
+	while(1) {
+		j = (j+1)&mask;
+		if(!x->buckets[j].pair) break;
+		unsigned k = x->buckets[j].hash&mask;
+		if(i<=j ? (k<=i || k>j) : (k<=i && k>j)) {
+			x->buckets[i] = x->buckets[j];
+			i = j;
+		}
+	}
+
+	x->buckets[i].pair = 0;
+	x->size--;
+}
+
+static struct jx_index * jx_index_create( struct jx *j )
+{
+	struct jx_index *x = xxcalloc(1,sizeof(*x));
+	struct jx_pair *p, *prev = 0;
+
+	x->bucket_count = 4*JX_INDEX_MIN_PAIRS;
+	x->buckets = xxcalloc(x->bucket_count,sizeof(*x->buckets));
+	x->head = j->u.pairs;
+
+	for(p=j->u.pairs;p;prev=p,p=p->next) {
+		jx_index_add(x,p,prev,0);
+	}
+
+	return x;
+}
+
+static void jx_index_delete_all( struct jx_index *x )
+{
+	if(!x) return;
+	free(x->buckets);
+	free(x);
+}
+
+void jx_arena_release( struct jx *object )
+{
+	jx_index_delete_all(object->index);
+	object->index = 0;
+}
+
+/*
+Bring the index up to date with pairs pushed onto the head of the
+object since it was last used.  If the old head is gone, then the
+list was changed some other way and the index is rebuilt.
+*/
+
+static struct jx_index * jx_index_update( struct jx *j )
+{
+	struct jx_index *x = j->index;
+	struct jx_pair *p, *last = 0;
+	int i, n = 0;
+
+	if(x->head==j->u.pairs) return x;
+
+	for(p=j->u.pairs;p && p!=x->head;p=p->next) {
+		last = p;
+		n++;
+	}
+
+	if(p!=x->head) {
+		jx_index_delete_all(x);
+		j->index = jx_index_create(j);
+		return j->index;
+	}
+
+	if(x->head && jx_pair_has_string_key(x->head)) {
+		struct jx_index_entry *e = jx_index_find(x,x->head->key->u.string_value,hash_string(x->head->key->u.string_value));
+		if(e && e->pair==x->head) e->prev = last;
+	}
+
+	/* Add the new pairs last to first, so that each shadows those after it. */
+	struct jx_pair *stack[64];
+	struct jx_pair **pushed = n<=64 ? stack : xxmalloc(n*sizeof(*pushed));
+
+	for(i=0,p=j->u.pairs;i<n;i++,p=p->next) pushed[i] = p;
+	for(i=n-1;i>=0;i--) jx_index_add(x,pushed[i],i>0 ? pushed[i-1] : 0,1);
+
+	if(pushed!=stack) free(pushed);
+
+	x->head = j->u.pairs;
+	return x;
+}
+
+/* Return the index of an object, creating it if the object is large enough. */
+static struct jx_index * jx_index_get( struct jx *j )
+{
+	struct jx_pair *p;
+	int n = 0;
+
+	if(j->index) return jx_index_update(j);
+
+	for(p=j->u.pairs;p;p=p->next) {
+		if(++n>=JX_INDEX_MIN_PAIRS) {
+			j->index = jx_index_create(j);
+			return j->index;
+		}
+	}
+
+	return 0;
+}
+
+void jx_object_index( struct jx *object )
+{
+	if(object && object->type==JX_OBJECT) jx_index_get(object);
+}
+
+static struct jx * jx_index_remove( struct jx *object, struct jx_index *x, const char *key )
+{
+	struct jx_index_entry *e = jx_index_find(x,key,hash_string(key));
+	if(!e) return 0;
+
+	struct jx_pair *p = e->pair;
+	struct jx_pair *prev = e->prev;
+	struct jx_pair *next = p->next;
+
+	if(prev) {
+		prev->next = next;
+	} else {
+		object->u.pairs = next;
+	}
+	jx_index_delete(x,e);
+
+	if(next && jx_pair_has_string_key(next)) {
+		e = jx_index_find(x,next->key->u.string_value,hash_string(next->key->u.string_value));
+		if(e && e->pair==next) e->prev = prev;
+	}
+
+	/* A later pair with the same key is now the first. */
+	if(x->duplicates>0) {
+		struct jx_pair *d, *before = prev;
+		for(d=next;d;before=d,d=d->next) {
+			if(jx_pair_has_string_key(d) && !strcmp(d->key->u.string_value,key)) {
+				x->duplicates--;
+				jx_index_add(x,d,before,0);
+				break;
+			}
+		}
+	}
+
+	x->head = object->u.pairs;
+
+	struct jx *value = p->value;
+	p->value = 0;
+	p->next = 0;
+	jx_pair_delete(p);
+	return value;
+}
+
 struct jx * jx_lookup_guard( struct jx *j, const char *key, int *found )
 {
 	struct jx_pair *p;
@@ -189,8 +483,16 @@ struct jx * jx_lookup_guard( struct jx *j, const char *key, int *found )
 
 	if(!j || j->type!=JX_OBJECT) return 0;
 
-	for(p=j->u.pairs;p;p=p->next) {
-		if(p && p->key && p->key->type==JX_STRING) {
+	/*
+	A lookup does not change the object, so that objects may be shared
+	by readers.  Pairs pushed since the index was last brought up to date
+	are searched in order, ahead of the index.
+	*/
+
+	struct jx_index *x = j->index;
+
+	for(p=j->u.pairs;p && !(x && p==x->head);p=p->next) {
+		if(p->key && p->key->type==JX_STRING) {
 			if(!strcmp(p->key->u.string_value,key)) {
 				if(found)
 					*found = 1;
@@ -199,7 +501,14 @@ struct jx * jx_lookup_guard( struct jx *j, const char *key, int *found )
 		}
 	}
 
-	return 0;
+	if(!p) return 0;
+
+	struct jx_index_entry *e = jx_index_find(x,key,hash_string(key));
+	if(!e) return 0;
+
+	if(found)
+		*found = 1;
+	return e->pair->value;
 }
 
 struct jx * jx_lookup( struct jx *j, const char *key )
@@ -261,6 +570,11 @@ struct jx * jx_remove( struct jx *object, struct jx *key )
 {
 	if(!object || object->type!=JX_OBJECT) return 0;
 
+	if(key && key->type==JX_STRING) {
+		struct jx_index *x = jx_index_get(object);
+		if(x) return jx_index_remove(object,x,key->u.string_value);
+	}
+
 	struct jx_pair *p;
 	struct jx_pair *last = 0;
 
@@ -272,6 +586,8 @@ struct jx * jx_remove( struct jx *object, struct jx *key )
 			} else {
 				object->u.pairs = p->next;
 			}
+			jx_index_delete_all(object->index);
+			object->index = 0;
 			p->value = 0;
 			p->next = 0;
 			jx_pair_delete(p);
@@ -287,6 +603,7 @@ int jx_insert( struct jx *j, struct jx *key, struct jx *value )
 {
 	if(!j || j->type!=JX_OBJECT) return 0;
 	j->u.pairs = jx_pair(key,value,j->u.pairs);
+	jx_index_get(j);
 	return 1;
 }
 
@@ -393,9 +710,14 @@ struct jx *jx_array_shift(struct jx *array) {
 
 }
 
+/*
+Values built while an arena is selected are released with the arena,
+so deleting one, as the parser does on errors, leaves it in place.
+*/
+
 void jx_pair_delete( struct jx_pair *pair )
 {
-	if(!pair) return;
+	if(!pair || jx_arena_current) return;
 	jx_delete(pair->key);
 	jx_delete(pair->value);
 	jx_pair_delete(pair->next);
@@ -404,7 +726,7 @@ void jx_pair_delete( struct jx_pair *pair )
 
 void jx_item_delete( struct jx_item *item )
 {
-	if(!item) return;
+	if(!item || jx_arena_current) return;
 	jx_delete(item->value);
 	jx_comprehension_delete(item->comp);
 	jx_item_delete(item->next);
@@ -412,7 +734,7 @@ void jx_item_delete( struct jx_item *item )
 }
 
 void jx_comprehension_delete(struct jx_comprehension *comp) {
-	if (!comp) return;
+	if (!comp || jx_arena_current) return;
 	free(comp->variable);
 	jx_delete(comp->elements);
 	jx_delete(comp->condition);
@@ -422,7 +744,7 @@ void jx_comprehension_delete(struct jx_comprehension *comp) {
 
 void jx_delete( struct jx *j )
 {
-	if(!j) return;
+	if(!j || jx_arena_current) return;
 
 	switch(j->type) {
 		case JX_DOUBLE:
@@ -450,6 +772,7 @@ void jx_delete( struct jx *j )
 			jx_delete(j->u.err);
 			break;
 	}
+	jx_index_delete_all(j->index);
 	free(j);
 }
 
@@ -536,6 +859,97 @@ int jx_equals( struct jx *j, struct jx *k )
 	return 0;
 }
 
+/* Mix a word into a hash, with a multiply and shift in the style of FNV and xorshift. */
+
+#define JX_HASH_INITIAL 0xcbf29ce484222325ULL
+#define JX_HASH_PRIME 0x9e3779b97f4a7c15ULL
+
+static uint64_t jx_hash_word( uint64_t h, uint64_t x )
+{
+	h = (h ^ x) * JX_HASH_PRIME;
+	return h ^ (h >> 29);
+}
+
+/* Strings are taken eight bytes at a time, then their length, so that adjacent strings cannot run together. */
+
+static uint64_t jx_hash_string( uint64_t h, const char *s )
+{
+	size_t length = strlen(s);
+	size_t i;
+	uint64_t x;
+
+	for(i=0;i+8<=length;i+=8) {
+		memcpy(&x,s+i,8);
+		h = jx_hash_word(h,x);
+	}
+
+	if(i<length) {
+		x = 0;
+		memcpy(&x,s+i,length-i);
+		h = jx_hash_word(h,x);
+	}
+
+	return jx_hash_word(h,length);
+}
+
+static uint64_t jx_hash_continue( uint64_t h, struct jx *j )
+{
+	uint64_t type = j ? j->type : 0xff;
+	h = jx_hash_word(h,type);
+	if(!j) return h;
+
+	switch(j->type) {
+		case JX_NULL:
+			break;
+		case JX_DOUBLE: {
+			/* Positive and negative zero are equal. */
+			double d = j->u.double_value==0 ? 0 : j->u.double_value;
+			uint64_t x;
+			memcpy(&x,&d,sizeof(x));
+			h = jx_hash_word(h,x);
+			break;
+		}
+		case JX_BOOLEAN:
+			h = jx_hash_word(h,(uint64_t)j->u.boolean_value);
+			break;
+		case JX_INTEGER:
+			h = jx_hash_word(h,(uint64_t)j->u.integer_value);
+			break;
+		case JX_SYMBOL:
+			h = jx_hash_string(h,j->u.symbol_name);
+			break;
+		case JX_STRING:
+			h = jx_hash_string(h,j->u.string_value);
+			break;
+		case JX_ARRAY: {
+			struct jx_item *i;
+			for(i=j->u.items;i;i=i->next) h = jx_hash_continue(h,i->value);
+			h = jx_hash_word(h,~type);
+			break;
+		}
+		case JX_OBJECT: {
+			struct jx_pair *p;
+			for(p=j->u.pairs;p;p=p->next) {
+				h = jx_hash_continue(h,p->key);
+				h = jx_hash_continue(h,p->value);
+			}
+			h = jx_hash_word(h,~type);
+			break;
+		}
+		case JX_OPERATOR:
+		case JX_ERROR:
+			/* Not constants; the type alone keeps the hash consistent with jx_equals. */
+			break;
+	}
+
+	return h;
+}
+
+uint64_t jx_hash( struct jx *j )
+{
+	return jx_hash_continue(JX_HASH_INITIAL,j);
+}
+
 struct jx_comprehension *jx_comprehension_copy(struct jx_comprehension *c)
 {
 	struct jx_comprehension *head = 0;
@@ -110,7 +110,18 @@ struct jx_operator {
 	struct jx *right;
 };
 
-/** JX value representing any expression type. */
+struct jx_index;
+
+/** JX value representing any expression type.
+Objects with many fields keep a hash index of their keys, so that
+@ref jx_lookup, @ref jx_insert and @ref jx_remove take constant time.
+The index is built when an object is created or inserted into, and
+is only changed by those calls, @ref jx_remove and @ref jx_object_index,
+so that lookups never modify a shared object.
+Pairs pushed onto the head of @ref jx.pairs directly are searched in
+order until the next such call, but code that otherwise edits the pair
+list of an object directly should remove pairs only with @ref jx_remove.
+*/
 
 struct jx {
 	jx_type_t type;               /**< type of this value */
@@ -126,6 +137,7 @@ struct jx {
 		struct jx_operator oper; /**< value of @ref JX_OPERATOR */
 		struct jx *err;  /**< error value of @ref JX_ERROR */
 	} u;
+	struct jx_index *index;  /**< private field index of a large @ref JX_OBJECT */
 };
 
 /** Create a JX null value. @return A JX expression. */
@@ -209,6 +221,14 @@ int jx_pair_equals(struct jx_pair *j, struct jx_pair *k);
 */
 int jx_equals( struct jx *j, struct jx *k );
 
+/** Compute a hash of an expression.
+Expressions that are equal according to @ref jx_equals have the same hash,
+so comparing hashes kept from earlier can stand in for comparing the values.
+@param j A constant expression.
+@return A 64-bit hash of the expression.
+*/
+uint64_t jx_hash( struct jx *j );
+
 /** Get the length of an array. Returns -1 if array is null or not an array. @param array The array to check. */
 int jx_array_length( struct jx *array );
 
@@ -259,6 +279,9 @@ struct jx * jx_lookup( struct jx *object, const char *key );
 /* Like @ref jx_lookup, but found is set to 1 when the key is found. Useful for when value is false. */
 struct jx * jx_lookup_guard( struct jx *j, const char *key, int *found );
 
+/** Index the keys of an object whose pairs were filled in directly, if it is large enough.  @param object The object to index. */
+void jx_object_index( struct jx *object );
+
 /** Search for a string item in an object.  The key is an ordinary string value. @param object The object in which to search.  @param key The string key to match.  @return The C string value of the matching object, or null if it is not found, or is not a string. */
 const char * jx_lookup_string( struct jx *object, const char *key );
 
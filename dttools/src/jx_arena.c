@@ -0,0 +1,162 @@
+/*
+Copyright (C) 2026- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "jx_arena.h"
+#include "hash_table.h"
+#include "xxmalloc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Most allocations come from chunks of this size. */
+#define JX_ARENA_CHUNK_SIZE (64*1024)
+
+/* Strings up to this length are interned. */
+#define JX_ARENA_INTERN_MAX 64
+
+#define JX_ARENA_ALIGN(n) (((n)+7)&~(size_t)7)
+
+struct jx_arena_chunk {
+	struct jx_arena_chunk *next;
+	size_t size;
+	size_t used;
+	char data[];
+};
+
+struct jx_arena {
+	struct jx_arena_chunk *chunks;
+	size_t total;
+
+	char **strings;
+	int string_count;
+	int string_buckets;
+
+	struct jx **objects;
+	int object_count;
+	int object_max;
+};
+
+struct jx_arena * jx_arena_create()
+{
+	struct jx_arena *a = xxcalloc(1,sizeof(*a));
+	a->string_buckets = 1024;
+	a->strings = xxcalloc(a->string_buckets,sizeof(*a->strings));
+	return a;
+}
+
+void jx_arena_delete( struct jx_arena *a )
+{
+	int i;
+
+	if(!a) return;
+
+	for(i=0;i<a->object_count;i++) {
+		jx_arena_release(a->objects[i]);
+	}
+
+	while(a->chunks) {
+		struct jx_arena_chunk *c = a->chunks;
+		a->chunks = c->next;
+		free(c);
+	}
+
+	free(a->objects);
+	free(a->strings);
+	free(a);
+}
+
+size_t jx_arena_size( struct jx_arena *a )
+{
+	return a->total;
+}
+
+void * jx_arena_alloc( struct jx_arena *a, size_t size )
+{
+	struct jx_arena_chunk *c = a->chunks;
+
+	size = JX_ARENA_ALIGN(size);
+
+	if(!c || c->used+size > c->size) {
+		/* Large requests get a chunk of their own, behind the current one. */
+		size_t chunk_size = size > JX_ARENA_CHUNK_SIZE/4 ? size : JX_ARENA_CHUNK_SIZE;
+		struct jx_arena_chunk *n = xxcalloc(1,sizeof(*n)+chunk_size);
+		n->size = chunk_size;
+		a->total += chunk_size;
+
+		if(c && chunk_size==size) {
+			n->next = c->next;
+			c->next = n;
+		} else {
+			n->next = c;
+			a->chunks = n;
+		}
+		c = n;
+	}
+
+	void *p = c->data+c->used;
+	c->used += size;
+	return p;
+}
+
+static char * jx_arena_strdup( struct jx_arena *a, const char *str, size_t length )
+{
+	char *s = jx_arena_alloc(a,length+1);
+	memcpy(s,str,length);
+	return s;
+}
+
+static void jx_arena_grow_strings( struct jx_arena *a )
+{
+	char **old = a->strings;
+	int old_buckets = a->string_buckets;
+	int i;
+
+	a->string_buckets *= 2;
+	a->strings = xxcalloc(a->string_buckets,sizeof(*a->strings));
+
+	unsigned mask = a->string_buckets-1;
+	for(i=0;i<old_buckets;i++) {
+		if(!old[i]) continue;
+		unsigned b = hash_string(old[i])&mask;
+		while(a->strings[b]) b = (b+1)&mask;
+		a->strings[b] = old[i];
+	}
+
+	free(old);
+}
+
+char * jx_arena_string( struct jx_arena *a, const char *str )
+{
+	size_t length = strlen(str);
+
+	if(length>JX_ARENA_INTERN_MAX) return jx_arena_strdup(a,str,length);
+
+	unsigned mask = a->string_buckets-1;
+	unsigned b = hash_string(str)&mask;
+
+	for(;a->strings[b];b=(b+1)&mask) {
+		if(!strcmp(a->strings[b],str)) return a->strings[b];
+	}
+
+	char *s = jx_arena_strdup(a,str,length);
+	a->strings[b] = s;
+
+	if(++a->string_count*2 > a->string_buckets) jx_arena_grow_strings(a);
+
+	return s;
+}
+
+/* Objects are tracked so that any index built on them later is released too. */
+void jx_arena_track( struct jx_arena *a, struct jx *object )
+{
+	if(a->object_count>=a->object_max) {
+		a->object_max = a->object_max ? a->object_max*2 : 256;
+		a->objects = xxrealloc(a->objects,a->object_max*sizeof(*a->objects));
+	}
+	a->objects[a->object_count++] = object;
+}
+
+/* vim: set noexpandtab tabstop=4: */
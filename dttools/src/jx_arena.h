@@ -0,0 +1,51 @@
+/*
+Copyright (C) 2026- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef JX_ARENA_H
+#define JX_ARENA_H
+
+/** @file jx_arena.h Arena allocation of JX values.
+An arena holds JX values that are created and discarded together, such
+as a large document that is parsed, read, and thrown away.  Values are
+carved out of large chunks instead of being allocated one at a time, and
+short strings, such as the keys repeated in every record, are stored
+once per arena.
+
+Values are placed in an arena by parsing with a parser given to
+@ref jx_parser_set_arena.  They belong to the arena: they must not be
+passed to @ref jx_delete, nor changed with @ref jx_insert or @ref jx_remove.
+All of them are released at once by @ref jx_arena_delete.
+An arena only applies to the thread parsing into it, and must not be
+used by two threads at once.
+Use @ref jx_copy to make an ordinary copy of a value that outlives its arena.
+*/
+
+#include "jx.h"
+
+#include <stddef.h>
+
+struct jx_arena;
+
+/** Create an empty arena. @return A new arena. */
+struct jx_arena * jx_arena_create();
+
+/** Release an arena and every value allocated in it. @param a The arena to delete. */
+void jx_arena_delete( struct jx_arena *a );
+
+/** Return the number of bytes taken by an arena. @param a An arena. @return The total size of its chunks. */
+size_t jx_arena_size( struct jx_arena *a );
+
+/* Private functions used by jx.c to allocate in an arena. */
+
+void * jx_arena_alloc( struct jx_arena *a, size_t size );
+char * jx_arena_string( struct jx_arena *a, const char *str );
+void jx_arena_track( struct jx_arena *a, struct jx *object );
+struct jx_arena * jx_arena_select( struct jx_arena *a );
+void jx_arena_release( struct jx *object );
+
+#endif
+
+/* vim: set noexpandtab tabstop=4: */
@@ -0,0 +1,198 @@
+/*
+Copyright (C) 2026- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+/*
+Measure the object operations that dominate catalog and deltadb
+processing, on records with increasing numbers of fields.
+With -f, measure parsing a JSON document such as a catalog dump.
+*/
+
+#include "jx.h"
+#include "jx_arena.h"
+#include "jx_parse.h"
+#include "jx_print.h"
+#include "stringtools.h"
+#include "timestamp.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *catalog_fields[] = {
+	"type", "name", "owner", "address", "port", "version", "lastheardfrom",
+	"starttime", "project", "tasks_waiting", "tasks_running", "workers",
+	"capacity_tasks", "capacity_cores", "capacity_memory", "capacity_disk",
+	0
+};
+
+static char **make_keys( int n )
+{
+	char **keys = malloc(n*sizeof(*keys));
+	int i;
+
+	for(i=0;i<n;i++) {
+		if(i<16) {
+			keys[i] = string_format("%s",catalog_fields[i]);
+		} else {
+			keys[i] = string_format("field_%d",i);
+		}
+	}
+
+	return keys;
+}
+
+static struct jx *make_record( char **keys, int n, int base )
+{
+	struct jx *j = jx_object(0);
+	int i;
+
+	for(i=0;i<n;i++) {
+		jx_insert_integer(j,keys[i],base+i);
+	}
+
+	return j;
+}
+
+static void report( const char *op, int n, int reps, timestamp_t start )
+{
+	timestamp_t elapsed = timestamp_get()-start;
+	printf("%-8s %6d fields %10.3f us/record\n",op,n,(double)elapsed/reps);
+}
+
+static void benchmark( int n )
+{
+	char **keys = make_keys(n);
+	int reps = 2000000/(n*n/16+n) + 1;
+	timestamp_t start;
+	int i, r;
+
+	struct jx *a = make_record(keys,n,0);
+	struct jx *b = make_record(keys,n,1);
+
+	/* Look up every field, as when comparing two versions of a record. */
+	start = timestamp_get();
+	for(r=0;r<reps;r++) {
+		for(i=0;i<n;i++) {
+			if(!jx_lookup(b,keys[i])) abort();
+		}
+	}
+	report("lookup",n,reps,start);
+
+	/* Replace every field, as when applying an update. */
+	start = timestamp_get();
+	for(r=0;r<reps;r++) {
+		for(i=0;i<n;i++) {
+			struct jx *key = jx_string(keys[i]);
+			jx_delete(jx_remove(a,key));
+			jx_insert(a,key,jx_integer(r));
+		}
+	}
+	report("update",n,reps,start);
+
+	start = timestamp_get();
+	for(r=0;r<reps;r++) {
+		jx_delete(jx_merge(a,b,0));
+	}
+	report("merge",n,reps,start);
+
+	/* Build a record and read one field, as for each catalog update. */
+	start = timestamp_get();
+	for(r=0;r<reps;r++) {
+		struct jx *j = make_record(keys,n,r);
+		if(!jx_lookup(j,keys[0])) abort();
+		jx_delete(j);
+	}
+	report("create",n,reps,start);
+
+	/* Parse a stream of records, one at a time or all into one arena. */
+	char *text = jx_print_string(a);
+	struct jx_parser *p;
+
+	start = timestamp_get();
+	for(r=0;r<reps;r++) {
+		jx_delete(jx_parse_string(text));
+	}
+	report("parse",n,reps,start);
+
+	start = timestamp_get();
+	struct jx_arena *arena = jx_arena_create();
+	for(r=0;r<reps;r++) {
+		p = jx_parser_create(0);
+		jx_parser_set_arena(p,arena);
+		jx_parser_read_string(p,text);
+		if(!jx_parser_yield(p)) abort();
+		jx_parser_delete(p);
+	}
+	jx_arena_delete(arena);
+	report("parse-a",n,reps,start);
+
+	free(text);
+
+	jx_delete(a);
+	jx_delete(b);
+	for(i=0;i<n;i++) free(keys[i]);
+	free(keys);
+}
+
+static void benchmark_file( const char *filename )
+{
+	FILE *file = fopen(filename,"r");
+	if(!file) {
+		fprintf(stderr,"couldn't open %s\n",filename);
+		exit(1);
+	}
+
+	char *text;
+	size_t length;
+	FILE *copy = open_memstream(&text,&length);
+	int c;
+	while((c=getc(file))!=EOF) putc(c,copy);
+	fclose(copy);
+
+	int reps = 100000000/(length+1) + 1;
+	timestamp_t start;
+	int r;
+
+	start = timestamp_get();
+	for(r=0;r<reps;r++) {
+		struct jx *j = jx_parse_string(text);
+		if(!j) abort();
+		jx_delete(j);
+	}
+	timestamp_t elapsed = timestamp_get()-start;
+	printf("%-8s %8.1f MB/s\n","string",(double)length*reps/elapsed);
+
+	start = timestamp_get();
+	for(r=0;r<reps;r++) {
+		rewind(file);
+		struct jx *j = jx_parse_stream(file);
+		if(!j) abort();
+		jx_delete(j);
+	}
+	elapsed = timestamp_get()-start;
+	printf("%-8s %8.1f MB/s\n","stream",(double)length*reps/elapsed);
+
+	fclose(file);
+	free(text);
+}
+
+int main( int argc, char *argv[] )
+{
+	int sizes[] = { 4, 16, 64, 256, 1024, 4096 };
+	int i;
+
+	if(argc>2 && !strcmp(argv[1],"-f")) {
+		for(i=2;i<argc;i++) benchmark_file(argv[i]);
+	} else if(argc>1) {
+		for(i=1;i<argc;i++) benchmark(atoi(argv[i]));
+	} else {
+		for(i=0;i<(int)(sizeof(sizes)/sizeof(sizes[0]));i++) benchmark(sizes[i]);
+	}
+
+	return 0;
+}
+
+/* vim: set noexpandtab tabstop=4: */
@@ -311,6 +311,7 @@ struct jx * jx_binary_read( FILE *stream )
 					break;
 				}
 			}
+			jx_object_index(obj);
 			return obj;
 			break;
 		case JX_BINARY_END:
@@ -5,6 +5,7 @@ See the file COPYING for details.
 */
 
 #include "jx_parse.h"
+#include "jx_arena.h"
 #include "jx_print.h"
 #include "jx_eval.h"
 
@@ -17,6 +18,12 @@ See the file COPYING for details.
 #include <stdio.h>
 #include <stdlib.h>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 typedef enum {
 	JX_TOKEN_SYMBOL,
 	JX_TOKEN_INTEGER,
@@ -65,6 +72,7 @@ struct jx_parser {
 	char token[MAX_TOKEN_SIZE];
 	FILE *source_file;
 	const char *source_string;
+	const char *source_end;
 	struct link *source_link;
 	unsigned line;
 	time_t stoptime;
@@ -77,6 +85,7 @@ struct jx_parser {
 	jx_token_t putback_token;
 	jx_int_t integer_value;
 	double double_value;
+	struct jx_arena *arena;
 };
 
 struct jx_parser *jx_parser_create(bool strict_mode) {
@@ -95,6 +104,7 @@ void jx_parser_read_stream( struct jx_parser *p, FILE *file )
 void jx_parser_read_string( struct jx_parser *p, const char *str )
 {
 	p->source_string = str;
+	p->source_end = str + strlen(str);
 }
 
 void jx_parser_read_link( struct jx_parser *p, struct link *l, time_t stoptime )
@@ -103,6 +113,11 @@ void jx_parser_read_link( struct jx_parser *p, struct link *l, time_t stoptime )
 	p->stoptime = stoptime;
 }
 
+void jx_parser_set_arena( struct jx_parser *p, struct jx_arena *a )
+{
+	p->arena = a;
+}
+
 int jx_parser_errors( struct jx_parser *p )
 {
 	return p->errors;
@@ -190,6 +205,128 @@ static void jx_ungetchar( struct jx_parser *p, int c )
 	p->putback_char_valid = true;
 }
 
+/*
+Fast paths for parsing from a string in memory.  Instead of reading one
+character at a time, the scanner looks ahead for the end of a run of
+whitespace, string characters, digits or letters, and takes the whole run
+at once.  Whitespace and string runs are found 32 or 16 bytes at a time
+where the compiler provides AVX2 or SSE2.  The runs stop at any character
+that the character-at-a-time code must see, so both give the same results,
+including a 0xff byte, which jx_getchar cannot tell apart from EOF.
+*/
+
+static int jx_fast( struct jx_parser *p )
+{
+	return p->source_string && !p->putback_char_valid;
+}
+
+#if defined(__AVX2__)
+#define JX_VECTOR_SIZE 32
+#define JX_VECTOR __m256i
+#define jx_vector_load(p) _mm256_loadu_si256((const __m256i *)(p))
+#define jx_vector_set(c) _mm256_set1_epi8(c)
+#define jx_vector_eq(a,b) _mm256_cmpeq_epi8(a,b)
+#define jx_vector_gt(a,b) _mm256_cmpgt_epi8(a,b)
+#define jx_vector_or(a,b) _mm256_or_si256(a,b)
+#define jx_vector_and(a,b) _mm256_and_si256(a,b)
+#define jx_vector_mask(a) ((uint32_t)_mm256_movemask_epi8(a))
+#elif defined(__SSE2__)
+#define JX_VECTOR_SIZE 16
+#define JX_VECTOR __m128i
+#define jx_vector_load(p) _mm_loadu_si128((const __m128i *)(p))
+#define jx_vector_set(c) _mm_set1_epi8(c)
+#define jx_vector_eq(a,b) _mm_cmpeq_epi8(a,b)
+#define jx_vector_gt(a,b) _mm_cmpgt_epi8(a,b)
+#define jx_vector_or(a,b) _mm_or_si128(a,b)
+#define jx_vector_and(a,b) _mm_and_si128(a,b)
+#define jx_vector_mask(a) ((uint32_t)_mm_movemask_epi8(a))
+#endif
+
+#ifdef JX_VECTOR_SIZE
+#define JX_VECTOR_ALL ((uint32_t)(((uint64_t)1<<JX_VECTOR_SIZE)-1))
+#endif
+
+/*
+Most runs of whitespace and string characters are short, such as the space
+after a colon or a field name, so the first few characters are examined
+one at a time before handing a long run to the vector loop.
+*/
+
+#define JX_SHORT_RUN 16
+
+/* Return the end of a run of whitespace, counting the newlines in it. */
+
+static const char * jx_skip_space( const char *s, const char *end, unsigned *lines )
+{
+	const char *short_end = end-s > JX_SHORT_RUN ? s+JX_SHORT_RUN : end;
+
+	while(s<short_end && isspace((unsigned char)*s)) {
+		if(*s=='\n') (*lines)++;
+		s++;
+	}
+	if(s<short_end) return s;
+
+#ifdef JX_VECTOR_SIZE
+	const JX_VECTOR space = jx_vector_set(' ');
+	const JX_VECTOR newline = jx_vector_set('\n');
+	const JX_VECTOR below = jx_vector_set('\t'-1);
+	const JX_VECTOR above = jx_vector_set('\r'+1);
+
+	while(end-s >= JX_VECTOR_SIZE) {
+		JX_VECTOR v = jx_vector_load(s);
+		JX_VECTOR ws = jx_vector_or(jx_vector_eq(v,space),jx_vector_and(jx_vector_gt(v,below),jx_vector_gt(above,v)));
+		uint32_t newlines = jx_vector_mask(jx_vector_eq(v,newline));
+		uint32_t stop = ~jx_vector_mask(ws) & JX_VECTOR_ALL;
+		if(stop) newlines &= (stop&-stop)-1;
+		for(;newlines;newlines&=newlines-1) (*lines)++;
+		if(stop) return s+__builtin_ctz(stop);
+		s += JX_VECTOR_SIZE;
+	}
+#endif
+	while(s<end && isspace((unsigned char)*s)) {
+		if(*s=='\n') (*lines)++;
+		s++;
+	}
+	return s;
+}
+
+/* Return the end of a run of characters that stand for themselves in a string. */
+
+static const char * jx_skip_string( const char *s, const char *end )
+{
+	const char *short_end = end-s > JX_SHORT_RUN ? s+JX_SHORT_RUN : end;
+
+	while(s<short_end && *s!='\"' && *s!='\\' && *s!='\n' && *s!=(char)0xff) s++;
+	if(s<short_end) return s;
+
+#ifdef JX_VECTOR_SIZE
+	const JX_VECTOR quote = jx_vector_set('\"');
+	const JX_VECTOR backslash = jx_vector_set('\\');
+	const JX_VECTOR newline = jx_vector_set('\n');
+	const JX_VECTOR ff = jx_vector_set((char)0xff);
+
+	while(end-s >= JX_VECTOR_SIZE) {
+		JX_VECTOR v = jx_vector_load(s);
+		JX_VECTOR m = jx_vector_or(jx_vector_or(jx_vector_eq(v,quote),jx_vector_eq(v,backslash)),jx_vector_or(jx_vector_eq(v,newline),jx_vector_eq(v,ff)));
+		uint32_t stop = jx_vector_mask(m);
+		if(stop) return s+__builtin_ctz(stop);
+		s += JX_VECTOR_SIZE;
+	}
+#endif
+	while(s<end && *s!='\"' && *s!='\\' && *s!='\n' && *s!=(char)0xff) s++;
+	return s;
+}
+
+static int jx_isdigit( char c )
+{
+	return (c>='0' && c<='9') || c=='.';
+}
+
+static int jx_isalnum( char c )
+{
+	return isalnum((unsigned char)c) || c=='_';
+}
+
 static int jx_scan_unicode( struct jx_parser *s )
 {
 	int i;
@@ -244,6 +381,51 @@ static void jx_unscan( struct jx_parser *s, jx_token_t t )
 	s->putback_token_valid = true;
 }
 
+/* Convert a numeric token to an integer or double value. */
+
+static jx_token_t jx_scan_number( struct jx_parser *s )
+{
+	char *endptr;
+
+	s->integer_value = strtoll(s->token,&endptr,10);
+	if(!*endptr) return JX_TOKEN_INTEGER;
+
+	s->double_value = strtod(s->token,&endptr);
+	if(!*endptr) return JX_TOKEN_DOUBLE;
+
+	jx_parse_error_a(s,string_format("invalid number format: %s",s->token));
+	return JX_TOKEN_PARSE_ERROR;
+}
+
+/* Distinguish keywords from other symbols. */
+
+static jx_token_t jx_scan_symbol( struct jx_parser *s )
+{
+	if(!strcmp(s->token,"null")) {
+		return JX_TOKEN_NULL;
+	} else if(!strcmp(s->token,"true")) {
+		return JX_TOKEN_TRUE;
+	} else if(!strcmp(s->token,"false")) {
+		return JX_TOKEN_FALSE;
+	} else if(!strcmp(s->token,"or")) {
+		return JX_TOKEN_OR;
+	} else if(!strcmp(s->token,"and")) {
+		return JX_TOKEN_AND;
+	} else if(!strcmp(s->token,"not")) {
+		return JX_TOKEN_NOT;
+	} else if (!strcmp(s->token, "for")) {
+		return JX_TOKEN_FOR;
+	} else if (!strcmp(s->token, "in")) {
+		return JX_TOKEN_IN;
+	} else if (!strcmp(s->token, "if")) {
+		return JX_TOKEN_IF;
+	} else if(!strcmp(s->token, "error")) {
+		return JX_TOKEN_ERROR;
+	} else {
+		return JX_TOKEN_SYMBOL;
+	}
+}
+
 static jx_token_t jx_scan( struct jx_parser *s )
 {
 	int c;
@@ -254,6 +436,9 @@ static jx_token_t jx_scan( struct jx_parser *s )
 	}
 
 	retry:
+	if(jx_fast(s)) {
+		s->source_string = jx_skip_space(s->source_string,s->source_end,&s->line);
+	}
 	c = jx_getchar(s);
 
 	if(isspace(c)) {
@@ -317,6 +502,15 @@ static jx_token_t jx_scan( struct jx_parser *s )
 	} else if(c=='\"') {
 		int i;
 		for(i=0;i<MAX_TOKEN_SIZE;i++) {
+			if(jx_fast(s)) {
+				const char *end = jx_skip_string(s->source_string,s->source_end);
+				size_t n = end-s->source_string;
+				if(n > (size_t)(MAX_TOKEN_SIZE-i)) n = MAX_TOKEN_SIZE-i;
+				memcpy(&s->token[i],s->source_string,n);
+				s->source_string += n;
+				i += n;
+				if(i>=MAX_TOKEN_SIZE) break;
+			}
 			int n = jx_scan_string_char(s);
 			if(n==EOF) {
 				if(i>10) i = 10;
@@ -344,6 +538,18 @@ static jx_token_t jx_scan( struct jx_parser *s )
 		goto retry;
 	} else if(strchr("0123456789.",c)) {
 		s->token[0] = c;
+		if(jx_fast(s)) {
+			/* Take a plain run of digits, leaving exponents to the loop below. */
+			const char *end = s->source_string;
+			while(end<s->source_end && jx_isdigit(*end)) end++;
+			size_t n = end-s->source_string;
+			if(n<MAX_TOKEN_SIZE-1 && *end!='e' && *end!='E') {
+				memcpy(&s->token[1],s->source_string,n);
+				s->token[n+1] = 0;
+				s->source_string = end;
+				return jx_scan_number(s);
+			}
+		}
 		int i;
 		for(i=1;i<MAX_TOKEN_SIZE;i++) {
 			c = jx_getchar(s);
@@ -363,23 +569,24 @@ static jx_token_t jx_scan( struct jx_parser *s )
 			else {
 				s->token[i] = 0;
 				jx_ungetchar(s,c);
-
-				char *endptr;
-
-				s->integer_value = strtoll(s->token,&endptr,10);
-				if(!*endptr) return JX_TOKEN_INTEGER;
-
-				s->double_value = strtod(s->token,&endptr);
-				if(!*endptr) return JX_TOKEN_DOUBLE;
-
-				jx_parse_error_a(s,string_format("invalid number format: %s",s->token));
-				return JX_TOKEN_PARSE_ERROR;
+				return jx_scan_number(s);
 			}
 		}
 		jx_parse_error_a(s,string_format("integer constant too long: %s",s->token));
 		return JX_TOKEN_PARSE_ERROR;
 	} else if(isalpha(c) || c=='_') {
 		s->token[0] = c;
+		if(jx_fast(s)) {
+			const char *end = s->source_string;
+			while(end<s->source_end && jx_isalnum(*end)) end++;
+			size_t n = end-s->source_string;
+			if(n<MAX_TOKEN_SIZE-1) {
+				memcpy(&s->token[1],s->source_string,n);
+				s->token[n+1] = 0;
+				s->source_string = end;
+				return jx_scan_symbol(s);
+			}
+		}
 		int i;
 		for(i=1;i<MAX_TOKEN_SIZE;i++) {
 			c = jx_getchar(s);
@@ -388,29 +595,7 @@ static jx_token_t jx_scan( struct jx_parser *s )
 			} else {
 				jx_ungetchar(s,c);
 				s->token[i] = 0;
-				if(!strcmp(s->token,"null")) {
-					return JX_TOKEN_NULL;
-				} else if(!strcmp(s->token,"true")) {
-					return JX_TOKEN_TRUE;
-				} else if(!strcmp(s->token,"false")) {
-					return JX_TOKEN_FALSE;
-				} else if(!strcmp(s->token,"or")) {
-					return JX_TOKEN_OR;
-				} else if(!strcmp(s->token,"and")) {
-					return JX_TOKEN_AND;
-				} else if(!strcmp(s->token,"not")) {
-					return JX_TOKEN_NOT;
-				} else if (!strcmp(s->token, "for")) {
-					return JX_TOKEN_FOR;
-				} else if (!strcmp(s->token, "in")) {
-					return JX_TOKEN_IN;
-				} else if (!strcmp(s->token, "if")) {
-					return JX_TOKEN_IF;
-				} else if(!strcmp(s->token, "error")) {
-					return JX_TOKEN_ERROR;
-				} else {
-					return JX_TOKEN_SYMBOL;
-				}
+				return jx_scan_symbol(s);
 			}
 		}
 		jx_parse_error_a(s,string_format("symbol too long: %s",s->token));
@@ -1005,27 +1190,226 @@ static struct jx * jx_parse_binary( struct jx_parser *s, int precedence )
 	}
 }
 
-struct jx * jx_parse( struct jx_parser *s )
+static struct jx * jx_parse_expr( struct jx_parser *s )
 {
 	struct jx *j = jx_parse_binary(s,JX_PRECEDENCE_MAX);
-	if (!j)
-		return NULL;
+	if (j) {
+		jx_token_t t = jx_scan(s);
+		if(t!=JX_TOKEN_SEMI) jx_unscan(s,t);
+	}
+	return j;
+}
 
-	jx_token_t t = jx_scan(s);
-	if(t!=JX_TOKEN_SEMI) jx_unscan(s,t);
+/*
+Most documents are plain JSON, and most values in a JX document are too.
+Those are parsed by a simpler descent that does not pass every value
+through each level of operator precedence.  It applies only to string
+sources, which can be rewound: a value that turns out to be part of a
+larger expression, or to contain an error, is parsed again from its
+start by the full grammar, so the result and any error are the same.
+*/
 
-	return j;
+struct jx_parse_mark {
+	const char *source;
+	unsigned line;
+	int errors;
+};
+
+static int jx_parse_mark( struct jx_parser *s, struct jx_parse_mark *m )
+{
+	if(!s->source_string || s->putback_char_valid || s->putback_token_valid) return 0;
+
+	m->source = s->source_string;
+	m->line = s->line;
+	m->errors = s->errors;
+	return 1;
 }
 
-static struct jx * jx_parse_finish( struct jx_parser *p )
+static void jx_parse_rewind( struct jx_parser *s, struct jx_parse_mark *m )
 {
-	struct jx * j = jx_parse(p);
-	if(jx_parser_errors(p)) {
-		debug(D_JX|D_NOTICE, "parse error: %s", jx_parser_error_string(p));
-		jx_parser_delete(p);
+	s->source_string = m->source;
+	s->line = m->line;
+	s->putback_char_valid = false;
+	s->putback_token_valid = false;
+
+	if(s->errors!=m->errors) {
+		s->errors = m->errors;
+		if(!s->errors) {
+			free(s->error_string);
+			s->error_string = 0;
+		}
+	}
+}
+
+static struct jx * jx_parse_json( struct jx_parser *s, jx_token_t t );
+
+/*
+Parse one member of an array or object, starting at mark m, and return
+the token that follows it.  If the member is not plain JSON, rewind and
+parse it as an expression, as jx_parse_item_list and jx_parse_pair_list do.
+*/
+
+static struct jx * jx_parse_json_member( struct jx_parser *s, struct jx_parse_mark *m, jx_token_t t, jx_token_t *next )
+{
+	struct jx *j = jx_parse_json(s,t);
+	if(j) {
+		*next = jx_scan(s);
+		if(*next==JX_TOKEN_COMMA || *next==JX_TOKEN_RBRACKET || *next==JX_TOKEN_RBRACE) return j;
 		jx_delete(j);
-		return NULL;
 	}
+
+	jx_parse_rewind(s,m);
+	j = jx_parse_expr(s);
+	if(j) *next = jx_scan(s);
+	return j;
+}
+
+static struct jx * jx_parse_json_array( struct jx_parser *s )
+{
+	unsigned line = s->line;
+	struct jx_item *head = 0;
+	struct jx_item **tail = &head;
+	struct jx_parse_mark m;
+
+	while(1) {
+		if(!jx_parse_mark(s,&m)) goto FAILURE;
+
+		jx_token_t t = jx_scan(s);
+		if(t==JX_TOKEN_RBRACKET) break;
+
+		struct jx_item *i = jx_item(NULL, NULL);
+		i->line = s->line;
+		*tail = i;
+		tail = &i->next;
+
+		i->value = jx_parse_json_member(s,&m,t,&t);
+		if(!i->value) goto FAILURE;
+
+		if(t==JX_TOKEN_RBRACKET) break;
+		if(t!=JX_TOKEN_COMMA) goto FAILURE;
+	}
+
+	struct jx *j = jx_array(head);
+	j->line = line;
+	return j;
+
+FAILURE:
+	jx_item_delete(head);
+	return NULL;
+}
+
+static struct jx * jx_parse_json_object( struct jx_parser *s )
+{
+	unsigned line = s->line;
+	struct jx_pair *head = 0;
+	struct jx_pair **tail = &head;
+	struct jx_parse_mark m;
+
+	while(1) {
+		jx_token_t t = jx_scan(s);
+		if(t==JX_TOKEN_RBRACE) break;
+		if(t!=JX_TOKEN_STRING) goto FAILURE;
+
+		struct jx_pair *p = jx_pair(jx_add_lineno(s, jx_string(s->token)), NULL, NULL);
+		*tail = p;
+		tail = &p->next;
+
+		if(jx_scan(s)!=JX_TOKEN_COLON) goto FAILURE;
+		p->line = s->line;
+
+		if(!jx_parse_mark(s,&m)) goto FAILURE;
+
+		p->value = jx_parse_json_member(s,&m,jx_scan(s),&t);
+		if(!p->value) goto FAILURE;
+
+		if(t==JX_TOKEN_RBRACE) break;
+		if(t!=JX_TOKEN_COMMA) goto FAILURE;
+	}
+
+	struct jx *j = jx_object(head);
+	j->line = line;
+	return j;
+
+FAILURE:
+	jx_pair_delete(head);
+	return NULL;
+}
+
+/*
+Parse a plain JSON value that begins with token t, or return null
+if it is something else.
+*/
+
+static struct jx * jx_parse_json( struct jx_parser *s, jx_token_t t )
+{
+	switch(t) {
+		case JX_TOKEN_LBRACE:
+			return jx_parse_json_object(s);
+		case JX_TOKEN_LBRACKET:
+			return jx_parse_json_array(s);
+		case JX_TOKEN_STRING:
+			return jx_add_lineno(s, jx_string(s->token));
+		case JX_TOKEN_INTEGER:
+			return jx_add_lineno(s, jx_integer(s->integer_value));
+		case JX_TOKEN_DOUBLE:
+			return jx_add_lineno(s, jx_double(s->double_value));
+		case JX_TOKEN_TRUE:
+			return jx_add_lineno(s, jx_boolean(true));
+		case JX_TOKEN_FALSE:
+			return jx_add_lineno(s, jx_boolean(false));
+		case JX_TOKEN_NULL:
+			return jx_add_lineno(s, jx_null());
+		case JX_TOKEN_SUB: {
+			/* A negative number, as in jx_parse_unary. */
+			unsigned line = s->line;
+			struct jx *j;
+			t = jx_scan(s);
+			if(t==JX_TOKEN_INTEGER) {
+				j = jx_integer(-s->integer_value);
+			} else if(t==JX_TOKEN_DOUBLE) {
+				j = jx_double(-s->double_value);
+			} else {
+				return NULL;
+			}
+			j->line = line;
+			return j;
+		}
+		default:
+			return NULL;
+	}
+}
+
+struct jx * jx_parse( struct jx_parser *s )
+{
+	struct jx_arena *saved = jx_arena_select(s->arena);
+	struct jx_parse_mark m;
+	struct jx *j = 0;
+
+	if(jx_parse_mark(s,&m)) {
+		j = jx_parse_json(s,jx_scan(s));
+		if(j) {
+			/* The value stands alone unless an operator follows. */
+			jx_token_t t = jx_scan(s);
+			jx_operator_t op = jx_token_to_operator(t);
+			if(s->errors!=m.errors || (op!=JX_OP_INVALID && !jx_operator_is_unary(op))) {
+				jx_delete(j);
+				j = 0;
+			} else if(t!=JX_TOKEN_SEMI) {
+				jx_unscan(s,t);
+			}
+		}
+		if(!j) jx_parse_rewind(s,&m);
+	}
+
+	if(!j) j = jx_parse_expr(s);
+
+	jx_arena_select(saved);
+	return j;
+}
+
+static struct jx * jx_parse_finish( struct jx_parser *p )
+{
+	struct jx * j = jx_parser_yield(p);
 	jx_parser_delete(p);
 	return j;
 }
@@ -1035,7 +1419,7 @@ struct jx * jx_parser_yield( struct jx_parser *p )
 	struct jx * j = jx_parse(p);
 	if(jx_parser_errors(p)) {
 		debug(D_JX|D_NOTICE, "parse error: %s", jx_parser_error_string(p));
-		jx_delete(j);
+		if(!p->arena) jx_delete(j);
 		return NULL;
 	}
 	return j;
@@ -1063,13 +1447,21 @@ struct jx * jx_parse_stream( FILE *file )
 }
 
 struct jx * jx_parse_file( const char *name )
+{
+	return jx_parse_file_arena(name,0);
+}
+
+struct jx * jx_parse_file_arena( const char *name, struct jx_arena *a )
 {
 	FILE *file = fopen(name,"r");
 	if (!file) {
 		debug(D_JX, "Could not open jx file: %s", name);
 		return NULL;
 	}
-	struct jx *j = jx_parse_stream(file);
+	struct jx_parser *p = jx_parser_create(false);
+	jx_parser_set_arena(p,a);
+	jx_parser_read_stream(p,file);
+	struct jx *j = jx_parse_finish(p);
 	fclose(file);
 	return j;
 }
@@ -18,6 +18,7 @@ with the following exceptions:
 */
 
 #include "jx.h"
+#include "jx_arena.h"
 #include "link.h"
 
 #include <stdbool.h>
@@ -34,6 +35,9 @@ struct jx * jx_parse_stream( FILE *file );
 /** Parse a file to a JX expression.  @param name The name of a file containing JSON data.  @return A JX expression which must be deleted with @ref jx_delete. If the parse fails or no JSON value is present, null is returned. */
 struct jx * jx_parse_file( const char *name );
 
+/** Parse a file to a JX expression allocated in an arena.  @param name The name of a file containing JSON data.  @param a The arena to hold the result, or null for ordinary allocation.  @return A JX expression, which is released by @ref jx_arena_delete rather than @ref jx_delete. If the parse fails or no JSON value is present, null is returned. @see jx_arena.h */
+struct jx * jx_parse_file_arena( const char *name, struct jx_arena *a );
+
 /** Parse a network link to a JX expression. @param l A @ref link object.  @param stoptime The absolute time at which to stop.   @return A JX expression which must be deleted with @ref jx_delete. If the parse fails or no JSON value is present, null is returned. */
 struct jx * jx_parse_link( struct link *l, time_t stoptime );
 
@@ -66,6 +70,9 @@ void jx_parser_read_string( struct jx_parser *p, const char *str );
 /** Attach parser to a link.  @param p A parser object.  @param l A @ref link object.  @param stoptime The absolute time at which to stop. */
 void jx_parser_read_link( struct jx_parser *p, struct link *l, time_t stoptime );
 
+/** Allocate the values returned by a parser in an arena.  Such values are released by @ref jx_arena_delete and must not be passed to @ref jx_delete.  @param p A parser object.  @param a An arena created by @ref jx_arena_create, or null for ordinary allocation. */
+void jx_parser_set_arena( struct jx_parser *p, struct jx_arena *a );
+
 /** Parse and return a single value. This function is useful for streaming multiple independent values from a single source. @param p A parser object @return A JX expression which must be deleted with @ref jx_delete. If the parse fails or no JSON value is present, null is returned. */
 struct jx * jx_parser_yield( struct jx_parser *p );
 
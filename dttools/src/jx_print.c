@@ -99,6 +99,14 @@ void jx_escape_string( const char *s, buffer_t *b )
 
 	buffer_putstring(b,"\"");
 	while(*s) {
+		/* Most characters need no escaping, so copy them a run at a time. */
+		const char *run = s;
+		while(*s && isprint(*s) && *s!='\"' && *s!='\'' && *s!='\\') s++;
+		if(s>run) {
+			buffer_putlstring(b,run,s-run);
+			continue;
+		}
+
 		switch(*s) {
 			case '\"':
 				buffer_putstring(b,"\\\"");
@@ -48,17 +48,18 @@ void nvpair_delete(struct nvpair *n)
 void nvpair_parse(struct nvpair *n, const char *data)
 {
 	char *text = xxstrdup(data);
-	char *name, *value;
+	char *name, *value, *state;
 
-	name = strtok(text, " ");
+	/* strtok_r, because the catalog server parses updates in several threads. */
+	name = strtok_r(text, " ", &state);
 	while(name) {
-		value = strtok(0, "\n");
+		value = strtok_r(0, "\n", &state);
 		if(value) {
 			nvpair_insert_string(n, name, value);
 		} else {
 			break;
 		}
-		name = strtok(0, " ");
+		name = strtok_r(0, " ", &state);
 	}
 
 	free(text);
@@ -0,0 +1,101 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+exe="arena.test"
+
+prepare()
+{
+	${CC} -g -o "$exe" -I ../src/ -x c - -x none ../src/libdttools.a -lm <<EOF
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jx.h"
+#include "jx_arena.h"
+#include "jx_parse.h"
+#include "jx_print.h"
+#include "stringtools.h"
+
+static int same(struct jx *a, struct jx *b) {
+	char *s = jx_print_string(a);
+	char *t = jx_print_string(b);
+	int result = !strcmp(s, t);
+	free(s);
+	free(t);
+	return result;
+}
+
+static struct jx *parse_arena(const char *str, struct jx_arena *a) {
+	struct jx_parser *p = jx_parser_create(0);
+	jx_parser_set_arena(p, a);
+	jx_parser_read_string(p, str);
+	struct jx *j = jx_parser_yield(p);
+	jx_parser_delete(p);
+	return j;
+}
+
+int main(int argc, char **argv) {
+	const char *text = "[ {\"name\":\"a\",\"port\":9094,\"load\":[0.5,1.5],\"up\":true,\"x\":null},"
+		" {\"name\":\"b\",\"port\":9095,\"load\":[],\"up\":false,\"f\":x+[i for i in [1,2] if i>1]} ]";
+
+	struct jx_arena *a = jx_arena_create();
+
+	struct jx *heap = jx_parse_string(text);
+	struct jx *j = parse_arena(text, a);
+	assert(heap && j);
+	assert(same(heap, j));
+
+	/* Keys are stored once per arena. */
+	struct jx *r0 = jx_array_index(j, 0);
+	struct jx *r1 = jx_array_index(j, 1);
+	assert(r0->u.pairs->key->u.string_value == r1->u.pairs->key->u.string_value);
+
+	/* A large object in an arena can be searched like any other. */
+	char *wide = strdup("{");
+	for(int i = 0; i < 100; i++) {
+		char *s = string_format("%s\"f%d\":%d,", wide, i, i);
+		free(wide);
+		wide = s;
+	}
+	struct jx *w = parse_arena(wide, a);
+	free(wide);
+	for(int i = 0; i < 100; i++) {
+		char key[16];
+		snprintf(key, sizeof(key), "f%d", i);
+		assert(jx_lookup_integer(w, key) == i);
+	}
+
+	/* Errors leave partial results to the arena. */
+	assert(!parse_arena("{\"a\":[1,2,}", a));
+
+	struct jx *c = jx_copy(j);
+	assert(jx_arena_size(a) > 0);
+	jx_arena_delete(a);
+
+	assert(same(heap, c));
+	jx_delete(c);
+	jx_delete(heap);
+
+	return 0;
+}
+EOF
+	return $?
+}
+
+run()
+{
+	./"$exe"
+	return $?
+}
+
+clean()
+{
+	rm -f "$exe"
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -0,0 +1,104 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+exe="hash.test"
+
+prepare()
+{
+	${CC} -g -o "$exe" -I ../src/ -x c - -x none ../src/libdttools.a -lm <<EOF
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jx.h"
+#include "jx_parse.h"
+
+/* Each line holds values that are equal, and differ from those on every other line. */
+static const char *groups[][3] = {
+	{ "null", 0 },
+	{ "true", 0 },
+	{ "false", 0 },
+	{ "0", 0 },
+	{ "1", 0 },
+	{ "-1", 0 },
+	{ "0.0", "-0.0", 0 },
+	{ "1.5", 0 },
+	{ "\"\"", 0 },
+	{ "\"1\"", 0 },
+	{ "\"abcdefgh\"", 0 },
+	{ "\"abcdefghi\"", 0 },
+	{ "[]", " [ ] ", 0 },
+	{ "[1]", 0 },
+	{ "[1,2]", "[ 1, 2 ]", 0 },
+	{ "[2,1]", 0 },
+	{ "[[1],2]", 0 },
+	{ "[[1,2]]", 0 },
+	{ "[\"ab\",\"c\"]", 0 },
+	{ "[\"a\",\"bc\"]", 0 },
+	{ "{}", 0 },
+	{ "{\"a\":1}", "{ \"a\" : 1 }", 0 },
+	{ "{\"a\":2}", 0 },
+	{ "{\"b\":1}", 0 },
+	{ "{\"a\":1,\"b\":2}", 0 },
+	{ "{\"b\":2,\"a\":1}", 0 },
+	{ "{\"a\":{\"b\":[1,{\"c\":null}]}}", 0 },
+	{ 0 },
+};
+
+int main(int argc, char **argv) {
+	int i, j, k, l;
+
+	for(i = 0; groups[i][0]; i++) {
+		for(j = 0; groups[i][j]; j++) {
+			struct jx *a = jx_parse_string(groups[i][j]);
+			assert(a);
+
+			struct jx *c = jx_copy(a);
+			assert(jx_hash(a) == jx_hash(c));
+			jx_delete(c);
+
+			for(k = 0; groups[k][0]; k++) {
+				for(l = 0; groups[k][l]; l++) {
+					struct jx *b = jx_parse_string(groups[k][l]);
+					assert(b);
+					if(i == k) {
+						assert(jx_equals(a, b));
+						assert(jx_hash(a) == jx_hash(b));
+					} else {
+						assert(!jx_equals(a, b));
+						if(jx_hash(a) == jx_hash(b)) {
+							fprintf(stderr, "%s and %s have the same hash\n", groups[i][j], groups[k][l]);
+							return 1;
+						}
+					}
+					jx_delete(b);
+				}
+			}
+
+			jx_delete(a);
+		}
+	}
+
+	return 0;
+}
+EOF
+	return $?
+}
+
+run()
+{
+	./"$exe"
+	return $?
+}
+
+clean()
+{
+	rm -f "$exe"
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -0,0 +1,145 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+exe="index.test"
+
+prepare()
+{
+	${CC} -g -o "$exe" -I ../src/ -x c - -x none ../src/libdttools.a -lm <<EOF
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jx.h"
+
+#define NKEYS 200
+
+/* The value of the first pair with the key, found without the index. */
+static struct jx *lookup_slow(struct jx *j, const char *key) {
+	struct jx_pair *p;
+	for(p = j->u.pairs; p; p = p->next) {
+		if(!strcmp(p->key->u.string_value, key)) return p->value;
+	}
+	return NULL;
+}
+
+static int length(struct jx *j) {
+	int n = 0;
+	struct jx_pair *p;
+	for(p = j->u.pairs; p; p = p->next) n++;
+	return n;
+}
+
+int main(int argc, char **argv) {
+	char key[32];
+	int i, k, n = 0;
+
+	struct jx *j = jx_object(NULL);
+	srand(42);
+
+	for(i = 0; i < 20000; i++) {
+		int op = rand() % 4;
+		snprintf(key, sizeof(key), "key%d", rand() % NKEYS);
+
+		if(op == 0) {
+			jx_insert(j, jx_string(key), jx_integer(i));
+			n++;
+		} else if(op == 1) {
+			/* Push a pair directly, as deltadb does when merging. */
+			j->u.pairs = jx_pair(jx_string(key), jx_integer(i), j->u.pairs);
+			n++;
+		} else if(op == 2) {
+			struct jx *expected = lookup_slow(j, key);
+			struct jx *k = jx_string(key);
+			struct jx *v = jx_remove(j, k);
+			assert(v == expected);
+			if(v) n--;
+			jx_delete(v);
+			jx_delete(k);
+		} else {
+			assert(jx_lookup(j, key) == lookup_slow(j, key));
+		}
+
+		assert(length(j) == n);
+
+		if(i % 1000 == 0) {
+			for(k = 0; k < NKEYS; k++) {
+				snprintf(key, sizeof(key), "key%d", k);
+				assert(jx_lookup(j, key) == lookup_slow(j, key));
+			}
+		}
+	}
+
+	/* Insertion order is kept for iteration. */
+	struct jx *o = jx_object(NULL);
+	for(k = 0; k < NKEYS; k++) {
+		snprintf(key, sizeof(key), "key%d", k);
+		jx_insert(o, jx_string(key), jx_integer(k));
+	}
+	assert(jx_lookup_integer(o, "key7") == 7);
+	struct jx *first = jx_string("key0");
+	jx_delete(jx_remove(o, first));
+	jx_delete(first);
+
+	void *it = NULL;
+	const char *name;
+	k = NKEYS - 1;
+	while((name = jx_iterate_keys(o, &it))) {
+		snprintf(key, sizeof(key), "key%d", k--);
+		assert(!strcmp(name, key));
+	}
+	assert(k == 0);
+
+	struct jx *c = jx_copy(o);
+	assert(jx_equals(c, o));
+
+	/* Lookups do not change an object, indexed or not. */
+	struct jx *r = jx_object(NULL);
+	for(k = 0; k < NKEYS; k++) {
+		snprintf(key, sizeof(key), "key%d", k);
+		r->u.pairs = jx_pair(jx_string(key), jx_integer(k), r->u.pairs);
+	}
+	assert(r->index == NULL);
+	for(k = 0; k < NKEYS; k++) {
+		snprintf(key, sizeof(key), "key%d", k);
+		assert(jx_lookup_integer(r, key) == k);
+	}
+	assert(r->index == NULL);
+
+	jx_object_index(r);
+	struct jx_index *x = r->index;
+	assert(x != NULL);
+	r->u.pairs = jx_pair(jx_string("key3"), jx_integer(-3), r->u.pairs);
+	assert(jx_lookup_integer(r, "key3") == -3);
+	assert(jx_lookup_integer(r, "key4") == 4);
+	assert(jx_lookup(r, "missing") == NULL);
+	assert(r->index == x);
+	jx_delete(r);
+
+	jx_delete(c);
+	jx_delete(o);
+	jx_delete(j);
+
+	return 0;
+}
+EOF
+	return $?
+}
+
+run()
+{
+	./"$exe"
+	return $?
+}
+
+clean()
+{
+	rm -f "$exe"
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -0,0 +1,149 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+exe="parse.test"
+
+prepare()
+{
+	${CC} -g -o "$exe" -I ../src/ -x c - -x none ../src/libdttools.a -lm <<EOF
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jx.h"
+#include "jx_parse.h"
+#include "jx_print.h"
+#include "stringtools.h"
+
+/* Describe a value with the line numbers of all of its parts. */
+static char *describe(struct jx *j) {
+	if(!j) return strdup("null");
+
+	char *text = jx_print_string(j);
+	char *s = string_format("%s@%u(", text, j->line);
+	free(text);
+
+	if(jx_istype(j, JX_OBJECT)) {
+		for(struct jx_pair *p = j->u.pairs; p; p = p->next) {
+			char *k = describe(p->key);
+			char *v = describe(p->value);
+			s = string_combine(s, string_format("%u:%s=%s,", p->line, k, v));
+			free(k);
+			free(v);
+		}
+	} else if(jx_istype(j, JX_ARRAY)) {
+		for(struct jx_item *i = j->u.items; i; i = i->next) {
+			char *v = describe(i->value);
+			s = string_combine(s, string_format("%u:%s,", i->line, v));
+			free(v);
+		}
+	} else if(jx_istype(j, JX_OPERATOR)) {
+		char *l = describe(j->u.oper.left);
+		char *r = describe(j->u.oper.right);
+		s = string_combine(s, string_format("%u:%s,%s", j->u.oper.line, l, r));
+		free(l);
+		free(r);
+	}
+
+	return string_combine(s, strdup(")"));
+}
+
+/* Parse every value in a document, from a string or from a stream. */
+static char *parse_all(const char *text, int from_string, int strict) {
+	struct jx_parser *p = jx_parser_create(strict);
+	FILE *file = 0;
+
+	if(from_string) {
+		jx_parser_read_string(p, text);
+	} else {
+		file = fmemopen((void *)text, strlen(text), "r");
+		jx_parser_read_stream(p, file);
+	}
+
+	char *s = strdup("");
+	for(int n = 0; n < 10; n++) {
+		struct jx *j = jx_parse(p);
+		const char *error = jx_parser_error_string(p);
+		char *d = describe(j);
+		s = string_combine(s, string_format("%s [%d %s]\n", d, jx_parser_errors(p), error ? error : ""));
+		free(d);
+		jx_delete(j);
+		if(!j) break;
+	}
+
+	jx_parser_delete(p);
+	if(file) fclose(file);
+	return s;
+}
+
+/*
+Parsing from a string takes shortcuts that parsing from a stream does not.
+Both must give the same values, line numbers and errors.
+*/
+static const char *documents[] = {
+	"{\"a\":1,\"b\":[1,2,3],\"c\":{\"d\":null,\"e\":true,\"f\":false}}",
+	"[1,2,3,]",
+	"{\"a\":1,}",
+	"{\"a\":1 \"b\":2}",
+	"{\"a\":1+2, \"b\":\"x\"+y, \"c\":[1,2+3,4], \"d\":[0,1][1]}",
+	"[ x for x in [1,2,3] if x>1 ]",
+	"{\"a\":-5,\"b\":-5.5,\"c\":- 3,\"d\":-\n4,\"e\":-x,\"f\":+5}",
+	"{\"a\":\n\"multi\nline\",\n\"b\":\n[\n1,\n\"x\ny\"\n,{\n}\n]\n}",
+	"{\"a\":\"\\\\u0041\\\\n\\\\t\\\\\"\",\"b\":\"\\\\u00e9\"}",
+	"{\"a\": \"unterminated",
+	"{\"a\": 1e5, \"b\": 1.5E-3, \"c\": [1e2,2e3], \"d\": 123456789012345678901234567890, \"e\":1e}",
+	"{\"a\":1} + {\"b\":2}",
+	"{\"a\":1}\n{\"b\":[1,\n2]}; {\"c\":3}\n[0]",
+	"[1,2,3",
+	"{\"a\":",
+	"{1:2}",
+	"[1;,2]",
+	"# comment\n{\"a\":1 # more\n,\"b\":2}",
+	"{\"a\":@}",
+	"{\"a\":x(1),\"b\":f,\"c\":error(\"e\")}",
+	"12 > 3",
+	"{\"k\":\"v\"} and true",
+	"{\"a\":\"a string long enough to be scanned in several vectors of characters\","
+	"                                                                 \n\n  \n"
+	"\"b\":\"with an escape \\\\\" after the first sixteen\",\"c\":\"newline past thirty-two chars ...\n\"}",
+	"{}",
+	"[]",
+	"",
+};
+
+int main(int argc, char **argv) {
+	for(unsigned i = 0; i < sizeof(documents) / sizeof(documents[0]); i++) {
+		for(int strict = 0; strict < 2; strict++) {
+			char *a = parse_all(documents[i], 1, strict);
+			char *b = parse_all(documents[i], 0, strict);
+			if(strcmp(a, b)) {
+				fprintf(stderr, "document %u differs:\n%s---\n%s", i, a, b);
+				return 1;
+			}
+			free(a);
+			free(b);
+		}
+	}
+	return 0;
+}
+EOF
+	return $?
+}
+
+run()
+{
+	./"$exe"
+	return $?
+}
+
+clean()
+{
+	rm -f "$exe"
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -38,6 +38,7 @@ See the file COPYING for details.
 #include "list.h"
 #include "xxmalloc.h"
 #include "jx.h"
+#include "jx_arena.h"
 #include "jx_parse.h"
 #include "jx_eval.h"
 #include "jx_print.h"
@@ -62,6 +63,7 @@ struct dag *dag_from_file(const char *filename, dag_syntax_type format, struct j
 	FILE *dagfile = NULL;
 	struct jx *dag = NULL;
 	struct jx *jx_tmp = NULL;
+	struct jx_arena *arena = NULL;
 	struct dag *d = NULL;
 
 	// Initial verification of file existence
@@ -72,9 +74,13 @@ struct dag *dag_from_file(const char *filename, dag_syntax_type format, struct j
 			return d;
 		}
 	} else if (format == DAG_SYNTAX_JX || format == DAG_SYNTAX_JSON){
-		dag = jx_parse_file(filename);
+		// The document is only read, so parse it into an arena
+		// rather than allocating each of its values separately.
+		arena = jx_arena_create();
+		dag = jx_parse_file_arena(filename, arena);
         if (!dag){
 			debug(D_MAKEFLOW_PARSER, "makeflow: failed to parse jx from %s\n", filename);
+			jx_arena_delete(arena);
 			return d;
 		}
 	}
@@ -95,7 +101,8 @@ struct dag *dag_from_file(const char *filename, dag_syntax_type format, struct j
 			break;
 		case DAG_SYNTAX_JX: //Evaluates the pending JX Variables from args file
 			jx_tmp = jx_eval_with_defines(dag,args);
-			jx_delete(dag);
+			jx_arena_delete(arena);
+			arena = NULL;
 			jx_delete(args);
 			dag = jx_tmp;
 			 //Intentional fall-through as JX and JSON both use dag_parse_jx
@@ -105,7 +112,11 @@ struct dag *dag_from_file(const char *filename, dag_syntax_type format, struct j
 				free(d);
 				d = NULL;
 			}
-			jx_delete(dag);
+			if(arena) {
+				jx_arena_delete(arena);
+			} else {
+				jx_delete(dag);
+			}
 			// JX doesn't really use errno, so give something generic
 			errno = EINVAL;
 			break;
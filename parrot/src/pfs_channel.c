@@ -9,10 +9,14 @@ See the file COPYING for details.
 #include "pfs_channel.h"
 
 #include "debug.h"
+#include "hash_table.h"
+#include "itable.h"
 #include "memfdexe.h"
+#include "stats.h"
 #include "tracer.h"
 #include "xxmalloc.h"
 
+#include <fcntl.h>
 #include <syscall.h>
 #include <unistd.h>
 
@@ -22,67 +26,269 @@ See the file COPYING for details.
 #include <stdlib.h>
 #include <string.h>
 
-struct entry {
+/*
+The channel is one file shared by Parrot and all of its tracees.  The data of
+diverted reads and writes and of mmaped files passes through it.  Space is
+handed out by a buddy allocator.  Each block is a power of two pages long and
+aligned to its size, and each order has its own free list.  So allocation and
+release take O(log size), and free neighbours always merge back together.
+
+A block named after a file (the mmap cache) stays findable after its last
+reference is dropped.  Such blocks are given back only when space runs out,
+oldest first, and only then does the channel grow.  Parrot maps the channel
+inside a large reservation of address space, so it normally grows in place.
+Tracees only see the channel through its fd and are never remapped.
+*/
+
+#define BLOCK_FREE   0
+#define BLOCK_INUSE  1
+#define BLOCK_CACHED 2
+
+#define ORDER_MAX 48
+
+/* Address space reserved for growing the channel in place. */
+#define CHANNEL_RESERVE ((pfs_size_t)1 << (sizeof(void *) > 4 ? 36 : 28))
+
+/* Alignment of the mapping, so that huge pages can back it. */
+#define CHANNEL_ALIGN (2*1024*1024)
+
+/* Released blocks at least this large give their memory back to the system. */
+#define CHANNEL_PUNCH_MIN ((pfs_size_t)64*1024*1024)
+
+struct block {
 	char *name;
 	pfs_size_t start;
-	pfs_size_t length;
-	int inuse;
-	struct entry *prev;
-	struct entry *next;
+	int order;
+	int state;
+	int refs;
+	struct block *prev;
+	struct block *next;
 };
 
 #define CHANNEL_FMT "`%s':%" PRIx64 ":%zu"
-#define CHANNEL_FMT_ARGS(e) e->name, (uint64_t)e->start, (size_t)e->length
+#define CHANNEL_FMT_ARGS(b) b->name, (uint64_t)b->start, (size_t)block_size(b->order)
 
 extern int parrot_fd_start;
 
-static struct entry *head=0;
+int pfs_channel_huge_pages = 0;
+
 static int channel_fd=-1;
 static char *channel_base=0;
 static pfs_size_t channel_size;
+static pfs_size_t channel_reserved;
+static int page_size=0;
+static int top_order;
+
+static struct block *free_lists[ORDER_MAX];
+static struct block *cache_head=0;
+static struct block *cache_tail=0;
+static struct itable *blocks=0;
+static struct hash_table *names=0;
+
+static pfs_size_t bytes_used=0;
+static pfs_size_t bytes_cached=0;
+
+static pfs_size_t block_size( int order )
+{
+	return (pfs_size_t)page_size << order;
+}
+
+static int order_for( pfs_size_t length )
+{
+	int order = 0;
+	while(block_size(order)<length) order++;
+	return order;
+}
 
-static struct entry * entry_create( const char *name, pfs_size_t start, pfs_size_t length, struct entry *prev, struct entry *next )
+static pfs_size_t round_up( pfs_size_t x )
 {
-	struct entry *e;
+	if(x%page_size) x = page_size * ((x/page_size)+1);
+	if(x<=0) x=page_size;
+	return x;
+}
 
-	e = malloc(sizeof(*e));
-	if(!e) return 0;
+static void list_push( struct block **head, struct block *b )
+{
+	b->prev = 0;
+	b->next = *head;
+	if(*head) (*head)->prev = b;
+	*head = b;
+}
 
-	e->name = name ? xxstrdup(name) : NULL;
+static void list_remove( struct block **head, struct block **tail, struct block *b )
+{
+	if(b->prev) b->prev->next = b->next; else *head = b->next;
+	if(b->next) b->next->prev = b->prev; else if(tail) *tail = b->prev;
+	b->prev = b->next = 0;
+}
 
-	e->start = start;
-	e->length = length;
-	e->inuse = 0;
+static void cache_append( struct block *b )
+{
+	b->next = 0;
+	b->prev = cache_tail;
+	if(cache_tail) cache_tail->next = b; else cache_head = b;
+	cache_tail = b;
+}
 
-	if(prev) {
-		e->prev = prev;
-		prev->next = e;
-	} else {
-		e->prev = e;
+static struct block * block_create( pfs_size_t start, int order )
+{
+	struct block *b = xxcalloc(1,sizeof(*b));
+	b->start = start;
+	b->order = order;
+	itable_insert(blocks,start,b);
+	return b;
+}
+
+static void block_unname( struct block *b )
+{
+	if(b->name) {
+		hash_table_remove(names,b->name);
+		free(b->name);
+		b->name = 0;
 	}
+}
 
-	if(next) {
-		e->next = next;
-		next->prev = e;
-	} else {
-		e->next = e;
+static void update_stats()
+{
+	pfs_size_t free_bytes = channel_size - bytes_used - bytes_cached;
+	pfs_size_t largest = 0;
+	int i;
+
+	for(i=top_order;i>=0;i--) {
+		if(free_lists[i]) {
+			largest = block_size(i);
+			break;
+		}
+	}
+
+	stats_set("parrot.channel.size",channel_size);
+	stats_set("parrot.channel.used",bytes_used);
+	stats_set("parrot.channel.cached",bytes_cached);
+	stats_set("parrot.channel.free",free_bytes);
+	stats_set("parrot.channel.largest_free",largest);
+	/* percent of the free space which is not in the largest free block */
+	stats_set("parrot.channel.fragmentation",free_bytes ? 100-(100*largest)/free_bytes : 0);
+}
+
+/* Return a block to the free lists, merging it with its free buddies. */
+static void block_release( struct block *b )
+{
+	block_unname(b);
+
+	while(b->order<top_order) {
+		struct block *buddy = itable_lookup(blocks,b->start^block_size(b->order));
+		if(!buddy || buddy->state!=BLOCK_FREE || buddy->order!=b->order) break;
+		list_remove(&free_lists[buddy->order],0,buddy);
+		if(buddy->start<b->start) {
+			struct block *t = b;
+			b = buddy;
+			buddy = t;
+		}
+		itable_remove(blocks,buddy->start);
+		free(buddy);
+		b->order++;
+	}
+
+	b->state = BLOCK_FREE;
+	b->refs = 0;
+	list_push(&free_lists[b->order],b);
+}
+
+/* Release a block which has held data, giving large ones back to the system. */
+static void block_discard( struct block *b )
+{
+	if(block_size(b->order)>=CHANNEL_PUNCH_MIN) {
+		if(fallocate(channel_fd,FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,b->start,block_size(b->order))==0) {
+			stats_inc("parrot.channel.released",block_size(b->order));
+		}
+	}
+	block_release(b);
+}
+
+/* Take a free block of exactly this order, splitting a larger one if needed. */
+static struct block * block_take( int order )
+{
+	struct block *b;
+	int i;
+
+	for(i=order;i<=top_order;i++) {
+		if(free_lists[i]) break;
+	}
+	if(i>top_order) return 0;
+
+	b = free_lists[i];
+	list_remove(&free_lists[i],0,b);
+
+	while(b->order>order) {
+		struct block *buddy;
+		b->order--;
+		buddy = block_create(b->start+block_size(b->order),b->order);
+		buddy->state = BLOCK_FREE;
+		list_push(&free_lists[buddy->order],buddy);
 	}
 
-	return e;
+	return b;
+}
+
+static int channel_map( pfs_size_t offset, pfs_size_t length )
+{
+	if(mmap(channel_base+offset,length,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_FIXED,channel_fd,offset)==MAP_FAILED)
+		return 0;
+	if(pfs_channel_huge_pages && madvise(channel_base+offset,length,MADV_HUGEPAGE)==-1)
+		debug(D_CHANNEL,"could not use huge pages for the channel: %s",strerror(errno));
+	return 1;
 }
 
-static void entry_delete( struct entry *e )
+/* Double the size of the channel, in place if the reservation allows. */
+static int channel_grow()
 {
-	if(head==e) head = e->next;
-	if(e->prev) e->prev->next = e->next;
-	if(e->next) e->next->prev = e->prev;
-	free(e->name);
-	free(e);
+	pfs_size_t newsize = channel_size*2;
+
+	if(top_order+1>=ORDER_MAX) {
+		errno = ENOMEM;
+		return 0;
+	}
+
+	if(ftruncate64(channel_fd,newsize)!=0)
+		return 0;
+
+	if(newsize<=channel_reserved) {
+		if(!channel_map(channel_size,newsize-channel_size)) {
+			ftruncate64(channel_fd,channel_size);
+			return 0;
+		}
+	} else {
+		void *newbase;
+		if(channel_reserved>channel_size) {
+			munmap(channel_base+channel_size,channel_reserved-channel_size);
+			channel_reserved = channel_size;
+		}
+		newbase = mremap(channel_base,channel_size,newsize,MREMAP_MAYMOVE);
+		if(newbase==MAP_FAILED) {
+			ftruncate64(channel_fd,channel_size);
+			return 0;
+		}
+		channel_base = newbase;
+		channel_reserved = newsize;
+		if(pfs_channel_huge_pages) madvise(channel_base,newsize,MADV_HUGEPAGE);
+	}
+
+	top_order++;
+	block_release(block_create(channel_size,top_order-1));
+	channel_size = newsize;
+	stats_inc("parrot.channel.grows",1);
+	update_stats();
+
+	debug(D_CHANNEL,"channel expanded to 0x%" PRIx64 " bytes at base 0x%" PRIxPTR ", %" PRId64 " in use, %" PRId64 " cached",(uint64_t)channel_size,(uintptr_t)channel_base,(int64_t)bytes_used,(int64_t)bytes_cached);
+
+	return 1;
 }
 
 int pfs_channel_init( pfs_size_t size )
 {
 	extern char pfs_temp_per_instance_dir[PATH_MAX];
+	void *reservation = MAP_FAILED;
+	pfs_size_t reserve;
 
 	if (channel_fd == -1) {
 		channel_fd = --parrot_fd_start;
@@ -107,23 +313,44 @@ int pfs_channel_init( pfs_size_t size )
 		close(fd);
 	}
 
-	channel_size = size;
+	page_size = sysconf(_SC_PAGE_SIZE);
+	top_order = order_for(size);
+	channel_size = block_size(top_order);
 	ftruncate(channel_fd,channel_size);
 
-	channel_base = (char*) mmap(0,channel_size,PROT_READ|PROT_WRITE,MAP_SHARED,channel_fd,0);
-	if(channel_base==MAP_FAILED) {
-		close(channel_fd);
-		return 0;
+	/* Reserve as much address space as we can get, aligned for huge pages. */
+	for(reserve=CHANNEL_RESERVE;reserve>channel_size;reserve/=2) {
+		reservation = mmap(0,reserve+CHANNEL_ALIGN,PROT_NONE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE,-1,0);
+		if(reservation!=MAP_FAILED) break;
 	}
 
-	head = entry_create(0,0,channel_size,0,0);
-	if(!head) {
-		close(channel_fd);
-		munmap(channel_base,channel_size);
-		return 0;
+	if(reservation!=MAP_FAILED) {
+		uintptr_t addr = (uintptr_t)reservation;
+		uintptr_t aligned = (addr+CHANNEL_ALIGN-1) & ~((uintptr_t)CHANNEL_ALIGN-1);
+		if(aligned>addr) munmap(reservation,aligned-addr);
+		munmap((char*)aligned+reserve,CHANNEL_ALIGN-(aligned-addr));
+		channel_base = (char*)aligned;
+		channel_reserved = reserve;
+		if(!channel_map(0,channel_size)) {
+			munmap(channel_base,channel_reserved);
+			close(channel_fd);
+			return 0;
+		}
+	} else {
+		channel_base = (char*) mmap(0,channel_size,PROT_READ|PROT_WRITE,MAP_SHARED,channel_fd,0);
+		if(channel_base==MAP_FAILED) {
+			close(channel_fd);
+			return 0;
+		}
+		channel_reserved = channel_size;
 	}
 
-	debug(D_CHANNEL,"fd is %d",channel_fd);
+	blocks = itable_create(0);
+	names = hash_table_create(0,0);
+	block_release(block_create(0,top_order));
+	update_stats();
+
+	debug(D_CHANNEL,"fd is %d, 0x%" PRIx64 " bytes reserved",channel_fd,(uint64_t)channel_reserved);
 
 	return 1;
 }
@@ -138,160 +365,141 @@ char * pfs_channel_base()
 	return channel_base;
 }
 
-static int page_size=0;
-
-static pfs_size_t round_up( pfs_size_t x )
-{
-	if(page_size==0) page_size = sysconf(_SC_PAGE_SIZE);
-	if(x%page_size) x = page_size * ((x/page_size)+1);
-	if(x<=0) x=page_size;
-	return x;
-}
-
 int pfs_channel_alloc( const char *name, pfs_size_t length, pfs_size_t *start )
 {
-	struct entry *e = head;
-	struct entry *tail;
-	pfs_size_t newsize;
+	struct block *b;
+	int order;
 
 	length = round_up(length);
-
-	do {
-		if(!e->inuse) {
-			if(e->length>=length) {
-				if(e->length>length) {
-					struct entry *f;
-					f = entry_create(0,e->start+length,e->length-length,e,e->next);
-					if(!f) return 0;
-				}
-
-				e->name = name ? xxstrdup(name) : 0;
-				e->length = length;
-				e->inuse = 1;
-				*start = e->start;
-				memset(channel_base+*start+length-page_size,0,page_size);
-				debug(D_DEBUG, "allocated channel " CHANNEL_FMT, CHANNEL_FMT_ARGS(e));
-				return 1;
-			} else {
-				/* not big enough */
+	order = order_for(length);
+
+	while(!(b = block_take(order))) {
+		if(cache_head) {
+			b = cache_head;
+			debug(D_CHANNEL,"evicting channel " CHANNEL_FMT,CHANNEL_FMT_ARGS(b));
+			list_remove(&cache_head,&cache_tail,b);
+			bytes_cached -= block_size(b->order);
+			block_discard(b);
+			stats_inc("parrot.channel.evictions",1);
+		} else {
+			debug(D_CHANNEL,"channel is full, attempting to expand it...");
+			if(!channel_grow()) {
+				debug(D_CHANNEL|D_NOTICE,"out of channel space: %s",strerror(errno));
+				return 0;
 			}
 		}
-		tail = e;
-		e = e->next;
-	} while(e!=head);
-
-	debug(D_CHANNEL,"channel is full, attempting to expand it...");
-	newsize = channel_size + length;
+	}
 
-	if(ftruncate64(channel_fd,newsize)==0) {
-		void *newbase;
-		newbase = mremap(channel_base,channel_size,newsize,MREMAP_MAYMOVE);
-		if(newbase!=MAP_FAILED) {
-			e = entry_create(name,channel_size,newsize-channel_size,tail,head);
-			channel_size = newsize;
-			channel_base = newbase;
-			debug(D_CHANNEL,"channel expanded to 0x%" PRIu64 " bytes at base 0x%" PRIdPTR, newsize, (uintptr_t) newbase);
-			return pfs_channel_alloc(name,length,start);
-		}
-		ftruncate64(channel_fd,channel_size);
+	if(name) {
+		struct block *old = hash_table_lookup(names,name);
+		if(old) pfs_channel_update_name(name,0);
+		b->name = xxstrdup(name);
+		hash_table_insert(names,name,b);
 	}
 
-	debug(D_CHANNEL|D_NOTICE,"out of channel space: %s",strerror(errno));
+	b->state = BLOCK_INUSE;
+	b->refs = 1;
+	bytes_used += block_size(b->order);
+	*start = b->start;
+	memset(channel_base+*start+length-page_size,0,page_size);
+	debug(D_DEBUG, "allocated channel " CHANNEL_FMT, CHANNEL_FMT_ARGS(b));
 
-	return 0;
+	stats_inc("parrot.channel.allocs",1);
+	update_stats();
+
+	return 1;
 }
 
 int pfs_channel_lookup( const char *name, pfs_size_t *start )
 {
-	struct entry *e = head;
+	struct block *b = hash_table_lookup(names,name);
 
-	do {
-		if(e->name && !strcmp(e->name,name)) {
-			*start = e->start;
-			return 1;
-		}
-		e = e->next;
-	} while(e!=head);
+	if(b) {
+		*start = b->start;
+		return 1;
+	}
 
 	return 0;
 }
 
 int pfs_channel_addref( pfs_size_t start )
 {
-	struct entry *e = head;
+	struct block *b = itable_lookup(blocks,start);
 
-	do {
-		if(e->start==start) {
-			e->inuse++;
-			debug(D_DEBUG, "increasing refcount to %d for channel " CHANNEL_FMT, e->inuse, CHANNEL_FMT_ARGS(e));
-			return 1;
-		}
-		e = e->next;
-	} while(e!=head);
-	return 0;
+	if(!b || b->state==BLOCK_FREE) return 0;
+
+	if(b->state==BLOCK_CACHED) {
+		list_remove(&cache_head,&cache_tail,b);
+		bytes_cached -= block_size(b->order);
+		bytes_used += block_size(b->order);
+		b->state = BLOCK_INUSE;
+		stats_inc("parrot.channel.cache_hits",1);
+	}
+
+	b->refs++;
+	debug(D_DEBUG, "increasing refcount to %d for channel " CHANNEL_FMT, b->refs, CHANNEL_FMT_ARGS(b));
+	return 1;
 }
 
 int pfs_channel_update_name( const char *oldname, const char *newname )
 {
-	struct entry *e = head;
+	struct block *b;
+
 	debug(D_CHANNEL,"updating channel for file '%s' to '%s'",oldname,newname);
+
 	/* If the channel already has an entry with the new name, make it
 	 * anonymous so we don't see stale entries later.
 	 */
-	if (newname) {
-		do {
-			if(e->name && !strcmp(e->name, newname)) {
-				debug(D_CHANNEL, "invalidating existing channel name");
-				free(e->name);
-				e->name = NULL;
-			}
-			e = e->next;
-		} while(e != head);
+	if(newname && (b = hash_table_lookup(names,newname))) {
+		debug(D_CHANNEL, "invalidating existing channel name");
+		block_unname(b);
+		if(b->state==BLOCK_CACHED) {
+			list_remove(&cache_head,&cache_tail,b);
+			bytes_cached -= block_size(b->order);
+			block_discard(b);
+		}
 	}
 
-	do {
-		if(e->name && !strcmp(e->name,oldname)) {
-			free(e->name);
-			e->name = newname ? xxstrdup(newname) : 0;
-			debug(D_DEBUG, "channel is now " CHANNEL_FMT, CHANNEL_FMT_ARGS(e));
-			return 1;
-		}
-		e = e->next;
-	} while(e!=head);
+	b = hash_table_lookup(names,oldname);
+	if(!b) return 0;
+
+	block_unname(b);
+	if(newname) {
+		b->name = xxstrdup(newname);
+		hash_table_insert(names,newname,b);
+		debug(D_DEBUG, "channel is now " CHANNEL_FMT, CHANNEL_FMT_ARGS(b));
+	} else if(b->state==BLOCK_CACHED) {
+		list_remove(&cache_head,&cache_tail,b);
+		bytes_cached -= block_size(b->order);
+		block_discard(b);
+	}
 
-	return 0;
+	update_stats();
+	return 1;
 }
 
 void pfs_channel_free( pfs_size_t start )
 {
-	struct entry *e = head;
-
-	do {
-		if(e->start==start) {
-			e->inuse--;
-			debug(D_DEBUG, "decreasing refcount to %d for channel " CHANNEL_FMT, e->inuse, CHANNEL_FMT_ARGS(e));
-			if(e->inuse<=0) {
-				struct entry *prev = e->prev;
-				struct entry *next = e->next;
-
-				debug(D_DEBUG, "freeing channel " CHANNEL_FMT, CHANNEL_FMT_ARGS(e));
-				e->inuse = 0;
-				/* collapse adjacent free blocks */
-				if((e->start <= next->start) && next->inuse == 0) {
-					e->length += next->length;
-					entry_delete(next);
-					if (next == prev)
-						prev = NULL;
-				}
-				if(prev && (prev->start <= e->start) && prev->inuse == 0) {
-					prev->length += e->length;
-					entry_delete(e);
-				}
-			}
-			return;
-		}
-		e = e->next;
-	} while(e!=head);
+	struct block *b = itable_lookup(blocks,start);
+
+	if(!b || b->state!=BLOCK_INUSE) return;
+
+	b->refs--;
+	debug(D_DEBUG, "decreasing refcount to %d for channel " CHANNEL_FMT, b->refs, CHANNEL_FMT_ARGS(b));
+	if(b->refs>0) return;
+
+	bytes_used -= block_size(b->order);
+	if(b->name) {
+		debug(D_DEBUG, "caching channel " CHANNEL_FMT, CHANNEL_FMT_ARGS(b));
+		b->state = BLOCK_CACHED;
+		bytes_cached += block_size(b->order);
+		cache_append(b);
+	} else {
+		debug(D_DEBUG, "freeing channel " CHANNEL_FMT, CHANNEL_FMT_ARGS(b));
+		block_discard(b);
+	}
+
+	update_stats();
 }
 
 /* vim: set noexpandtab tabstop=4: */
@@ -26,6 +26,9 @@ void   pfs_channel_free( pfs_size_t start );
 
 int    pfs_channel_update_name( const char* oldname, const char* newname );
 
+/* Ask for transparent huge pages to back the channel. */
+extern int pfs_channel_huge_pages;
+
 #ifdef __cplusplus
 }
 #endif
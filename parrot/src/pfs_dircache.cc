@@ -18,37 +18,141 @@ extern "C" {
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <string.h>
+#include <time.h>
 
-pfs_dircache::pfs_dircache()
+#define ENTRY_LSTAT         (1<<0)
+#define ENTRY_STAT          (1<<1)
+#define ENTRY_LSTAT_MISSING (1<<2)
+#define ENTRY_STAT_MISSING  (1<<3)
+#define ENTRY_LINK          (1<<4)
+
+struct pfs_dircache_entry {
+	char *path;
+	int flags;
+	time_t expires;
+	struct pfs_stat lbuf;
+	struct pfs_stat sbuf;
+	char *link;
+	pfs_size_t linklen;
+	struct pfs_dircache_entry *prev;
+	struct pfs_dircache_entry *next;
+};
+
+static struct hash_table *ttl_table = 0;
+
+void pfs_dircache::set_ttl( const char *service, int ttl )
 {
-	dircache_table = 0;
-	dircache_path  = 0;
+	int *value = (int *)xxmalloc(sizeof(*value));
+	*value = ttl;
+
+	if(!ttl_table) ttl_table = hash_table_create(0, 0);
+	free(hash_table_remove(ttl_table, service));
+	hash_table_insert(ttl_table, service, value);
+}
+
+pfs_dircache::pfs_dircache( const char *s, int t )
+{
+	table = 0;
+	head = tail = 0;
+	count = 0;
+	dircache_path = 0;
+	service = s;
+	ttl = t;
 }
 
 pfs_dircache::~pfs_dircache()
 {
 	invalidate();
 
-	if (dircache_table)
-		hash_table_delete(dircache_table);
+	if (table)
+		hash_table_delete(table);
+}
 
-	if (dircache_path)
-		free(dircache_path);
+/* Overrides are only set while parsing arguments, so looking them up on each
+ * insert is cheap and avoids ordering problems with static constructors. */
+int pfs_dircache::get_ttl()
+{
+	int *value;
+	if (ttl_table && service && (value = (int *)hash_table_lookup(ttl_table, service)))
+		return *value;
+	if (ttl_table && (value = (int *)hash_table_lookup(ttl_table, "*")))
+		return *value;
+	return ttl;
 }
 
-void pfs_dircache::invalidate()
+void pfs_dircache::remove( struct pfs_dircache_entry *e )
 {
-	char *key;
-	void *value;
+	hash_table_remove(table, e->path);
+	if (e->prev) e->prev->next = e->next; else head = e->next;
+	if (e->next) e->next->prev = e->prev; else tail = e->prev;
+	count--;
+	free(e->path);
+	free(e->link);
+	free(e);
+}
 
-	if (dircache_table) {
-		hash_table_firstkey(dircache_table);
-		while (hash_table_nextkey(dircache_table, &key, &value)) {
-			hash_table_remove(dircache_table, key);
-			free(value);
-		}
+struct pfs_dircache_entry *pfs_dircache::find( const char *path )
+{
+	struct pfs_dircache_entry *e;
+
+	if (!table)
+		return 0;
+
+	e = (struct pfs_dircache_entry *)hash_table_lookup(table, path);
+	if (!e)
+		return 0;
+
+	if (e->expires <= time(0)) {
+		remove(e);
+		return 0;
+	}
+
+	/* move to the front of the LRU list */
+	if (e != head) {
+		e->prev->next = e->next;
+		if (e->next) e->next->prev = e->prev; else tail = e->prev;
+		e->prev = 0;
+		e->next = head;
+		head->prev = e;
+		head = e;
+	}
+
+	return e;
+}
+
+/* Find or create the entry for path, resetting its lifetime. */
+struct pfs_dircache_entry *pfs_dircache::fetch( const char *path )
+{
+	struct pfs_dircache_entry *e;
+	int t = get_ttl();
+
+	if (t <= 0)
+		return 0;
+
+	if (!table) table = hash_table_create(0, 0);
+
+	e = find(path);
+	if (!e) {
+		while (count >= PFS_DIRCACHE_MAX && tail)
+			remove(tail);
+		e = (struct pfs_dircache_entry *)xxcalloc(1, sizeof(*e));
+		e->path = xxstrdup(path);
+		e->next = head;
+		if (head) head->prev = e; else tail = e;
+		head = e;
+		hash_table_insert(table, path, e);
+		count++;
 	}
+	e->expires = time(0) + t;
+	return e;
+}
+
+void pfs_dircache::invalidate()
+{
+	while (head)
+		remove(head);
 
 	if (dircache_path) {
 		free(dircache_path);
@@ -56,44 +160,156 @@ void pfs_dircache::invalidate()
 	}
 }
 
+void pfs_dircache::invalidate( const char *path )
+{
+	char parent[PFS_PATH_MAX];
+	struct pfs_dircache_entry *e;
+
+	if (!table)
+		return;
+
+	if ((e = (struct pfs_dircache_entry *)hash_table_lookup(table, path)))
+		remove(e);
+
+	path_dirname(path, parent);
+	if ((e = (struct pfs_dircache_entry *)hash_table_lookup(table, parent)))
+		remove(e);
+}
+
+void pfs_dircache::invalidate_tree( const char *path )
+{
+	struct pfs_dircache_entry *e, *next;
+	size_t n = strlen(path);
+
+	invalidate(path);
+
+	for (e = head; e; e = next) {
+		next = e->next;
+		if (!strncmp(e->path, path, n) && e->path[n] == '/')
+			remove(e);
+	}
+}
+
 void pfs_dircache::begin( const char *path )
 {
-	invalidate();
+	free(dircache_path);
 	dircache_path = xxstrdup(path);
 }
 
 void pfs_dircache::insert( const char *name, struct pfs_stat *buf, pfs_dir *dir )
 {
 	char path[PFS_PATH_MAX];
-	struct pfs_stat *copy;
-
-	if (!dircache_table) dircache_table = hash_table_create(0, 0);
 
 	dir->append(name);
 
-	copy = (struct pfs_stat *)xxmalloc(sizeof(struct pfs_stat));
-	*copy = *buf;
+	if (!dircache_path)
+		return;
+
+	snprintf(path, sizeof(path), "%s/%s", dircache_path, path_basename(name));
+	insert_stat(path, buf, 0);
+}
+
+int pfs_dircache::lookup( const char *path, struct pfs_stat *buf, int follow )
+{
+	struct pfs_dircache_entry *e = find(path);
+
+	if (!e)
+		return 0;
+
+	if (follow) {
+		/* nothing at the path means nothing to follow, but a dangling link has no target */
+		if (e->flags & ENTRY_STAT) {
+			*buf = e->sbuf;
+			return 1;
+		} else if (e->flags & (ENTRY_STAT_MISSING|ENTRY_LSTAT_MISSING)) {
+			errno = ENOENT;
+			return -1;
+		} else if (e->flags & ENTRY_LSTAT && !S_ISLNK(e->lbuf.st_mode)) {
+			*buf = e->lbuf;
+			return 1;
+		}
+	} else {
+		if (e->flags & ENTRY_LSTAT) {
+			*buf = e->lbuf;
+			return 1;
+		} else if (e->flags & ENTRY_LSTAT_MISSING) {
+			errno = ENOENT;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+void pfs_dircache::insert_stat( const char *path, const struct pfs_stat *buf, int follow )
+{
+	struct pfs_dircache_entry *e = fetch(path);
+
+	if (!e)
+		return;
 
-	sprintf(path, "%s/%s", dircache_path, path_basename(name));
-	hash_table_insert(dircache_table, path, copy);
+	if (follow) {
+		/* something is at the path, so neither lookup can be missing */
+		e->flags = (e->flags & ~(ENTRY_STAT_MISSING|ENTRY_LSTAT_MISSING)) | ENTRY_STAT;
+		e->sbuf = *buf;
+	} else {
+		if (!S_ISLNK(buf->st_mode)) {
+			e->flags = (e->flags & ~ENTRY_STAT_MISSING) | ENTRY_STAT;
+			e->sbuf = *buf;
+		} else if (!(e->flags & ENTRY_LSTAT) || !S_ISLNK(e->lbuf.st_mode) || e->lbuf.st_ino != buf->st_ino) {
+			/* a link that was not there before may lead anywhere */
+			e->flags &= ~(ENTRY_STAT|ENTRY_STAT_MISSING);
+		}
+		e->flags = (e->flags & ~ENTRY_LSTAT_MISSING) | ENTRY_LSTAT;
+		e->lbuf = *buf;
+	}
 }
 
-int pfs_dircache::lookup( const char *path, struct pfs_stat *buf )
+/*
+stat() of a dangling link fails while lstat() does not, so a failed stat()
+says nothing of lstat().  A failed lstat() means nothing is at the path,
+so stat() would fail as well.
+*/
+void pfs_dircache::insert_missing( const char *path, int follow )
 {
-	struct pfs_stat *value;
-	int result = 0;
+	struct pfs_dircache_entry *e = fetch(path);
 
-	if (!dircache_table) dircache_table = hash_table_create(0, 0);
+	if (!e)
+		return;
 
-	value = (struct pfs_stat *)hash_table_lookup(dircache_table, path);
-	if (value) {
-		*buf = *value;
-		hash_table_remove(dircache_table, path);
-		free(value);
-		result = 1;
+	if (follow) {
+		e->flags = (e->flags & ~ENTRY_STAT) | ENTRY_STAT_MISSING;
+	} else {
+		e->flags = (e->flags & ~(ENTRY_LSTAT|ENTRY_LINK|ENTRY_STAT)) | ENTRY_LSTAT_MISSING | ENTRY_STAT_MISSING;
+		free(e->link);
+		e->link = 0;
 	}
+}
+
+int pfs_dircache::lookup_readlink( const char *path, char *buf, pfs_size_t size )
+{
+	struct pfs_dircache_entry *e = find(path);
+
+	if (!e || !(e->flags & ENTRY_LINK))
+		return -1;
+
+	pfs_size_t length = e->linklen < size ? e->linklen : size;
+	memcpy(buf, e->link, length);
+	return length;
+}
+
+void pfs_dircache::insert_readlink( const char *path, const char *target, pfs_size_t length )
+{
+	struct pfs_dircache_entry *e = fetch(path);
+
+	if (!e)
+		return;
 
-	return (result);
+	free(e->link);
+	e->link = (char *)xxmalloc(length);
+	memcpy(e->link, target, length);
+	e->linklen = length;
+	e->flags = (e->flags & ~ENTRY_LSTAT_MISSING) | ENTRY_LINK;
 }
 
 /* vim: set noexpandtab tabstop=4: */
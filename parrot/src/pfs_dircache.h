@@ -15,21 +15,64 @@ extern "C" {
 #include "xxmalloc.h"
 }
 
+/*
+A pfs_dircache remembers the metadata of a remote service: lstat and stat
+results (including ENOENT) and readlink targets, keyed by the full Parrot
+path.  Entries come from directory listings and from individual lookups, live
+for the service's TTL, and are evicted least-recently-used beyond a fixed
+number of entries.  Since all traced processes are served by the single
+parrot_run process, one cache per service is shared by the whole session.
+
+Services must invalidate a path when they modify it.  The TTL of a service
+may be overridden with parrot_run --metadata-ttl <service>=<seconds>; a TTL
+of zero disables the cache.
+*/
+
+#define PFS_DIRCACHE_MAX 16384
+
 class pfs_dir;
+struct pfs_dircache_entry;
 
 class pfs_dircache {
 public:
-	pfs_dircache();
+	pfs_dircache( const char *service = 0, int ttl = 5 );
 	virtual ~pfs_dircache();
 
+	/* Drop everything. */
 	virtual void invalidate();
+	/* Drop a path and its parent directory. */
+	virtual void invalidate( const char *path );
+	/* Drop a path, its parent and everything below it (rename, rmdir). */
+	virtual void invalidate_tree( const char *path );
+
+	/* Fill the cache from a directory listing of path. */
 	virtual void begin( const char *path );
-	virtual void insert( const char *name, struct pfs_stat *buf, pfs_dir *dir);
-	virtual int lookup( const char *path, struct pfs_stat *buf );
+	virtual void insert( const char *name, struct pfs_stat *buf, pfs_dir *dir );
+
+	/* Returns 1 on a hit, -1 with errno=ENOENT on a negative hit, 0 on a miss. */
+	virtual int lookup( const char *path, struct pfs_stat *buf, int follow = 0 );
+	virtual void insert_stat( const char *path, const struct pfs_stat *buf, int follow );
+	virtual void insert_missing( const char *path, int follow );
+
+	/* Returns the length of the cached target, or -1 on a miss. */
+	virtual int lookup_readlink( const char *path, char *buf, pfs_size_t size );
+	virtual void insert_readlink( const char *path, const char *target, pfs_size_t length );
+
+	static void set_ttl( const char *service, int ttl );
+
+private:
+	struct pfs_dircache_entry *find( const char *path );
+	struct pfs_dircache_entry *fetch( const char *path );
+	void remove( struct pfs_dircache_entry *e );
+	int get_ttl();
 
-protected:
-	struct hash_table *dircache_table;
+	struct hash_table *table;
+	struct pfs_dircache_entry *head;
+	struct pfs_dircache_entry *tail;
+	int count;
 	char *dircache_path;
+	const char *service;
+	int ttl;
 };
 
 #endif
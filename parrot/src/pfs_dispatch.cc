@@ -3596,6 +3596,7 @@ void pfs_dispatch32( struct pfs_process *p )
 {
 	struct pfs_process *oldcurrent = pfs_current;
 	pfs_current = p;
+	pfs_profile_begin(p);
 
 	switch(p->state) {
 		case PFS_PROCESS_STATE_KERNEL:
@@ -3609,9 +3610,12 @@ void pfs_dispatch32( struct pfs_process *p )
 			assert(0);
 	}
 
+	pfs_profile_end(p,0);
+
 	switch(p->state) {
 		case PFS_PROCESS_STATE_KERNEL:
 		case PFS_PROCESS_STATE_USER:
+			tracer_stop_at_exit(p->tracer,p->state==PFS_PROCESS_STATE_KERNEL);
 			tracer_continue(p->tracer,0);
 			break;
 		default:
@@ -433,13 +433,41 @@ static int iovec_size( struct pfs_process *p, struct pfs_kernel_iovec *v, int co
 static int iovec_copy_in( struct pfs_process *p, char *buf, struct pfs_kernel_iovec *v, int count )
 {
 	int i, pos=0;
+	struct tracer_gather g;
+	tracer_gather_init(&g);
 	for(i=0;i<count;i++) {
-		tracer_copy_in(p->tracer,&buf[pos],POINTER(v[i].iov_base),v[i].iov_len,0);
+		if(g.n == TRACER_GATHER_MAX) {
+			tracer_gather_copy_in(p->tracer,&g);
+			tracer_gather_init(&g);
+		}
+		tracer_gather_add(&g,&buf[pos],POINTER(v[i].iov_base),v[i].iov_len);
 		pos += v[i].iov_len;
 	}
+	tracer_gather_copy_in(p->tracer,&g);
 	return pos;
 }
 
+/* Fetch two strings (two paths, or a path and an attribute name) at once. */
+static int copy_in_string_pair( struct pfs_process *p, char *a, const void *ua, size_t alen, char *b, const void *ub, size_t blen )
+{
+	struct tracer_gather g;
+	tracer_gather_init(&g);
+	tracer_gather_add_string(&g,a,ua,alen,NULL);
+	tracer_gather_add_string(&g,b,ub,blen,NULL);
+	return tracer_gather_copy_in(p->tracer,&g);
+}
+
+/* Fetch a path and, if udata is not NULL, the fixed size argument beside it. */
+static int copy_in_path_and( struct pfs_process *p, char *path, const void *upath, size_t pathlen, void *data, const void *udata, size_t length )
+{
+	struct tracer_gather g;
+	tracer_gather_init(&g);
+	tracer_gather_add_string(&g,path,upath,pathlen,NULL);
+	if(udata)
+		tracer_gather_add(&g,data,udata,length);
+	return tracer_gather_copy_in(p->tracer,&g);
+}
+
 static int iovec_copy_out( struct pfs_process *p, void *buf, struct pfs_kernel_iovec *v, int count, size_t total )
 {
 	int i = 0;
@@ -969,6 +997,7 @@ static void decode_syscall( struct pfs_process *p, int entering )
 	if(entering) {
 		p->state = PFS_PROCESS_STATE_KERNEL;
 		p->syscall_dummy = 0;
+		p->syscall_passthrough = 0;
 		tracer_args_get(p->tracer,&p->syscall,p->syscall_args);
 
 		debug(D_SYSCALL,"%s",tracer_syscall_name(p->tracer,p->syscall));
@@ -1569,7 +1598,10 @@ static void decode_syscall( struct pfs_process *p, int entering )
 		case SYSCALL64_read:
 		case SYSCALL64_pread64:
 			if (p->table->isnative(args[0])) {
-				if (entering) debug(D_DEBUG, "fallthrough %s(%" PRId64 ", %" PRId64 ", %" PRId64 ")", tracer_syscall_name(p->tracer,p->syscall), args[0], args[1], args[2]);
+				if (entering) {
+					debug(D_DEBUG, "fallthrough %s(%" PRId64 ", %" PRId64 ", %" PRId64 ")", tracer_syscall_name(p->tracer,p->syscall), args[0], args[1], args[2]);
+					p->syscall_passthrough = 1;
+				}
 			} else {
 				decode_read(p,entering,p->syscall,args);
 			}
@@ -1578,7 +1610,10 @@ static void decode_syscall( struct pfs_process *p, int entering )
 		case SYSCALL64_write:
 		case SYSCALL64_pwrite64:
 			if (p->table->isnative(args[0])) {
-				if (entering) debug(D_DEBUG, "fallthrough %s(%" PRId64 ", %" PRId64 ", %" PRId64 ")", tracer_syscall_name(p->tracer,p->syscall), args[0], args[1], args[2]);
+				if (entering) {
+					debug(D_DEBUG, "fallthrough %s(%" PRId64 ", %" PRId64 ", %" PRId64 ")", tracer_syscall_name(p->tracer,p->syscall), args[0], args[1], args[2]);
+					p->syscall_passthrough = 1;
+				}
 			} else {
 				decode_write(p,entering,p->syscall,args);
 			}
@@ -1586,7 +1621,10 @@ static void decode_syscall( struct pfs_process *p, int entering )
 
 		case SYSCALL64_readv:
 			if (p->table->isnative(args[0])) {
-				if (entering) debug(D_DEBUG, "fallthrough %s(%" PRId64 ", %" PRId64 ", %" PRId64 ")", tracer_syscall_name(p->tracer,p->syscall), args[0], args[1], args[2]);
+				if (entering) {
+					debug(D_DEBUG, "fallthrough %s(%" PRId64 ", %" PRId64 ", %" PRId64 ")", tracer_syscall_name(p->tracer,p->syscall), args[0], args[1], args[2]);
+					p->syscall_passthrough = 1;
+				}
 			} else {
 				decode_readv(p,entering,p->syscall,args);
 			}
@@ -1594,7 +1632,10 @@ static void decode_syscall( struct pfs_process *p, int entering )
 
 		case SYSCALL64_writev:
 			if (p->table->isnative(args[0])) {
-				if (entering) debug(D_DEBUG, "fallthrough %s(%" PRId64 ", %" PRId64 ", %" PRId64 ")", tracer_syscall_name(p->tracer,p->syscall), args[0], args[1], args[2]);
+				if (entering) {
+					debug(D_DEBUG, "fallthrough %s(%" PRId64 ", %" PRId64 ", %" PRId64 ")", tracer_syscall_name(p->tracer,p->syscall), args[0], args[1], args[2]);
+					p->syscall_passthrough = 1;
+				}
 			} else {
 				decode_writev(p,entering,p->syscall,args);
 			}
@@ -1828,7 +1869,10 @@ static void decode_syscall( struct pfs_process *p, int entering )
 
 		case SYSCALL64_lseek:
 			if (p->table->isnative(args[0])) {
-				if (entering) debug(D_DEBUG, "fallthrough %s(%" PRId64 ", %" PRId64 ", %" PRId64 ")", tracer_syscall_name(p->tracer,p->syscall), args[0], args[1], args[2]);
+				if (entering) {
+					debug(D_DEBUG, "fallthrough %s(%" PRId64 ", %" PRId64 ", %" PRId64 ")", tracer_syscall_name(p->tracer,p->syscall), args[0], args[1], args[2]);
+					p->syscall_passthrough = 1;
+				}
 			} else if(entering) {
 				p->syscall_result = pfs_lseek(args[0],args[1],args[2]);
 				if(p->syscall_result<0) p->syscall_result = -errno;
@@ -1848,7 +1892,10 @@ static void decode_syscall( struct pfs_process *p, int entering )
 
 		case SYSCALL64_fstat:
 			if (p->table->isnative(args[0])) {
-				if (entering) debug(D_DEBUG, "fallthrough %s(%" PRId64 ", %" PRId64 ", %" PRId64 ")", tracer_syscall_name(p->tracer,p->syscall), args[0], args[1], args[2]);
+				if (entering) {
+					debug(D_DEBUG, "fallthrough %s(%" PRId64 ", %" PRId64 ", %" PRId64 ")", tracer_syscall_name(p->tracer,p->syscall), args[0], args[1], args[2]);
+					p->syscall_passthrough = 1;
+				}
 			} else {
 				decode_stat(p,entering,SYSCALL64_fstat,args);
 			}
@@ -2245,8 +2292,7 @@ static void decode_syscall( struct pfs_process *p, int entering )
 
 		case SYSCALL64_rename:
 			if(entering) {
-				TRACER_MEM_OP(tracer_copy_in_string(p->tracer,path,POINTER(args[0]),sizeof(path),0));
-				TRACER_MEM_OP(tracer_copy_in_string(p->tracer,path2,POINTER(args[1]),sizeof(path2),0));
+				TRACER_MEM_OP(copy_in_string_pair(p,path,POINTER(args[0]),sizeof(path),path2,POINTER(args[1]),sizeof(path2)));
 				p->syscall_result = pfs_rename(path,path2);
 				if(p->syscall_result<0) p->syscall_result = -errno;
 				divert_to_dummy(p,p->syscall_result);
@@ -2255,8 +2301,7 @@ static void decode_syscall( struct pfs_process *p, int entering )
 
 		case SYSCALL64_link:
 			if(entering) {
-				TRACER_MEM_OP(tracer_copy_in_string(p->tracer,path,POINTER(args[0]),sizeof(path),0));
-				TRACER_MEM_OP(tracer_copy_in_string(p->tracer,path2,POINTER(args[1]),sizeof(path2),0));
+				TRACER_MEM_OP(copy_in_string_pair(p,path,POINTER(args[0]),sizeof(path),path2,POINTER(args[1]),sizeof(path2)));
 				p->syscall_result = pfs_link(path,path2);
 				if(p->syscall_result<0) p->syscall_result = -errno;
 				divert_to_dummy(p,p->syscall_result);
@@ -2265,8 +2310,7 @@ static void decode_syscall( struct pfs_process *p, int entering )
 
 		case SYSCALL64_symlink:
 			if(entering) {
-				TRACER_MEM_OP(tracer_copy_in_string(p->tracer,path,POINTER(args[0]),sizeof(path),0));
-				TRACER_MEM_OP(tracer_copy_in_string(p->tracer,path2,POINTER(args[1]),sizeof(path2),0));
+				TRACER_MEM_OP(copy_in_string_pair(p,path,POINTER(args[0]),sizeof(path),path2,POINTER(args[1]),sizeof(path2)));
 				p->syscall_result = pfs_symlink(path,path2);
 				if(p->syscall_result<0) p->syscall_result = -errno;
 				divert_to_dummy(p,p->syscall_result);
@@ -2317,10 +2361,8 @@ static void decode_syscall( struct pfs_process *p, int entering )
 		case SYSCALL64_utime:
 			if(entering) {
 				struct utimbuf ut;
-				TRACER_MEM_OP(tracer_copy_in_string(p->tracer,path,POINTER(args[0]),sizeof(path),0));
-				if(args[1]) {
-					TRACER_MEM_OP(tracer_copy_in(p->tracer,&ut,POINTER(args[1]),sizeof(ut),TRACER_O_ATOMIC));
-				} else {
+				TRACER_MEM_OP(copy_in_path_and(p,path,POINTER(args[0]),sizeof(path),&ut,POINTER(args[1]),sizeof(ut)));
+				if(!args[1]) {
 					ut.actime = ut.modtime = time(0);
 				}
 				p->syscall_result = pfs_utime(path,&ut);
@@ -2333,9 +2375,8 @@ static void decode_syscall( struct pfs_process *p, int entering )
 			if(entering) {
 				struct timeval times[2];
 				struct utimbuf ut;
-				TRACER_MEM_OP(tracer_copy_in_string(p->tracer,path,POINTER(args[0]),sizeof(path),0));
+				TRACER_MEM_OP(copy_in_path_and(p,path,POINTER(args[0]),sizeof(path),times,POINTER(args[1]),sizeof(times)));
 				if(args[1]) {
-					TRACER_MEM_OP(tracer_copy_in(p->tracer,times,POINTER(args[1]),sizeof(times),TRACER_O_ATOMIC));
 					ut.actime = times[0].tv_sec;
 					ut.modtime = times[1].tv_sec;
 				} else {
@@ -2364,12 +2405,11 @@ static void decode_syscall( struct pfs_process *p, int entering )
 
 		case SYSCALL64_getxattr:
 			if(entering) {
-				TRACER_MEM_OP(tracer_copy_in_string(p->tracer,path,POINTER(args[0]),sizeof(path),0)); /* args[0] */
 				char name[4096]; /* args[1] */
 				/* void *value args[2] */
 				size_t size = args[3]; /* args[3] */
 
-				TRACER_MEM_OP(tracer_copy_in_string(p->tracer,name,POINTER(args[1]),sizeof(name),0));
+				TRACER_MEM_OP(copy_in_string_pair(p,path,POINTER(args[0]),sizeof(path),name,POINTER(args[1]),sizeof(name)));
 				value = malloc(size); /* freed at return */
 				if (value == NULL) {
 				  divert_to_dummy(p,-ENOMEM);
@@ -2387,12 +2427,11 @@ static void decode_syscall( struct pfs_process *p, int entering )
 
 		case SYSCALL64_lgetxattr:
 			if(entering) {
-				TRACER_MEM_OP(tracer_copy_in_string(p->tracer,path,POINTER(args[0]),sizeof(path),0)); /* args[0] */
 				char name[4096]; /* args[1] */
 				/* void *value args[2] */
 				size_t size = args[3]; /* args[3] */
 
-				TRACER_MEM_OP(tracer_copy_in_string(p->tracer,name,POINTER(args[1]),sizeof(name),0));
+				TRACER_MEM_OP(copy_in_string_pair(p,path,POINTER(args[0]),sizeof(path),name,POINTER(args[1]),sizeof(name)));
 				value = malloc(size); /* freed at return */
 				if (value == NULL) {
 				  divert_to_dummy(p,-ENOMEM);
@@ -2452,13 +2491,12 @@ static void decode_syscall( struct pfs_process *p, int entering )
 
 		case SYSCALL64_setxattr:
 			if(entering) {
-				TRACER_MEM_OP(tracer_copy_in_string(p->tracer,path,POINTER(args[0]),sizeof(path),0)); /* args[0] */
 				char name[4096]; /* args[1] */
 				/* void *value args[2] */
 				size_t size = args[3]; /* args[3] */
 				int flags = args[4]; /* args[4] */
 
-				TRACER_MEM_OP(tracer_copy_in_string(p->tracer,name,POINTER(args[1]),sizeof(name),0));
+				TRACER_MEM_OP(copy_in_string_pair(p,path,POINTER(args[0]),sizeof(path),name,POINTER(args[1]),sizeof(name)));
 				value = malloc(size); /* freed at return */
 				if (value == NULL) {
 				  divert_to_dummy(p,-ENOMEM);
@@ -2475,13 +2513,12 @@ static void decode_syscall( struct pfs_process *p, int entering )
 
 		case SYSCALL64_lsetxattr:
 			if(entering) {
-				TRACER_MEM_OP(tracer_copy_in_string(p->tracer,path,POINTER(args[0]),sizeof(path),0)); /* args[0] */
 				char name[4096]; /* args[1] */
 				/* void *value args[2] */
 				size_t size = args[3]; /* args[3] */
 				int flags = args[4]; /* args[4] */
 
-				TRACER_MEM_OP(tracer_copy_in_string(p->tracer,name,POINTER(args[1]),sizeof(name),0));
+				TRACER_MEM_OP(copy_in_string_pair(p,path,POINTER(args[0]),sizeof(path),name,POINTER(args[1]),sizeof(name)));
 				value = malloc(size); /* freed at return */
 				if (value == NULL) {
 				  divert_to_dummy(p,-ENOMEM);
@@ -2498,10 +2535,9 @@ static void decode_syscall( struct pfs_process *p, int entering )
 
 		case SYSCALL64_removexattr:
 			if(entering) {
-				TRACER_MEM_OP(tracer_copy_in_string(p->tracer,path,POINTER(args[0]),sizeof(path),0)); /* args[0] */
 				char name[4096]; /* args[1] */
 
-				TRACER_MEM_OP(tracer_copy_in_string(p->tracer,name,POINTER(args[1]),sizeof(name),0));
+				TRACER_MEM_OP(copy_in_string_pair(p,path,POINTER(args[0]),sizeof(path),name,POINTER(args[1]),sizeof(name)));
 
 				p->syscall_result = pfs_removexattr(path,name);
 				if(p->syscall_result<0)
@@ -2512,10 +2548,9 @@ static void decode_syscall( struct pfs_process *p, int entering )
 
 		case SYSCALL64_lremovexattr:
 			if(entering) {
-				TRACER_MEM_OP(tracer_copy_in_string(p->tracer,path,POINTER(args[0]),sizeof(path),0)); /* args[0] */
 				char name[4096]; /* args[1] */
 
-				TRACER_MEM_OP(tracer_copy_in_string(p->tracer,name,POINTER(args[1]),sizeof(name),0));
+				TRACER_MEM_OP(copy_in_string_pair(p,path,POINTER(args[0]),sizeof(path),name,POINTER(args[1]),sizeof(name)));
 
 				p->syscall_result = pfs_lremovexattr(path,name);
 				if(p->syscall_result<0)
@@ -2634,10 +2669,8 @@ static void decode_syscall( struct pfs_process *p, int entering )
 			}
 			if(entering) {
 				struct timeval times[2];
-				TRACER_MEM_OP(tracer_copy_in_string(p->tracer,path,POINTER(args[1]),sizeof(path),0));
-				if(args[2]) {
-					TRACER_MEM_OP(tracer_copy_in(p->tracer,times,POINTER(args[2]),sizeof(times),TRACER_O_ATOMIC));
-				} else {
+				TRACER_MEM_OP(copy_in_path_and(p,path,POINTER(args[1]),sizeof(path),times,POINTER(args[2]),sizeof(times)));
+				if(!args[2]) {
 					gettimeofday(&times[0],0);
 					times[1] = times[0];
 				}
@@ -2699,8 +2732,7 @@ static void decode_syscall( struct pfs_process *p, int entering )
 				break;
 			}
 			if(entering) {
-				TRACER_MEM_OP(tracer_copy_in_string(p->tracer,path,POINTER(args[1]),sizeof(path),0));
-				TRACER_MEM_OP(tracer_copy_in_string(p->tracer,path2,POINTER(args[3]),sizeof(path2),0));
+				TRACER_MEM_OP(copy_in_string_pair(p,path,POINTER(args[1]),sizeof(path),path2,POINTER(args[3]),sizeof(path2)));
 				p->syscall_result = pfs_renameat(args[0],path,args[2],path2);
 				if(p->syscall_result<0) p->syscall_result = -errno;
 				divert_to_dummy(p,p->syscall_result);
@@ -2717,8 +2749,7 @@ static void decode_syscall( struct pfs_process *p, int entering )
 				break;
 			}
 			if(entering) {
-				TRACER_MEM_OP(tracer_copy_in_string(p->tracer,path,POINTER(args[1]),sizeof(path),0));
-				TRACER_MEM_OP(tracer_copy_in_string(p->tracer,path2,POINTER(args[3]),sizeof(path2),0));
+				TRACER_MEM_OP(copy_in_string_pair(p,path,POINTER(args[1]),sizeof(path),path2,POINTER(args[3]),sizeof(path2)));
 				p->syscall_result = pfs_linkat(args[0],path,args[2],path2,args[4]);
 				if(p->syscall_result<0) p->syscall_result = -errno;
 				divert_to_dummy(p,p->syscall_result);
@@ -2735,8 +2766,7 @@ static void decode_syscall( struct pfs_process *p, int entering )
 				break;
 			}
 			if(entering) {
-				TRACER_MEM_OP(tracer_copy_in_string(p->tracer,path,POINTER(args[0]),sizeof(path),0));
-				TRACER_MEM_OP(tracer_copy_in_string(p->tracer,path2,POINTER(args[2]),sizeof(path2),0));
+				TRACER_MEM_OP(copy_in_string_pair(p,path,POINTER(args[0]),sizeof(path),path2,POINTER(args[2]),sizeof(path2)));
 				p->syscall_result = pfs_symlinkat(path,args[1],path2);
 				if(p->syscall_result<0) p->syscall_result = -errno;
 				divert_to_dummy(p,p->syscall_result);
@@ -3261,6 +3291,7 @@ void pfs_dispatch64( struct pfs_process *p )
 {
 	struct pfs_process *oldcurrent = pfs_current;
 	pfs_current = p;
+	pfs_profile_begin(p);
 
 	switch(p->state) {
 		case PFS_PROCESS_STATE_KERNEL:
@@ -3269,14 +3300,22 @@ void pfs_dispatch64( struct pfs_process *p )
 		case PFS_PROCESS_STATE_USER:
 			p->nsyscalls += 1;
 			decode_syscall(p,1);
+			/* I/O on a native fd is left entirely to the kernel. With the
+			 * seccomp filter, the next stop is the next system call Parrot
+			 * must see, so skip the exit stop and consider it done now. */
+			if(p->syscall_passthrough && tracer_seccomp_enabled())
+				p->state = PFS_PROCESS_STATE_USER;
 			break;
 		default:
 			assert(0);
 	}
 
+	pfs_profile_end(p,1);
+
 	switch(p->state) {
 		case PFS_PROCESS_STATE_KERNEL:
 		case PFS_PROCESS_STATE_USER:
+			tracer_stop_at_exit(p->tracer,p->state==PFS_PROCESS_STATE_KERNEL);
 			tracer_continue(p->tracer,0);
 			break;
 		default:
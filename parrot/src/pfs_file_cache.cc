@@ -16,6 +16,8 @@ extern "C" {
 #include "file_cache.h"
 #include "full_io.h"
 #include "hash_table.h"
+#include "macros.h"
+#include "xxmalloc.h"
 }
 
 #include <unistd.h>
@@ -32,11 +34,17 @@ extern "C" {
 extern struct file_cache *pfs_file_cache;
 extern int pfs_session_cache;
 extern int pfs_main_timeout;
+extern int pfs_cache_block_size;
 
 static struct hash_table * not_found_table = 0;
 
 #define BUFFER_SIZE 65536
 
+/* Sequential reads of a sparse file fetch up to this many blocks ahead. */
+#define SPARSE_READAHEAD_MAX 16
+/* Missing blocks are requested from the service this many at a time. */
+#define SPARSE_FETCH_BLOCKS 8
+
 static pfs_ssize_t copy_fd_to_file( int fd, pfs_file *file )
 {
 	pfs_ssize_t ractual, wactual, offset = 0;
@@ -170,6 +178,115 @@ public:
 	}
 };
 
+/*
+A read-only file from a service that honors read offsets is cached one
+block at a time: a read fetches only the blocks it touches that are not
+already present, plus a read-ahead window that grows while the reads are
+sequential.  The remote file is opened on the first miss, so a file that
+is already (partially) cached by this or another session costs nothing.
+*/
+
+class pfs_file_sparse : public pfs_file
+{
+private:
+	struct file_cache_sparse *sparse;
+	pfs_file *rfile;
+	struct pfs_stat info;
+	char *buffer;
+	pfs_off_t next_offset;
+	int readahead;
+
+	int fetch( pfs_off_t offset, pfs_size_t length ) {
+		int block_size = file_cache_sparse_block_size(sparse);
+		INT64_T start, count;
+
+		if(offset==next_offset) {
+			readahead = readahead ? MIN(readahead*2,SPARSE_READAHEAD_MAX) : 1;
+			length += (pfs_size_t)readahead*block_size;
+		} else {
+			readahead = 0;
+		}
+		next_offset = offset+length;
+
+		while(file_cache_sparse_missing(sparse,offset,length,&start,&count)) {
+			if(!rfile) {
+				debug(D_CACHE,"opening %s for ranged reads",name.path);
+				rfile = name.service->open(&name,O_RDONLY,0);
+				if(!rfile) return -1;
+			}
+			if(!buffer) buffer = (char*) xxmalloc((pfs_size_t)SPARSE_FETCH_BLOCKS*block_size);
+
+			/* fill a few blocks at a time, so that an error keeps what has arrived */
+			while(count>0) {
+				pfs_size_t chunk = MIN(count,(pfs_size_t)SPARSE_FETCH_BLOCKS*block_size);
+				pfs_size_t done = 0;
+				while(done<chunk) {
+					pfs_ssize_t actual = rfile->read(buffer+done,chunk-done,start+done);
+					if(actual<0) return -1;
+					if(actual==0) {
+						errno = EIO;
+						return -1;
+					}
+					done += actual;
+				}
+				if(file_cache_sparse_fill(sparse,buffer,chunk,start)<0) return -1;
+				start += chunk;
+				count -= chunk;
+			}
+		}
+		return 0;
+	}
+
+public:
+	pfs_file_sparse( pfs_name *n, struct file_cache_sparse *s, struct pfs_stat *i ) : pfs_file(n) {
+		sparse = s;
+		rfile = 0;
+		info = *i;
+		buffer = 0;
+		next_offset = 0;
+		readahead = 0;
+	}
+
+	virtual int close() {
+		if(rfile) {
+			rfile->close();
+			delete rfile;
+			rfile = 0;
+		}
+		free(buffer);
+		buffer = 0;
+		return file_cache_sparse_close(sparse);
+	}
+
+	virtual pfs_ssize_t read( void *d, pfs_size_t length, pfs_off_t offset ) {
+		if(offset>=info.st_size) return 0;
+		length = MIN(length,info.st_size-offset);
+		if(fetch(offset,length)<0) return -1;
+		return file_cache_sparse_read(sparse,d,length,offset);
+	}
+
+	virtual int fstat( struct pfs_stat *buf ) {
+		*buf = info;
+		return 0;
+	}
+
+	virtual pfs_ssize_t get_size() {
+		return info.st_size;
+	}
+
+	/* Programs are executed from a local copy, so fetch the rest. */
+	virtual int get_local_name( char *n ) {
+		readahead = 0;
+		next_offset = -1;
+		if(fetch(0,info.st_size)<0) return -1;
+		return file_cache_contains(pfs_file_cache,name.path,n);
+	}
+
+	virtual int is_seekable() {
+		return 1;
+	}
+};
+
 pfs_file * pfs_cache_open( pfs_name *name, int flags, mode_t mode )
 {
 	struct pfs_stat buf;
@@ -214,6 +331,15 @@ pfs_file * pfs_cache_open( pfs_name *name, int flags, mode_t mode )
 		debug(D_DEBUG, "file cache lookup failed: %s", strerror(errno));
 	}
 
+	char version[PFS_LINE_MAX];
+	if(pfs_cache_block_size>0 && !pfs_session_cache && (flags&O_ACCMODE)==O_RDONLY && !(flags&O_TRUNC) && S_ISREG(buf.st_mode) && buf.st_size>0 && name->service->is_ranged() && name->service->get_version(name,&buf,version,sizeof(version))) {
+		struct file_cache_sparse *sparse = file_cache_sparse_open(pfs_file_cache,name->path,buf.st_size,buf.st_mtime,version,pfs_cache_block_size);
+		if(sparse) {
+			debug(D_CACHE,"sparse %s",name->path);
+			return new pfs_file_sparse(name,sparse,&buf);
+		}
+	}
+
 	debug(D_CACHE,"loading %s",name->path);
 
 	fd = file_cache_begin(pfs_file_cache,name->path,txn);
@@ -263,6 +389,9 @@ pfs_file * pfs_cache_open( pfs_name *name, int flags, mode_t mode )
 		delete rfile;
 		errno = save_errno;
 	} else if(ok_to_fail) {
+		/* A new or truncated file is only a scratch copy, stored back on close and never committed. */
+		file_cache_abort(pfs_file_cache,name->path,txn);
+		txn[0] = 0;
 		result = name->service->open(name,flags,mode);
 		if(result) {
 			result->close();
@@ -276,8 +405,10 @@ pfs_file * pfs_cache_open( pfs_name *name, int flags, mode_t mode )
 	if(result) {
 		return result;
 	} else {
+		int save_errno = errno;
 		close(fd);
-		file_cache_abort(pfs_file_cache,name->path,txn);
+		if(txn[0]) file_cache_abort(pfs_file_cache,name->path,txn);
+		errno = save_errno;
 		if(pfs_session_cache && errno==ENOENT) {
 			hash_table_insert(not_found_table,name->path,(void*)1);
 		}
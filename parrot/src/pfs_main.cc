@@ -8,9 +8,11 @@ See the file COPYING for details.
 #include "linux-version.h"
 #include "pfs_channel.h"
 #include "pfs_critical.h"
+#include "pfs_dircache.h"
 #include "pfs_dispatch.h"
 #include "pfs_paranoia.h"
 #include "pfs_process.h"
+#include "pfs_profile.h"
 #include "pfs_service.h"
 #include "pfs_table.h"
 #include "pfs_time.h"
@@ -94,10 +96,15 @@ int pfs_force_cache = 0;
 int pfs_force_sync = 0;
 int pfs_follow_symlinks = 1;
 int pfs_session_cache = 0;
+int pfs_cache_block_size = 1048576;
+INT64_T pfs_cache_size = 0;
+int pfs_http_streams = 4;
 int pfs_use_helper = 0;
 int pfs_checksum_files = 1;
 int pfs_write_rval = 0;
 int pfs_no_flock = 0;
+int pfs_use_seccomp = 0;
+int pfs_native_io = 0;
 int pfs_paranoid_mode = 0;
 const char *pfs_write_rval_file = "parrot.rval";
 int pfs_enable_small_file_optimizations = 1;
@@ -177,8 +184,16 @@ enum {
 	LONG_OPT_PID_WARP,
 	LONG_OPT_PID_FIXED,
 	LONG_OPT_STATS_FILE,
+	LONG_OPT_PROFILE,
 	LONG_OPT_DISABLE_SERVICE,
 	LONG_OPT_NO_FLOCK,
+	LONG_OPT_SECCOMP,
+	LONG_OPT_NATIVE_IO,
+	LONG_OPT_CHANNEL_HUGE_PAGES,
+	LONG_OPT_METADATA_TTL,
+	LONG_OPT_CACHE_BLOCK_SIZE,
+	LONG_OPT_CACHE_SIZE,
+	LONG_OPT_HTTP_STREAMS,
 	LONG_OPT_EXT_IMAGE,
 };
 
@@ -255,6 +270,7 @@ static void show_help( const char *cmd )
 	printf( " %-30s Display version number.\n", "-v,--version");
 	printf( " %-30s Test if Parrot is already running.\n", "   --is-running");
 	printf( " %-30s Save runtime statistics to a file.\n", "   --stats-file");
+	printf( " %-30s Save system call latencies to a file. (SIGUSR2 updates it)\n", "   --profile=<file>");
 	printf( " %-30s Show most commonly used options.\n", "-h,--help");
 	printf("\n");
 	printf("Virtualization options:\n");
@@ -280,6 +296,8 @@ static void show_help( const char *cmd )
 	printf("\n");
 	printf("Performance and consistency options:\n");
 	printf( " %-30s Set the I/O block size hint.              (PARROT_BLOCK_SIZE)\n", "-b,--block-size=<bytes>");
+	printf( " %-30s Cache ranged files in blocks of this size, 0 for whole files.\n", "--cache-block-size=<bytes>");
+	printf( " %-30s Evict old cached files beyond this size.  (PARROT_CACHE_SIZE)\n", "--cache-size=<bytes>");
 	printf( " %-30s Disable small file optimizations.\n", "-D,--no-optimize");
 	printf( " %-30s Enable file snapshot caching for all protocols.\n", "-F,--with-snapshots");
 	printf( " %-30s Disable following symlinks.\n", "-f,--no-follow-symlinks");
@@ -288,7 +306,12 @@ static void show_help( const char *cmd )
 	printf( " %-30s Force synchronous disk writes.            (PARROT_FORCE_SYNC)\n", "-Y,--sync-write");
 	printf( " %-30s Enable automatic decompression on .gz files.\n", "-Z,--auto-decompress");
 	printf( " %-30s Disable the given service.\n", "--disable-service");
+	printf( " %-30s Fetch large HTTP reads over this many connections.\n", "--http-streams=<n>");
 	printf( " %-30s Make flock a no-op.\n", "--no-flock");
+	printf( " %-30s Cache remote metadata for this long. (e.g. chirp=10, 0 disables)\n", "--metadata-ttl=[<service>=]<sec>");
+	printf( " %-30s Only stop on system calls Parrot must see. (PARROT_SECCOMP)\n", "--seccomp");
+	printf( " %-30s Let the kernel do I/O on local files. (PARROT_NATIVE_IO)\n", "--native-io");
+	printf( " %-30s Back the I/O channel with transparent huge pages.\n", "--channel-huge-pages");
 	printf("\n");
 	printf("Filesystem Options:\n");
 	printf( " %-30s Mount a read-only ext[234] disk image.\n", "--ext <image>=<mountpoint>");
@@ -398,6 +421,13 @@ static void handle_event( pid_t pid, int status, struct rusage *usage )
 	if (WIFSTOPPED(status) && WSTOPSIG(status) == (SIGTRAP|0x80)) {
 		/* The common case, a syscall delivery stop. */
 		pfs_dispatch(p);
+	} else if (status>>8 == (SIGTRAP | (PTRACE_EVENT_SECCOMP<<8))) {
+		/* In seccomp mode, the filter stops the tracee on entry to a system
+		 * call we must see. This stands in for the syscall-entry-stop, and
+		 * pfs_dispatch arranges to stop again at the exit.
+		 */
+		assert(p->state == PFS_PROCESS_STATE_USER);
+		pfs_dispatch(p);
 	} else if (status>>8 == (SIGTRAP | (PTRACE_EVENT_CLONE<<8)) || status>>8 == (SIGTRAP | (PTRACE_EVENT_FORK<<8)) || status>>8 == (SIGTRAP | (PTRACE_EVENT_VFORK<<8))) {
 		pid_t cpid;
 		struct pfs_process *child;
@@ -726,6 +756,12 @@ int main( int argc, char *argv[] )
 	s = getenv("PARROT_SESSION_CACHE");
 	if(s) pfs_session_cache = 1;
 
+	s = getenv("PARROT_CACHE_BLOCK_SIZE");
+	if(s) pfs_cache_block_size = string_metric_parse(s);
+
+	s = getenv("PARROT_CACHE_SIZE");
+	if(s) pfs_cache_size = string_metric_parse(s);
+
 	s = getenv("PARROT_HOST_NAME");
 	if(s) pfs_false_uname = xxstrdup(pfs_false_uname);
 
@@ -741,6 +777,12 @@ int main( int argc, char *argv[] )
 	s = getenv("PARROT_FORCE_SYNC");
 	if(s) pfs_force_sync = 1;
 
+	s = getenv("PARROT_SECCOMP");
+	if(s) pfs_use_seccomp = 1;
+
+	s = getenv("PARROT_NATIVE_IO");
+	if(s) pfs_native_io = 1;
+
 	s = getenv("PARROT_LDSO_PATH");
 	if(s) snprintf(pfs_ldso_path, sizeof(pfs_ldso_path), "%s", s);
 
@@ -846,14 +888,22 @@ int main( int argc, char *argv[] )
 		{"no-follow-symlinks", no_argument, 0, 'f'},
 		{"no-helper", no_argument, 0, 'H'},
 		{"no-optimize", no_argument, 0, 'D'},
+		{"cache-block-size", required_argument, 0, LONG_OPT_CACHE_BLOCK_SIZE},
+		{"cache-size", required_argument, 0, LONG_OPT_CACHE_SIZE},
+		{"http-streams", required_argument, 0, LONG_OPT_HTTP_STREAMS},
+		{"metadata-ttl", required_argument, 0, LONG_OPT_METADATA_TTL},
 		{"no-flock", no_argument, 0, LONG_OPT_NO_FLOCK},
 		{"no-set-foreground", no_argument, 0, LONG_OPT_NO_SET_FOREGROUND},
 		{"paranoid", no_argument, 0, 'P'},
 		{"parrot-path", required_argument, 0, LONG_OPT_PARROT_PATH},
 		{"pid-fixed", no_argument, 0, LONG_OPT_PID_FIXED},
 		{"pid-warp", no_argument, 0, LONG_OPT_PID_WARP},
+		{"profile", required_argument, 0, LONG_OPT_PROFILE},
 		{"proxy", required_argument, 0, 'p'},
 		{"root-checksum", required_argument, 0, 'R'},
+		{"seccomp", no_argument, 0, LONG_OPT_SECCOMP},
+		{"native-io", no_argument, 0, LONG_OPT_NATIVE_IO},
+		{"channel-huge-pages", no_argument, 0, LONG_OPT_CHANNEL_HUGE_PAGES},
 		{"session-caching", no_argument, 0, 'S'},
 		{"stats-file", required_argument, 0, LONG_OPT_STATS_FILE},
 		{"status-file", required_argument, 0, 'c'},
@@ -1122,6 +1172,9 @@ int main( int argc, char *argv[] )
 			free(stats_file);
 			stats_file = xxstrdup(optarg);
 			break;
+		case LONG_OPT_PROFILE:
+			pfs_profile_init(optarg);
+			break;
 		case LONG_OPT_DISABLE_SERVICE:
 			if (!hash_table_remove(available_services, optarg)) {
 				fprintf(stderr, "warning: unknown service %s\n", optarg);
@@ -1130,6 +1183,34 @@ int main( int argc, char *argv[] )
 		case LONG_OPT_NO_FLOCK:
 			pfs_no_flock = 1;
 			break;
+		case LONG_OPT_SECCOMP:
+			pfs_use_seccomp = 1;
+			break;
+		case LONG_OPT_NATIVE_IO:
+			pfs_native_io = 1;
+			break;
+		case LONG_OPT_CHANNEL_HUGE_PAGES:
+			pfs_channel_huge_pages = 1;
+			break;
+		case LONG_OPT_CACHE_BLOCK_SIZE:
+			pfs_cache_block_size = string_metric_parse(optarg);
+			break;
+		case LONG_OPT_CACHE_SIZE:
+			pfs_cache_size = string_metric_parse(optarg);
+			break;
+		case LONG_OPT_HTTP_STREAMS:
+			pfs_http_streams = atoi(optarg);
+			break;
+		case LONG_OPT_METADATA_TTL: {
+			char *split = strchr(optarg, '=');
+			if (split) {
+				*split = '\0';
+				pfs_dircache::set_ttl(optarg, string_time_parse(split+1));
+			} else {
+				pfs_dircache::set_ttl("*", string_time_parse(optarg));
+			}
+			break;
+		}
 		case LONG_OPT_EXT_IMAGE: {
 			char service[128];
 			char image[PATH_MAX] = {0};
@@ -1232,6 +1313,7 @@ int main( int argc, char *argv[] )
 
 	pfs_file_cache = file_cache_init(pfs_temp_dir);
 	if(!pfs_file_cache) fatal("couldn't setup cache in %s: %s\n",pfs_temp_dir,strerror(errno));
+	file_cache_set_capacity(pfs_file_cache,pfs_cache_size);
 	file_cache_cleanup(pfs_file_cache);
 
 	string_nformat(pfs_cvmfs_locks_dir, sizeof(pfs_cvmfs_locks_dir), "%s/cvmfs_locks_XXXXXX", pfs_temp_per_instance_dir);
@@ -1280,6 +1362,14 @@ int main( int argc, char *argv[] )
 		}
 	}
 
+	if (pfs_use_seccomp) {
+		if (valgrind) {
+			debug(D_NOTICE, "seccomp mode cannot be used with --valgrind, tracing all system calls");
+		} else if (tracer_seccomp_enable() == -1) {
+			debug(D_NOTICE, "seccomp mode requires Linux 4.8 or later, tracing all system calls");
+		}
+	}
+
 	/* XXX Notes on strange code ahead:
 	 *
 	 * Previously we had a really simple synchronization mechanism whereby the
@@ -1338,6 +1428,11 @@ int main( int argc, char *argv[] )
 			signal(SIGUSR1, set_attached_and_ready);
 			raise(SIGSTOP); /* synchronize with parent, above */
 			while (!attached_and_ready) ; /* spin waiting to be traced (NO SLEEPING/STOPPING) */
+			if (tracer_seccomp_enabled() && tracer_seccomp_install() == -1) {
+				fprintf(stderr, "unable to install seccomp filter: %s\n", strerror(errno));
+				fflush(stderr);
+				_exit(1);
+			}
 			execvp(argv[optind],&argv[optind]);
 		}
 		fprintf(stderr, "unable to execute %s: %s\n", argv[optind], strerror(errno));
@@ -1423,8 +1518,12 @@ int main( int argc, char *argv[] )
 				} while (wait_barrier && pfswait(&p, it->pid, 1));
 			}
 		}
+
+		pfs_profile_poll();
 	}
 
+	pfs_profile_dump();
+
 	for (std::vector<pfs_service *>::iterator it = service_instances.begin(); it != service_instances.end(); ++it) {
 		delete *it;
 	}
@@ -247,6 +247,7 @@ struct pfs_process * pfs_process_create( pid_t pid, struct pfs_process *parent,
 	child->syscall_parrotfd = -1;
 	child->syscall_result = 0;
 	child->syscall_args_changed = 0;
+	child->syscall_passthrough = 0;
 	/* to prevent accidental copy out */
 	child->did_stream_warning = 0;
 	child->nsyscalls = 0;
@@ -8,6 +8,7 @@ See the file COPYING for details.
 #ifndef PFS_PROCESS_H
 #define PFS_PROCESS_H
 
+#include "pfs_profile.h"
 #include "pfs_types.h"
 #include "pfs_table.h"
 #include "pfs_sysdeps.h"
@@ -75,6 +76,8 @@ struct pfs_process {
 	INT64_T syscall_result;
 	INT64_T syscall_args[TRACER_ARGS_MAX];
 	INT64_T syscall_args_changed;
+	INT64_T syscall_passthrough; /* nothing to do at exit, see pfs_dispatch */
+	struct pfs_profile_call profile;
 
 	char tmp[4096];
 };
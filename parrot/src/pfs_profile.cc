@@ -0,0 +1,269 @@
+/*
+Copyright (C) 2005- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "pfs_profile.h"
+#include "pfs_process.h"
+
+extern "C" {
+#include "debug.h"
+#include "hash_table.h"
+#include "histogram.h"
+#include "jx.h"
+#include "jx_pretty_print.h"
+#include "stringtools.h"
+#include "timestamp.h"
+#include "tracer.h"
+#include "xxmalloc.h"
+}
+
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct pfs_profile_record {
+	uint64_t count;
+	timestamp_t parrot;
+	timestamp_t kernel;
+	timestamp_t trap;
+	uint64_t bytes;
+	int is_io;
+	struct histogram *latency;
+};
+
+static char *profile_path = 0;
+static timestamp_t profile_started = 0;
+static volatile sig_atomic_t profile_requested = 0;
+
+static struct pfs_profile_record **records32 = 0;
+static struct pfs_profile_record **records64 = 0;
+static struct hash_table *services = 0;
+
+static const char *io_syscalls[] = {
+	"read", "pread", "pread64", "readv", "preadv", "preadv2",
+	"write", "pwrite", "pwrite64", "writev", "pwritev", "pwritev2",
+	"sendfile", "sendfile64", "copy_file_range", "splice",
+	0
+};
+
+static struct pfs_profile_record *record_create( const char *syscall_name )
+{
+	struct pfs_profile_record *r = (struct pfs_profile_record *) xxcalloc(1, sizeof(*r));
+	r->latency = histogram_create(1.0);
+	if(syscall_name) {
+		for(int i = 0; io_syscalls[i]; i++) {
+			if(!strcmp(syscall_name, io_syscalls[i])) {
+				r->is_io = 1;
+				break;
+			}
+		}
+	}
+	return r;
+}
+
+static void record_add( struct pfs_profile_record *r, struct pfs_profile_call *c, INT64_T bytes )
+{
+	timestamp_t total = c->parrot + c->kernel;
+
+	r->count++;
+	r->parrot += c->parrot;
+	if(c->dummy) {
+		r->trap += c->kernel;
+	} else {
+		r->kernel += c->kernel;
+	}
+	if(bytes > 0) r->bytes += bytes;
+
+	/* Buckets are powers of two: a call of n microseconds lands in the
+	 * bucket labelled with the smallest power of two not below n. */
+	histogram_insert(r->latency, log2(total > 1 ? (double) total : 1.0));
+}
+
+static struct jx *record_to_jx( struct pfs_profile_record *r )
+{
+	struct jx *j = jx_object(0);
+	struct jx *latency = jx_object(0);
+
+	jx_insert_integer(j, "count", r->count);
+	jx_insert_integer(j, "parrot_time", r->parrot);
+	jx_insert_integer(j, "kernel_time", r->kernel);
+	jx_insert_integer(j, "trap_time", r->trap);
+	if(r->is_io || r->bytes) jx_insert_integer(j, "bytes", r->bytes);
+
+	double *buckets = histogram_buckets(r->latency);
+	for(int i = 0; i < histogram_size(r->latency); i++) {
+		char key[32];
+		string_nformat(key, sizeof(key), "%.0f", exp2(buckets[i]));
+		jx_insert_integer(latency, key, histogram_count(r->latency, buckets[i]));
+	}
+	free(buckets);
+	jx_insert(j, jx_string("latency"), latency);
+
+	return j;
+}
+
+static struct jx *syscalls_to_jx( struct pfs_profile_record **records, int max, const char *(*name)(int), struct pfs_profile_record *total )
+{
+	struct jx *j = jx_object(0);
+
+	for(int i = 0; i < max; i++) {
+		struct pfs_profile_record *r = records[i];
+		if(!r) continue;
+		jx_insert(j, jx_string(name(i)), record_to_jx(r));
+		total->count += r->count;
+		total->parrot += r->parrot;
+		total->kernel += r->kernel;
+		total->trap += r->trap;
+		total->bytes += r->bytes;
+	}
+
+	return j;
+}
+
+static void request_dump( int sig )
+{
+	profile_requested = 1;
+}
+
+void pfs_profile_init( const char *path )
+{
+	struct sigaction s;
+
+	profile_path = xxstrdup(path);
+	profile_started = timestamp_get();
+	records32 = (struct pfs_profile_record **) xxcalloc(SYSCALL32_MAX, sizeof(*records32));
+#ifdef CCTOOLS_CPU_X86_64
+	records64 = (struct pfs_profile_record **) xxcalloc(SYSCALL64_MAX, sizeof(*records64));
+#endif
+	services = hash_table_create(0, 0);
+
+	/* Restart the wait in the main loop rather than have it end early. */
+	s.sa_handler = request_dump;
+	sigfillset(&s.sa_mask);
+	s.sa_flags = SA_RESTART;
+	sigaction(SIGUSR2, &s, 0);
+}
+
+void pfs_profile_begin( struct pfs_process *p )
+{
+	if(!profile_path) return;
+
+	struct pfs_profile_call *c = &p->profile;
+	c->start = timestamp_get();
+	if(p->state == PFS_PROCESS_STATE_USER) {
+		c->resumed = 0;
+		c->parrot = 0;
+		c->kernel = 0;
+		c->dummy = 0;
+		c->service = 0;
+	} else {
+		c->kernel = c->resumed ? c->start - c->resumed : 0;
+		c->dummy = p->syscall_dummy != 0;
+	}
+}
+
+void pfs_profile_end( struct pfs_process *p, int is64 )
+{
+	if(!profile_path) return;
+
+	struct pfs_profile_call *c = &p->profile;
+	timestamp_t now = timestamp_get();
+	c->parrot += now - c->start;
+
+	if(p->state == PFS_PROCESS_STATE_KERNEL) {
+		c->resumed = now;
+		return;
+	}
+
+	struct pfs_profile_record **records = is64 ? records64 : records32;
+	int max = is64 ? SYSCALL64_MAX : SYSCALL32_MAX;
+	if(!records || p->syscall < 0 || p->syscall >= max) return;
+
+	struct pfs_profile_record *r = records[p->syscall];
+	if(!r) {
+		r = records[p->syscall] = record_create(is64 ? tracer_syscall64_name(p->syscall) : tracer_syscall32_name(p->syscall));
+	}
+
+	/* Without an exit stop the result of the call is not known. */
+	INT64_T bytes = (r->is_io && c->resumed) ? p->syscall_result : 0;
+	record_add(r, c, bytes);
+	if(c->service) record_add(c->service, c, bytes);
+}
+
+void pfs_profile_service( const char *name )
+{
+	if(!profile_path || !pfs_current) return;
+
+	struct pfs_profile_call *c = &pfs_current->profile;
+	if(c->service) return;
+
+	c->service = (struct pfs_profile_record *) hash_table_lookup(services, name);
+	if(!c->service) {
+		c->service = record_create(0);
+		hash_table_insert(services, name, c->service);
+	}
+}
+
+void pfs_profile_dump()
+{
+	if(!profile_path) return;
+
+	struct pfs_profile_record total;
+	memset(&total, 0, sizeof(total));
+
+	struct jx *j = jx_object(0);
+	jx_insert(j, jx_string("syscall32"), syscalls_to_jx(records32, SYSCALL32_MAX, tracer_syscall32_name, &total));
+#ifdef CCTOOLS_CPU_X86_64
+	jx_insert(j, jx_string("syscall64"), syscalls_to_jx(records64, SYSCALL64_MAX, tracer_syscall64_name, &total));
+#endif
+
+	struct jx *s = jx_object(0);
+	char *name;
+	void *value;
+	hash_table_firstkey(services);
+	while(hash_table_nextkey(services, &name, &value)) {
+		jx_insert(s, jx_string(name), record_to_jx((struct pfs_profile_record *) value));
+	}
+	jx_insert(j, jx_string("service"), s);
+
+	jx_insert_integer(j, "elapsed", timestamp_get() - profile_started);
+	jx_insert_integer(j, "count", total.count);
+	jx_insert_integer(j, "parrot_time", total.parrot);
+	jx_insert_integer(j, "kernel_time", total.kernel);
+	jx_insert_integer(j, "trap_time", total.trap);
+	jx_insert_integer(j, "bytes", total.bytes);
+
+	/* Replace the report atomically so it can be read while Parrot runs. */
+	char *tmp = string_format("%s.tmp", profile_path);
+	FILE *file = fopen(tmp, "w");
+	if(file) {
+		jx_pretty_print_stream(j, file);
+		fprintf(file, "\n");
+		if(fclose(file) == 0 && rename(tmp, profile_path) == 0) {
+			debug(D_PROCESS, "wrote profile to %s", profile_path);
+		} else {
+			debug(D_NOTICE, "couldn't write profile %s: %s", profile_path, strerror(errno));
+			unlink(tmp);
+		}
+	} else {
+		debug(D_NOTICE, "couldn't write profile %s: %s", tmp, strerror(errno));
+	}
+	free(tmp);
+	jx_delete(j);
+}
+
+void pfs_profile_poll()
+{
+	if(profile_requested) {
+		profile_requested = 0;
+		pfs_profile_dump();
+	}
+}
+
+/* vim: set noexpandtab tabstop=4: */
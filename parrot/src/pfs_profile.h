@@ -0,0 +1,58 @@
+/*
+Copyright (C) 2005- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef PFS_PROFILE_H
+#define PFS_PROFILE_H
+
+extern "C" {
+#include "timestamp.h"
+}
+
+/*
+The profiler records, for every system call Parrot traps, how long the call
+spent in Parrot itself (decoding, emulation and the services it called) and
+how long it spent in the kernel between the entry and exit stops.  For calls
+Parrot answered itself, the kernel only ran a dummy call, so that time is the
+round trip of the trap and is reported separately as trap time.
+
+Totals and log2 latency histograms are kept per system call and per service
+(the service of the path or file descriptor the call used), along with the
+bytes moved by the read and write family.  I/O that Parrot lets the kernel do
+on native descriptors is counted under the system call only.
+
+The report is written as JSON to the file given to parrot_run --profile when
+Parrot exits, and again whenever Parrot receives SIGUSR2.
+*/
+
+struct pfs_process;
+struct pfs_profile_record;
+
+/* Per-process state of the system call in progress. */
+struct pfs_profile_call {
+	timestamp_t start;
+	timestamp_t resumed;
+	timestamp_t parrot;
+	timestamp_t kernel;
+	int dummy;
+	struct pfs_profile_record *service;
+};
+
+void pfs_profile_init( const char *path );
+
+/* Called around each stop handled by pfs_dispatch. */
+void pfs_profile_begin( struct pfs_process *p );
+void pfs_profile_end( struct pfs_process *p, int is64 );
+
+/* Attribute the current system call to the named service. */
+void pfs_profile_service( const char *name );
+
+/* Write the report now, or if SIGUSR2 asked for one. */
+void pfs_profile_dump();
+void pfs_profile_poll();
+
+#endif
+
+/* vim: set noexpandtab tabstop=4: */
@@ -31,13 +31,63 @@ struct pfs_mount_entry *pfs_process_current_ns(void);
 /*
 Some things that could be cleaned up in this code:
 - Use list.h instead of an embedded linked list.
-- The resolver cache was used to cache the (expensive) lookups of the external resolver, which is basically unused.  Not clear if the cache actually helps for internal lookups, which simply traverse a (usually short) linked list.  Try removing the resolver cache and see how that impacts real applications.
 */
 
 extern char pfs_temp_dir[PFS_PATH_MAX];
 
 static struct pfs_mount_entry *mount_list = 0;
-static struct hash_table *resolve_cache = 0;
+
+/*
+A namespace is a list of mount entries, where the first match wins, so
+large mountlists (such as those of parrot_package_run) are indexed by a
+trie of path components.  Each trie node records the earliest entry whose
+prefix ends there, both for the plain prefix and the prefix with a
+trailing slash.  Entries with wildcards cannot be placed in the trie and
+are checked in order, but only those before the best trie match.
+
+The trie of a namespace is built on first use and kept in its head entry.
+It records the generation of the head and of each parent namespace it
+passed through, and is rebuilt when any of them change.  resolve_epoch
+invalidates every trie, for the rare change to a list shared by several
+namespaces.
+*/
+
+#define TRIE_INDEX_MIN 16
+
+struct pfs_resolve_node {
+	char *name;
+	struct pfs_mount_entry *entry;
+	int position;
+	struct pfs_mount_entry *dir_entry;
+	int dir_position;
+	int nchildren;
+	struct pfs_resolve_node *children;
+	struct pfs_resolve_node *sibling;
+	struct hash_table *index;
+};
+
+struct pfs_resolve_dep {
+	struct pfs_mount_entry *ns;
+	unsigned generation;
+};
+
+struct pfs_resolve_pattern {
+	struct pfs_mount_entry *entry;
+	int position;
+};
+
+struct pfs_resolve_trie {
+	struct pfs_resolve_node root;
+	struct pfs_resolve_pattern *patterns;
+	int npatterns;
+	struct pfs_resolve_dep *deps;
+	int ndeps;
+	unsigned epoch;
+	/* results of external resolvers, which are too slow to run on every call */
+	struct hash_table *resolved;
+};
+
+static unsigned resolve_epoch = 0;
 
 static pfs_resolve_t pfs_resolve_ns( struct pfs_mount_entry *ns, const char *logical_name, char *physical_name, mode_t mode, time_t stoptime );
 
@@ -47,17 +97,209 @@ void pfs_resolve_init(void) {
 	mount_list->refcount = 1;
 }
 
-static void pfs_resolve_cache_flush()
+static void trie_node_free(struct pfs_resolve_node *n)
 {
-	char *key, *value;
+	struct pfs_resolve_node *c, *next;
 
-	if(!resolve_cache) return;
+	for (c = n->children; c; c = next) {
+		next = c->sibling;
+		trie_node_free(c);
+		free(c);
+	}
+	if (n->index) hash_table_delete(n->index);
+	free(n->name);
+}
 
-	hash_table_firstkey(resolve_cache);
-	while(hash_table_nextkey(resolve_cache,&key,(void**)&value)) {
-		hash_table_remove(resolve_cache,key);
-		free(value);
+static void trie_delete(struct pfs_resolve_trie *t)
+{
+	char *key;
+	void *value;
+
+	if (!t) return;
+
+	trie_node_free(&t->root);
+	free(t->patterns);
+	free(t->deps);
+	if (t->resolved) {
+		hash_table_firstkey(t->resolved);
+		while (hash_table_nextkey(t->resolved, &key, &value))
+			free(value);
+		hash_table_delete(t->resolved);
 	}
+	free(t);
+}
+
+/* Record that the namespace headed by ns has changed. */
+static void ns_changed(struct pfs_mount_entry *ns, unsigned generation, struct pfs_resolve_trie *trie)
+{
+	trie_delete(trie);
+	ns->trie = 0;
+	ns->generation = generation + 1;
+}
+
+static struct pfs_resolve_node *trie_child(struct pfs_resolve_node *n, const char *name, size_t len)
+{
+	struct pfs_resolve_node *c;
+
+	if (n->index) {
+		char key[PFS_PATH_MAX];
+		memcpy(key, name, len);
+		key[len] = 0;
+		return (struct pfs_resolve_node *) hash_table_lookup(n->index, key);
+	}
+
+	for (c = n->children; c; c = c->sibling) {
+		if (!strncmp(c->name, name, len) && !c->name[len])
+			return c;
+	}
+	return 0;
+}
+
+static struct pfs_resolve_node *trie_add_child(struct pfs_resolve_node *n, const char *name, size_t len)
+{
+	struct pfs_resolve_node *c = (struct pfs_resolve_node *) xxcalloc(1, sizeof(*c));
+
+	c->name = (char *) xxmalloc(len + 1);
+	memcpy(c->name, name, len);
+	c->name[len] = 0;
+	c->sibling = n->children;
+	n->children = c;
+	n->nchildren++;
+
+	if (n->index) {
+		hash_table_insert(n->index, c->name, c);
+	} else if (n->nchildren >= TRIE_INDEX_MIN) {
+		struct pfs_resolve_node *i;
+		n->index = hash_table_create(0, 0);
+		for (i = n->children; i; i = i->sibling)
+			hash_table_insert(n->index, i->name, i);
+	}
+
+	return c;
+}
+
+static void trie_insert(struct pfs_resolve_trie *t, struct pfs_mount_entry *e, int position)
+{
+	char prefix[PFS_PATH_MAX];
+	struct pfs_resolve_node *n = &t->root;
+	const char *s, *slash;
+	int dir = 0;
+	size_t len;
+
+	strcpy(prefix, e->prefix);
+	len = strlen(prefix);
+	if (len > 0 && prefix[len-1] == '/') {
+		prefix[len-1] = 0;
+		dir = 1;
+	}
+
+	for (s = prefix;; s = slash + 1) {
+		struct pfs_resolve_node *c;
+		slash = strchr(s, '/');
+		len = slash ? (size_t) (slash - s) : strlen(s);
+		c = trie_child(n, s, len);
+		n = c ? c : trie_add_child(n, s, len);
+		if (!slash) break;
+	}
+
+	/* an earlier entry for the same prefix shadows this one */
+	if (dir) {
+		if (!n->dir_entry) {
+			n->dir_entry = e;
+			n->dir_position = position;
+		}
+	} else if (!n->entry) {
+		n->entry = e;
+		n->position = position;
+	}
+}
+
+static void trie_add_dep(struct pfs_resolve_trie *t, struct pfs_mount_entry *ns)
+{
+	t->deps = (struct pfs_resolve_dep *) xxrealloc(t->deps, (t->ndeps + 1) * sizeof(*t->deps));
+	t->deps[t->ndeps].ns = ns;
+	t->deps[t->ndeps].generation = ns->generation;
+	t->ndeps++;
+}
+
+static struct pfs_resolve_trie *trie_build(struct pfs_mount_entry *head)
+{
+	struct pfs_resolve_trie *t = (struct pfs_resolve_trie *) xxcalloc(1, sizeof(*t));
+	struct pfs_mount_entry *ns;
+	int position = 0;
+
+	t->epoch = resolve_epoch;
+	t->resolved = hash_table_create(0, 0);
+	trie_add_dep(t, head);
+
+	for (ns = head; ns; ns = ns->next) {
+		while (ns->parent) {
+			ns = ns->parent;
+			trie_add_dep(t, ns);
+		}
+		if (*ns->prefix == '\x00' || *ns->redirect == '\x00') {
+			break;
+		}
+		if (strpbrk(ns->prefix, "*?[\\")) {
+			t->patterns = (struct pfs_resolve_pattern *) xxrealloc(t->patterns, (t->npatterns + 1) * sizeof(*t->patterns));
+			t->patterns[t->npatterns].entry = ns;
+			t->patterns[t->npatterns].position = position;
+			t->npatterns++;
+		} else {
+			trie_insert(t, ns, position);
+		}
+		position++;
+	}
+
+	debug(D_RESOLVE, "indexed %d mount entries (%d patterns)", position, t->npatterns);
+	return t;
+}
+
+static int trie_valid(struct pfs_resolve_trie *t)
+{
+	int i;
+
+	if (t->epoch != resolve_epoch) return 0;
+	for (i = 0; i < t->ndeps; i++) {
+		if (t->deps[i].ns->generation != t->deps[i].generation) return 0;
+	}
+	return 1;
+}
+
+static int mount_entry_matches( const char *logical_name, const char *prefix );
+
+/* Find the first entry in the namespace matching logical_name. */
+static struct pfs_mount_entry *trie_lookup(struct pfs_resolve_trie *t, const char *logical_name)
+{
+	struct pfs_resolve_node *n = &t->root;
+	struct pfs_mount_entry *best = 0;
+	int best_position = INT_MAX;
+	const char *s, *slash;
+	int i;
+
+	for (s = logical_name;; s = slash + 1) {
+		size_t len;
+		slash = strchr(s, '/');
+		len = slash ? (size_t) (slash - s) : strlen(s);
+		n = trie_child(n, s, len);
+		if (!n) break;
+		if (n->entry && n->position < best_position) {
+			best = n->entry;
+			best_position = n->position;
+		}
+		if (slash && n->dir_entry && n->dir_position < best_position) {
+			best = n->dir_entry;
+			best_position = n->dir_position;
+		}
+		if (!slash) break;
+	}
+
+	for (i = 0; i < t->npatterns && t->patterns[i].position < best_position; i++) {
+		if (mount_entry_matches(logical_name, t->patterns[i].entry->prefix))
+			return t->patterns[i].entry;
+	}
+
+	return best;
 }
 
 static struct pfs_mount_entry *find_parent_ns(struct pfs_mount_entry *ns) {
@@ -92,6 +334,8 @@ void pfs_resolve_add_entry( const char *prefix, const char *redirect, mode_t mod
 	}
 
 	struct pfs_mount_entry *m = (struct pfs_mount_entry *) xxmalloc(sizeof(*m));
+	struct pfs_resolve_trie *trie = ns->trie;
+	unsigned generation = ns->generation;
 	memcpy(m, ns, sizeof(*m));
 	memset(ns, 0, sizeof(*ns));
 	strcpy(ns->prefix, prefix);
@@ -100,7 +344,9 @@ void pfs_resolve_add_entry( const char *prefix, const char *redirect, mode_t mod
 	ns->next = m;
 	ns->refcount = m->refcount;
 	m->refcount = 1;
-	pfs_resolve_cache_flush();
+	m->trie = 0;
+	m->generation = 0;
+	ns_changed(ns, generation, trie);
 }
 
 int pfs_resolve_remove_entry( const char *prefix )
@@ -110,10 +356,13 @@ int pfs_resolve_remove_entry( const char *prefix )
 	if (!ns) ns = mount_list;
 	assert(ns);
 	assert(!(ns->next && ns->parent));
+	struct pfs_mount_entry *head = ns;
 
 	while (ns) {
 		if(!strcmp(ns->prefix,prefix)) {
 			unsigned refcount = ns->refcount;
+			struct pfs_resolve_trie *trie = ns->trie;
+			unsigned generation = ns->generation;
 			struct pfs_mount_entry *e = NULL;
 			if (ns->next) {
 				e = ns->next;
@@ -124,13 +373,16 @@ int pfs_resolve_remove_entry( const char *prefix )
 			}
 
 			assert(!(e->next && e->parent));
+			/* lists shared with other namespaces don't know who depends on them */
+			if (e->refcount > 1 || (ns != head && ns->refcount > 1)) resolve_epoch++;
 			memcpy(ns, e, sizeof(*ns));
 			ns->refcount = refcount;
 			pfs_resolve_share_ns(e->next);
 			pfs_resolve_share_ns(e->parent);
 			pfs_resolve_drop_ns(e);
 
-			pfs_resolve_cache_flush();
+			ns_changed(ns, generation, trie);
+			if (ns != head) ns_changed(head, head->generation, head->trie);
 			return 1;
 		}
 		ns = ns->next;
@@ -182,6 +434,31 @@ static pfs_resolve_t pfs_resolve_external( const char *logical_name, const char
 	}
 }
 
+/*
+Does a logical name fall under a mountlist entry,
+either by matching its pattern or by having it as a prefix?
+*/
+
+static int mount_entry_matches( const char *logical_name, const char *prefix )
+{
+	int plen = strlen(prefix);
+	int llen = strlen(logical_name);
+
+	return
+		/* match patterns to logical name */
+		!fnmatch(prefix,logical_name,0)
+		||
+		/* or match prefix exactly to logical name */
+		(
+			!strncmp(prefix,logical_name,plen) &&
+			(
+				prefix[plen-1]=='/' ||
+				logical_name[plen]=='/' ||
+				plen==llen
+			)
+		);
+}
+
 /*
 Compare a logical name to a mountlist entry and
 determine what to do with it.
@@ -202,20 +479,7 @@ static pfs_resolve_t mount_entry_check( const char *logical_name, const char *pr
 	int plen = strlen(prefix);
 	int llen = strlen(logical_name);
 
-	if(
-		/* match patterns to logical name */
-		!fnmatch(prefix,logical_name,0)
-		||
-		/* or match prefix exactly to logical name */
-		(
-			!strncmp(prefix,logical_name,plen) &&
-			(
-				prefix[plen-1]=='/' ||
-				logical_name[plen]=='/' ||
-				plen==llen
-			)
-		)
-	) {
+	if(mount_entry_matches(logical_name,prefix)) {
 		if(!strcmp(redirect,"DENY")) {
 			result = PFS_RESOLVE_DENIED;
 		} else if(!strcmp(redirect,"ENOENT")) {
@@ -321,38 +585,30 @@ static pfs_resolve_t pfs_resolve_ns( struct pfs_mount_entry *ns, const char *log
 	assert(physical_name);
 	assert(physical_name);
 	pfs_resolve_t result = PFS_RESOLVE_UNCHANGED;
+	struct pfs_mount_entry *e;
 	const char *t;
-	char lookup_key[PFS_PATH_MAX + 3 * sizeof(int) + 1];
 
-	sprintf(lookup_key, "%o|%p|%s", mode, ns, logical_name);
-
-	if(!resolve_cache) resolve_cache = hash_table_create(0,0);
+	if(ns->trie && !trie_valid(ns->trie)) {
+		trie_delete(ns->trie);
+		ns->trie = 0;
+	}
+	if(!ns->trie) ns->trie = trie_build(ns);
 
-	t = (const char *) hash_table_lookup(resolve_cache,lookup_key);
-	if(t) {
-		strcpy(physical_name,t);
-		result = PFS_RESOLVE_CHANGED;
-	} else {
-		while (ns) {
-			assert(!(ns->next && ns->parent));
-			assert(ns->refcount > 0);
-			if (ns->parent) {
-				ns = ns->parent;
-				continue;
-			}
-			if (*ns->prefix == '\x00' || *ns->redirect == '\x00') {
-				// we hit the end of the mountlist
-				break;
-			}
-			result = mount_entry_check(logical_name,ns->prefix,ns->redirect,physical_name);
-			if(result!=PFS_RESOLVE_UNCHANGED) {
-				if ((mode & ns->mode) != mode) {
-					result = PFS_RESOLVE_DENIED;
-					debug(D_RESOLVE,"%s denied, requesting mode %o on mount entry with %o",logical_name,mode,ns->mode);
-				}
-				break;
+	e = trie_lookup(ns->trie,logical_name);
+	if(e) {
+		int external = !strncmp(e->redirect,"resolver:",9);
+		if(external && (t = (const char *) hash_table_lookup(ns->trie->resolved,logical_name))) {
+			strcpy(physical_name,t);
+			result = PFS_RESOLVE_CHANGED;
+		} else {
+			result = mount_entry_check(logical_name,e->prefix,e->redirect,physical_name);
+			if(external && result==PFS_RESOLVE_CHANGED) {
+				hash_table_insert(ns->trie->resolved,logical_name,xxstrdup(physical_name));
 			}
-			ns = ns->next;
+		}
+		if(result!=PFS_RESOLVE_UNCHANGED && (mode & e->mode) != mode) {
+			result = PFS_RESOLVE_DENIED;
+			debug(D_RESOLVE,"%s denied, requesting mode %o on mount entry with %o",logical_name,mode,e->mode);
 		}
 	}
 
@@ -377,9 +633,6 @@ static pfs_resolve_t pfs_resolve_ns( struct pfs_mount_entry *ns, const char *log
 
 	if(result==PFS_RESOLVE_UNCHANGED || result==PFS_RESOLVE_CHANGED) {
 		debug(D_RESOLVE,"%s = %s,%o",logical_name,physical_name,mode);
-		if(!hash_table_lookup(resolve_cache,lookup_key)) {
-			hash_table_insert(resolve_cache,lookup_key,xxstrdup(physical_name));
-		}
 	}
 
 	return result;
@@ -416,6 +669,7 @@ void pfs_resolve_drop_ns(struct pfs_mount_entry *ns) {
 	if (ns->refcount == 0) {
 		pfs_resolve_drop_ns(ns->next);
 		pfs_resolve_drop_ns(ns->parent);
+		trie_delete(ns->trie);
 		free(ns);
 	}
 }
@@ -426,11 +680,16 @@ void pfs_resolve_seal_ns(void) {
 	assert(ns);
 
 	struct pfs_mount_entry *m = (struct pfs_mount_entry *) xxmalloc(sizeof(*m));
+	struct pfs_resolve_trie *trie = ns->trie;
+	unsigned generation = ns->generation;
 	memcpy(m, ns, sizeof(*m));
 	memset(ns, 0, sizeof(*ns));
 	ns->parent = m;
 	ns->refcount = m->refcount;
 	m->refcount = 1;
+	m->trie = 0;
+	m->generation = 0;
+	ns_changed(ns, generation, trie);
 }
 
 /* vim: set noexpandtab tabstop=4: */
@@ -27,6 +27,9 @@ struct pfs_mount_entry {
 	mode_t mode;
 	struct pfs_mount_entry *next;
 	struct pfs_mount_entry *parent;
+	/* Lookup structure for the namespace headed by this entry, valid while the generations it recorded are unchanged. */
+	unsigned generation;
+	struct pfs_resolve_trie *trie;
 };
 
 void pfs_resolve_init(void);
@@ -0,0 +1,114 @@
+/*
+Copyright (C) 2005- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+/*
+Measures the throughput of pfs_resolve against a mountlist the size of
+those written by parrot_package_create, without tracing any process.
+*/
+
+#include "pfs_resolve.h"
+
+#include "timestamp.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+char pfs_temp_dir[PFS_PATH_MAX] = "/tmp/parrot.bench";
+
+struct pfs_mount_entry *pfs_process_current_ns(void)
+{
+	return 0;
+}
+
+static void show_help(const char *cmd)
+{
+	printf("Use: %s [-n entries] [-r resolutions]\n", cmd);
+}
+
+int main(int argc, char *argv[])
+{
+	int entries = 5000;
+	int resolutions = 1000000;
+	char logical[PFS_PATH_MAX];
+	char physical[PFS_PATH_MAX];
+	char expected[PFS_PATH_MAX];
+	timestamp_t start, elapsed;
+	int c, i;
+
+	while ((c = getopt(argc, argv, "n:r:h")) != -1) {
+		switch (c) {
+		case 'n':
+			entries = atoi(optarg);
+			break;
+		case 'r':
+			resolutions = atoi(optarg);
+			break;
+		default:
+			show_help(argv[0]);
+			return c == 'h' ? 0 : 1;
+		}
+	}
+
+	if (entries < 1 || resolutions < 1) {
+		show_help(argv[0]);
+		return 1;
+	}
+
+	pfs_resolve_init();
+
+	/* Entries added later take precedence, so the patterns are checked last. */
+	pfs_resolve_add_entry("/proc/*/mem", "DENY", R_OK|W_OK|X_OK);
+	pfs_resolve_add_entry("/dev/", "LOCAL", R_OK|W_OK|X_OK);
+	for (i = 0; i < entries; i++) {
+		char prefix[PFS_PATH_MAX];
+		char redirect[PFS_PATH_MAX];
+		sprintf(prefix, "/usr/lib/pkg%d/share/%d", i % 97, i);
+		sprintf(redirect, "/tmp/package/usr/lib/pkg%d/share/%d", i % 97, i);
+		pfs_resolve_add_entry(prefix, redirect, R_OK|W_OK|X_OK);
+	}
+
+	start = timestamp_get();
+	pfs_resolve("/", physical, R_OK, 0);
+	elapsed = timestamp_get() - start;
+	printf("indexed %d entries in %.3f ms\n", entries + 2, elapsed / 1000.0);
+
+	start = timestamp_get();
+	for (i = 0; i < resolutions; i++) {
+		int n = (int) (((long long) i * 7919) % entries);
+		pfs_resolve_t result;
+
+		switch (i % 4) {
+		case 0:
+		case 1:
+			sprintf(logical, "/usr/lib/pkg%d/share/%d/lib/libfoo.so.%d", n % 97, n, i % 10);
+			sprintf(expected, "/tmp/package/usr/lib/pkg%d/share/%d/lib/libfoo.so.%d", n % 97, n, i % 10);
+			break;
+		case 2:
+			sprintf(logical, "/home/user/data/input.%d", i % 1000);
+			strcpy(expected, logical);
+			break;
+		default:
+			sprintf(logical, "/proc/%d/mem", n);
+			expected[0] = 0;
+			break;
+		}
+
+		result = pfs_resolve(logical, physical, R_OK, 0);
+		if (expected[0] ? strcmp(physical, expected) != 0 : result != PFS_RESOLVE_DENIED) {
+			fprintf(stderr, "%s resolved to %s (%d)\n", logical, physical, result);
+			return 1;
+		}
+	}
+	elapsed = timestamp_get() - start;
+
+	printf("%d resolutions in %.3f s: %.0f resolutions/s\n", resolutions, elapsed / 1000000.0, resolutions / (elapsed / 1000000.0));
+
+	return 0;
+}
+
+/* vim: set noexpandtab tabstop=4: */
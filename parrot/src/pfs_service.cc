@@ -51,6 +51,22 @@ int pfs_service::is_local()
 	return 0;
 }
 
+/* Whether files opened by this service honor the offset given to read. */
+int pfs_service::is_ranged()
+{
+	return is_seekable();
+}
+
+/*
+A string which changes whenever the contents of the file do, so that parts of
+it may be cached across sessions.  Emulated mtimes are not, so by default
+there is none.
+*/
+int pfs_service::get_version( pfs_name *name, const struct pfs_stat *buf, char *version, int length )
+{
+	return 0;
+}
+
 pfs_file * pfs_service::open( pfs_name *name, int flags, mode_t mode )
 {
 	errno = ENOENT;
@@ -25,6 +25,8 @@ public:
 	virtual int tilde_is_special();
 	virtual int is_seekable() = 0;
 	virtual int is_local();
+	virtual int is_ranged();
+	virtual int get_version( pfs_name *name, const struct pfs_stat *buf, char *version, int length );
 
 	virtual pfs_file * open( pfs_name *name, int flags, mode_t mode );
 	virtual pfs_dir * getdir( pfs_name *name );
@@ -5,6 +5,7 @@ See the file COPYING for details.
 
 #ifdef HAS_CVMFS
 
+#include "pfs_dircache.h"
 #include "pfs_service.h"
 #include <libcvmfs.h>
 
@@ -51,6 +52,9 @@ extern bool pfs_cvmfs_enable_alien;
 extern char pfs_cvmfs_option_file[];
 extern struct jx *pfs_cvmfs_options;
 
+/* CVMFS is read-only, so the only staleness is a catalog update. */
+static pfs_dircache cvmfs_dircache("cvmfs",60);
+
 extern char * pfs_cvmfs_http_proxy;
 
 
@@ -1488,20 +1492,34 @@ class pfs_service_cvmfs:public pfs_service {
 	}
 
 	virtual int lstat(pfs_name * name, struct pfs_stat *info) {
-		int rc = anystat(name,info,0,1);
+		int rc = cvmfs_dircache.lookup(name->path,info,0);
+		if(rc) return rc > 0 ? 0 : -1;
+		rc = anystat(name,info,0,1);
 		if( rc == -1 && errno == EAGAIN ) {
 			class pfs_service *local = pfs_service_lookup_default();
 			return local->lstat(name,info);
 		}
+		if(rc == 0) {
+			cvmfs_dircache.insert_stat(name->path,info,0);
+		} else if(errno == ENOENT) {
+			cvmfs_dircache.insert_missing(name->path,0);
+		}
 		return rc;
 	}
 
 	virtual int stat(pfs_name * name, struct pfs_stat *info) {
-		int rc = anystat(name,info,1,1);
+		int rc = cvmfs_dircache.lookup(name->path,info,1);
+		if(rc) return rc > 0 ? 0 : -1;
+		rc = anystat(name,info,1,1);
 		if( rc == -1 && errno == EAGAIN ) {
 			class pfs_service *local = pfs_service_lookup_default();
 			return local->stat(name,info);
 		}
+		if(rc == 0) {
+			cvmfs_dircache.insert_stat(name->path,info,1);
+		} else if(errno == ENOENT) {
+			cvmfs_dircache.insert_missing(name->path,1);
+		}
 		return rc;
 	}
 
@@ -492,6 +492,11 @@ public:
 	virtual int is_seekable() {
 		return 1;
 	}
+
+	virtual int get_version( pfs_name *name, const struct pfs_stat *buf, char *version, int length ) {
+		snprintf(version,length,"%lld",(long long)buf->st_mtime);
+		return 1;
+	}
 };
 
 #endif
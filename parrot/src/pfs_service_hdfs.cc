@@ -39,7 +39,7 @@ extern const char *pfs_username;
 
 #define HDFS_END debug(D_HDFS,"= %d %s",(int)result,((result>=0) ? "" : strerror(errno))); return result;
 
-static pfs_dircache hdfs_dircache;
+static pfs_dircache hdfs_dircache("hdfs");
 
 class pfs_file_hdfs : public pfs_file
 {
@@ -65,7 +65,7 @@ public:
 	virtual int fsync() {
 		int result;
 
-		hdfs_dircache.invalidate();
+		hdfs_dircache.invalidate(name.path);
 
 		debug(D_HDFS, "flushing file %s ", name.rest);
 		result = hdfs->flush(fs, handle);
@@ -83,7 +83,7 @@ public:
 	virtual pfs_ssize_t write( const void *data, pfs_size_t length, pfs_off_t offset ) {
 		pfs_ssize_t result;
 
-		hdfs_dircache.invalidate();
+		hdfs_dircache.invalidate(name.path);
 
 		/* Ignore offset since HDFS does not support seekable writes. */
 		debug(D_HDFS, "writing to file %s ", name.rest);
@@ -225,7 +225,7 @@ public:
 		HDFS_CHECK_INIT(0)
 		HDFS_CHECK_FS(0)
 
-		hdfs_dircache.invalidate();
+		hdfs_dircache.invalidate(name->path);
 
 		switch (flags&O_ACCMODE) {
 			case O_RDONLY:
@@ -345,16 +345,19 @@ public:
 		int result;
 		hdfsFileInfo *file_info = 0;
 
-		if (hdfs_dircache.lookup(name->rest, buf)) {
-			result = 0;
+		result = hdfs_dircache.lookup(name->path, buf);
+		if (result) {
+			result = result > 0 ? 0 : -1;
 		} else {
 			file_info = hdfs->stat(fs, name->rest);
 
 			if (file_info != NULL) {
 				hdfs_copy_fileinfo(name, file_info, buf);
 				hdfs->free_stat(file_info, 1);
+				hdfs_dircache.insert_stat(name->path, buf, 0);
 				result = 0;
 			} else {
+				hdfs_dircache.insert_missing(name->path, 0);
 				errno = ENOENT;
 				result = -1;
 			}
@@ -407,7 +410,7 @@ public:
 		HDFS_CHECK_INIT(-1)
 		HDFS_CHECK_FS(-1)
 
-		hdfs_dircache.invalidate();
+		hdfs_dircache.invalidate(name->path);
 
 		debug(D_HDFS, "mkdir %s", name->rest);
 		result = hdfs->mkdir(fs, name->rest);
@@ -423,7 +426,7 @@ public:
 		HDFS_CHECK_INIT(-1)
 		HDFS_CHECK_FS(-1)
 
-		hdfs_dircache.invalidate();
+		hdfs_dircache.invalidate_tree(name->path);
 
 		debug(D_HDFS, "rmdir %s", name->rest);
 		result = hdfs->unlink(fs, name->rest,1);
@@ -439,7 +442,7 @@ public:
 		HDFS_CHECK_INIT(-1)
 		HDFS_CHECK_FS(-1)
 
-		hdfs_dircache.invalidate();
+		hdfs_dircache.invalidate(name->path);
 
 		debug(D_HDFS, "unlink %s", name->rest);
 		result = hdfs->unlink(fs, name->rest,0);
@@ -455,7 +458,8 @@ public:
 		HDFS_CHECK_INIT(-1)
 		HDFS_CHECK_FS(-1)
 
-		hdfs_dircache.invalidate();
+		hdfs_dircache.invalidate_tree(name->path);
+		hdfs_dircache.invalidate_tree(newname->path);
 
 		debug(D_HDFS, "rename %s to %s", name->rest, newname->rest);
 		result = hdfs->rename(fs, name->rest, newname->rest);
@@ -504,6 +508,11 @@ public:
 	virtual int is_seekable() {
 		return 1;
 	}
+
+	virtual int get_version( pfs_name *name, const struct pfs_stat *buf, char *version, int length ) {
+		snprintf(version,length,"%lld",(long long)buf->st_mtime);
+		return 1;
+	}
 };
 
 static pfs_service_hdfs pfs_service_hdfs_instance;
@@ -5,6 +5,7 @@ This software is distributed under the GNU General Public License.
 See the file COPYING for details.
 */
 
+#include "pfs_dircache.h"
 #include "pfs_service.h"
 
 extern "C" {
@@ -12,6 +13,7 @@ extern "C" {
 #include "stringtools.h"
 #include "domain_name.h"
 #include "link.h"
+#include "macros.h"
 #include "file_cache.h"
 #include "full_io.h"
 #include "http_query.h"
@@ -31,6 +33,12 @@ extern "C" {
 #define HTTP_FILE_MODE (S_IFREG | 0555)
 
 extern int pfs_main_timeout;
+extern int pfs_http_streams;
+
+/* Reads at least this large are split into parallel range requests. */
+#define HTTP_PARALLEL_MIN (1024*1024)
+
+static pfs_dircache http_dircache("http",60);
 
 static struct link * http_fetch( pfs_name *name, const char *action, INT64_T *size )
 {
@@ -45,25 +53,88 @@ static struct link * http_fetch( pfs_name *name, const char *action, INT64_T *si
 	return http_query_size(url,action,size,time(0)+pfs_main_timeout,0);
 }
 
+static struct link * http_fetch_range( pfs_name *name, INT64_T offset )
+{
+	char url[HTTP_LINE_MAX];
+	INT64_T size;
+
+	sprintf(url,"http://%s:%d%s",name->host,name->port,name->rest);
+	return http_query_range(url,"GET",offset,-1,&size,time(0)+pfs_main_timeout);
+}
+
 class pfs_file_http : public pfs_file
 {
 private:
 	struct link *link;
 	INT64_T size;
+	INT64_T position;
+	int parallel;
 
 public:
 	pfs_file_http( pfs_name *n, struct link *l, INT64_T s ) : pfs_file(n) {
 		link = l;
 		size = s;
+		position = 0;
+		parallel = pfs_http_streams>1 && !getenv("HTTP_PROXY");
 	}
 
 	virtual int close() {
-		link_close(link);
+		if(link) link_close(link);
 		return 0;
 	}
 
 	virtual pfs_ssize_t read( void *d, pfs_size_t length, pfs_off_t offset ) {
-		return link_read(link,(char*)d,length,LINK_FOREVER);
+		pfs_ssize_t result;
+
+		if(parallel && length>=HTTP_PARALLEL_MIN && offset<size) {
+			char url[HTTP_LINE_MAX];
+
+			/* the streaming connection would only fall behind */
+			if(link) link_close(link);
+			link = 0;
+
+			sprintf(url,"http://%s:%d%s",name.host,name.port,name.rest);
+			result = http_fetch_ranges(url,d,offset,MIN(length,size-offset),pfs_http_streams,time(0)+pfs_main_timeout);
+			if(result>=0) return result;
+
+			/* any failure is retried over a single stream, which reports it if it persists */
+			if(errno==ESPIPE) {
+				debug(D_HTTP,"%s does not support parallel ranges",url);
+				parallel = 0;
+			} else {
+				debug(D_HTTP,"parallel ranges of %s failed: %s",url,strerror(errno));
+			}
+		}
+
+		/* a read elsewhere in the file needs a new ranged request */
+		if(offset!=position || !link) {
+			if(link) link_close(link);
+			link = 0;
+			if(offset>=size) return 0;
+			link = http_fetch_range(&name,offset);
+			if(!link && errno==ESPIPE) {
+				/* the server ignores ranges, so skip ahead in a full response */
+				INT64_T ignored;
+				char skip[HTTP_LINE_MAX];
+				link = http_fetch(&name,"GET",&ignored);
+				for(position=0;link && position<offset;) {
+					int chunk = link_read(link,skip,MIN(offset-position,(INT64_T)sizeof(skip)),LINK_FOREVER);
+					if(chunk<=0) {
+						link_close(link);
+						link = 0;
+						errno = EIO;
+					} else {
+						position += chunk;
+					}
+				}
+			}
+			if(!link) return -1;
+			position = offset;
+		}
+
+		result = link_read(link,(char*)d,length,LINK_FOREVER);
+		if(result>0) position += result;
+		return result;
 	}
 
 	virtual int fstat( struct pfs_stat *buf ) {
@@ -105,6 +176,10 @@ public:
 	virtual int stat( pfs_name *name, struct pfs_stat *buf ) {
 		struct link *link;
 		INT64_T size;
+		int result;
+
+		result = http_dircache.lookup(name->path,buf,1);
+		if(result) return result>0 ? 0 : -1;
 
 		link = http_fetch(name,"HEAD",&size);
 		if(link) {
@@ -112,8 +187,10 @@ public:
 			pfs_service_emulate_stat(name,buf);
 			buf->st_mode = HTTP_FILE_MODE;
 			buf->st_size = size;
+			http_dircache.insert_stat(name->path,buf,0);
 			return 0;
 		} else {
+			if(errno==ENOENT) http_dircache.insert_missing(name->path,0);
 			return -1;
 		}
 	}
@@ -125,6 +202,24 @@ public:
 	virtual int is_seekable (void) {
 		return 0;
 	}
+
+	virtual int is_ranged (void) {
+		return 1;
+	}
+
+	/* stat() gives the session start as the mtime, so ask for a real validator */
+	virtual int get_version( pfs_name *name, const struct pfs_stat *buf, char *version, int length ) {
+		char url[HTTP_LINE_MAX];
+		struct link *link;
+		INT64_T size;
+
+		if(!name->host[0]) return 0;
+		sprintf(url,"http://%s:%d%s",name->host,name->port,name->rest);
+		link = http_query_validator(url,"HEAD",&size,version,length,time(0)+pfs_main_timeout);
+		if(!link) return 0;
+		link_close(link);
+		return size==buf->st_size && version[0];
+	}
 };
 
 static pfs_service_http pfs_service_http_instance;
@@ -52,6 +52,7 @@ extern "C" ssize_t pread(int fd, void *buf, size_t count, off_t  offset);
 extern "C" ssize_t pwrite(int  fd,  const  void  *buf, size_t count, off_t offset);
 
 extern const char * pfs_username;
+extern int pfs_native_io;
 
 static int check_implicit_acl( const char *path, int checkflags )
 {
@@ -104,7 +105,7 @@ public:
 
 	virtual int canbenative (char *path, size_t len) {
 		struct stat64 buf;
-		if (::fstat64(fd, &buf) == 0 && (S_ISSOCK(buf.st_mode) || S_ISBLK(buf.st_mode) || S_ISCHR(buf.st_mode) || S_ISFIFO(buf.st_mode))) {
+		if (::fstat64(fd, &buf) == 0 && (S_ISSOCK(buf.st_mode) || S_ISBLK(buf.st_mode) || S_ISCHR(buf.st_mode) || S_ISFIFO(buf.st_mode) || (pfs_native_io && S_ISREG(buf.st_mode)))) {
 			snprintf(path, len, "%s", name.rest);
 			return 1;
 		}
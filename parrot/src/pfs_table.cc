@@ -93,6 +93,7 @@ static const int _SENTINEL2 = 0;
 	do {\
 		if (!PARROT_FD(fd))\
 			return (errno = EBADF, -1);\
+		pfs_profile_service(pointers[fd]->file->get_name()->service_name);\
 	} while (0)
 
 pfs_table::pfs_table()
@@ -601,6 +602,11 @@ int pfs_table::resolve_name(int is_special_syscall, const char *cname, struct pf
 			follow_symlink(pname, mode, depth + 1);
 		}
 
+		/* Attribute path-based calls to the service the path ends up in. */
+		if (depth == 0) {
+			pfs_profile_service(pname->service_name);
+		}
+
 		return 1;
 	}
 }
@@ -797,8 +803,10 @@ int pfs_table::open( const char *lname, int flags, mode_t mode, int force_cache,
 	if(result>=0) {
 		file = open_object(lname,flags,mode,force_cache);
 		if(file) {
-			if(path && file->canbenative(path, len)) {
+			/* The tracee reopens a native file, which would fail if we just created it exclusively. */
+			if(path && !((flags&O_CREAT) && (flags&O_EXCL)) && file->canbenative(path, len)) {
 				file->close();
+				delete file;
 				result = -2;
 			} else {
 				pointers[result] = new pfs_pointer(file,flags,mode);
@@ -21,12 +21,19 @@ See the file COPYING for details.
 #include <syscall.h>
 #include <unistd.h>
 
+#include <sys/mman.h>
+#include <sys/prctl.h>
 #include <sys/wait.h>
 
+#include <linux/audit.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+
 #include <assert.h>
 #include <errno.h>
 #include <limits.h>
 #include <signal.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -86,6 +93,78 @@ struct tracer {
 		struct x86_64_registers regs64;
 	} regs;
 	int has_args5_bug;
+	int stop_at_exit;
+};
+
+static int tracer_seccomp = 0;
+
+/*
+System calls which Parrot passes through to the kernel without looking at
+them.  In seccomp mode, the filter installed in the tracee allows these to
+run natively, so they never cause a stop.  Everything else (including every
+system call taking a path or a file descriptor) still traps to Parrot, which
+makes any fd-specific decision at the time of the trap, exactly as it does
+when every system call is traced.  This list must only contain calls which
+fall through the first case of decode_syscall in pfs_dispatch64.cc.
+*/
+
+static const int seccomp_native_syscalls[] = {
+	SYSCALL64_alarm,
+	SYSCALL64_arch_prctl,
+	SYSCALL64_brk,
+	SYSCALL64_clock_getres,
+	SYSCALL64_clock_nanosleep,
+	SYSCALL64_exit,
+	SYSCALL64_exit_group,
+	SYSCALL64_futex,
+	SYSCALL64_get_robust_list,
+	SYSCALL64_getcpu,
+	SYSCALL64_getitimer,
+	SYSCALL64_getpgid,
+	SYSCALL64_getpgrp,
+	SYSCALL64_getpriority,
+	SYSCALL64_getrandom,
+	SYSCALL64_getrlimit,
+	SYSCALL64_getrusage,
+	SYSCALL64_getsid,
+	SYSCALL64_gettid,
+	SYSCALL64_madvise,
+	SYSCALL64_membarrier,
+	SYSCALL64_mincore,
+	SYSCALL64_mlock,
+	SYSCALL64_mprotect,
+	SYSCALL64_mremap,
+	SYSCALL64_msync,
+	SYSCALL64_munlock,
+	SYSCALL64_nanosleep,
+	SYSCALL64_pause,
+	SYSCALL64_prlimit64,
+	SYSCALL64_rt_sigaction,
+	SYSCALL64_rt_sigpending,
+	SYSCALL64_rt_sigprocmask,
+	SYSCALL64_rt_sigreturn,
+	SYSCALL64_rt_sigsuspend,
+	SYSCALL64_rt_sigtimedwait,
+	SYSCALL64_sched_get_priority_max,
+	SYSCALL64_sched_get_priority_min,
+	SYSCALL64_sched_getaffinity,
+	SYSCALL64_sched_getparam,
+	SYSCALL64_sched_getscheduler,
+	SYSCALL64_sched_setaffinity,
+	SYSCALL64_sched_yield,
+	SYSCALL64_set_robust_list,
+	SYSCALL64_set_tid_address,
+	SYSCALL64_setitimer,
+	SYSCALL64_sigaltstack,
+	SYSCALL64_sysinfo,
+	SYSCALL64_timer_create,
+	SYSCALL64_timer_delete,
+	SYSCALL64_timer_getoverrun,
+	SYSCALL64_timer_gettime,
+	SYSCALL64_timer_settime,
+	SYSCALL64_times,
+	SYSCALL64_wait4,
+	SYSCALL64_waitid,
 };
 
 int tracer_attach (pid_t pid)
@@ -94,6 +173,8 @@ int tracer_attach (pid_t pid)
 
 	if (linux_available(3,8,0))
 		options |= PTRACE_O_EXITKILL;
+	if (tracer_seccomp)
+		options |= PTRACE_O_TRACESECCOMP;
 	assert(linux_available(2,5,60));
 
 	if (linux_available(3,4,0)) {
@@ -154,6 +235,7 @@ struct tracer *tracer_init (pid_t pid)
 	t->gotregs = 0;
 	t->setregs = 0;
 	t->has_args5_bug = 0;
+	t->stop_at_exit = 0;
 
 	memset(&t->regs,0,sizeof(t->regs));
 
@@ -200,11 +282,75 @@ int tracer_continue( struct tracer *t, int signum )
 			return -1;
 		t->setregs = 0;
 	}
-	if (ptrace(PTRACE_SYSCALL,t->pid,0,signum) == -1)
+	/* With a seccomp filter in place, the tracee traps by itself on the
+	 * system calls we care about. We only need a syscall-stop to see the exit
+	 * of a call we have already seen enter.
+	 */
+	if (ptrace(tracer_seccomp && !t->stop_at_exit ? PTRACE_CONT : PTRACE_SYSCALL,t->pid,0,signum) == -1)
 		ERROR;
 	return 0;
 }
 
+void tracer_stop_at_exit( struct tracer *t, int stop )
+{
+	t->stop_at_exit = stop;
+}
+
+int tracer_seccomp_enable( void )
+{
+	/* Before 4.8, the seccomp stop came before the syscall-entry-stop, which
+	 * would require a different dance to reach the exit of the call.
+	 */
+	if (!linux_available(4,8,0)) {
+		errno = ENOSYS;
+		return -1;
+	}
+	tracer_seccomp = 1;
+	return 0;
+}
+
+int tracer_seccomp_enabled( void )
+{
+	return tracer_seccomp;
+}
+
+int tracer_seccomp_install( void )
+{
+	const size_t n = sizeof(seccomp_native_syscalls)/sizeof(seccomp_native_syscalls[0]);
+	struct sock_filter filter[sizeof(seccomp_native_syscalls)/sizeof(seccomp_native_syscalls[0])+10];
+	struct sock_fprog prog;
+	size_t i, k = 0;
+
+	/* Jump offsets are relative to the next instruction and unsigned, so the
+	 * two return instructions (trace at n+8, allow at n+9) come last.
+	 */
+	assert(n+3 <= UCHAR_MAX);
+
+	filter[k++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_W|BPF_ABS, offsetof(struct seccomp_data, arch));
+	filter[k++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, AUDIT_ARCH_X86_64, 1, 0);
+	filter[k++] = (struct sock_filter)BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_TRACE); /* i386 binaries trace everything */
+	filter[k++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_W|BPF_ABS, offsetof(struct seccomp_data, nr));
+	filter[k++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JSET|BPF_K, 0x40000000 /* x32 */, n+3, 0);
+	for (i = 0; i < n; i++)
+		filter[k++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, seccomp_native_syscalls[i], n+3-i, 0);
+	/* Anonymous mmaps are never interesting, see decode_mmap. */
+	filter[k++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, SYSCALL64_mmap, 0, 2);
+	filter[k++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_W|BPF_ABS, offsetof(struct seccomp_data, args[3]));
+	filter[k++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JSET|BPF_K, MAP_ANONYMOUS, 1, 0);
+	filter[k++] = (struct sock_filter)BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_TRACE);
+	filter[k++] = (struct sock_filter)BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW);
+	assert(k == sizeof(filter)/sizeof(filter[0]));
+
+	prog.len = k;
+	prog.filter = filter;
+
+	if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == -1)
+		return -1;
+	if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog, 0, 0) == -1)
+		return -1;
+	return 0;
+}
+
 int tracer_args_get( struct tracer *t, INT64_T *syscall, INT64_T args[TRACER_ARGS_MAX] )
 {
 	if(!t->gotregs) {
@@ -565,7 +711,7 @@ static ssize_t tracer_copy_in_slow( struct tracer *t, void *data, const void *ua
 	return total;
 }
 
-ssize_t copy_in_fast( struct tracer *t, void *data, const void *uaddr, size_t length, int flags )
+static ssize_t copy_in_fast( struct tracer *t, void *data, const void *uaddr, size_t length, int flags )
 {
 	int i;
 	size_t pgsize = (size_t)getpagesize();
@@ -688,6 +834,68 @@ static ssize_t copy_in_string_slow( struct tracer *t, char *str, const void *uad
 	return total;
 }
 
+static ssize_t copy_vm_readv( struct tracer *t, const struct iovec *local, size_t ln, const struct iovec *remote, size_t rn )
+{
+	if (!linux_available(3,2,0))
+		return errno = ENOSYS, -1;
+
+#ifdef CCTOOLS_CPU_I386
+	return syscall(SYSCALL32_process_vm_readv, (int32_t)t->pid, local, (int32_t)ln, remote, (int32_t)rn, (int32_t)0);
+#else
+	return syscall(SYSCALL64_process_vm_readv, (int64_t)t->pid, local, (int64_t)ln, remote, (int64_t)rn, (int64_t)0);
+#endif
+}
+
+static size_t string_chunk( const void *uaddr, size_t length )
+{
+	size_t pgsize = (size_t)getpagesize();
+	return MIN(pgsize-(((uintptr_t)uaddr)&(pgsize-1)), length);
+}
+
+/* Strings are fetched a page at a time, stopping at the first page holding
+ * the NUL. Most paths fit in the remainder of the page they start on, so this
+ * is usually a single process_vm_readv of a few dozen bytes rather than a
+ * full PFS_PATH_MAX worth of memory.
+ */
+static ssize_t copy_in_string_fast( struct tracer *t, char *str, const void *uaddr, size_t length, size_t done )
+{
+	while (done < length) {
+		struct iovec local, remote;
+		const void *current = VOID_MATH(uaddr, +done);
+		size_t count = string_chunk(current, length-done);
+
+		local.iov_base = str+done;
+		local.iov_len = count;
+		remote.iov_base = (void *)current;
+		remote.iov_len = count;
+		ssize_t n = copy_vm_readv(t, &local, 1, &remote, 1);
+		if (n == -1 || (size_t)n != count) {
+			if (n == -1 && errno == ENOSYS)
+				return -1;
+			return errno = EFAULT, -1;
+		}
+		if (memchr(str+done, '\0', count))
+			return done+count;
+		done += count;
+	}
+	return done;
+}
+
+static ssize_t string_terminate( char *str, ssize_t rc )
+{
+	if (rc > 0) {
+		void *nul = memchr(str,'\0',rc);
+		if (nul) {
+			rc = (ssize_t)((uintptr_t)nul-(uintptr_t)str);
+		} else {
+			*str = '\0';
+			errno = EINVAL;
+			rc = -1;
+		}
+	}
+	return rc;
+}
+
 ssize_t tracer_copy_in_string( struct tracer *t, char *str, const void *uaddr, size_t length, int flags )
 {
 	if(length==0) return 0;
@@ -698,21 +906,104 @@ ssize_t tracer_copy_in_string( struct tracer *t, char *str, const void *uaddr, s
 	}
 #endif
 
-	ssize_t rc = copy_in_fast(t,str,uaddr,length,flags);
+	ssize_t rc = copy_in_string_fast(t,str,uaddr,length,0);
 	if (rc == -1 && errno == ENOSYS && !(flags & TRACER_O_FAST))
 		rc = copy_in_string_slow(t,str,uaddr,length,flags);
-	/* check for NUL */
-	if (rc > 0) {
-		void *nul = memchr(str,'\0',length);
-		if (nul) {
-			rc = (ssize_t)((uintptr_t)nul-(uintptr_t)str);
+	return string_terminate(str,rc);
+}
+
+void tracer_gather_init( struct tracer_gather *g )
+{
+	g->n = 0;
+}
+
+static void gather_add( struct tracer_gather *g, void *data, const void *uaddr, size_t length, ssize_t *result, int string )
+{
+	assert(g->n < TRACER_GATHER_MAX);
+	g->entry[g->n].data = data;
+	g->entry[g->n].uaddr = uaddr;
+	g->entry[g->n].length = length;
+	g->entry[g->n].result = result;
+	g->entry[g->n].string = string;
+	g->n++;
+}
+
+void tracer_gather_add( struct tracer_gather *g, void *data, const void *uaddr, size_t length )
+{
+	gather_add(g, data, uaddr, length, NULL, 0);
+}
+
+void tracer_gather_add_string( struct tracer_gather *g, char *str, const void *uaddr, size_t maxlength, ssize_t *result )
+{
+	gather_add(g, str, uaddr, maxlength, result, 1);
+}
+
+/* Fetch every buffer in one process_vm_readv. Strings contribute their first
+ * page (chunk) to the batch and are only continued individually if no NUL was
+ * found there. If the batch comes up short, we redo each entry on its own so
+ * that the failure is reported exactly as the individual calls would.
+ */
+int tracer_gather_copy_in( struct tracer *t, struct tracer_gather *g )
+{
+	struct iovec local[TRACER_GATHER_MAX];
+	struct iovec remote[TRACER_GATHER_MAX];
+	size_t total = 0;
+	ssize_t n = -1;
+	int i, rn = 0;
+
+	for (i = 0; i < g->n; i++) {
+		const void *uaddr = g->entry[i].uaddr;
+#if !defined(CCTOOLS_CPU_I386)
+		if(!tracer_is_64bit(t)) {
+			uaddr = VOID_MATH(uaddr, & 0xffffffff);
+			g->entry[i].uaddr = uaddr;
+		}
+#endif
+		size_t length = g->entry[i].string ? string_chunk(uaddr, g->entry[i].length) : g->entry[i].length;
+		if (length == 0)
+			continue;
+		local[rn].iov_base = g->entry[i].data;
+		local[rn].iov_len = length;
+		remote[rn].iov_base = (void *)uaddr;
+		remote[rn].iov_len = length;
+		total += length;
+		rn++;
+	}
+
+	if (rn)
+		n = copy_vm_readv(t, local, rn, remote, rn);
+
+	for (i = 0; i < g->n; i++) {
+		struct tracer_gather_entry *e = &g->entry[i];
+		ssize_t rc;
+		if (e->length == 0) {
+			rc = 0;
+		} else if (n >= 0 && (size_t)n == total) {
+			if (e->string) {
+				size_t chunk = string_chunk(e->uaddr, e->length);
+				if (memchr(e->data, '\0', chunk)) {
+					rc = chunk;
+				} else {
+					rc = copy_in_string_fast(t, (char *)e->data, e->uaddr, e->length, chunk);
+					if (rc == -1 && errno == ENOSYS)
+						rc = copy_in_string_slow(t, (char *)e->data, e->uaddr, e->length, 0);
+				}
+				rc = string_terminate((char *)e->data, rc);
+			} else {
+				rc = e->length;
+			}
+		} else if (e->string) {
+			rc = tracer_copy_in_string(t, (char *)e->data, e->uaddr, e->length, 0);
 		} else {
-			*str = '\0';
-			errno = EINVAL;
-			rc = -1;
+			rc = tracer_copy_in(t, e->data, e->uaddr, e->length, TRACER_O_ATOMIC);
 		}
+		if (e->result)
+			*e->result = rc;
+		if (rc == -1)
+			return -1;
 	}
-	return rc;
+
+	return 0;
 }
 
 const char * tracer_syscall32_name( int syscall )
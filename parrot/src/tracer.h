@@ -19,6 +19,7 @@ int tracer_attach( pid_t pid );
 void tracer_detach( struct tracer *t );
 struct tracer *tracer_init( pid_t pid );
 int tracer_continue( struct tracer *t, int signum );
+void tracer_stop_at_exit( struct tracer *t, int stop );
 int tracer_listen( struct tracer *t );
 int tracer_getevent( struct tracer *t, unsigned long *message );
 
@@ -40,8 +41,35 @@ ssize_t tracer_copy_out( struct tracer *t, const void *data, const void *uaddr,
 ssize_t tracer_copy_in( struct tracer *t, void *data, const void *uaddr, size_t length, int flags );
 ssize_t tracer_copy_in_string( struct tracer *t, char *data, const void *uaddr, size_t maxlength, int flags );
 
+/* Gather several argument buffers of one system call with a single
+ * process_vm_readv. Buffers are copied atomically; strings behave as
+ * tracer_copy_in_string, storing their length in *result if not NULL. */
+#define TRACER_GATHER_MAX 16
+struct tracer_gather_entry {
+	void *data;
+	const void *uaddr;
+	size_t length;
+	ssize_t *result;
+	int string;
+};
+struct tracer_gather {
+	int n;
+	struct tracer_gather_entry entry[TRACER_GATHER_MAX];
+};
+void tracer_gather_init( struct tracer_gather *g );
+void tracer_gather_add( struct tracer_gather *g, void *data, const void *uaddr, size_t length );
+void tracer_gather_add_string( struct tracer_gather *g, char *str, const void *uaddr, size_t maxlength, ssize_t *result );
+int tracer_gather_copy_in( struct tracer *t, struct tracer_gather *g );
+
 int tracer_is_64bit( struct tracer *t );
 
+/* Seccomp mode: the tracee installs a filter (tracer_seccomp_install, just
+ * before exec) so that only the system calls Parrot virtualizes stop it. Call
+ * tracer_seccomp_enable before tracer_attach. */
+int tracer_seccomp_enable( void );
+int tracer_seccomp_enabled( void );
+int tracer_seccomp_install( void );
+
 const char *tracer_syscall32_name( int syscall );
 const char *tracer_syscall64_name( int syscall );
 const char *tracer_syscall_name( struct tracer *t, int syscall );
@@ -0,0 +1,87 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+. ./parrot-test.sh
+
+exe="seccomp.test"
+
+prepare()
+{
+	gcc -I../src/ -g $CCTOOLS_TEST_CCFLAGS -o "$exe" -x c - -x none <<EOF
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static double now (void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec/1e6;
+}
+
+/* A syscall-rate benchmark: a tight loop of calls Parrot never looks at,
+ * followed by a loop of calls it must virtualize. Only the second loop should
+ * stop the tracee in seccomp mode. */
+int main (int argc, char *argv[])
+{
+	int n = argc > 1 ? atoi(argv[1]) : 100000;
+	int i, status;
+	long count = 0;
+	double start, native, virtual;
+	char buf[16];
+	pid_t pid;
+
+	start = now();
+	for (i = 0; i < n; i++)
+		count += syscall(SYS_gettid) > 0;
+	native = now()-start;
+
+	start = now();
+	for (i = 0; i < n/10; i++) {
+		int fd = open("/dev/zero", O_RDONLY);
+		if (fd == -1)
+			return 1;
+		count += read(fd, buf, sizeof(buf)) == sizeof(buf);
+		close(fd);
+	}
+	virtual = now()-start;
+
+	pid = fork();
+	if (pid == 0)
+		_exit(getpid() > 0 ? 7 : 0);
+	waitpid(pid, &status, 0);
+
+	printf("%ld %d\n", count, WEXITSTATUS(status));
+	fprintf(stderr, "%.0f native syscalls/s, %.0f open/read/close/s\n", n/native, (n/10)/virtual);
+	return 0;
+}
+EOF
+	echo "110000 7" > output.expected
+}
+
+run()
+{
+	for mode in "" --seccomp; do
+		echo "parrot_run $mode:"
+		if parrot $mode -- ./"$exe" 100000 > output.actual; then
+			require_identical_files output.actual output.expected
+		else
+			return 1
+		fi
+	done
+	return 0
+}
+
+clean()
+{
+	rm -f "$exe" output.actual output.expected
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4: